@@ -0,0 +1,101 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Helpers shared by the microbenchmarks
+ *
+ * Every result is one JSON object per line on stdout:
+ *   {"bench":..,"case":..,"threads":..,"ops":..,"seconds":..,
+ *    "ops_per_sec":..,"ns_per_op":..}
+ * so `make -s bench > results.jsonl` can be diffed between builds.
+ * Benchmarks that count heap allocations add "allocs_per_op".
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void bench_report(const char *bench, const char *name, int threads, long ops,
+                                double seconds)
+{
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"threads\":%d,\"ops\":%ld,\"seconds\":%.4f,"
+           "\"ops_per_sec\":%.0f,\"ns_per_op\":%.1f}\n",
+           bench, name, threads, ops, seconds, seconds > 0 ? ops / seconds : 0.0,
+           ops > 0 ? seconds * 1e9 / ops : 0.0);
+    fflush(stdout);
+}
+
+/* bench_report plus the malloc/calloc/realloc calls the measured code made */
+static inline void bench_report_allocs(const char *bench, const char *name, int threads, long ops,
+                                       double seconds, unsigned long allocs)
+{
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"threads\":%d,\"ops\":%ld,\"seconds\":%.4f,"
+           "\"ops_per_sec\":%.0f,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f}\n",
+           bench, name, threads, ops, seconds, seconds > 0 ? ops / seconds : 0.0,
+           ops > 0 ? seconds * 1e9 / ops : 0.0, ops > 0 ? (double)allocs / ops : 0.0);
+    fflush(stdout);
+}
+
+/* -------------------- Parallel runs -------------------- */
+
+typedef void (*bench_body_t)(int id, void *ctx);
+
+typedef struct
+{
+    int id;
+    void *ctx;
+    bench_body_t body;
+    pthread_barrier_t *start;
+} BenchThread;
+
+static inline void *bench_thread_main(void *arg)
+{
+    BenchThread *t = arg;
+    pthread_barrier_wait(t->start);
+    t->body(t->id, t->ctx);
+    return NULL;
+}
+
+/*
+ * Run body(id, ctx) on threads threads at once and return the seconds
+ * from their common start until the last one finished
+ */
+static inline double bench_parallel(int threads, bench_body_t body, void *ctx)
+{
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    BenchThread *args = calloc((size_t)threads, sizeof(BenchThread));
+    pthread_barrier_t start;
+    if (!tids || !args)
+    {
+        fprintf(stderr, "[Bench] Out of memory\n");
+        exit(1);
+    }
+
+    pthread_barrier_init(&start, NULL, (unsigned)threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        args[i] = (BenchThread){.id = i, .ctx = ctx, .body = body, .start = &start};
+        pthread_create(&tids[i], NULL, bench_thread_main, &args[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    double began = bench_now();
+    for (int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    double elapsed = bench_now() - began;
+
+    pthread_barrier_destroy(&start);
+    free(args);
+    free(tids);
+    return elapsed;
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,307 @@
+/*
+ * Database layer microbenchmark
+ *
+ * Times every db_* entry point against a fresh database in a temporary
+ * directory (default /tmp). The read paths also run on 4 threads, each
+ * on its own pooled connection. Writes commit one transaction per call,
+ * so their cost depends on the directory's filesystem.
+ *
+ * Usage: db_bench [read_ops] [directory]
+ */
+#include "bench.h"
+#include "auth/database.h"
+#include "utils/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_READ_OPS 20000
+#define WRITE_OPS_DIVISOR 10      /* Write cases run read_ops / this */
+#define CHEAP_OPS_FACTOR 1000     /* In-memory cases run read_ops * this, to be timeable */
+#define BENCH_USERS 16
+#define BENCH_FILES 1000          /* Files of the listed user */
+#define BENCH_CHUNKS_PER_FILE 4
+#define BENCH_LIST_PAGE 100
+#define BENCH_ORPHAN_BATCH 64
+#define BENCH_RECONCILE_OPS 20
+
+static const int read_thread_counts[] = {1, 4};
+
+static long read_ops;
+static long write_ops;
+static uint64_t chunk_seq;           /* Makes every file's chunks distinct */
+
+/* -------------------- Fixtures -------------------- */
+
+static const char *user_name(long i)
+{
+    static __thread char name[32];
+    snprintf(name, sizeof(name), "user_%ld", i % BENCH_USERS);
+    return name;
+}
+
+static void file_chunks(DbChunk *chunks)
+{
+    for (int c = 0; c < BENCH_CHUNKS_PER_FILE; c++)
+    {
+        memset(&chunks[c], 0, sizeof(DbChunk));
+        uint64_t seq = __atomic_fetch_add(&chunk_seq, 1, __ATOMIC_RELAXED);
+        memcpy(chunks[c].hash, &seq, sizeof(seq));
+        chunks[c].size = 64 * 1024;
+    }
+}
+
+static int add_file(const char *username, const char *filename)
+{
+    DbChunk chunks[BENCH_CHUNKS_PER_FILE];
+    file_chunks(chunks);
+    size_t size = (size_t)BENCH_CHUNKS_PER_FILE * 64 * 1024;
+    return db_add_or_update_file(username, filename, size, size, "none", chunks,
+                                 BENCH_CHUNKS_PER_FILE, NULL);
+}
+
+static const char *listed_file(long i)
+{
+    static __thread char name[32];
+    snprintf(name, sizeof(name), "file_%04ld.bin", i % BENCH_FILES);
+    return name;
+}
+
+/* -------------------- Cases -------------------- */
+
+typedef int (*db_case_t)(long i);
+
+static int case_create_user(long i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "new_user_%ld", i);
+    return db_create_user(name, "hash");
+}
+
+static int case_user_exists(long i)
+{
+    bool exists;
+    return db_user_exists(user_name(i), &exists);
+}
+
+static int case_verify_password(long i)
+{
+    bool valid;
+    return db_verify_password(user_name(i), "hash", &valid);
+}
+
+static int case_get_user_quota(long i)
+{
+    size_t used, limit;
+    return db_get_user_quota(user_name(i), &used, &limit);
+}
+
+static int case_get_user_weight(long i)
+{
+    int weight;
+    return db_get_user_weight(user_name(i), &weight);
+}
+
+static int case_add_file(long i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "added_%ld.bin", i);
+    return add_file("user_1", name);
+}
+
+/* Same file each time: also drops the old version's chunk references */
+static int case_replace_file(long i)
+{
+    (void)i;
+    return add_file("user_2", "replaced.bin");
+}
+
+static int case_get_file_size(long i)
+{
+    size_t size;
+    return db_get_file_size("user_0", listed_file(i * 7), &size);
+}
+
+static int case_list_files(long i)
+{
+    DbFileInfo page[BENCH_LIST_PAGE];
+    size_t count;
+    const char *after = i % 10 == 0 ? "" : listed_file(i * 13 % (BENCH_FILES - BENCH_LIST_PAGE));
+    return db_list_files("user_0", after, page, BENCH_LIST_PAGE, &count);
+}
+
+static int case_check_quota(long i)
+{
+    bool has_quota;
+    return db_check_quota(user_name(i), 1024 * 1024, &has_quota);
+}
+
+static int case_chunk_exists(long i)
+{
+    unsigned char hash[DB_CHUNK_HASH_LEN] = {0};
+    uint64_t seq = (uint64_t)i % (chunk_seq ? chunk_seq : 1);
+    memcpy(hash, &seq, sizeof(seq));
+    bool exists;
+    return db_chunk_exists(hash, &exists);
+}
+
+/* The two in-memory cases store their result through a volatile, so the
+ * call can't be dropped or hoisted out of the loop */
+static int case_write_version(long i)
+{
+    (void)i;
+    volatile uint64_t version = db_write_version();
+    (void)version;
+    return 0;
+}
+
+static int case_get_connection(long i)
+{
+    (void)i;
+    sqlite3 *volatile db = db_get_connection();
+    return db ? 0 : -1;
+}
+
+static int case_remove_file(long i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "added_%ld.bin", i);
+    return db_remove_file("user_1", name, NULL);
+}
+
+static int case_list_orphan_chunks(long i)
+{
+    (void)i;
+    DbChunk orphans[BENCH_ORPHAN_BATCH];
+    size_t count;
+    return db_list_orphan_chunks(orphans, BENCH_ORPHAN_BATCH, &count);
+}
+
+/* One batch per call; fails once no orphans are left */
+static int case_delete_orphan_chunks(long i)
+{
+    (void)i;
+    DbChunk orphans[BENCH_ORPHAN_BATCH];
+    size_t count;
+    if (db_list_orphan_chunks(orphans, BENCH_ORPHAN_BATCH, &count) != 0 || count == 0)
+        return -1;
+    return db_delete_orphan_chunks(orphans, count);
+}
+
+static int case_update_user_quota(long i)
+{
+    (void)i;
+    return db_update_user_quota("user_0");
+}
+
+static int case_reconcile_quotas(long i)
+{
+    (void)i;
+    return db_reconcile_quotas() >= 0 ? 0 : -1;
+}
+
+/* -------------------- Runner -------------------- */
+
+typedef struct
+{
+    db_case_t fn;
+    long ops_per_thread;
+    long failed;
+} DbRun;
+
+static void db_body(int id, void *ctx)
+{
+    DbRun *r = ctx;
+    long base = (long)id * r->ops_per_thread;
+    for (long i = 0; i < r->ops_per_thread; i++)
+    {
+        if (r->fn(base + i) != 0)
+            __atomic_fetch_add(&r->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void run(const char *name, db_case_t fn, long ops, int threads)
+{
+    DbRun r = {.fn = fn, .ops_per_thread = ops / threads};
+    double elapsed = bench_parallel(threads, db_body, &r);
+    bench_report("db", name, threads, r.ops_per_thread * threads, elapsed);
+    if (r.failed > 0)
+        fprintf(stderr, "[Bench] db %s: %ld call(s) failed\n", name, r.failed);
+}
+
+static void run_reads_n(const char *name, db_case_t fn, long ops)
+{
+    for (size_t i = 0; i < sizeof(read_thread_counts) / sizeof(read_thread_counts[0]); i++)
+        run(name, fn, ops, read_thread_counts[i]);
+}
+
+static void run_reads(const char *name, db_case_t fn)
+{
+    run_reads_n(name, fn, read_ops);
+}
+
+int main(int argc, char *argv[])
+{
+    read_ops = argc > 1 ? atol(argv[1]) : DEFAULT_READ_OPS;
+    if (read_ops < WRITE_OPS_DIVISOR)
+        read_ops = DEFAULT_READ_OPS;
+    write_ops = read_ops / WRITE_OPS_DIVISOR;
+
+    char dir[256], db_path[300];
+    snprintf(dir, sizeof(dir), "%s/stash_db_bench.XXXXXX", argc > 2 ? argv[2] : "/tmp");
+    log_min_level = LOG_LEVEL_WARN;
+    if (!mkdtemp(dir))
+    {
+        perror("[Bench] mkdtemp");
+        return 1;
+    }
+    snprintf(db_path, sizeof(db_path), "%s/stash.db", dir);
+    if (db_init(db_path) != 0)
+    {
+        fprintf(stderr, "[Bench] Database initialization failed\n");
+        return 1;
+    }
+
+    /* Users and the listed user's files (timed as the first write cases) */
+    for (long i = 0; i < BENCH_USERS; i++)
+        db_create_user(user_name(i), "hash");
+    double began = bench_now();
+    for (long i = 0; i < BENCH_FILES; i++)
+        add_file("user_0", listed_file(i));
+    bench_report("db", "add_or_update_file_setup", 1, BENCH_FILES, bench_now() - began);
+
+    run("create_user", case_create_user, write_ops, 1);
+    run("add_or_update_file", case_add_file, write_ops, 1);
+    run("add_or_update_file_replace", case_replace_file, write_ops, 1);
+
+    run_reads("user_exists", case_user_exists);
+    run_reads("verify_password", case_verify_password);
+    run_reads("get_user_quota", case_get_user_quota);
+    run_reads("get_user_weight", case_get_user_weight);
+    run_reads("get_file_size", case_get_file_size);
+    run_reads("list_files", case_list_files);
+    run_reads("check_quota", case_check_quota);
+    run_reads("chunk_exists", case_chunk_exists);
+    run_reads_n("write_version", case_write_version, read_ops * CHEAP_OPS_FACTOR);
+    run_reads_n("get_connection", case_get_connection, read_ops * CHEAP_OPS_FACTOR);
+
+    run("remove_file", case_remove_file, write_ops, 1);
+    run("list_orphan_chunks", case_list_orphan_chunks, write_ops, 1);
+    /* remove_file and replace left write_ops * 2 files' chunks orphaned */
+    run("delete_orphan_chunks", case_delete_orphan_chunks,
+        write_ops * 2 * BENCH_CHUNKS_PER_FILE / BENCH_ORPHAN_BATCH, 1);
+    run("update_user_quota", case_update_user_quota, write_ops / 10 > 0 ? write_ops / 10 : 1, 1);
+    run("reconcile_quotas", case_reconcile_quotas, BENCH_RECONCILE_OPS, 1);
+
+    db_close();
+    const char *suffixes[] = {"", "-wal", "-shm"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        char path[320];
+        snprintf(path, sizeof(path), "%s%s", db_path, suffixes[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+    return 0;
+}
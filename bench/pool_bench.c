@@ -0,0 +1,244 @@
+/*
+ * Allocation microbenchmark
+ *
+ * Times the allocations the server makes per request and counts the
+ * calls each one makes into the general-purpose allocator: this binary
+ * is linked with -Wl,--wrap for malloc, calloc and realloc, so every
+ * call from the server's objects is counted (libc's and SQLite's own
+ * are not). Each case runs once to warm up first, so the counts are the
+ * steady state, where they should be 0 except reply_oversize:
+ *
+ * session: session_create + session_mark_inactive + session_destroy
+ * task: task_lanes_push, then task_lanes_pop + task_lanes_release, on the
+ *   same thread (1) or handed from one thread to another (2), as from a
+ *   client thread to a worker
+ * reply: a LIST-page-sized Completion body allocated, posted, taken and
+ *   released
+ * reply_oversize: the same with a body larger than the largest class
+ * stream: chunk_stream_open + chunk_stream_close of a BENCH_CHUNKS-chunk
+ *   manifest, what a DOWNLOAD does before sending
+ *
+ * Usage: pool_bench [ops_per_thread]
+ */
+#include "bench.h"
+#include "queue/task_lanes.h"
+#include "session/session_manager.h"
+#include "storage/chunk_store.h"
+#include "utils/logger.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_OPS_PER_THREAD 50000
+#define BENCH_MAX_THREADS 4
+#define BENCH_LANE_CAPACITY 256
+#define BENCH_REPLY_SIZE 4096
+#define BENCH_OVERSIZE_REPLY (1024 * 1024)
+#define BENCH_CHUNKS 64
+
+/* -------------------- Allocation counting -------------------- */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static __thread unsigned long thread_allocs;
+static unsigned long run_allocs;  /* Sum over a run's threads */
+
+void *__wrap_malloc(size_t size)
+{
+    thread_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    thread_allocs++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    thread_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+/* -------------------- Cases -------------------- */
+
+typedef enum
+{
+    CASE_SESSION,
+    CASE_TASK,
+    CASE_REPLY,
+    CASE_REPLY_OVERSIZE,
+    CASE_STREAM
+} alloc_case_t;
+
+typedef struct
+{
+    alloc_case_t which;
+    int threads;
+    long ops_per_thread;
+} AllocBench;
+
+static SessionManager manager;
+static TaskLanes lanes;
+static Response responses[BENCH_MAX_THREADS];
+static int devnull = -1;
+static char manifest_path[64];
+
+static void session_op(void)
+{
+    uint64_t session_id = session_create(&manager, dup(devnull));
+    if (session_id == 0)
+        return;
+    session_mark_inactive(&manager, session_id);
+    session_destroy(&manager, session_id);
+}
+
+static void task_push(void)
+{
+    Task t = {.type = TASK_LIST, .weight = 1};
+    snprintf(t.username, sizeof(t.username), "bench");
+    while (task_lanes_push(&lanes, &t) != 0)
+        sched_yield();
+}
+
+static void task_pop(void)
+{
+    Task *t;
+    if (task_lanes_pop(&lanes, TASK_LANE_BULK, &t, true) == 0)
+        task_lanes_release(&lanes, t);
+}
+
+static void reply_op(Response *resp, size_t size)
+{
+    uint64_t seq;
+    if (response_begin(resp, TASK_LIST, &seq) != 0)
+        return;
+    char *data = response_buf_alloc(size);
+    if (data)
+        data[0] = '\0';
+    response_set(resp, seq, RESPONSE_SUCCESS, "", data, data ? size : 0);
+
+    Completion done;
+    if (response_take(resp, &done))
+        completion_release(&done);
+}
+
+static void stream_op(void)
+{
+    size_t size;
+    int fd = open(manifest_path, O_RDONLY | O_CLOEXEC);
+    ChunkStream *cs = fd >= 0 ? chunk_stream_open(fd, &size) : NULL;
+    if (!cs)
+        fprintf(stderr, "[Bench] Cannot open the manifest\n");
+    chunk_stream_close(cs);
+}
+
+static void alloc_body(int id, void *ctx)
+{
+    AllocBench *b = ctx;
+    unsigned long start = thread_allocs;
+
+    for (long i = 0; i < b->ops_per_thread; i++)
+    {
+        switch (b->which)
+        {
+        case CASE_SESSION:
+            session_op();
+            break;
+        case CASE_TASK:
+            /* One thread does both halves; with two, one pushes, one pops */
+            if (b->threads == 1 || id == 0)
+                task_push();
+            if (b->threads == 1 || id == 1)
+                task_pop();
+            break;
+        case CASE_REPLY:
+            reply_op(&responses[id], BENCH_REPLY_SIZE);
+            break;
+        case CASE_REPLY_OVERSIZE:
+            reply_op(&responses[id], BENCH_OVERSIZE_REPLY);
+            break;
+        case CASE_STREAM:
+            stream_op();
+            break;
+        }
+    }
+
+    __atomic_fetch_add(&run_allocs, thread_allocs - start, __ATOMIC_RELAXED);
+}
+
+static void run(const char *name, alloc_case_t which, const int *thread_counts, size_t runs,
+                long ops_per_thread)
+{
+    for (size_t i = 0; i < runs; i++)
+    {
+        AllocBench b = {.which = which, .threads = thread_counts[i],
+                        .ops_per_thread = ops_per_thread};
+
+        /* Warm up: slabs and array capacities reach their steady state */
+        bench_parallel(b.threads, alloc_body, &b);
+
+        run_allocs = 0;
+        double elapsed = bench_parallel(b.threads, alloc_body, &b);
+        /* Handed-off tasks: count each once, not once per side */
+        long ops = which == CASE_TASK ? ops_per_thread : b.threads * ops_per_thread;
+        bench_report_allocs("alloc", name, b.threads, ops, elapsed, run_allocs);
+    }
+}
+
+/* A manifest of BENCH_CHUNKS made-up chunks (never opened: only parsed and pinned) */
+static int write_manifest(void)
+{
+    snprintf(manifest_path, sizeof(manifest_path), "/tmp/pool_bench.%d.manifest", (int)getpid());
+    FILE *fp = fopen(manifest_path, "w");
+    if (!fp)
+        return -1;
+
+    fputs(MANIFEST_MAGIC, fp);
+    fprintf(fp, "size %d\n", BENCH_CHUNKS * 8192);
+    for (int i = 0; i < BENCH_CHUNKS; i++)
+        fprintf(fp, "%064x 8192\n", i + 1);
+    return fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int parallel[] = {1, BENCH_MAX_THREADS};
+    static const int handoff[] = {1, 2};
+
+    long ops_per_thread = argc > 1 ? atol(argv[1]) : DEFAULT_OPS_PER_THREAD;
+    if (ops_per_thread <= 0)
+        ops_per_thread = DEFAULT_OPS_PER_THREAD;
+
+    log_min_level = LOG_LEVEL_WARN;
+    devnull = open("/dev/null", O_RDWR);
+    if (devnull < 0 || session_manager_init(&manager) != 0 ||
+        task_lanes_init(&lanes, BENCH_LANE_CAPACITY, BENCH_LANE_CAPACITY) != 0 ||
+        write_manifest() != 0)
+    {
+        fprintf(stderr, "[Bench] Initialization failed\n");
+        return 1;
+    }
+    for (int i = 0; i < BENCH_MAX_THREADS; i++)
+        response_init(&responses[i]);
+
+    run("session", CASE_SESSION, parallel, 2, ops_per_thread);
+    run("task", CASE_TASK, handoff, 2, ops_per_thread);
+    run("reply", CASE_REPLY, parallel, 2, ops_per_thread);
+    run("reply_oversize", CASE_REPLY_OVERSIZE, parallel, 1, ops_per_thread / 10);
+    run("stream", CASE_STREAM, parallel, 2, ops_per_thread / 10);
+
+    for (int i = 0; i < BENCH_MAX_THREADS; i++)
+        response_destroy(&responses[i]);
+    unlink(manifest_path);
+    task_lanes_destroy(&lanes);
+    session_manager_destroy(&manager);
+    close(devnull);
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Queue microbenchmark
+ *
+ * Measures TaskQueue and ClientQueue push/pop throughput for both queue
+ * implementations. Half the threads produce, half consume; each result is
+ * printed as one JSON object per line.
+ *
+ * Usage: queue_bench [ops_per_producer]
+ */
+#include "queue/task_queue.h"
+#include "queue/client_queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_OPS_PER_PRODUCER 200000
+#define BENCH_TASK_CAPACITY 128     /* Matches TASK_QUEUE_CAPACITY */
+#define BENCH_CLIENT_CAPACITY 64    /* Matches DEFAULT_QUEUE_CAPACITY */
+
+static const int thread_counts[] = {4, 16, 64};
+
+typedef enum
+{
+    BENCH_TASK_QUEUE,
+    BENCH_CLIENT_QUEUE
+} bench_queue_t;
+
+typedef struct
+{
+    bench_queue_t which;
+    TaskQueue task_q;
+    ClientQueue client_q;
+    long ops_per_producer;
+} Bench;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg)
+{
+    Bench *b = arg;
+    Task t;
+    memset(&t, 0, sizeof(t));
+    strcpy(t.filename, "bench.bin");
+
+    for (long i = 0; i < b->ops_per_producer; i++)
+    {
+        if (b->which == BENCH_TASK_QUEUE)
+        {
+            t.session_id = (uint64_t)i;
+            task_queue_push(&b->task_q, &t);
+        }
+        else
+        {
+            client_queue_push(&b->client_q, (int)(i & 0xffff));
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    Bench *b = arg;
+    Task t;
+    long popped = 0;
+
+    /* Runs until shutdown drains the queue */
+    if (b->which == BENCH_TASK_QUEUE)
+    {
+        while (task_queue_pop(&b->task_q, &t) == 0)
+            popped++;
+    }
+    else
+    {
+        while (client_queue_pop(&b->client_q) >= 0)
+            popped++;
+    }
+    return (void *)popped;
+}
+
+static void run(bench_queue_t which, queue_impl_t impl, int threads, long ops_per_producer)
+{
+    Bench b;
+    memset(&b, 0, sizeof(b));
+    b.which = which;
+    b.ops_per_producer = ops_per_producer;
+
+    int rc = which == BENCH_TASK_QUEUE
+                 ? task_queue_init(&b.task_q, BENCH_TASK_CAPACITY, impl)
+                 : client_queue_init(&b.client_q, BENCH_CLIENT_CAPACITY, impl);
+    if (rc != 0)
+    {
+        fprintf(stderr, "[Bench] Queue initialization failed\n");
+        exit(1);
+    }
+
+    int producers = threads / 2;
+    int consumers = threads - producers;
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+
+    double start = now_sec();
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&tids[i], NULL, consumer, &b);
+    for (int i = 0; i < producers; i++)
+        pthread_create(&tids[consumers + i], NULL, producer, &b);
+
+    for (int i = 0; i < producers; i++)
+        pthread_join(tids[consumers + i], NULL);
+
+    /* Producers are done; let consumers drain and exit */
+    if (which == BENCH_TASK_QUEUE)
+        task_queue_signal_shutdown(&b.task_q);
+    else
+        client_queue_signal_shutdown(&b.client_q);
+
+    long popped = 0;
+    for (int i = 0; i < consumers; i++)
+    {
+        void *ret;
+        pthread_join(tids[i], &ret);
+        popped += (long)ret;
+    }
+    double elapsed = now_sec() - start;
+
+    long expected = (long)producers * ops_per_producer;
+    printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"threads\":%d,\"producers\":%d,\"consumers\":%d,"
+           "\"ops\":%ld,\"seconds\":%.4f,\"ops_per_sec\":%.0f,\"lost\":%ld}\n",
+           which == BENCH_TASK_QUEUE ? "task_queue" : "client_queue",
+           impl == QUEUE_IMPL_LOCKFREE ? "lockfree" : "mutex",
+           threads, producers, consumers, popped, elapsed,
+           elapsed > 0 ? popped / elapsed : 0.0, expected - popped);
+    fflush(stdout);
+
+    if (which == BENCH_TASK_QUEUE)
+        task_queue_destroy(&b.task_q);
+    else
+        client_queue_destroy(&b.client_q);
+    free(tids);
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = DEFAULT_OPS_PER_PRODUCER;
+    if (argc > 1)
+        ops = atol(argv[1]);
+    if (ops <= 0)
+    {
+        fprintf(stderr, "Usage: %s [ops_per_producer]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+    {
+        for (int which = BENCH_TASK_QUEUE; which <= BENCH_CLIENT_QUEUE; which++)
+        {
+            run((bench_queue_t)which, QUEUE_IMPL_MUTEX, thread_counts[i], ops);
+            run((bench_queue_t)which, QUEUE_IMPL_LOCKFREE, thread_counts[i], ops);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Session manager microbenchmark
+ *
+ * create_destroy: session_create + session_mark_inactive + session_destroy
+ * cycles, each on a fresh descriptor (session_destroy closes it, so the
+ * cycle includes one dup(2)).
+ * get: session_get + session_put over a table holding BENCH_LIVE_SESSIONS
+ * sessions, the lookup every worker does to deliver a result.
+ *
+ * Usage: session_bench [ops_per_thread]
+ */
+#include "bench.h"
+#include "session/session_manager.h"
+#include "utils/logger.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEFAULT_OPS_PER_THREAD 50000
+#define BENCH_LIVE_SESSIONS (SESSION_TABLE_INITIAL_CAPACITY / 2)
+
+static const int thread_counts[] = {1, 4, 16};
+
+static SessionManager manager;
+static int devnull = -1;
+
+typedef struct
+{
+    long ops_per_thread;
+    uint64_t ids[BENCH_LIVE_SESSIONS];
+} SessionBench;
+
+static void create_destroy_body(int id, void *ctx)
+{
+    (void)id;
+    SessionBench *b = ctx;
+    for (long i = 0; i < b->ops_per_thread; i++)
+    {
+        uint64_t session_id = session_create(&manager, dup(devnull));
+        if (session_id == 0)
+            continue;
+        session_mark_inactive(&manager, session_id);
+        session_destroy(&manager, session_id);
+    }
+}
+
+static void get_body(int id, void *ctx)
+{
+    SessionBench *b = ctx;
+    for (long i = 0; i < b->ops_per_thread; i++)
+    {
+        Session *session = session_get(&manager, b->ids[(id + i) % BENCH_LIVE_SESSIONS]);
+        if (!session)
+            fprintf(stderr, "[Bench] Live session not found\n");
+        session_put(session);
+    }
+}
+
+static void run(const char *name, bench_body_t body, SessionBench *b)
+{
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+    {
+        int threads = thread_counts[i];
+        double elapsed = bench_parallel(threads, body, b);
+        bench_report("session", name, threads, threads * b->ops_per_thread, elapsed);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static SessionBench b;
+    b.ops_per_thread = argc > 1 ? atol(argv[1]) : DEFAULT_OPS_PER_THREAD;
+    if (b.ops_per_thread <= 0)
+        b.ops_per_thread = DEFAULT_OPS_PER_THREAD;
+
+    log_min_level = LOG_LEVEL_WARN;
+    devnull = open("/dev/null", O_RDWR);
+    if (devnull < 0 || session_manager_init(&manager) != 0)
+    {
+        fprintf(stderr, "[Bench] Session manager initialization failed\n");
+        return 1;
+    }
+
+    run("create_destroy", create_destroy_body, &b);
+
+    for (int i = 0; i < BENCH_LIVE_SESSIONS; i++)
+        b.ids[i] = session_create(&manager, dup(devnull));
+    run("get", get_body, &b);
+
+    session_manager_destroy(&manager);
+    close(devnull);
+    return 0;
+}
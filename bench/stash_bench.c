@@ -0,0 +1,732 @@
+/*
+ * Protocol-level load generator
+ *
+ * Opens N sessions against a running server, each on its own thread with
+ * its own user, speaking protocol v2 directly. Every session first uploads
+ * a working set of files (not measured), then issues requests back to
+ * back for the given duration, picking the operation from a weighted mix
+ * and upload sizes from a weighted size list. Uploads overwrite a random
+ * slot of the working set, downloads and deletes pick a stored file (an
+ * upload is done instead while the set is empty).
+ *
+ * Upload bodies are random and stamped per upload, so the chunk store
+ * never deduplicates them. The result is printed as one JSON object:
+ * ops/s, MB/s (10^6 bytes) and latency percentiles per operation.
+ *
+ * Usage: stash_bench [options] [host] [port]
+ */
+#include "stash_proto.h"
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "10985"
+#define DEFAULT_SESSIONS 8
+#define DEFAULT_DURATION 10
+#define DEFAULT_FILES 16
+#define DEFAULT_USER_PREFIX "bench"
+#define DEFAULT_MIX "upload=30,download=50,delete=5,list=15"
+#define DEFAULT_SIZES "4k:60,64k:30,1m:10"
+#define BENCH_PASSWORD "benchpass"
+
+#define MAX_SIZE_CLASSES 16
+#define IO_BUFFER_SIZE 65536
+#define STAMP_INTERVAL 4096   /* Bytes between per-upload stamps in a body */
+
+typedef enum
+{
+    OP_UPLOAD,
+    OP_DOWNLOAD,
+    OP_DELETE,
+    OP_LIST,
+    OP_COUNT
+} bench_op_t;
+
+static const char *const OP_NAMES[OP_COUNT] = {"upload", "download", "delete", "list"};
+static const uint8_t OP_FRAMES[OP_COUNT] = {FRAME_UPLOAD, FRAME_DOWNLOAD, FRAME_DELETE, FRAME_LIST};
+
+typedef struct
+{
+    const char *host;
+    const char *port;
+    int sessions;
+    int duration;
+    int files;
+    const char *user_prefix;
+    const char *mix_spec;
+    const char *sizes_spec;
+    unsigned mix[OP_COUNT];              /* Weights */
+    unsigned mix_total;
+    size_t sizes[MAX_SIZE_CLASSES];
+    unsigned size_weights[MAX_SIZE_CLASSES];
+    unsigned size_total;
+    int size_count;
+    size_t max_size;
+} BenchConfig;
+
+typedef struct
+{
+    uint64_t ops;
+    uint64_t errors;                     /* Replies with a non-OK status */
+    uint64_t bytes;                      /* Upload bodies sent, download bodies received */
+    uint32_t *latency_us;                /* One per op (errors included) */
+    size_t latency_cap;
+} OpStats;
+
+typedef struct
+{
+    int index;
+    int fd;
+    char username[64];
+    uint64_t rng;
+    uint32_t tag;
+    size_t *stored;                      /* Working set: size of file slot i, 0 = absent */
+    unsigned char *body;                 /* Upload body, max_size bytes */
+    uint64_t uploads;                    /* Stamp of the next upload */
+    OpStats stats[OP_COUNT];
+    bool failed;                         /* Connection or setup failed; stats are partial */
+    char error[128];
+} Session;
+
+static BenchConfig config = {
+    .host = DEFAULT_HOST,
+    .port = DEFAULT_PORT,
+    .sessions = DEFAULT_SESSIONS,
+    .duration = DEFAULT_DURATION,
+    .files = DEFAULT_FILES,
+    .user_prefix = DEFAULT_USER_PREFIX,
+    .mix_spec = DEFAULT_MIX,
+    .sizes_spec = DEFAULT_SIZES,
+};
+
+static pthread_barrier_t start_barrier;
+static bool stop = false;           /* Set by main when the duration is up */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift64*: per-session, so sessions never contend on a shared RNG */
+static uint64_t rng_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+/* -------------------- Options -------------------- */
+
+/* "64k", "1m", "2g" or plain bytes; 0 on error */
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s)
+        return 0;
+    switch (*end)
+    {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default: break;
+    }
+    return *end == '\0' ? (size_t)v : 0;
+}
+
+/* "upload=30,download=50,..." - omitted operations get weight 0 */
+static int parse_mix(const char *spec)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    memset(config.mix, 0, sizeof(config.mix));
+    config.mix_total = 0;
+
+    for (char *save, *item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(item, '=');
+        if (!eq)
+            return -1;
+        *eq = '\0';
+        int op = 0;
+        while (op < OP_COUNT && strcmp(item, OP_NAMES[op]) != 0)
+            op++;
+        if (op == OP_COUNT)
+            return -1;
+        config.mix[op] = (unsigned)atoi(eq + 1);
+        config.mix_total += config.mix[op];
+    }
+    return config.mix_total > 0 ? 0 : -1;
+}
+
+/* "4k:60,64k:30,1m:10" - upload sizes and their weights */
+static int parse_sizes(const char *spec)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    config.size_count = 0;
+    config.size_total = 0;
+    config.max_size = 0;
+
+    for (char *save, *item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        if (config.size_count == MAX_SIZE_CLASSES)
+            return -1;
+        char *colon = strchr(item, ':');
+        unsigned weight = 1;
+        if (colon)
+        {
+            *colon = '\0';
+            weight = (unsigned)atoi(colon + 1);
+        }
+        size_t size = parse_size(item);
+        if (size == 0 || weight == 0)
+            return -1;
+        config.sizes[config.size_count] = size;
+        config.size_weights[config.size_count] = weight;
+        config.size_count++;
+        config.size_total += weight;
+        if (size > config.max_size)
+            config.max_size = size;
+    }
+    return config.size_count > 0 ? 0 : -1;
+}
+
+static void print_usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [options] [host] [port]\n", progname);
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  -c, --sessions N       Concurrent sessions, one user each (default: %d)\n",
+            DEFAULT_SESSIONS);
+    fprintf(stderr, "  -d, --duration SEC     Measured run time (default: %d)\n", DEFAULT_DURATION);
+    fprintf(stderr, "  -m, --mix SPEC         Operation weights (default: %s)\n", DEFAULT_MIX);
+    fprintf(stderr, "  -s, --sizes SPEC       Upload sizes and weights (default: %s)\n",
+            DEFAULT_SIZES);
+    fprintf(stderr, "  -f, --files N          Working set per session (default: %d)\n",
+            DEFAULT_FILES);
+    fprintf(stderr, "  -u, --user PREFIX      Session users are PREFIX_<n> (default: %s)\n",
+            DEFAULT_USER_PREFIX);
+    fprintf(stderr, "  -h, --help             Show this help message\n");
+}
+
+static int parse_options(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"sessions", required_argument, NULL, 'c'},
+        {"duration", required_argument, NULL, 'd'},
+        {"mix", required_argument, NULL, 'm'},
+        {"sizes", required_argument, NULL, 's'},
+        {"files", required_argument, NULL, 'f'},
+        {"user", required_argument, NULL, 'u'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:d:m:s:f:u:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config.sessions = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atoi(optarg);
+            break;
+        case 'm':
+            config.mix_spec = optarg;
+            break;
+        case 's':
+            config.sizes_spec = optarg;
+            break;
+        case 'f':
+            config.files = atoi(optarg);
+            break;
+        case 'u':
+            config.user_prefix = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind < argc)
+        config.host = argv[optind];
+    if (optind + 1 < argc)
+        config.port = argv[optind + 1];
+
+    if (config.sessions <= 0 || config.duration <= 0 || config.files <= 0)
+    {
+        fprintf(stderr, "Sessions, duration and files must be positive\n");
+        return -1;
+    }
+    if (parse_mix(config.mix_spec) != 0)
+    {
+        fprintf(stderr, "Bad operation mix '%s'\n", config.mix_spec);
+        return -1;
+    }
+    if (parse_sizes(config.sizes_spec) != 0)
+    {
+        fprintf(stderr, "Bad size list '%s'\n", config.sizes_spec);
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------- Wire -------------------- */
+
+static int connect_to_server(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+
+    int fd = -1;
+    for (rp = res; rp; rp = rp->ai_next)
+    {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+        {
+            /* Request header and body go out as separate sends; without this
+             * the second waits on the server's delayed ACK (~40 ms) */
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool send_exact(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_exact(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Header and name; an inline payload or body follows separately */
+static bool send_request(Session *s, uint8_t type, const char *name, uint64_t payload_len)
+{
+    unsigned char frame[FRAME_HEADER_SIZE + FRAME_MAX_NAME];
+    size_t name_len = strlen(name);
+    FrameHeader hdr = {.type = type, .name_len = (uint16_t)name_len, .tag = s->tag++,
+                       .payload_len = payload_len};
+    frame_encode_header(&hdr, frame);
+    memcpy(frame + FRAME_HEADER_SIZE, name, name_len);
+    return send_exact(s->fd, frame, FRAME_HEADER_SIZE + name_len);
+}
+
+/* Read a reply, discarding the payload; text (if any) lands in msg */
+static bool recv_reply(Session *s, FrameHeader *hdr, char *msg, size_t msg_size)
+{
+    unsigned char raw[FRAME_HEADER_SIZE];
+    char scratch[IO_BUFFER_SIZE];
+    if (!recv_exact(s->fd, raw, sizeof(raw)))
+        return false;
+    frame_decode_header(raw, hdr);
+
+    uint64_t remaining = hdr->payload_len;
+    size_t kept = 0;
+    while (remaining > 0)
+    {
+        size_t n = remaining > sizeof(scratch) ? sizeof(scratch) : (size_t)remaining;
+        if (!recv_exact(s->fd, scratch, n))
+            return false;
+        if (msg && kept < msg_size - 1)
+        {
+            size_t take = n < msg_size - 1 - kept ? n : msg_size - 1 - kept;
+            memcpy(msg + kept, scratch, take);
+            kept += take;
+        }
+        remaining -= n;
+    }
+    if (msg)
+        msg[kept] = '\0';
+    return true;
+}
+
+/* Switch to protocol v2 (no compression: bodies are random), then sign up
+ * or, if the user is left over from an earlier run, log in */
+static bool session_open(Session *s)
+{
+    s->fd = connect_to_server(config.host, config.port);
+    if (s->fd < 0)
+    {
+        snprintf(s->error, sizeof(s->error), "connect failed");
+        return false;
+    }
+
+    const char *line = PROTO_NEGOTIATE_LINE "\n";
+    if (!send_exact(s->fd, line, strlen(line)))
+        return false;
+    char banner[1024];
+    size_t len = 0;
+    size_t ack_len = strlen(PROTO_NEGOTIATE_OK);
+    while (len < ack_len || strcmp(banner + len - ack_len, PROTO_NEGOTIATE_OK) != 0)
+    {
+        /* Byte-wise so no frame bytes are consumed past the ack */
+        if (len == sizeof(banner) - 1 || !recv_exact(s->fd, banner + len, 1))
+        {
+            snprintf(s->error, sizeof(s->error), "protocol negotiation failed");
+            return false;
+        }
+        banner[++len] = '\0';
+    }
+
+    const uint8_t attempts[] = {FRAME_SIGNUP, FRAME_LOGIN};
+    for (int i = 0; i < 2; i++)
+    {
+        FrameHeader hdr;
+        char msg[sizeof(s->error)];
+        if (!send_request(s, attempts[i], s->username, strlen(BENCH_PASSWORD)) ||
+            !send_exact(s->fd, BENCH_PASSWORD, strlen(BENCH_PASSWORD)) ||
+            !recv_reply(s, &hdr, msg, sizeof(msg)))
+            break;
+        if (hdr.status == FRAME_STATUS_OK)
+            return true;
+        snprintf(s->error, sizeof(s->error), "%s", msg);
+    }
+    if (!s->error[0])
+        snprintf(s->error, sizeof(s->error), "connection lost during login");
+    return false;
+}
+
+/* -------------------- Operations -------------------- */
+
+static size_t pick_size(Session *s)
+{
+    unsigned r = (unsigned)(rng_next(&s->rng) % config.size_total);
+    for (int i = 0; i < config.size_count; i++)
+    {
+        if (r < config.size_weights[i])
+            return config.sizes[i];
+        r -= config.size_weights[i];
+    }
+    return config.sizes[config.size_count - 1];
+}
+
+static bench_op_t pick_op(Session *s)
+{
+    unsigned r = (unsigned)(rng_next(&s->rng) % config.mix_total);
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (r < config.mix[op])
+            return op;
+        r -= config.mix[op];
+    }
+    return OP_LIST;
+}
+
+/* A stored slot chosen uniformly, -1 if the working set is empty */
+static int pick_stored(Session *s)
+{
+    int start = (int)(rng_next(&s->rng) % (uint64_t)config.files);
+    for (int i = 0; i < config.files; i++)
+    {
+        int slot = (start + i) % config.files;
+        if (s->stored[slot])
+            return slot;
+    }
+    return -1;
+}
+
+static void record(OpStats *st, double seconds)
+{
+    if (st->ops == st->latency_cap)
+    {
+        size_t cap = st->latency_cap ? st->latency_cap * 2 : 4096;
+        uint32_t *grown = realloc(st->latency_us, cap * sizeof(uint32_t));
+        if (!grown)
+            return;
+        st->latency_us = grown;
+        st->latency_cap = cap;
+    }
+    double us = seconds * 1e6;
+    st->latency_us[st->ops++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+/*
+ * Run one operation, recording it in the session's stats if measured (the
+ * preload is not). Returns false once the connection is unusable.
+ */
+static bool run_op(Session *s, bench_op_t op, bool measured)
+{
+    int slot = op == OP_UPLOAD || op == OP_LIST ? -1 : pick_stored(s);
+    if (op != OP_UPLOAD && op != OP_LIST && slot < 0)
+        op = OP_UPLOAD;
+    if (op == OP_UPLOAD)
+        slot = (int)(rng_next(&s->rng) % (uint64_t)config.files);
+
+    char name[32];
+    snprintf(name, sizeof(name), op == OP_LIST ? "" : "bench_%d.bin", slot);
+
+    size_t size = op == OP_UPLOAD ? pick_size(s) : 0;
+    if (op == OP_UPLOAD)
+    {
+        /* A fresh stamp every STAMP_INTERVAL bytes keeps every chunk unique */
+        uint64_t stamp = ((uint64_t)s->index << 40) | s->uploads++;
+        for (size_t off = 0; off + sizeof(stamp) <= size; off += STAMP_INTERVAL)
+            memcpy(s->body + off, &stamp, sizeof(stamp));
+    }
+
+    double start = now_sec();
+    if (!send_request(s, OP_FRAMES[op], name, size) ||
+        (size > 0 && !send_exact(s->fd, s->body, size)))
+    {
+        snprintf(s->error, sizeof(s->error), "connection lost sending %s", OP_NAMES[op]);
+        return false;
+    }
+
+    FrameHeader hdr;
+    if (!recv_reply(s, &hdr, NULL, 0))
+    {
+        snprintf(s->error, sizeof(s->error), "connection lost awaiting %s", OP_NAMES[op]);
+        return false;
+    }
+    double elapsed = now_sec() - start;
+
+    bool ok = hdr.status == FRAME_STATUS_OK;
+    if (ok && op == OP_UPLOAD)
+        s->stored[slot] = size;
+    else if (ok && op == OP_DELETE)
+        s->stored[slot] = 0;
+
+    if (measured)
+    {
+        OpStats *st = &s->stats[op];
+        record(st, elapsed);
+        if (!ok)
+            st->errors++;
+        else if (op == OP_UPLOAD)
+            st->bytes += size;
+        else if (op == OP_DOWNLOAD)
+            st->bytes += hdr.payload_len;
+    }
+    return true;
+}
+
+static void *session_main(void *arg)
+{
+    Session *s = arg;
+    bool ok = session_open(s);
+
+    /* Preload half the working set so downloads have files to read */
+    for (int i = 0; ok && i < (config.files + 1) / 2; i++)
+        ok = run_op(s, OP_UPLOAD, false);
+
+    pthread_barrier_wait(&start_barrier);
+    while (ok && !__atomic_load_n(&stop, __ATOMIC_RELAXED))
+        ok = run_op(s, pick_op(s), true);
+
+    s->failed = !ok;
+    if (s->fd >= 0)
+    {
+        send_request(s, FRAME_QUIT, "", 0);
+        close(s->fd);
+    }
+    return NULL;
+}
+
+/* -------------------- Report -------------------- */
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t n, double q)
+{
+    size_t idx = (size_t)(q * (double)n);
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void print_op(int op, Session *sessions, double elapsed, bool first)
+{
+    uint64_t ops = 0, errors = 0, bytes = 0;
+    for (int i = 0; i < config.sessions; i++)
+    {
+        ops += sessions[i].stats[op].ops;
+        errors += sessions[i].stats[op].errors;
+        bytes += sessions[i].stats[op].bytes;
+    }
+
+    uint32_t *all = malloc((ops ? ops : 1) * sizeof(uint32_t));
+    size_t n = 0;
+    double sum = 0;
+    for (int i = 0; all && i < config.sessions; i++)
+    {
+        OpStats *st = &sessions[i].stats[op];
+        memcpy(all + n, st->latency_us, st->ops * sizeof(uint32_t));
+        n += st->ops;
+    }
+    if (!all)
+        n = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += all[i];
+    qsort(all, n, sizeof(uint32_t), cmp_u32);
+
+    printf("%s\"%s\":{\"ops\":%lu,\"errors\":%lu,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f,"
+           "\"latency_us\":{\"mean\":%.0f,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}",
+           first ? "" : ",", OP_NAMES[op], (unsigned long)ops, (unsigned long)errors, ops / elapsed,
+           bytes / elapsed / 1e6, n ? sum / n : 0.0, n ? percentile(all, n, 0.5) : 0,
+           n ? percentile(all, n, 0.9) : 0, n ? percentile(all, n, 0.99) : 0,
+           n ? percentile(all, n, 0.999) : 0, n ? all[n - 1] : 0);
+    free(all);
+}
+
+/* Returns the number of failed sessions */
+static int print_report(Session *sessions, double elapsed)
+{
+    uint64_t ops = 0, bytes = 0;
+    int failed = 0;
+    for (int i = 0; i < config.sessions; i++)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            ops += sessions[i].stats[op].ops;
+            bytes += sessions[i].stats[op].bytes;
+        }
+        if (sessions[i].failed)
+            failed++;
+    }
+
+    printf("{\"bench\":\"stash\",\"host\":\"%s\",\"port\":\"%s\",\"sessions\":%d,"
+           "\"failed_sessions\":%d,\"seconds\":%.3f,\"mix\":\"%s\",\"sizes\":\"%s\",\"files\":%d,"
+           "\"ops\":%lu,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f,\"by_op\":{",
+           config.host, config.port, config.sessions, failed, elapsed, config.mix_spec,
+           config.sizes_spec, config.files, (unsigned long)ops, ops / elapsed,
+           bytes / elapsed / 1e6);
+    bool first = true;
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (config.mix[op] == 0)
+            continue;
+        print_op(op, sessions, elapsed, first);
+        first = false;
+    }
+    printf("}}\n");
+    fflush(stdout);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (parse_options(argc, argv) != 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    Session *sessions = calloc((size_t)config.sessions, sizeof(Session));
+    pthread_t *tids = calloc((size_t)config.sessions, sizeof(pthread_t));
+    if (!sessions || !tids)
+    {
+        fprintf(stderr, "[Bench] Out of memory\n");
+        return 1;
+    }
+
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    for (int i = 0; i < config.sessions; i++)
+    {
+        Session *s = &sessions[i];
+        s->index = i;
+        s->fd = -1;
+        s->tag = 1;
+        s->rng = seed + 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        snprintf(s->username, sizeof(s->username), "%s_%d", config.user_prefix, i);
+        s->stored = calloc((size_t)config.files, sizeof(size_t));
+        s->body = malloc(config.max_size);
+        if (!s->stored || !s->body)
+        {
+            fprintf(stderr, "[Bench] Out of memory\n");
+            return 1;
+        }
+        for (size_t off = 0; off < config.max_size; off += sizeof(uint64_t))
+        {
+            uint64_t r = rng_next(&s->rng);
+            size_t n = config.max_size - off < sizeof(r) ? config.max_size - off : sizeof(r);
+            memcpy(s->body + off, &r, n);
+        }
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)config.sessions + 1);
+    for (int i = 0; i < config.sessions; i++)
+        pthread_create(&tids[i], NULL, session_main, &sessions[i]);
+
+    /* Measure from the moment every session has finished its preload */
+    pthread_barrier_wait(&start_barrier);
+    double start = now_sec();
+    sleep((unsigned)config.duration);
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < config.sessions; i++)
+        pthread_join(tids[i], NULL);
+    double elapsed = now_sec() - start;
+
+    for (int i = 0; i < config.sessions; i++)
+    {
+        if (sessions[i].failed)
+            fprintf(stderr, "[Bench] Session %d (%s): %s\n", i, sessions[i].username,
+                    sessions[i].error[0] ? sessions[i].error : "failed");
+    }
+    int failed = print_report(sessions, elapsed);
+
+    for (int i = 0; i < config.sessions; i++)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+            free(sessions[i].stats[op].latency_us);
+        free(sessions[i].stored);
+        free(sessions[i].body);
+    }
+    free(sessions);
+    free(tids);
+    pthread_barrier_destroy(&start_barrier);
+    return failed ? 1 : 0;
+}
@@ -5,11 +5,21 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 #include "client_ui.h"
+#include "stash_proto.h"
+#include "delta.h"
+#include "compress.h"
 
 #define BUFFER_SIZE 8192
 #define CMD_BUFFER_SIZE 512
+#define MAX_BATCH_FILES 32
+
+/* A transfer cut off by a dropped connection is resumed this many times */
+#define MAX_RESUMES 3
+#define RECONNECT_ATTEMPTS 3
 
 /* StashCLI Client - Interactive client with authentication support */
 
@@ -51,27 +61,202 @@ int connect_to_server(const char *host, const char *port)
     return sockfd;
 }
 
-ssize_t recv_response(int sockfd, char *buffer, size_t bufsize)
+/* -------------------- Protocol v2 framing -------------------- */
+
+static uint32_t next_tag = 1;
+
+/* Server agreed to compressed bodies ("PROTO 2 deflate") */
+static bool wire_deflate = false;
+
+/* Receive exactly len bytes; returns false if the connection closed */
+static bool recv_exact(int sockfd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = recv(sockfd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool send_exact(int sockfd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = send(sockfd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Append one request frame (header + name + inline payload) to out.
+ * For requests with a body (UPLOAD, delta sync), payload_len is the body
+ * size and the body is sent separately (after the inline prefix, for
+ * UPLOAD_RESUME and compressed UPLOAD).
+ * Returns the number of bytes written, 0 if it does not fit.
+ */
+static size_t encode_request(char *out, size_t outsize, uint8_t type, uint8_t flags, uint32_t tag,
+                             const char *name, const char *payload, uint64_t payload_len)
+{
+    size_t name_len = name ? strlen(name) : 0;
+    FrameHeader hdr = {.type = type, .status = flags, .name_len = (uint16_t)name_len,
+                       .tag = tag, .payload_len = payload_len};
+    size_t inline_len = (size_t)frame_inline_len(&hdr);
+    size_t total = FRAME_HEADER_SIZE + name_len + inline_len;
+
+    if (name_len > FRAME_MAX_NAME || total > outsize)
+        return 0;
+
+    frame_encode_header(&hdr, (unsigned char *)out);
+    if (name_len > 0)
+        memcpy(out + FRAME_HEADER_SIZE, name, name_len);
+    if (inline_len > 0)
+        memcpy(out + FRAME_HEADER_SIZE + name_len, payload, inline_len);
+    return total;
+}
+
+static bool send_request(int sockfd, uint8_t type, const char *name,
+                         const char *payload, uint64_t payload_len)
+{
+    char frame[CMD_BUFFER_SIZE];
+    size_t len = encode_request(frame, sizeof(frame), type, 0, next_tag++, name, payload, payload_len);
+    return len > 0 && send_exact(sockfd, frame, len);
+}
+
+static bool recv_reply_header(int sockfd, FrameHeader *hdr)
+{
+    unsigned char raw[FRAME_HEADER_SIZE];
+    if (!recv_exact(sockfd, raw, sizeof(raw)))
+        return false;
+    frame_decode_header(raw, hdr);
+    return true;
+}
+
+/* Read a reply payload as text, dropping whatever does not fit */
+static bool recv_reply_text(int sockfd, const FrameHeader *hdr, char *buf, size_t bufsize)
+{
+    uint64_t remaining = hdr->payload_len;
+    size_t kept = 0;
+
+    while (remaining > 0)
+    {
+        char scratch[BUFFER_SIZE];
+        size_t n = remaining > sizeof(scratch) ? sizeof(scratch) : (size_t)remaining;
+        if (!recv_exact(sockfd, scratch, n))
+            return false;
+        size_t room = bufsize - 1 - kept;
+        size_t take = n < room ? n : room;
+        memcpy(buf + kept, scratch, take);
+        kept += take;
+        remaining -= n;
+    }
+    buf[kept] = '\0';
+    return true;
+}
+
+/*
+ * Switch the connection to framed protocol v2, asking for compressed
+ * bodies. The text welcome banner that precedes the server's
+ * acknowledgement is discarded; a server that doesn't compress answers
+ * with the plain acknowledgement.
+ */
+bool negotiate_protocol(int sockfd)
+{
+    const char *line = PROTO_NEGOTIATE_DEFLATE "\n";
+    if (!send_exact(sockfd, line, strlen(line)))
+        return false;
+
+    char buf[BUFFER_SIZE];
+    size_t len = 0;
+    while (len < sizeof(buf) - 1)
+    {
+        ssize_t n = recv(sockfd, buf + len, 1, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        len += n;
+        buf[len] = '\0';
+
+        /* Read byte-wise so no frame bytes are consumed past the ack */
+        const char *acks[] = {PROTO_NEGOTIATE_OK_DEFLATE, PROTO_NEGOTIATE_OK};
+        for (int i = 0; i < 2; i++)
+        {
+            size_t ack_len = strlen(acks[i]);
+            if (len >= ack_len && strcmp(buf + len - ack_len, acks[i]) == 0)
+            {
+                wire_deflate = i == 0;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* -------------------- Reconnect -------------------- */
+
+/* Where and as whom to reconnect after the connection drops */
+static struct
 {
-    ssize_t bytes = recv(sockfd, buffer, bufsize - 1, 0);
-    if (bytes > 0)
+    const char *host;
+    const char *port;
+    char username[64];
+    char password[256];
+} saved_login;
+
+/*
+ * Open a new connection and log in again after the old one dropped. The
+ * new socket takes over sockfd's descriptor number, so callers keep using
+ * the fd they have.
+ */
+static bool reconnect(int sockfd)
+{
+    for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++)
     {
-        buffer[bytes] = '\0';
+        ui_show_info("Connection lost, reconnecting (attempt %d/%d)...", attempt, RECONNECT_ATTEMPTS);
+        sleep(1);
+
+        int fd = connect_to_server(saved_login.host, saved_login.port);
+        if (fd < 0)
+            continue;
+
+        FrameHeader hdr;
+        char response[BUFFER_SIZE];
+        bool ok = negotiate_protocol(fd) &&
+                  send_request(fd, FRAME_LOGIN, saved_login.username, saved_login.password,
+                               strlen(saved_login.password)) &&
+                  recv_reply_header(fd, &hdr) &&
+                  recv_reply_text(fd, &hdr, response, sizeof(response)) &&
+                  hdr.status == FRAME_STATUS_OK;
+        if (ok && dup2(fd, sockfd) >= 0)
+        {
+            close(fd);
+            return true;
+        }
+        close(fd);
     }
-    return bytes;
+    return false;
 }
 
 bool authenticate(int sockfd, char *authenticated_username, size_t username_bufsize)
 {
-    char command[CMD_BUFFER_SIZE];
     char username[64];
     char password[256];
     char response[BUFFER_SIZE];
 
-    /* Read welcome message (silently) */
-    ssize_t bytes = recv_response(sockfd, response, sizeof(response));
-    (void)bytes;
-
     while (1)
     {
         int choice = ui_show_auth_menu();
@@ -88,47 +273,34 @@ bool authenticate(int sockfd, char *authenticated_username, size_t username_bufs
             if (!ui_prompt_password(password, sizeof(password)))
                 return false;
 
-            /* Send authentication command */
-            if (choice == 1)
+            /* Send authentication request */
+            uint8_t type = (choice == 1) ? FRAME_SIGNUP : FRAME_LOGIN;
+            FrameHeader hdr;
+            if (!send_request(sockfd, type, username, password, strlen(password)) ||
+                !recv_reply_header(sockfd, &hdr) ||
+                !recv_reply_text(sockfd, &hdr, response, sizeof(response)))
             {
-                snprintf(command, sizeof(command), "SIGNUP %s %s\n", username, password);
-            }
-            else
-            {
-                snprintf(command, sizeof(command), "LOGIN %s %s\n", username, password);
+                ui_show_error("Connection lost");
+                return false;
             }
 
-            send(sockfd, command, strlen(command), 0);
+            bool success = (hdr.status == FRAME_STATUS_OK);
+            ui_show_auth_result(success, response);
 
-            /* Receive response */
-            bytes = recv_response(sockfd, response, sizeof(response));
-            if (bytes > 0)
+            if (success)
             {
-                /* Check if authentication succeeded */
-                bool success = (strstr(response, "SIGNUP OK") != NULL ||
-                               strstr(response, "LOGIN OK") != NULL);
+                /* Kept to log in again after a dropped connection */
+                snprintf(saved_login.username, sizeof(saved_login.username), "%s", username);
+                snprintf(saved_login.password, sizeof(saved_login.password), "%s", password);
 
-                ui_show_auth_result(success, response);
-
-                if (success)
+                /* Store username for display */
+                if (authenticated_username && username_bufsize > 0)
                 {
-                    /* Read the file menu message (silently) */
-                    recv_response(sockfd, response, sizeof(response));
-
-                    /* Store username for display */
-                    if (authenticated_username && username_bufsize > 0)
-                    {
-                        strncpy(authenticated_username, username, username_bufsize - 1);
-                        authenticated_username[username_bufsize - 1] = '\0';
-                    }
-
-                    return true;
+                    strncpy(authenticated_username, username, username_bufsize - 1);
+                    authenticated_username[username_bufsize - 1] = '\0';
                 }
-            }
-            else
-            {
-                ui_show_error("Connection lost");
-                return false;
+
+                return true;
             }
         }
     }
@@ -136,6 +308,119 @@ bool authenticate(int sockfd, char *authenticated_username, size_t username_bufs
     return false;
 }
 
+static int write_encoded(void *ctx, const void *buf, size_t len)
+{
+    return fwrite(buf, 1, len, (FILE *)ctx) == len ? 0 : -1;
+}
+
+/*
+ * Compress fp into a temp file as a compressed UPLOAD body, if the
+ * server takes compressed bodies and the start of the file compresses
+ * well. Returns the temp file (rewound), or NULL to send fp as it is.
+ */
+static FILE *encode_upload(FILE *fp, uint64_t filesize, uint64_t *encoded_size)
+{
+    char sample[COMPRESS_SAMPLE_SIZE];
+    ssize_t n = pread(fileno(fp), sample, sizeof(sample), 0);
+    if (!wire_deflate || n <= 0 || !compress_worthwhile(sample, (size_t)n))
+        return NULL;
+
+    FILE *encoded = tmpfile();
+    if (!encoded)
+        return NULL;
+    if (lseek(fileno(fp), 0, SEEK_SET) != 0 ||
+        compress_encode_fd(fileno(fp), write_encoded, encoded) != 0 || fflush(encoded) != 0)
+    {
+        fclose(encoded);
+        return NULL;
+    }
+
+    *encoded_size = (uint64_t)ftello(encoded);
+    rewind(encoded);
+    ui_show_info("Compressed %lu bytes to %lu for upload", (unsigned long)filesize,
+                 (unsigned long)*encoded_size);
+    return encoded;
+}
+
+/*
+ * Send the file from offset on - as UPLOAD from the start (the encoded
+ * copy, if there is one), UPLOAD_RESUME otherwise - and read the reply.
+ * Returns false if the connection dropped.
+ */
+static bool send_upload(int sockfd, const char *name, FILE *fp, FILE *encoded,
+                        uint64_t encoded_size, uint64_t offset, uint64_t filesize,
+                        size_t *total_sent, FrameHeader *hdr, char *response, size_t response_size)
+{
+    bool sent;
+    if (offset == 0 && encoded)
+    {
+        /* Compressed body, prefixed with the plain size */
+        char frame[CMD_BUFFER_SIZE];
+        unsigned char prefix[FRAME_DEFLATE_PREFIX_SIZE];
+        frame_put_u64(prefix, filesize);
+        size_t len = encode_request(frame, sizeof(frame), FRAME_UPLOAD, FRAME_FLAG_DEFLATE,
+                                    next_tag++, name, (const char *)prefix,
+                                    FRAME_DEFLATE_PREFIX_SIZE + encoded_size);
+        sent = len > 0 && send_exact(sockfd, frame, len);
+
+        /* Progress counts the bytes on the wire */
+        fp = encoded;
+        filesize = encoded_size;
+    }
+    else if (offset == 0)
+    {
+        sent = send_request(sockfd, FRAME_UPLOAD, name, NULL, filesize);
+    }
+    else
+    {
+        unsigned char prefix[FRAME_RESUME_PREFIX_SIZE];
+        frame_put_u64(prefix, filesize);
+        frame_put_u64(prefix + 8, offset);
+        sent = send_request(sockfd, FRAME_UPLOAD_RESUME, name, (const char *)prefix,
+                            FRAME_RESUME_PREFIX_SIZE + filesize - offset);
+    }
+    if (!sent || fseeko(fp, (off_t)offset, SEEK_SET) != 0)
+        return false;
+
+    /* Send file data in chunks */
+    char buf[4096];
+    size_t n;
+    *total_sent = (size_t)offset;
+
+    /* Initial progress display */
+    ui_show_upload_progress(*total_sent, (size_t)filesize);
+
+    while (*total_sent < filesize && (n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        if (!send_exact(sockfd, buf, n))
+            return false;
+        *total_sent += n;
+
+        /* Update progress every 4KB */
+        ui_show_upload_progress(*total_sent, (size_t)filesize);
+    }
+
+    return recv_reply_header(sockfd, hdr) && recv_reply_text(sockfd, hdr, response, response_size);
+}
+
+/* Ask how much of an interrupted upload the server kept (0 if none) */
+static bool query_upload_offset(int sockfd, const char *name, uint64_t filesize, uint64_t *offset)
+{
+    unsigned char total[8];
+    char reply[BUFFER_SIZE];
+    FrameHeader hdr;
+
+    frame_put_u64(total, filesize);
+    if (!send_request(sockfd, FRAME_UPLOAD_OFFSET, name, (const char *)total, sizeof(total)) ||
+        !recv_reply_header(sockfd, &hdr) || !recv_reply_text(sockfd, &hdr, reply, sizeof(reply)))
+        return false;
+
+    *offset = hdr.status == FRAME_STATUS_OK && hdr.payload_len == 8
+                  ? frame_get_u64((const unsigned char *)reply)
+                  : 0;
+    return true;
+}
+
 void handle_upload(int sockfd, const char *filename)
 {
     FILE *fp = fopen(filename, "rb");
@@ -159,170 +444,623 @@ void handle_upload(int sockfd, const char *filename)
 
     ui_show_upload_start(basename, (size_t)filesize);
 
-    /* Send UPLOAD command with size (use basename only) */
-    char cmd[CMD_BUFFER_SIZE];
-    snprintf(cmd, sizeof(cmd), "UPLOAD %s %ld\n", basename, filesize);
-    send(sockfd, cmd, strlen(cmd), 0);
+    uint64_t encoded_size = 0;
+    FILE *encoded = encode_upload(fp, (uint64_t)filesize, &encoded_size);
 
-    /* Send file data in chunks */
-    char buf[4096];
+    char response[BUFFER_SIZE] = {0};
+    FrameHeader hdr;
     size_t total_sent = 0;
-    size_t n;
+    bool connected = send_upload(sockfd, basename, fp, encoded, encoded_size, 0,
+                                 (uint64_t)filesize, &total_sent, &hdr, response, sizeof(response));
+
+    /* After a dropped connection, continue from what the server kept (it
+     * decodes a compressed body as it arrives, so that is a plain offset,
+     * and the rest goes uncompressed). BUSY on a resume means the server
+     * hasn't noticed the old connection is gone yet and still holds the
+     * partial upload. */
+    for (int resumes = 0; resumes < MAX_RESUMES; resumes++)
+    {
+        if (connected && !(resumes > 0 && hdr.status == FRAME_STATUS_BUSY))
+            break;
+        if (connected)
+            sleep(1);
+        else if (!reconnect(sockfd))
+            break;
 
-    /* Initial progress display */
-    ui_show_upload_progress(0, (size_t)filesize);
+        uint64_t offset;
+        connected = query_upload_offset(sockfd, basename, (uint64_t)filesize, &offset);
+        if (!connected)
+            continue;
+        ui_show_info("Resuming upload of '%s' at byte %lu", basename, (unsigned long)offset);
+        connected = send_upload(sockfd, basename, fp, encoded, encoded_size, offset,
+                                (uint64_t)filesize, &total_sent, &hdr, response, sizeof(response));
+    }
+
+    if (encoded)
+        fclose(encoded);
+    fclose(fp);
+
+    if (!connected)
+    {
+        ui_show_upload_result(false, "Connection lost", total_sent);
+        return;
+    }
+    ui_show_upload_result(hdr.status == FRAME_STATUS_OK, response, total_sent);
+}
+
+/*
+ * Request filenames[first..count) in a single write; the first of them
+ * from byte offset on (resuming a download cut off by a dropped
+ * connection). Whole files are asked for compressed once negotiated.
+ */
+static bool send_downloads(int sockfd, char **filenames, int first, int count, uint64_t offset)
+{
+    char batch[BUFFER_SIZE];
+    size_t batch_len = 0;
 
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    for (int i = first; i < count; i++)
     {
-        ssize_t sent = send(sockfd, buf, n, 0);
-        if (sent < 0)
+        unsigned char range[FRAME_RANGE_SIZE];
+        bool ranged = i == first && offset > 0;
+        if (ranged)
         {
-            ui_show_error("Error sending file data: %s", strerror(errno));
-            fclose(fp);
-            return;
+            frame_put_u64(range, offset);
+            frame_put_u64(range + 8, 0);  /* To the end */
         }
-        total_sent += sent;
 
-        /* Update progress every 4KB */
-        ui_show_upload_progress(total_sent, (size_t)filesize);
+        uint8_t flags = wire_deflate && !ranged ? FRAME_FLAG_DEFLATE : 0;
+        size_t len = encode_request(batch + batch_len, sizeof(batch) - batch_len,
+                                    FRAME_DOWNLOAD, flags, next_tag++, filenames[i],
+                                    ranged ? (const char *)range : NULL, ranged ? sizeof(range) : 0);
+        if (len == 0)
+        {
+            ui_show_error("Too many files in one request");
+            return false;
+        }
+        batch_len += len;
     }
+    if (!send_exact(sockfd, batch, batch_len))
+    {
+        ui_show_error("Connection lost");
+        return false;
+    }
+    return true;
+}
 
-    fclose(fp);
+/* Receive len payload bytes into fp (NULL drops them); false if the connection dropped */
+static bool recv_download_body(int sockfd, FILE *fp, uint64_t len, size_t *received, size_t total)
+{
+    char buf[BUFFER_SIZE];
 
-    /* Receive response */
-    char response[BUFFER_SIZE];
-    ssize_t bytes = recv_response(sockfd, response, sizeof(response));
-    bool success = false;
-    if (bytes > 0)
+    while (len > 0)
     {
-        success = (strstr(response, "UPLOAD OK") != NULL);
-    }
+        size_t want = len > sizeof(buf) ? sizeof(buf) : (size_t)len;
+        ssize_t bytes = recv(sockfd, buf, want, 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return false;
+        if (fp)
+            fwrite(buf, 1, bytes, fp);
+        *received += bytes;
+        len -= bytes;
 
-    ui_show_upload_result(success, response, total_sent);
+        /* Update progress */
+        ui_show_download_progress(*received, total);
+    }
+    return true;
 }
 
-void handle_download(int sockfd, const char *filename)
+/* Decoded download content goes to the local file */
+typedef struct
 {
-    char cmd[CMD_BUFFER_SIZE];
-    snprintf(cmd, sizeof(cmd), "DOWNLOAD %s\n", filename);
-    send(sockfd, cmd, strlen(cmd), 0);
+    FILE *fp;          /* NULL drops it */
+    size_t *received;
+    size_t total;
+} DownloadSink;
 
-    ui_show_download_start(filename);
+static int write_download(void *ctx, const void *buf, size_t len)
+{
+    DownloadSink *sink = ctx;
+    if (sink->fp)
+        fwrite(buf, 1, len, sink->fp);
+    *sink->received += len;
+    ui_show_download_progress(*sink->received, sink->total);
+    return 0;
+}
 
-    /* Receive file data and response */
+/*
+ * Receive a compressed download payload of len bytes - the plain size,
+ * then segments - decoding into fp. *received counts plain bytes, so a
+ * resume after a drop can ask for the rest as a plain range.
+ * Returns false if the connection dropped; *intact is false if the
+ * payload did not decode to the promised size.
+ */
+static bool recv_compressed_body(int sockfd, FILE *fp, uint64_t len, size_t *received,
+                                 size_t *total, bool *intact)
+{
+    unsigned char prefix[FRAME_DEFLATE_PREFIX_SIZE];
+    *intact = len >= sizeof(prefix);
+    if (!*intact)
+        return recv_download_body(sockfd, NULL, len, received, 0);
+    if (!recv_exact(sockfd, prefix, sizeof(prefix)))
+        return false;
+    len -= sizeof(prefix);
+    *total = (size_t)frame_get_u64(prefix);
+    ui_show_download_progress(*received, *total);
+
+    SegmentDecoder dec;
+    segment_decoder_init(&dec);
+    DownloadSink sink = {.fp = fp, .received = received, .total = *total};
     char buf[BUFFER_SIZE];
-    FILE *fp = fopen(filename, "wb");
-    if (!fp)
+    bool connected = true;
+
+    while (len > 0)
     {
-        ui_show_error("Cannot create file '%s': %s", filename, strerror(errno));
-        /* Still need to drain the response */
-        ssize_t bytes;
-        while ((bytes = recv(sockfd, buf, sizeof(buf), 0)) > 0)
+        size_t want = len > sizeof(buf) ? sizeof(buf) : (size_t)len;
+        ssize_t bytes = recv(sockfd, buf, want, 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
         {
-            if (strstr(buf, "DOWNLOAD") || strstr(buf, "ERROR"))
-                break;
+            connected = false;
+            break;
         }
-        return;
+        /* After an error keep reading so the next reply lines up */
+        if (*intact && segment_decoder_feed(&dec, buf, (size_t)bytes, write_download, &sink) != 0)
+            *intact = false;
+        len -= (uint64_t)bytes;
     }
 
-    ssize_t bytes;
-    size_t total_received = 0;
-    bool found_end = false;
-    char *server_message = NULL;
+    if (!segment_decoder_idle(&dec) || *received != *total)
+        *intact = false;
+    segment_decoder_free(&dec);
+    return connected;
+}
 
-    /* Initial progress display */
-    ui_show_download_progress(0, 0);
+/*
+ * Download one or more files. All requests are sent in a single write and
+ * the replies are read back in order, so N files cost one round trip. If
+ * the connection drops, the client reconnects and requests the rest again,
+ * the interrupted file as a byte range from where it stopped.
+ */
+void handle_download(int sockfd, char **filenames, int count)
+{
+    if (!send_downloads(sockfd, filenames, 0, count, 0))
+        return;
 
-    while ((bytes = recv(sockfd, buf, sizeof(buf), 0)) > 0)
+    int resumes = 0;
+    for (int i = 0; i < count; i++)
     {
-        /* Look for end marker */
-        char *end_marker = strstr(buf, "\nDOWNLOAD OK");
-        if (!end_marker)
-            end_marker = strstr(buf, "DOWNLOAD FAILED");
-        if (!end_marker)
-            end_marker = strstr(buf, "ERROR");
+        const char *filename = filenames[i];
+        FILE *fp = NULL;
+        bool started = false;      /* Local file created */
+        bool compressed = wire_deflate;  /* Reply is size prefix + segments */
+        size_t total = 0;
+        size_t total_received = 0;
+
+        ui_show_download_start(filename);
 
-        if (end_marker)
+        while (1)
         {
-            /* Write data before the marker */
-            size_t data_len = end_marker - buf;
-            if (data_len > 0)
+            FrameHeader hdr;
+            char message[BUFFER_SIZE];
+            bool connected = recv_reply_header(sockfd, &hdr);
+
+            if (connected && hdr.status != FRAME_STATUS_OK)
             {
-                fwrite(buf, 1, data_len, fp);
-                total_received += data_len;
+                connected = recv_reply_text(sockfd, &hdr, message, sizeof(message));
+                if (connected)
+                {
+                    if (fp)
+                        fclose(fp);
+                    ui_show_download_result(false, message, total_received);
+                    break;
+                }
             }
-            server_message = end_marker;
-            found_end = true;
-            break;
+            else if (connected)
+            {
+                /* Payload length is known up front: no end marker to search for */
+                if (!started)
+                {
+                    started = true;
+                    fp = fopen(filename, "wb");
+                    if (!fp)
+                        ui_show_error("Cannot create file '%s': %s", filename, strerror(errno));
+
+                    /* Initial progress display (a compressed reply starts with the size) */
+                    if (!compressed)
+                    {
+                        total = (size_t)hdr.payload_len;
+                        ui_show_download_progress(0, total);
+                    }
+                }
+
+                bool intact = true;
+                connected = compressed
+                                ? recv_compressed_body(sockfd, fp, hdr.payload_len, &total_received,
+                                                       &total, &intact)
+                                : recv_download_body(sockfd, fp, hdr.payload_len, &total_received, total);
+                if (connected)
+                {
+                    if (fp)
+                        fclose(fp);
+                    if (!intact)
+                        ui_show_download_result(false, "Corrupt compressed download", total_received);
+                    else
+                        ui_show_download_result(fp != NULL, "Cannot create local file", total_received);
+                    break;
+                }
+            }
+
+            /* Connection dropped: ask again for this file from where it
+             * stopped, and for the files after it */
+            if (resumes++ == MAX_RESUMES || !reconnect(sockfd) ||
+                !send_downloads(sockfd, filenames, i, count, total_received))
+            {
+                if (fp)
+                    fclose(fp);
+                ui_show_download_result(false, "Connection closed unexpectedly", total_received);
+                return;
+            }
+            compressed = wire_deflate && total_received == 0;
+            ui_show_info("Resuming download of '%s' at byte %zu", filename, total_received);
         }
-        else
+    }
+}
+
+/* Delete one or more files, pipelined like handle_download */
+void handle_delete(int sockfd, char **filenames, int count)
+{
+    char batch[BUFFER_SIZE];
+    size_t batch_len = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = encode_request(batch + batch_len, sizeof(batch) - batch_len,
+                                    FRAME_DELETE, 0, next_tag++, filenames[i], NULL, 0);
+        if (len == 0)
         {
-            /* Write all data */
-            fwrite(buf, 1, bytes, fp);
-            total_received += bytes;
+            ui_show_error("Too many files in one request");
+            return;
+        }
+        batch_len += len;
+    }
+    if (!send_exact(sockfd, batch, batch_len))
+    {
+        ui_show_error("Connection lost");
+        return;
+    }
 
-            /* Update progress */
-            ui_show_download_progress(total_received, 0);
+    for (int i = 0; i < count; i++)
+    {
+        char response[BUFFER_SIZE];
+        FrameHeader hdr;
+        if (!recv_reply_header(sockfd, &hdr) || !recv_reply_text(sockfd, &hdr, response, sizeof(response)))
+        {
+            ui_show_error("Connection lost");
+            return;
         }
+
+        ui_show_delete_result(hdr.status == FRAME_STATUS_OK, filenames[i], response);
     }
+}
 
-    fclose(fp);
+/* -------------------- Delta Sync -------------------- */
+
+static const char *path_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
 
-    bool success = (found_end && total_received > 0 &&
-                   server_message && strstr(server_message, "DOWNLOAD OK"));
+/* Send len bytes of a file as a request body */
+static bool send_fd_body(int sockfd, int fd, uint64_t len)
+{
+    char buf[BUFFER_SIZE];
+    uint64_t sent = 0;
 
-    if (!found_end)
+    ui_show_upload_progress(0, (size_t)len);
+    while (sent < len)
     {
-        ui_show_download_result(false, "Connection closed unexpectedly", total_received);
+        size_t want = len - sent > sizeof(buf) ? sizeof(buf) : (size_t)(len - sent);
+        ssize_t n = delta_fd_read(&fd, buf, want, sent);
+        if (n <= 0 || !send_exact(sockfd, buf, (size_t)n))
+            return false;
+        sent += (uint64_t)n;
+        ui_show_upload_progress((size_t)sent, (size_t)len);
     }
-    else
+    return true;
+}
+
+/* Receive a reply payload into a file */
+static bool recv_to_fd(int sockfd, int fd, uint64_t len)
+{
+    char buf[BUFFER_SIZE];
+    uint64_t received = 0;
+
+    ui_show_download_progress(0, (size_t)len);
+    while (received < len)
     {
-        ui_show_download_result(success, server_message ? server_message : "", total_received);
+        size_t want = len - received > sizeof(buf) ? sizeof(buf) : (size_t)(len - received);
+        if (!recv_exact(sockfd, buf, want) || delta_fd_write(&fd, buf, want) != 0)
+            return false;
+        received += want;
+        ui_show_download_progress((size_t)received, (size_t)len);
     }
+    return true;
 }
 
-void handle_delete(int sockfd, const char *filename)
+/*
+ * Re-upload a file the server already has, sending only what changed:
+ * fetch the server copy's signature, then send a delta against it.
+ * Falls back to a full upload when the server has no copy, or when its
+ * copy changed between the two requests.
+ */
+void handle_sync_upload(int sockfd, const char *filename)
 {
-    char cmd[CMD_BUFFER_SIZE];
-    snprintf(cmd, sizeof(cmd), "DELETE %s\n", filename);
-    send(sockfd, cmd, strlen(cmd), 0);
+    const char *basename = path_basename(filename);
+    char response[BUFFER_SIZE] = {0};
+    FrameHeader hdr;
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        ui_show_error("Cannot open file '%s': %s", filename, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    if (!send_request(sockfd, FRAME_SIGNATURE, basename, NULL, 0) ||
+        !recv_reply_header(sockfd, &hdr))
+    {
+        ui_show_error("Connection lost");
+        close(fd);
+        return;
+    }
+
+    if (hdr.status != FRAME_STATUS_OK || hdr.payload_len > DELTA_MAX_SIGNATURE)
+    {
+        close(fd);
+        if (!recv_reply_text(sockfd, &hdr, response, sizeof(response)))
+            return;
+        if (hdr.status == FRAME_STATUS_NOT_FOUND)
+        {
+            ui_show_info("'%s' is not on the server yet, uploading it in full", basename);
+            handle_upload(sockfd, filename);
+            return;
+        }
+        ui_show_upload_result(false, response, 0);
+        return;
+    }
+
+    /* Signature of the server's copy */
+    DeltaSignature sig;
+    unsigned char *raw = malloc(hdr.payload_len ? hdr.payload_len : 1);
+    if (!raw || !recv_exact(sockfd, raw, hdr.payload_len))
+    {
+        ui_show_error(raw ? "Connection lost" : "Out of memory");
+        free(raw);
+        close(fd);
+        return;
+    }
+    int rc = delta_signature_decode(raw, hdr.payload_len, &sig);
+    free(raw);
+    if (rc != 0)
+    {
+        ui_show_error("Server sent an invalid signature");
+        close(fd);
+        return;
+    }
+
+    /* The delta's size goes in the request header, so build it first */
+    FILE *tmp = tmpfile();
+    int tmp_fd = tmp ? fileno(tmp) : -1;
+    DeltaFile local = {delta_fd_read, &fd, (uint64_t)st.st_size};
+    rc = tmp ? delta_generate(&sig, &local, delta_fd_write, &tmp_fd) : -1;
+    delta_signature_free(&sig);
+    close(fd);
+
+    struct stat dst;
+    if (rc != 0 || fstat(tmp_fd, &dst) != 0)
+    {
+        ui_show_error("Cannot compute delta for '%s'", filename);
+        if (tmp)
+            fclose(tmp);
+        return;
+    }
+
+    ui_show_info("Sending %lu byte delta for %s (%lu bytes)", (unsigned long)dst.st_size,
+                 basename, (unsigned long)st.st_size);
+    if (!send_request(sockfd, FRAME_UPLOAD_DELTA, basename, NULL, (uint64_t)dst.st_size) ||
+        !send_fd_body(sockfd, tmp_fd, (uint64_t)dst.st_size))
+    {
+        ui_show_error("Error sending delta");
+        fclose(tmp);
+        return;
+    }
+    fclose(tmp);
 
-    char response[BUFFER_SIZE];
-    ssize_t bytes = recv_response(sockfd, response, sizeof(response));
     bool success = false;
-    if (bytes > 0)
+    if (recv_reply_header(sockfd, &hdr) && recv_reply_text(sockfd, &hdr, response, sizeof(response)))
+        success = (hdr.status == FRAME_STATUS_OK);
+
+    if (!success && (hdr.status == FRAME_STATUS_CONFLICT || hdr.status == FRAME_STATUS_NOT_FOUND))
     {
-        success = (strstr(response, "DELETE OK") != NULL);
+        ui_show_info("'%s' changed on the server, uploading it in full", basename);
+        handle_upload(sockfd, filename);
+        return;
+    }
+    ui_show_upload_result(success, response, (size_t)dst.st_size);
+}
+
+/*
+ * Bring a local copy up to date with the server's, receiving only what
+ * changed: send the local copy's signature and apply the delta that comes
+ * back. The result is written beside the file and renamed over it once
+ * its checksum matches. Without a local copy this is a plain download.
+ */
+void handle_sync_download(int sockfd, char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 && errno == ENOENT)
+    {
+        handle_download(sockfd, &filename, 1);
+        return;
+    }
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        ui_show_error("Cannot open file '%s': %s", filename, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    DeltaFile local = {delta_fd_read, &fd, (uint64_t)st.st_size};
+    DeltaSignature sig;
+    if (delta_signature_build(&local, &sig) != 0)
+    {
+        ui_show_error("Cannot read file '%s'", filename);
+        close(fd);
+        return;
+    }
+    size_t sig_len = delta_signature_encoded_size(&sig);
+    unsigned char *raw = malloc(sig_len);
+    if (raw)
+        delta_signature_encode(&sig, raw);
+    delta_signature_free(&sig);
+
+    ui_show_download_start(filename);
+    FrameHeader hdr;
+    if (!raw || !send_request(sockfd, FRAME_DOWNLOAD_DELTA, filename, NULL, sig_len) ||
+        !send_exact(sockfd, raw, sig_len) || !recv_reply_header(sockfd, &hdr))
+    {
+        ui_show_error(raw ? "Connection lost" : "Out of memory");
+        free(raw);
+        close(fd);
+        return;
     }
+    free(raw);
 
-    ui_show_delete_result(success, filename, response);
+    if (hdr.status != FRAME_STATUS_OK)
+    {
+        char message[BUFFER_SIZE];
+        close(fd);
+        if (recv_reply_text(sockfd, &hdr, message, sizeof(message)))
+            ui_show_download_result(false, message, 0);
+        return;
+    }
+
+    /* Stage the delta, then rebuild the file next to the original */
+    FILE *tmp = tmpfile();
+    int tmp_fd = tmp ? fileno(tmp) : -1;
+    if (!tmp || !recv_to_fd(sockfd, tmp_fd, hdr.payload_len))
+    {
+        ui_show_download_result(false, tmp ? "Connection closed unexpectedly"
+                                           : "Cannot create temp file", 0);
+        if (tmp)
+            fclose(tmp);
+        close(fd);
+        return;
+    }
+
+    char part_path[CMD_BUFFER_SIZE];
+    snprintf(part_path, sizeof(part_path), "%s.stash-part", filename);
+    int out_fd = open(part_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    DeltaFile delta = {delta_fd_read, &tmp_fd, hdr.payload_len};
+    int rc = out_fd >= 0 ? delta_apply(&local, &delta, delta_fd_write, &out_fd) : -1;
+    fclose(tmp);
+    close(fd);
+
+    if (out_fd >= 0 && close(out_fd) != 0)
+        rc = -1;
+    if (rc == 0 && rename(part_path, filename) == 0)
+    {
+        ui_show_download_result(true, "", (size_t)hdr.payload_len);
+        return;
+    }
+
+    unlink(part_path);
+    ui_show_download_result(false, rc == -2 ? "Delta does not reproduce the server's file"
+                                            : "Cannot write local file", (size_t)hdr.payload_len);
+}
+
+/* Show one page of "name\tsize\ttimestamp" lines; returns false once the
+ * page ends with "LIST END" rather than "LIST MORE" */
+static bool show_list_page(char *page, char *cursor, size_t cursor_size, int *count)
+{
+    bool more = false;
+    for (char *line = strtok(page, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        /* Split from the right: the name is whatever precedes the numbers */
+        char *time_field = strrchr(line, '\t');
+        if (!time_field)
+        {
+            more = strcmp(line, "LIST MORE") == 0;
+            break;
+        }
+        *time_field++ = '\0';
+        char *size_field = strrchr(line, '\t');
+        if (!size_field)
+            continue;
+        *size_field++ = '\0';
+
+        ui_show_file_entry(line, (size_t)strtoull(size_field, NULL, 10),
+                           (time_t)strtoll(time_field, NULL, 10));
+        snprintf(cursor, cursor_size, "%s", line);
+        (*count)++;
+    }
+    return more;
 }
 
 void handle_list(int sockfd)
 {
-    char cmd[] = "LIST\n";
-    send(sockfd, cmd, strlen(cmd), 0);
+    char cursor[FRAME_MAX_NAME + 1] = "";
+    int count = 0;
+    bool more = true;
 
-    char response[BUFFER_SIZE];
-    ssize_t bytes = recv_response(sockfd, response, sizeof(response));
-    if (bytes > 0)
+    /* Page through the listing, each request continuing after the last name */
+    while (more)
     {
-        /* Parse the LIST response - simple display for now */
-        /* In a real implementation, you'd parse file info properly */
-        if (strstr(response, "No files") || strlen(response) < 5)
+        FrameHeader hdr;
+        if (!send_request(sockfd, FRAME_LIST, cursor, NULL, 0) ||
+            !recv_reply_header(sockfd, &hdr))
         {
-            ui_show_file_list_header();
-            ui_show_file_list_empty();
+            ui_show_error("Connection lost");
+            return;
         }
-        else
+
+        if (hdr.status != FRAME_STATUS_OK)
         {
-            ui_show_file_list_header();
-            /* For now, just display the raw response */
-            /* A better implementation would parse each file entry */
-            printf("%s", response);
-            printf("\n");
+            char response[BUFFER_SIZE];
+            if (recv_reply_text(sockfd, &hdr, response, sizeof(response)))
+                ui_show_error("%s", response);
+            else
+                ui_show_error("Connection lost");
+            return;
+        }
+
+        char *page = malloc(hdr.payload_len + 1);
+        if (!page || !recv_exact(sockfd, page, hdr.payload_len))
+        {
+            ui_show_error(page ? "Connection lost" : "Out of memory");
+            free(page);
+            return;
         }
+        page[hdr.payload_len] = '\0';
+
+        if (count == 0 && cursor[0] == '\0')
+            ui_show_file_list_header();
+        more = show_list_page(page, cursor, sizeof(cursor), &count);
+        free(page);
     }
+
+    if (count == 0)
+        ui_show_file_list_empty();
+    printf("\n");
 }
 
 void interactive_session(int sockfd, const char *username)
@@ -330,6 +1068,7 @@ void interactive_session(int sockfd, const char *username)
     char line[CMD_BUFFER_SIZE];
     char command[64];
     char arg1[256];
+    char *args[MAX_BATCH_FILES];
 
     ui_show_session_header(username);
 
@@ -354,6 +1093,12 @@ void interactive_session(int sockfd, const char *username)
         arg1[0] = '\0';
         sscanf(line, "%63s %255s", command, arg1);
 
+        /* Collect every argument for commands that take several files */
+        int nargs = 0;
+        strtok(line, " \t");
+        for (char *tok = strtok(NULL, " \t"); tok && nargs < MAX_BATCH_FILES; tok = strtok(NULL, " \t"))
+            args[nargs++] = tok;
+
         /* Handle commands */
         if (strcmp(command, "help") == 0)
         {
@@ -374,22 +1119,44 @@ void interactive_session(int sockfd, const char *username)
         {
             if (strlen(arg1) == 0)
             {
-                ui_show_usage_error("download", "download <filename>");
+                ui_show_usage_error("download", "download <filename> [filename...]");
             }
             else
             {
-                handle_download(sockfd, arg1);
+                handle_download(sockfd, args, nargs);
             }
         }
         else if (strcmp(command, "delete") == 0)
         {
             if (strlen(arg1) == 0)
             {
-                ui_show_usage_error("delete", "delete <filename>");
+                ui_show_usage_error("delete", "delete <filename> [filename...]");
+            }
+            else
+            {
+                handle_delete(sockfd, args, nargs);
+            }
+        }
+        else if (strcmp(command, "sync-up") == 0)
+        {
+            if (strlen(arg1) == 0)
+            {
+                ui_show_usage_error("sync-up", "sync-up <filename>");
+            }
+            else
+            {
+                handle_sync_upload(sockfd, arg1);
+            }
+        }
+        else if (strcmp(command, "sync-down") == 0)
+        {
+            if (strlen(arg1) == 0)
+            {
+                ui_show_usage_error("sync-down", "sync-down <filename>");
             }
             else
             {
-                handle_delete(sockfd, arg1);
+                handle_sync_download(sockfd, arg1);
             }
         }
         else if (strcmp(command, "list") == 0)
@@ -399,7 +1166,10 @@ void interactive_session(int sockfd, const char *username)
         else if (strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0)
         {
             ui_show_info("Sending QUIT command...");
-            send(sockfd, "QUIT\n", 5, 0);
+            FrameHeader hdr;
+            char response[BUFFER_SIZE];
+            if (send_request(sockfd, FRAME_QUIT, NULL, NULL, 0) && recv_reply_header(sockfd, &hdr))
+                recv_reply_text(sockfd, &hdr, response, sizeof(response));
             break;
         }
         else
@@ -430,6 +1200,8 @@ int main(int argc, char *argv[])
     const char *host = argv[1];
     const char *port = argv[2];
     char username[64] = {0};
+    saved_login.host = host;
+    saved_login.port = port;
 
     /* Show fancy splash screen (clears on key press) */
     ui_show_splash_screen();
@@ -449,6 +1221,14 @@ int main(int argc, char *argv[])
 
     ui_show_connected();
 
+    /* Switch to the framed protocol before authenticating */
+    if (!negotiate_protocol(sockfd))
+    {
+        ui_show_connection_error("Server does not support protocol v2");
+        close(sockfd);
+        return 1;
+    }
+
     /* Authenticate first */
     if (!authenticate(sockfd, username, sizeof(username)))
     {
@@ -339,12 +339,20 @@ void ui_show_help(void)
     printf("      - Upload a file to server\n");
 
     printf("    ");
-    tui_print_color(TUI_COLOR_GREEN, "download <filename>");
-    printf("    - Download a file from server\n");
+    tui_print_color(TUI_COLOR_GREEN, "download <file...>");
+    printf("      - Download one or more files from server\n");
 
     printf("    ");
-    tui_print_color(TUI_COLOR_GREEN, "delete <filename>");
-    printf("      - Delete a file from server\n");
+    tui_print_color(TUI_COLOR_GREEN, "delete <file...>");
+    printf("       - Delete one or more files from server\n");
+
+    printf("    ");
+    tui_print_color(TUI_COLOR_GREEN, "sync-up <filename>");
+    printf("     - Re-upload a file, sending only what changed\n");
+
+    printf("    ");
+    tui_print_color(TUI_COLOR_GREEN, "sync-down <filename>");
+    printf("   - Update a local copy, receiving only what changed\n");
 
     printf("    ");
     tui_print_color(TUI_COLOR_GREEN, "list");
@@ -492,19 +500,27 @@ void ui_show_file_list_header(void)
     printf("\n");
 
     /* Table header */
-    tui_print_styled(TUI_COLOR_CYAN, TUI_STYLE_BOLD, "  %-40s  %10s\n", "FILENAME", "SIZE");
+    tui_print_styled(TUI_COLOR_CYAN, TUI_STYLE_BOLD, "  %-40s  %10s  %16s\n", "FILENAME", "SIZE",
+                     "MODIFIED");
     tui_separator(BANNER_WIDTH, '-');
 }
 
-void ui_show_file_entry(const char *filename, size_t filesize)
+void ui_show_file_entry(const char *filename, size_t filesize, time_t modified)
 {
     char size_str[32];
     tui_format_bytes(filesize, size_str, sizeof(size_str));
 
+    char time_str[32] = "-";
+    struct tm tm;
+    if (modified > 0 && localtime_r(&modified, &tm))
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", &tm);
+
     printf("  ");
     tui_print_color(TUI_COLOR_WHITE, "%-40s", filename);
     printf("  ");
     tui_print_color(TUI_COLOR_YELLOW, "%10s", size_str);
+    printf("  ");
+    tui_print_color(TUI_COLOR_BRIGHT_BLACK, "%16s", time_str);
     printf("\n");
 }
 
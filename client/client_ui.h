@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
 
 /* ============================================================================
  * Client UI Layer - Presentation Logic
@@ -184,8 +185,9 @@ void ui_show_file_list_header(void);
  *
  * filename: Name of the file
  * filesize: Size of the file in bytes
+ * modified: Time of its last upload (0 if unknown)
  */
-void ui_show_file_entry(const char *filename, size_t filesize);
+void ui_show_file_entry(const char *filename, size_t filesize, time_t modified);
 
 /**
  * Display file list footer
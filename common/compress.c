@@ -0,0 +1,224 @@
+#include "compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+const char *compress_codec_name(compress_codec_t codec)
+{
+    return codec == COMPRESS_ZLIB ? "zlib" : "none";
+}
+
+size_t compress_bound(size_t len)
+{
+    return (size_t)compressBound((uLong)len);
+}
+
+/* Compressed output small enough to be worth inflating later */
+static bool saves_enough(size_t compressed, size_t len)
+{
+    return compressed * 100 <= len * (100 - COMPRESS_MIN_SAVING);
+}
+
+size_t compress_block(const void *src, size_t len, void *dst, size_t cap)
+{
+    uLongf out_len = (uLongf)cap;
+    if (len == 0 || compress2(dst, &out_len, src, (uLong)len, COMPRESS_LEVEL) != Z_OK)
+        return 0;
+    return saves_enough(out_len, len) ? (size_t)out_len : 0;
+}
+
+bool compress_worthwhile(const void *sample, size_t len)
+{
+    if (len > COMPRESS_SAMPLE_SIZE)
+        len = COMPRESS_SAMPLE_SIZE;
+    if (len == 0)
+        return false;
+
+    size_t cap = compress_bound(len);
+    void *out = malloc(cap);
+    if (!out)
+        return false;
+    bool worthwhile = compress_block(sample, len, out, cap) > 0;
+    free(out);
+    return worthwhile;
+}
+
+ssize_t decompress_block(const void *src, size_t len, void *dst, size_t cap)
+{
+    uLongf out_len = (uLongf)cap;
+    if (uncompress(dst, &out_len, src, (uLong)len) != Z_OK)
+        return -1;
+    return (ssize_t)out_len;
+}
+
+void compress_segment_header(unsigned char out[COMPRESS_SEGMENT_HEADER], compress_codec_t codec,
+                             uint32_t raw_len, uint32_t data_len)
+{
+    out[0] = (unsigned char)codec;
+    put_be32(out + 1, raw_len);
+    put_be32(out + 5, data_len);
+}
+
+uint64_t compress_plain_size(uint64_t len)
+{
+    uint64_t segments = (len + COMPRESS_SEGMENT_MAX - 1) / COMPRESS_SEGMENT_MAX;
+    return len + segments * COMPRESS_SEGMENT_HEADER;
+}
+
+/* -------------------- Encoder -------------------- */
+
+int compress_encode_fd(int fd, compress_write_fn write, void *ctx)
+{
+    size_t cap = compress_bound(COMPRESS_BLOCK_SIZE);
+    unsigned char *in = malloc(COMPRESS_BLOCK_SIZE);
+    unsigned char *out = malloc(cap);
+    int rc = (in && out) ? 0 : -1;
+
+    while (rc == 0)
+    {
+        /* Fill a whole block so segments don't depend on read sizes */
+        size_t len = 0;
+        while (len < COMPRESS_BLOCK_SIZE)
+        {
+            ssize_t n = read(fd, in + len, COMPRESS_BLOCK_SIZE - len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                rc = -1;
+            if (n <= 0)
+                break;
+            len += (size_t)n;
+        }
+        if (rc != 0 || len == 0)
+            break;
+
+        unsigned char header[COMPRESS_SEGMENT_HEADER];
+        size_t packed = compress_block(in, len, out, cap);
+        compress_segment_header(header, packed ? COMPRESS_ZLIB : COMPRESS_NONE, (uint32_t)len,
+                                (uint32_t)(packed ? packed : len));
+        if (write(ctx, header, sizeof(header)) != 0 ||
+            write(ctx, packed ? out : in, packed ? packed : len) != 0)
+            rc = -1;
+    }
+
+    free(in);
+    free(out);
+    return rc;
+}
+
+/* -------------------- Decoder -------------------- */
+
+void segment_decoder_init(SegmentDecoder *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+}
+
+bool segment_decoder_idle(const SegmentDecoder *dec)
+{
+    return dec->header_len == 0;
+}
+
+void segment_decoder_free(SegmentDecoder *dec)
+{
+    free(dec->data);
+    free(dec->raw);
+    dec->data = NULL;
+    dec->raw = NULL;
+}
+
+/* Check a complete header; -2 if it is malformed */
+static int segment_begin(SegmentDecoder *dec)
+{
+    dec->codec = (compress_codec_t)dec->header[0];
+    dec->raw_len = get_be32(dec->header + 1);
+    dec->data_len = get_be32(dec->header + 5);
+    dec->data_have = 0;
+
+    if (dec->raw_len == 0 || dec->raw_len > COMPRESS_SEGMENT_MAX)
+        return -2;
+    if (dec->codec == COMPRESS_NONE)
+        return dec->data_len == dec->raw_len ? 0 : -2;
+    if (dec->codec != COMPRESS_ZLIB || dec->data_len == 0 ||
+        dec->data_len > compress_bound(dec->raw_len))
+        return -2;
+
+    if (!dec->data)
+        dec->data = malloc(compress_bound(COMPRESS_SEGMENT_MAX));
+    if (!dec->raw)
+        dec->raw = malloc(COMPRESS_SEGMENT_MAX);
+    return dec->data && dec->raw ? 0 : -1;
+}
+
+int segment_decoder_feed(SegmentDecoder *dec, const void *data, size_t len,
+                         compress_write_fn write, void *ctx)
+{
+    const unsigned char *p = data;
+
+    while (len > 0)
+    {
+        if (dec->header_len < COMPRESS_SEGMENT_HEADER)
+        {
+            size_t take = COMPRESS_SEGMENT_HEADER - dec->header_len;
+            if (take > len)
+                take = len;
+            memcpy(dec->header + dec->header_len, p, take);
+            dec->header_len += take;
+            p += take;
+            len -= take;
+            if (dec->header_len < COMPRESS_SEGMENT_HEADER)
+                break;
+
+            int rc = segment_begin(dec);
+            if (rc != 0)
+                return rc;
+            continue;
+        }
+
+        size_t take = dec->data_len - dec->data_have;
+        if (take > len)
+            take = len;
+
+        if (dec->codec == COMPRESS_NONE)
+        {
+            /* Plain data passes straight through */
+            if (write(ctx, p, take) != 0)
+                return -1;
+        }
+        else
+        {
+            memcpy(dec->data + dec->data_have, p, take);
+        }
+        dec->data_have += (uint32_t)take;
+        p += take;
+        len -= take;
+
+        if (dec->data_have < dec->data_len)
+            break;
+
+        if (dec->codec == COMPRESS_ZLIB)
+        {
+            ssize_t n = decompress_block(dec->data, dec->data_len, dec->raw, COMPRESS_SEGMENT_MAX);
+            if (n != (ssize_t)dec->raw_len)
+                return -2;
+            if (write(ctx, dec->raw, dec->raw_len) != 0)
+                return -1;
+        }
+        dec->header_len = 0;
+    }
+    return 0;
+}
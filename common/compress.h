@@ -0,0 +1,108 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * zlib body compression - shared by the server and the client
+ *
+ * A compressed body (protocol v2 with "deflate" negotiated) is a sequence
+ * of segments, each compressed on its own or stored as-is:
+ *
+ *   codec u8 | raw_len u32 | data_len u32 | data
+ *
+ * COMPRESS_NONE data is raw_len plain bytes; COMPRESS_ZLIB data is a zlib
+ * stream that inflates to raw_len bytes. Segments let content that does
+ * not compress (media, archives) pass through untouched, and let the
+ * server send chunks it keeps compressed at rest without touching them.
+ *
+ * Whether a file is worth compressing at all is decided from a sample:
+ * if its first COMPRESS_SAMPLE_SIZE bytes don't shrink by
+ * COMPRESS_MIN_SAVING percent, the file is stored/sent plain.
+ */
+
+#define COMPRESS_SEGMENT_HEADER 9
+#define COMPRESS_SEGMENT_MAX (256 * 1024)  /* Largest raw_len: one chunk store chunk */
+#define COMPRESS_BLOCK_SIZE (64 * 1024)    /* Segment size the client encodes with */
+#define COMPRESS_SAMPLE_SIZE (64 * 1024)
+#define COMPRESS_MIN_SAVING 10             /* Percent; less is not worth inflating */
+#define COMPRESS_LEVEL 1                   /* Fast: the link, not the CPU, is the bottleneck */
+
+typedef enum
+{
+    COMPRESS_NONE = 0,
+    COMPRESS_ZLIB = 1
+} compress_codec_t;
+
+/* Output sink: store all len bytes. Returns 0, or -1 on error. */
+typedef int (*compress_write_fn)(void *ctx, const void *buf, size_t len);
+
+/* Name recorded in the files table ("none", "zlib") */
+const char *compress_codec_name(compress_codec_t codec);
+
+/* Whether content starting with this sample is worth compressing */
+bool compress_worthwhile(const void *sample, size_t len);
+
+/* Largest output compress_block can produce for len bytes */
+size_t compress_bound(size_t len);
+
+/**
+ * Compress one block at COMPRESS_LEVEL
+ * @param cap Capacity of dst (compress_bound(len))
+ * @return Compressed size, or 0 if it saves less than COMPRESS_MIN_SAVING
+ *         (keep the block plain)
+ */
+size_t compress_block(const void *src, size_t len, void *dst, size_t cap);
+
+/**
+ * Inflate one compressed block
+ * @return Raw size, or -1 if the data is corrupt or inflates past cap
+ */
+ssize_t decompress_block(const void *src, size_t len, void *dst, size_t cap);
+
+/* Write a segment header */
+void compress_segment_header(unsigned char out[COMPRESS_SEGMENT_HEADER], compress_codec_t codec,
+                             uint32_t raw_len, uint32_t data_len);
+
+/* Encoded size of len plain bytes sent as COMPRESS_NONE segments */
+uint64_t compress_plain_size(uint64_t len);
+
+/**
+ * Encode a whole file as segments of COMPRESS_BLOCK_SIZE, compressing
+ * each one that shrinks enough
+ * @return 0 on success, -1 on a read or write error
+ */
+int compress_encode_fd(int fd, compress_write_fn write, void *ctx);
+
+/* Incremental decoder for a received compressed body */
+typedef struct SegmentDecoder
+{
+    unsigned char header[COMPRESS_SEGMENT_HEADER];
+    size_t header_len;        /* Header bytes of the current segment received */
+    compress_codec_t codec;
+    uint32_t raw_len;
+    uint32_t data_len;
+    uint32_t data_have;       /* Data bytes of the current segment received */
+    unsigned char *data;      /* COMPRESS_ZLIB: the segment, inflated once complete */
+    unsigned char *raw;
+} SegmentDecoder;
+
+void segment_decoder_init(SegmentDecoder *dec);
+
+/**
+ * Decode the next received bytes; plain output goes to write
+ * @return 0 on success, -1 if write failed or memory ran out, -2 if the
+ *         body is malformed
+ */
+int segment_decoder_feed(SegmentDecoder *dec, const void *data, size_t len,
+                         compress_write_fn write, void *ctx);
+
+/* True between segments (a complete body ends here) */
+bool segment_decoder_idle(const SegmentDecoder *dec);
+
+void segment_decoder_free(SegmentDecoder *dec);
+
+#endif /* COMPRESS_H */
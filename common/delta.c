@@ -0,0 +1,643 @@
+#include "delta.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+/* Literal bytes buffered behind the sliding window before they are sent */
+#define DELTA_WINDOW_SLACK (256 * 1024)
+#define DELTA_OUT_BUFFER (64 * 1024)
+#define DELTA_IO_BUFFER (64 * 1024)
+
+#define DELTA_OP_COPY 'C'
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_END 'E'
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+/* Read exactly len bytes at offset; -1 on error or a short file */
+static int read_full(const DeltaFile *f, void *buf, size_t len, uint64_t offset)
+{
+    unsigned char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = f->read(f->ctx, p, len, offset);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+/* -------------------- Checksums -------------------- */
+
+/*
+ * rsync's weak checksum over a window of len bytes:
+ *   s1 = sum(x[i]), s2 = sum((len - i) * x[i])  (both mod 2^16)
+ * Rolling one byte out and one in is O(1), see roll below.
+ */
+typedef struct Rolling
+{
+    uint32_t s1;
+    uint32_t s2;
+} Rolling;
+
+static void rolling_init(Rolling *r, const unsigned char *data, size_t len)
+{
+    r->s1 = 0;
+    r->s2 = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        r->s1 += data[i];
+        r->s2 += r->s1;
+    }
+}
+
+static void rolling_roll(Rolling *r, unsigned char out, unsigned char in, size_t len)
+{
+    r->s1 += (uint32_t)in - out;
+    r->s2 += r->s1 - (uint32_t)len * out;
+}
+
+static uint32_t rolling_digest(const Rolling *r)
+{
+    return (r->s1 & 0xffff) | (r->s2 << 16);
+}
+
+static void strong_hash(const unsigned char *data, size_t len, unsigned char *out)
+{
+    unsigned char full[SHA256_DIGEST_LENGTH];
+    SHA256(data, len, full);
+    memcpy(out, full, DELTA_STRONG_LEN);
+}
+
+/* -------------------- Signatures -------------------- */
+
+uint32_t delta_block_size(uint64_t file_size)
+{
+    uint64_t b = DELTA_MIN_BLOCK;
+    while (b < DELTA_MAX_BLOCK && b * b < file_size)
+        b += 64;
+    return (uint32_t)b;
+}
+
+static uint32_t block_count(uint64_t file_size, uint32_t block_size)
+{
+    return (uint32_t)((file_size + block_size - 1) / block_size);
+}
+
+int delta_signature_build(const DeltaFile *base, DeltaSignature *sig)
+{
+    sig->block_size = delta_block_size(base->size);
+    sig->file_size = base->size;
+    sig->count = block_count(base->size, sig->block_size);
+    sig->blocks = calloc(sig->count ? sig->count : 1, sizeof(DeltaBlock));
+    unsigned char *buf = malloc(sig->block_size);
+    if (!sig->blocks || !buf)
+    {
+        free(buf);
+        delta_signature_free(sig);
+        return -1;
+    }
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < sig->count; i++)
+    {
+        size_t len = base->size - offset < sig->block_size ? (size_t)(base->size - offset)
+                                                           : sig->block_size;
+        if (read_full(base, buf, len, offset) != 0)
+        {
+            free(buf);
+            delta_signature_free(sig);
+            return -1;
+        }
+
+        Rolling r;
+        rolling_init(&r, buf, len);
+        sig->blocks[i].weak = rolling_digest(&r);
+        strong_hash(buf, len, sig->blocks[i].strong);
+        offset += len;
+    }
+
+    free(buf);
+    return 0;
+}
+
+size_t delta_signature_encoded_size(const DeltaSignature *sig)
+{
+    return DELTA_SIG_HEADER_SIZE + (size_t)sig->count * (4 + DELTA_STRONG_LEN);
+}
+
+void delta_signature_encode(const DeltaSignature *sig, unsigned char *out)
+{
+    memcpy(out, DELTA_SIG_MAGIC, 4);
+    put_be32(out + 4, sig->block_size);
+    put_be64(out + 8, sig->file_size);
+    put_be32(out + 16, sig->count);
+
+    out += DELTA_SIG_HEADER_SIZE;
+    for (uint32_t i = 0; i < sig->count; i++)
+    {
+        put_be32(out, sig->blocks[i].weak);
+        memcpy(out + 4, sig->blocks[i].strong, DELTA_STRONG_LEN);
+        out += 4 + DELTA_STRONG_LEN;
+    }
+}
+
+int delta_signature_decode(const unsigned char *buf, size_t len, DeltaSignature *sig)
+{
+    sig->blocks = NULL;
+    if (len < DELTA_SIG_HEADER_SIZE || memcmp(buf, DELTA_SIG_MAGIC, 4) != 0)
+        return -1;
+
+    sig->block_size = get_be32(buf + 4);
+    sig->file_size = get_be64(buf + 8);
+    sig->count = get_be32(buf + 16);
+
+    if (sig->block_size < DELTA_MIN_BLOCK || sig->block_size > DELTA_MAX_BLOCK ||
+        sig->file_size > (uint64_t)UINT32_MAX * sig->block_size ||
+        sig->count != block_count(sig->file_size, sig->block_size) ||
+        len != delta_signature_encoded_size(sig))
+        return -1;
+
+    sig->blocks = malloc((sig->count ? sig->count : 1) * sizeof(DeltaBlock));
+    if (!sig->blocks)
+        return -1;
+
+    buf += DELTA_SIG_HEADER_SIZE;
+    for (uint32_t i = 0; i < sig->count; i++)
+    {
+        sig->blocks[i].weak = get_be32(buf);
+        memcpy(sig->blocks[i].strong, buf + 4, DELTA_STRONG_LEN);
+        buf += 4 + DELTA_STRONG_LEN;
+    }
+    return 0;
+}
+
+void delta_signature_free(DeltaSignature *sig)
+{
+    free(sig->blocks);
+    sig->blocks = NULL;
+    sig->count = 0;
+}
+
+/* -------------------- Delta Generation -------------------- */
+
+/* Buffered op writer; copies of consecutive blocks merge into one op */
+typedef struct DeltaOut
+{
+    delta_write_fn write;
+    void *ctx;
+    unsigned char buf[DELTA_OUT_BUFFER];
+    size_t len;
+    uint32_t run_start;    /* Pending copy run */
+    uint32_t run_count;
+    int error;
+} DeltaOut;
+
+static void out_flush(DeltaOut *out)
+{
+    if (out->len > 0 && !out->error && out->write(out->ctx, out->buf, out->len) != 0)
+        out->error = -1;
+    out->len = 0;
+}
+
+static void out_put(DeltaOut *out, const void *data, size_t len)
+{
+    if (out->error)
+        return;
+    if (out->len + len > sizeof(out->buf))
+    {
+        out_flush(out);
+        /* Large literals bypass the buffer */
+        if (len > sizeof(out->buf))
+        {
+            if (!out->error && out->write(out->ctx, data, len) != 0)
+                out->error = -1;
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+}
+
+static void out_flush_run(DeltaOut *out)
+{
+    if (out->run_count == 0)
+        return;
+    unsigned char op[9];
+    op[0] = DELTA_OP_COPY;
+    put_be32(op + 1, out->run_start);
+    put_be32(op + 5, out->run_count);
+    out_put(out, op, sizeof(op));
+    out->run_count = 0;
+}
+
+static void out_copy(DeltaOut *out, uint32_t block)
+{
+    if (out->run_count > 0 && out->run_start + out->run_count == block)
+    {
+        out->run_count++;
+        return;
+    }
+    out_flush_run(out);
+    out->run_start = block;
+    out->run_count = 1;
+}
+
+static void out_literal(DeltaOut *out, const unsigned char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    out_flush_run(out);
+    unsigned char op[5];
+    op[0] = DELTA_OP_LITERAL;
+    put_be32(op + 1, (uint32_t)len);
+    out_put(out, op, sizeof(op));
+    out_put(out, data, len);
+}
+
+/* Weak checksum -> block index chains */
+typedef struct BlockIndex
+{
+    int32_t *head;
+    int32_t *next;
+    uint32_t mask;
+} BlockIndex;
+
+static int block_index_build(BlockIndex *idx, const DeltaSignature *sig)
+{
+    uint32_t nbuckets = 16;
+    while (nbuckets < sig->count * 2)
+        nbuckets *= 2;
+
+    idx->mask = nbuckets - 1;
+    idx->head = malloc(nbuckets * sizeof(int32_t));
+    idx->next = malloc((sig->count ? sig->count : 1) * sizeof(int32_t));
+    if (!idx->head || !idx->next)
+    {
+        free(idx->head);
+        free(idx->next);
+        return -1;
+    }
+    memset(idx->head, 0xff, nbuckets * sizeof(int32_t));
+
+    /* Insert backwards so each chain lists the lowest block first */
+    for (uint32_t i = sig->count; i-- > 0;)
+    {
+        uint32_t b = (sig->blocks[i].weak ^ (sig->blocks[i].weak >> 16)) & idx->mask;
+        idx->next[i] = idx->head[b];
+        idx->head[b] = (int32_t)i;
+    }
+    return 0;
+}
+
+static uint32_t block_len(const DeltaSignature *sig, uint32_t i)
+{
+    uint64_t start = (uint64_t)i * sig->block_size;
+    uint64_t left = sig->file_size - start;
+    return left < sig->block_size ? (uint32_t)left : sig->block_size;
+}
+
+/* Find a base block of exactly len bytes matching data; -1 if none */
+static int64_t block_match(const BlockIndex *idx, const DeltaSignature *sig, uint32_t weak,
+                           const unsigned char *data, size_t len)
+{
+    unsigned char strong[DELTA_STRONG_LEN];
+    bool hashed = false;
+
+    for (int32_t i = idx->head[(weak ^ (weak >> 16)) & idx->mask]; i >= 0; i = idx->next[i])
+    {
+        if (sig->blocks[i].weak != weak || block_len(sig, (uint32_t)i) != len)
+            continue;
+        if (!hashed)
+        {
+            strong_hash(data, len, strong);
+            hashed = true;
+        }
+        if (memcmp(strong, sig->blocks[i].strong, DELTA_STRONG_LEN) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int delta_generate(const DeltaSignature *sig, const DeltaFile *target,
+                   delta_write_fn write, void *ctx)
+{
+    size_t bs = sig->block_size;
+    size_t cap = 2 * bs + DELTA_WINDOW_SLACK;
+    DeltaOut *out = calloc(1, sizeof(DeltaOut));
+    unsigned char *buf = malloc(cap);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    BlockIndex idx = {0};
+    int rc = -1;
+
+    if (!out || !buf || !md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1 ||
+        block_index_build(&idx, sig) != 0)
+        goto done;
+
+    out->write = write;
+    out->ctx = ctx;
+
+    unsigned char header[DELTA_HEADER_SIZE];
+    memcpy(header, DELTA_MAGIC, 4);
+    put_be32(header + 4, sig->block_size);
+    put_be64(header + 8, sig->file_size);
+    put_be64(header + 16, target->size);
+    out_put(out, header, sizeof(header));
+
+    /*
+     * buf holds target bytes from file offset 'base': [lit, pos) is literal
+     * data not sent yet, [pos, pos + bs) the window whose checksum is in r.
+     */
+    uint64_t base = 0;
+    size_t pos = 0, lit = 0, filled = 0;
+    bool eof = target->size == 0;
+    bool valid = false;
+    Rolling r = {0};
+
+    while (!out->error)
+    {
+        /* Keep one byte past the window buffered so it can roll */
+        if (!eof && filled - pos <= bs)
+        {
+            out_literal(out, buf + lit, pos - lit);
+            memmove(buf, buf + pos, filled - pos);
+            base += pos;
+            filled -= pos;
+            pos = lit = 0;
+
+            while (filled < cap && base + filled < target->size)
+            {
+                size_t want = cap - filled;
+                if (want > target->size - base - filled)
+                    want = (size_t)(target->size - base - filled);
+                ssize_t n = target->read(target->ctx, buf + filled, want, base + filled);
+                if (n <= 0)
+                    goto done;
+                EVP_DigestUpdate(md, buf + filled, (size_t)n);
+                filled += (size_t)n;
+            }
+            eof = base + filled >= target->size;
+        }
+
+        size_t avail = filled - pos;
+        if (avail < bs)
+        {
+            /* Tail: only the base's short last block can match it */
+            Rolling tail;
+            rolling_init(&tail, buf + pos, avail);
+            int64_t m = avail > 0 ? block_match(&idx, sig, rolling_digest(&tail), buf + pos, avail)
+                                  : -1;
+            if (m >= 0)
+            {
+                out_literal(out, buf + lit, pos - lit);
+                out_copy(out, (uint32_t)m);
+            }
+            else
+            {
+                out_literal(out, buf + lit, filled - lit);
+            }
+            break;
+        }
+
+        if (!valid)
+        {
+            rolling_init(&r, buf + pos, bs);
+            valid = true;
+        }
+
+        int64_t m = block_match(&idx, sig, rolling_digest(&r), buf + pos, bs);
+        if (m >= 0)
+        {
+            out_literal(out, buf + lit, pos - lit);
+            out_copy(out, (uint32_t)m);
+            pos += bs;
+            lit = pos;
+            valid = false;
+            continue;
+        }
+
+        if (avail > bs)
+            rolling_roll(&r, buf[pos], buf[pos + bs], bs);
+        else
+            valid = false;
+        pos++;
+    }
+
+    out_flush_run(out);
+    unsigned char end[1 + DELTA_HASH_LEN];
+    end[0] = DELTA_OP_END;
+    EVP_DigestFinal_ex(md, end + 1, NULL);
+    out_put(out, end, sizeof(end));
+    out_flush(out);
+    rc = out->error;
+
+done:
+    free(idx.head);
+    free(idx.next);
+    EVP_MD_CTX_free(md);
+    free(buf);
+    free(out);
+    return rc;
+}
+
+/* -------------------- Delta Application -------------------- */
+
+/* Sequential reader over the delta */
+typedef struct DeltaIn
+{
+    const DeltaFile *file;
+    uint64_t offset;
+    unsigned char buf[DELTA_IO_BUFFER];
+    size_t pos;
+    size_t len;
+} DeltaIn;
+
+/* Returns 0, -1 on a read error, -2 if the delta ends early */
+static int in_read(DeltaIn *in, void *dst, size_t len)
+{
+    unsigned char *p = dst;
+    while (len > 0)
+    {
+        if (in->pos == in->len)
+        {
+            if (in->offset >= in->file->size)
+                return -2;
+            ssize_t n = in->file->read(in->file->ctx, in->buf, sizeof(in->buf), in->offset);
+            if (n <= 0)
+                return -1;
+            in->offset += (uint64_t)n;
+            in->pos = 0;
+            in->len = (size_t)n;
+        }
+        size_t take = in->len - in->pos < len ? in->len - in->pos : len;
+        memcpy(p, in->buf + in->pos, take);
+        in->pos += take;
+        p += take;
+        len -= take;
+    }
+    return 0;
+}
+
+int delta_read_header(const DeltaFile *delta, uint64_t *target_size)
+{
+    unsigned char header[DELTA_HEADER_SIZE];
+    if (delta->size < DELTA_HEADER_SIZE)
+        return -2;
+    if (read_full(delta, header, sizeof(header), 0) != 0)
+        return -1;
+    if (memcmp(header, DELTA_MAGIC, 4) != 0)
+        return -2;
+    *target_size = get_be64(header + 16);
+    return 0;
+}
+
+int delta_apply(const DeltaFile *base, const DeltaFile *delta, delta_write_fn write, void *ctx)
+{
+    DeltaIn *in = calloc(1, sizeof(DeltaIn));
+    unsigned char *buf = malloc(DELTA_IO_BUFFER);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    int rc = -1;
+
+    if (!in || !buf || !md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1)
+        goto done;
+    in->file = delta;
+
+    unsigned char header[DELTA_HEADER_SIZE];
+    if ((rc = in_read(in, header, sizeof(header))) != 0)
+        goto done;
+
+    rc = -2;
+    uint32_t bs = get_be32(header + 4);
+    uint64_t target_size = get_be64(header + 16);
+    if (memcmp(header, DELTA_MAGIC, 4) != 0 || bs < DELTA_MIN_BLOCK || bs > DELTA_MAX_BLOCK ||
+        get_be64(header + 8) != base->size)
+        goto done;
+    uint64_t nblocks = (base->size + bs - 1) / bs;
+
+    uint64_t written = 0;
+    while (1)
+    {
+        unsigned char op[9];
+        if ((rc = in_read(in, op, 1)) != 0)
+            goto done;
+
+        if (op[0] == DELTA_OP_END)
+        {
+            unsigned char want[DELTA_HASH_LEN], got[DELTA_HASH_LEN];
+            if ((rc = in_read(in, want, sizeof(want))) != 0)
+                goto done;
+            EVP_DigestFinal_ex(md, got, NULL);
+            rc = written == target_size && memcmp(want, got, sizeof(got)) == 0 ? 0 : -2;
+            goto done;
+        }
+
+        uint64_t offset, len;
+        bool copy = op[0] == DELTA_OP_COPY;
+        if (copy)
+        {
+            if ((rc = in_read(in, op + 1, 8)) != 0)
+                goto done;
+            uint64_t first = get_be32(op + 1), count = get_be32(op + 5);
+            rc = -2;
+            if (count == 0 || first + count > nblocks)
+                goto done;
+            offset = first * bs;
+            len = (first + count) * bs > base->size ? base->size - offset : count * bs;
+        }
+        else if (op[0] == DELTA_OP_LITERAL)
+        {
+            if ((rc = in_read(in, op + 1, 4)) != 0)
+                goto done;
+            offset = 0;
+            len = get_be32(op + 1);
+        }
+        else
+        {
+            rc = -2;
+            goto done;
+        }
+
+        rc = -2;
+        if (written + len > target_size)
+            goto done;
+
+        while (len > 0)
+        {
+            size_t n = len > DELTA_IO_BUFFER ? DELTA_IO_BUFFER : (size_t)len;
+            rc = copy ? read_full(base, buf, n, offset) : in_read(in, buf, n);
+            if (rc != 0)
+                goto done;
+            rc = -1;
+            if (write(ctx, buf, n) != 0)
+                goto done;
+            EVP_DigestUpdate(md, buf, n);
+            offset += n;
+            len -= n;
+            written += n;
+        }
+    }
+
+done:
+    EVP_MD_CTX_free(md);
+    free(buf);
+    free(in);
+    return rc;
+}
+
+/* -------------------- Plain Files -------------------- */
+
+ssize_t delta_fd_read(void *ctx, void *buf, size_t len, uint64_t offset)
+{
+    int fd = *(int *)ctx;
+    ssize_t n;
+    do
+        n = pread(fd, buf, len, (off_t)offset);
+    while (n < 0 && errno == EINTR);
+    return n;
+}
+
+int delta_fd_write(void *ctx, const void *buf, size_t len)
+{
+    int fd = *(int *)ctx;
+    const unsigned char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * rsync-style delta transfer - shared by the server and the client
+ *
+ * The side that holds the old copy of a file (the base) describes it with a
+ * signature: the file cut into fixed-size blocks, each with a weak rolling
+ * checksum and a strong hash. The side holding the new copy (the target)
+ * slides a window over it one byte at a time; wherever the window's rolling
+ * checksum and then its strong hash match a base block it emits "copy block
+ * i", everything else goes out as literal bytes. The receiver rebuilds the
+ * target from its base plus the delta and checks the target's SHA-256,
+ * which the delta carries at its end.
+ *
+ * A small edit costs a signature (~20 bytes per block, with blocks of about
+ * sqrt(file size)) plus the changed blocks, instead of the whole file.
+ *
+ * Wire formats (integers big-endian):
+ *   signature: "SSIG" | block_size u32 | file_size u64 | count u32 |
+ *              count x (weak u32 | strong[DELTA_STRONG_LEN])
+ *   delta:     "SDLT" | block_size u32 | base_size u64 | target_size u64 |
+ *              ops... | 'E' sha256(target)
+ *   ops:       'C' first_block u32 | count u32   (copy from the base)
+ *              'L' len u32 | bytes               (literal data)
+ */
+
+#define DELTA_SIG_MAGIC "SSIG"
+#define DELTA_MAGIC "SDLT"
+#define DELTA_SIG_HEADER_SIZE 20
+#define DELTA_HEADER_SIZE 24
+#define DELTA_STRONG_LEN 16
+#define DELTA_HASH_LEN 32
+
+#define DELTA_MIN_BLOCK 1024
+#define DELTA_MAX_BLOCK (64 * 1024)
+
+/* Largest signature a peer may send (DOWNLOAD_DELTA request payload) */
+#define DELTA_MAX_SIGNATURE (16 * 1024 * 1024)
+
+/* Random-access input: read up to len bytes at offset, like pread(2).
+ * Returns bytes read (0 at end of file) or -1 on error. */
+typedef ssize_t (*delta_read_fn)(void *ctx, void *buf, size_t len, uint64_t offset);
+
+/* Output sink: store all len bytes. Returns 0, or -1 on error. */
+typedef int (*delta_write_fn)(void *ctx, const void *buf, size_t len);
+
+/* A file the delta code reads from */
+typedef struct DeltaFile
+{
+    delta_read_fn read;
+    void *ctx;
+    uint64_t size;
+} DeltaFile;
+
+typedef struct DeltaBlock
+{
+    uint32_t weak;
+    unsigned char strong[DELTA_STRONG_LEN];
+} DeltaBlock;
+
+typedef struct DeltaSignature
+{
+    uint32_t block_size;
+    uint64_t file_size;
+    uint32_t count;          /* Last block is shorter unless block_size divides file_size */
+    DeltaBlock *blocks;
+} DeltaSignature;
+
+/**
+ * Block size for a file of this size: about sqrt(size), clamped to
+ * DELTA_MIN_BLOCK..DELTA_MAX_BLOCK
+ */
+uint32_t delta_block_size(uint64_t file_size);
+
+/**
+ * Compute the signature of a base file
+ * @return 0 on success, -1 on error (read failed or out of memory)
+ */
+int delta_signature_build(const DeltaFile *base, DeltaSignature *sig);
+
+/* Bytes delta_signature_encode writes */
+size_t delta_signature_encoded_size(const DeltaSignature *sig);
+
+/* Serialize a signature into out (delta_signature_encoded_size bytes) */
+void delta_signature_encode(const DeltaSignature *sig, unsigned char *out);
+
+/**
+ * Parse a received signature
+ * @return 0 on success, -1 if it is malformed or memory ran out
+ */
+int delta_signature_decode(const unsigned char *buf, size_t len, DeltaSignature *sig);
+
+/* Free a signature's block array */
+void delta_signature_free(DeltaSignature *sig);
+
+/**
+ * Write the delta that turns the signature's base into target
+ * @return 0 on success, -1 on a read or write error
+ */
+int delta_generate(const DeltaSignature *sig, const DeltaFile *target,
+                   delta_write_fn write, void *ctx);
+
+/**
+ * Read a delta's header without applying it
+ * @param target_size Output: size of the file the delta rebuilds
+ * @return 0 on success, -1 on a read error, -2 if it is not a delta
+ */
+int delta_read_header(const DeltaFile *delta, uint64_t *target_size);
+
+/**
+ * Rebuild the target from base and delta, writing it sequentially
+ * @return 0 on success, -1 on a read or write error, -2 if the delta is
+ *         malformed or was made against a different base (the result
+ *         does not match the target's hash)
+ */
+int delta_apply(const DeltaFile *base, const DeltaFile *delta, delta_write_fn write, void *ctx);
+
+/* delta_read_fn / delta_write_fn over a plain file: ctx points to the int fd */
+ssize_t delta_fd_read(void *ctx, void *buf, size_t len, uint64_t offset);
+int delta_fd_write(void *ctx, const void *buf, size_t len);
+
+#endif /* DELTA_H */
@@ -0,0 +1,135 @@
+#include "stash_proto.h"
+#include "delta.h"
+
+static void put_be16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    put_be16(p, (uint16_t)(v >> 16));
+    put_be16(p + 2, (uint16_t)v);
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get_be16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)get_be16(p) << 16) | get_be16(p + 2);
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+void frame_encode_header(const FrameHeader *hdr, unsigned char out[FRAME_HEADER_SIZE])
+{
+    out[0] = hdr->type;
+    out[1] = hdr->status;
+    put_be16(out + 2, hdr->name_len);
+    put_be32(out + 4, hdr->tag);
+    put_be64(out + 8, hdr->payload_len);
+}
+
+void frame_decode_header(const unsigned char in[FRAME_HEADER_SIZE], FrameHeader *hdr)
+{
+    hdr->type = in[0];
+    hdr->status = in[1];
+    hdr->name_len = get_be16(in + 2);
+    hdr->tag = get_be32(in + 4);
+    hdr->payload_len = get_be64(in + 8);
+}
+
+int frame_validate_request(const FrameHeader *hdr)
+{
+    if (hdr->type < FRAME_SIGNUP || hdr->type > FRAME_UPLOAD_RESUME)
+        return -1;
+    if (hdr->name_len > FRAME_MAX_NAME)
+        return -1;
+    /* Only bodies are streamed; everything else is read whole */
+    if (!frame_has_body(hdr->type) && hdr->payload_len > FRAME_MAX_INLINE_PAYLOAD)
+        return -1;
+    if (hdr->type == FRAME_DOWNLOAD_DELTA && hdr->payload_len > DELTA_MAX_SIGNATURE)
+        return -1;
+    if (hdr->type == FRAME_UPLOAD_RESUME && hdr->payload_len < FRAME_RESUME_PREFIX_SIZE)
+        return -1;
+    /* Flags: FRAME_FLAG_DEFLATE, on UPLOAD and DOWNLOAD only */
+    if (hdr->status & ~FRAME_FLAG_DEFLATE)
+        return -1;
+    if (hdr->status && hdr->type != FRAME_UPLOAD && hdr->type != FRAME_DOWNLOAD)
+        return -1;
+    if (hdr->type == FRAME_UPLOAD && (hdr->status & FRAME_FLAG_DEFLATE) &&
+        hdr->payload_len < FRAME_DEFLATE_PREFIX_SIZE)
+        return -1;
+    return 0;
+}
+
+int frame_has_body(uint8_t type)
+{
+    return type == FRAME_UPLOAD || type == FRAME_UPLOAD_DELTA || type == FRAME_DOWNLOAD_DELTA ||
+           type == FRAME_UPLOAD_RESUME;
+}
+
+uint64_t frame_inline_len(const FrameHeader *hdr)
+{
+    if (hdr->type == FRAME_UPLOAD_RESUME)
+        return FRAME_RESUME_PREFIX_SIZE;
+    if (hdr->type == FRAME_UPLOAD && (hdr->status & FRAME_FLAG_DEFLATE))
+        return FRAME_DEFLATE_PREFIX_SIZE;
+    return frame_has_body(hdr->type) ? 0 : hdr->payload_len;
+}
+
+void frame_put_u64(unsigned char *p, uint64_t v)
+{
+    put_be64(p, v);
+}
+
+uint64_t frame_get_u64(const unsigned char *p)
+{
+    return get_be64(p);
+}
+
+const char *frame_type_name(uint8_t type)
+{
+    switch (type & ~FRAME_REPLY)
+    {
+    case FRAME_SIGNUP:
+        return "SIGNUP";
+    case FRAME_LOGIN:
+        return "LOGIN";
+    case FRAME_UPLOAD:
+        return "UPLOAD";
+    case FRAME_DOWNLOAD:
+        return "DOWNLOAD";
+    case FRAME_DELETE:
+        return "DELETE";
+    case FRAME_LIST:
+        return "LIST";
+    case FRAME_QUIT:
+        return "QUIT";
+    case FRAME_SIGNATURE:
+        return "SIGNATURE";
+    case FRAME_UPLOAD_DELTA:
+        return "UPLOAD_DELTA";
+    case FRAME_DOWNLOAD_DELTA:
+        return "DOWNLOAD_DELTA";
+    case FRAME_UPLOAD_OFFSET:
+        return "UPLOAD_OFFSET";
+    case FRAME_UPLOAD_RESUME:
+        return "UPLOAD_RESUME";
+    default:
+        return "UNKNOWN";
+    }
+}
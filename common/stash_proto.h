@@ -0,0 +1,153 @@
+#ifndef STASH_PROTO_H
+#define STASH_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * StashCLI wire protocol v2 - length-prefixed binary frames
+ *
+ * Shared by the server and the client. A connection starts in the text
+ * protocol (v1); the client switches it by sending the line "PROTO 2".
+ * Once the server answers "PROTO 2 OK\n", every message in both directions
+ * is a frame:
+ *
+ *   +------+--------+----------+-----+-------------+------+---------+
+ *   | type | status | name_len | tag | payload_len | name | payload |
+ *   |  u8  |   u8   |   u16    | u32 |     u64     |      |         |
+ *   +------+--------+----------+-----+-------------+------+---------+
+ *
+ * Integers are big-endian. A receiver always knows how many bytes to read
+ * next, so payloads are never scanned for markers. Requests may be
+ * pipelined: the server answers them in order and echoes each tag.
+ *
+ * A client that sends "PROTO 2 deflate" instead, and gets
+ * "PROTO 2 OK deflate\n" back, may set FRAME_FLAG_DEFLATE on UPLOAD and
+ * DOWNLOAD requests: the file then travels as a compressed body
+ * (common/compress.h) preceded by its plain size.
+ */
+
+#define PROTO_VERSION_TEXT 1
+#define PROTO_VERSION_FRAMED 2
+
+#define PROTO_NEGOTIATE_LINE "PROTO 2"
+#define PROTO_NEGOTIATE_OK "PROTO 2 OK\n"
+#define PROTO_NEGOTIATE_DEFLATE "PROTO 2 deflate"
+#define PROTO_NEGOTIATE_OK_DEFLATE "PROTO 2 OK deflate\n"
+
+#define FRAME_HEADER_SIZE 16
+#define FRAME_MAX_NAME 255
+
+/* Largest payload accepted inline, on requests without a body (password, etc.) */
+#define FRAME_MAX_INLINE_PAYLOAD 4096
+
+/* Request types; replies carry the request type with FRAME_REPLY set */
+typedef enum
+{
+    FRAME_SIGNUP = 1,    /* name = username, payload = password */
+    FRAME_LOGIN = 2,     /* name = username, payload = password */
+    FRAME_UPLOAD = 3,    /* name = filename, payload = file body */
+    FRAME_DOWNLOAD = 4,  /* name = filename, optional payload = byte range (FRAME_RANGE_SIZE) */
+    FRAME_DELETE = 5,    /* name = filename */
+    FRAME_LIST = 6,      /* name = cursor, optional payload = page size (u64); see below */
+    FRAME_QUIT = 7,
+    /* Delta sync (common/delta.h) */
+    FRAME_SIGNATURE = 8,      /* name = filename; reply payload = signature of the stored file */
+    FRAME_UPLOAD_DELTA = 9,   /* name = filename, payload = delta against that signature */
+    FRAME_DOWNLOAD_DELTA = 10, /* name = filename, payload = signature of the client's copy;
+                                * reply payload = delta that turns it into the stored file */
+    /* Resumable uploads */
+    FRAME_UPLOAD_OFFSET = 11,  /* name = filename, payload = total size (u64);
+                                * reply payload = bytes of it the server already has (u64) */
+    FRAME_UPLOAD_RESUME = 12   /* name = filename, payload = total size (u64) | offset (u64) |
+                                * body from offset to the end */
+} frame_type_t;
+
+/* DOWNLOAD range payload: offset (u64) | length (u64, 0 = to the end) */
+#define FRAME_RANGE_SIZE 16
+
+/* UPLOAD_RESUME payload prefix read ahead of the streamed body */
+#define FRAME_RESUME_PREFIX_SIZE 16
+
+/*
+ * LIST pages through the user's files in name order. The cursor is the
+ * last name of the previous page (empty for the first); the reply payload
+ * is one "name\tsize\ttimestamp\n" line per file, then "LIST MORE\n" if
+ * further names follow or "LIST END\n". The text protocol takes the cursor
+ * as "LIST [<cursor>]" and always uses the default page size.
+ */
+#define LIST_PAGE_DEFAULT 1000
+#define LIST_PAGE_MAX 10000
+
+/*
+ * Request flags, carried in the status byte of requests (deflate
+ * negotiated only). UPLOAD: payload = plain size (u64) | compressed body.
+ * DOWNLOAD (without a range): the reply payload has the same form.
+ */
+#define FRAME_FLAG_DEFLATE 0x01
+#define FRAME_DEFLATE_PREFIX_SIZE 8
+
+#define FRAME_REPLY 0x80
+
+/* Reply status; on failure the payload is a human-readable message */
+typedef enum
+{
+    FRAME_STATUS_OK = 0,
+    FRAME_STATUS_ERROR = 1,
+    FRAME_STATUS_NOT_FOUND = 2,
+    FRAME_STATUS_QUOTA_EXCEEDED = 3,
+    FRAME_STATUS_PERMISSION_DENIED = 4,
+    FRAME_STATUS_BAD_REQUEST = 5,
+    FRAME_STATUS_BUSY = 6,
+    FRAME_STATUS_CONFLICT = 7     /* Delta made against content that has since changed */
+} frame_status_t;
+
+typedef struct FrameHeader
+{
+    uint8_t type;
+    uint8_t status;
+    uint16_t name_len;
+    uint32_t tag;
+    uint64_t payload_len;
+} FrameHeader;
+
+/**
+ * Serialize a header into its 16-byte wire form
+ */
+void frame_encode_header(const FrameHeader *hdr, unsigned char out[FRAME_HEADER_SIZE]);
+
+/**
+ * Parse a 16-byte wire header
+ */
+void frame_decode_header(const unsigned char in[FRAME_HEADER_SIZE], FrameHeader *hdr);
+
+/**
+ * Check a request header before reading its name and payload
+ * @return 0 if well-formed, -1 if the stream cannot be trusted (unknown
+ *         type, oversized name or inline payload) and should be closed
+ */
+int frame_validate_request(const FrameHeader *hdr);
+
+/**
+ * Whether a request's payload is a body streamed to disk (uploads and the
+ * delta requests) rather than read inline
+ */
+int frame_has_body(uint8_t type);
+
+/**
+ * Payload bytes read inline, ahead of any streamed body: the whole payload
+ * for requests without a body, FRAME_RESUME_PREFIX_SIZE for UPLOAD_RESUME,
+ * FRAME_DEFLATE_PREFIX_SIZE for a compressed UPLOAD
+ */
+uint64_t frame_inline_len(const FrameHeader *hdr);
+
+/* Big-endian u64 fields inside payloads (ranges, offsets) */
+void frame_put_u64(unsigned char *p, uint64_t v);
+uint64_t frame_get_u64(const unsigned char *p);
+
+/**
+ * Human-readable name of a request type (for logs)
+ */
+const char *frame_type_name(uint8_t type);
+
+#endif /* STASH_PROTO_H */
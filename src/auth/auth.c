@@ -1,5 +1,6 @@
 #include "auth.h"
 #include "user_metadata.h"
+#include "../utils/logger.h"
 #include <string.h>
 #include <stdio.h>
 #include <openssl/sha.h>
@@ -21,14 +22,14 @@ int user_signup(const char *username, const char *password)
 {
     if (!username || !password)
     {
-        fprintf(stderr, "[Auth] Invalid parameters for signup\n");
+        LOG_ERROR("Auth", "Invalid parameters for signup");
         return -1;
     }
 
     /* Check if user already exists */
     if (user_exists(username))
     {
-        printf("[Auth] Signup failed: User '%s' already exists\n", username);
+        LOG_INFO("Auth", "Signup failed: User '%s' already exists", username);
         return -2;  /* User already exists */
     }
 
@@ -41,16 +42,16 @@ int user_signup(const char *username, const char *password)
 
     if (result == 0)
     {
-        printf("[Auth] User '%s' signed up successfully\n", username);
+        LOG_INFO("Auth", "User '%s' signed up successfully", username);
     }
     else if (result == -2)
     {
         /* Rare case: user was created between exists check and create */
-        printf("[Auth] Signup failed: User '%s' already exists\n", username);
+        LOG_INFO("Auth", "Signup failed: User '%s' already exists", username);
     }
     else
     {
-        fprintf(stderr, "[Auth] Signup failed for user '%s': database error\n", username);
+        LOG_ERROR("Auth", "Signup failed for user '%s': database error", username);
     }
 
     return result;
@@ -60,7 +61,7 @@ int user_login(const char *username, const char *password)
 {
     if (!username || !password)
     {
-        fprintf(stderr, "[Auth] Invalid parameters for login\n");
+        LOG_ERROR("Auth", "Invalid parameters for login");
         return -1;
     }
 
@@ -73,19 +74,19 @@ int user_login(const char *username, const char *password)
 
     if (result == 0)
     {
-        printf("[Auth] User '%s' logged in successfully\n", username);
+        LOG_INFO("Auth", "User '%s' logged in successfully", username);
     }
     else if (result == -2)
     {
-        printf("[Auth] Login failed: User '%s' not found\n", username);
+        LOG_INFO("Auth", "Login failed: User '%s' not found", username);
     }
     else if (result == -3)
     {
-        printf("[Auth] Login failed: Invalid password for user '%s'\n", username);
+        LOG_INFO("Auth", "Login failed: Invalid password for user '%s'", username);
     }
     else
     {
-        fprintf(stderr, "[Auth] Login failed for user '%s': database error\n", username);
+        LOG_ERROR("Auth", "Login failed for user '%s': database error", username);
     }
 
     return result;
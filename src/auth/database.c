@@ -1,12 +1,123 @@
 #include "database.h"
 #include "user_metadata.h"
+#include "../utils/logger.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
-/* Global database connection (thread-safe with FULLMUTEX mode) */
-static sqlite3 *db = NULL;
-static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Connection pool
+ *
+ * Every thread that touches the metadata gets its own SQLite connection
+ * (opened lazily, SQLITE_OPEN_NOMUTEX) with its own set of prepared
+ * statements, compiled once on first use and reset after each call. In WAL
+ * mode readers on separate connections never block each other or the
+ * writer, so exists/verify/quota/file_size lookups run in parallel across
+ * worker threads.
+ *
+ * Writers still serialize: SQLite allows one write transaction at a time.
+ * They take db_write_mutex in-process instead of spinning in SQLite's busy
+ * handler, and the busy timeout only covers other processes on the file.
+ */
+
+#define DB_BUSY_TIMEOUT_MS 5000
+
+/* Cached statement ids, indexes into STMT_SQL */
+typedef enum
+{
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_CREATE_USER,
+    STMT_USER_EXISTS,
+    STMT_VERIFY_PASSWORD,
+    STMT_GET_USER_QUOTA,
+    STMT_GET_USER_WEIGHT,
+    STMT_GET_USER_ID,
+    STMT_UPSERT_FILE,
+    STMT_DELETE_FILE,
+    STMT_GET_OLD_FILE,
+    STMT_ADJUST_QUOTA,
+    STMT_GET_FILE_SIZE,
+    STMT_LIST_FILES,
+    STMT_UPDATE_USER_QUOTA,
+    STMT_RELEASE_CHUNKS,
+    STMT_DELETE_FILE_CHUNKS,
+    STMT_REF_CHUNK,
+    STMT_ADD_FILE_CHUNK,
+    STMT_CHUNK_EXISTS,
+    STMT_LIST_ORPHAN_CHUNKS,
+    STMT_DELETE_ORPHAN_CHUNK,
+    STMT_COUNT
+} stmt_id_t;
+
+static const char *const STMT_SQL[STMT_COUNT] = {
+    [STMT_BEGIN] = "BEGIN IMMEDIATE",
+    [STMT_COMMIT] = "COMMIT",
+    [STMT_ROLLBACK] = "ROLLBACK",
+    [STMT_CREATE_USER] = "INSERT INTO users (username, password_hash) VALUES (?, ?)",
+    [STMT_USER_EXISTS] = "SELECT 1 FROM users WHERE username = ? LIMIT 1",
+    [STMT_VERIFY_PASSWORD] = "SELECT password_hash FROM users WHERE username = ?",
+    [STMT_GET_USER_QUOTA] = "SELECT quota_used, quota_limit FROM users WHERE username = ?",
+    [STMT_GET_USER_WEIGHT] = "SELECT weight FROM users WHERE username = ?",
+    [STMT_GET_USER_ID] = "SELECT id FROM users WHERE username = ?",
+    [STMT_UPSERT_FILE] =
+        "INSERT INTO files (user_id, filename, size, physical_size, codec, timestamp) "
+        "VALUES (?, ?, ?, ?, ?, strftime('%s', 'now')) "
+        "ON CONFLICT(user_id, filename) DO UPDATE SET "
+        "size = excluded.size, physical_size = excluded.physical_size, "
+        "codec = excluded.codec, timestamp = excluded.timestamp "
+        "RETURNING id",
+    [STMT_DELETE_FILE] = "DELETE FROM files WHERE user_id = ? AND filename = ?",
+    [STMT_GET_OLD_FILE] = "SELECT id, size FROM files WHERE user_id = ? AND filename = ?",
+    [STMT_ADJUST_QUOTA] =
+        "UPDATE users SET quota_used = quota_used + ? WHERE id = ? "
+        "RETURNING quota_used, quota_limit",
+    [STMT_GET_FILE_SIZE] =
+        "SELECT f.size FROM files f "
+        "JOIN users u ON f.user_id = u.id "
+        "WHERE u.username = ? AND f.filename = ?",
+    [STMT_LIST_FILES] =
+        "SELECT filename, size, timestamp FROM files "
+        "WHERE user_id = (SELECT id FROM users WHERE username = ?) AND filename > ? "
+        "ORDER BY filename LIMIT ?",
+    [STMT_UPDATE_USER_QUOTA] =
+        "UPDATE users SET quota_used = "
+        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = users.id) "
+        "WHERE username = ?",
+    [STMT_RELEASE_CHUNKS] =
+        "UPDATE chunks SET refcount = refcount - fc.n "
+        "FROM (SELECT hash, COUNT(*) AS n FROM file_chunks WHERE file_id = ? GROUP BY hash) AS fc "
+        "WHERE chunks.hash = fc.hash",
+    [STMT_DELETE_FILE_CHUNKS] = "DELETE FROM file_chunks WHERE file_id = ?",
+    [STMT_REF_CHUNK] =
+        "INSERT INTO chunks (hash, size, refcount) VALUES (?, ?, 1) "
+        "ON CONFLICT(hash) DO UPDATE SET refcount = refcount + 1",
+    [STMT_ADD_FILE_CHUNK] = "INSERT INTO file_chunks (file_id, seq, hash) VALUES (?, ?, ?)",
+    [STMT_CHUNK_EXISTS] = "SELECT 1 FROM chunks WHERE hash = ?",
+    [STMT_LIST_ORPHAN_CHUNKS] = "SELECT hash, size FROM chunks WHERE refcount <= 0 LIMIT ?",
+    [STMT_DELETE_ORPHAN_CHUNK] = "DELETE FROM chunks WHERE hash = ? AND refcount <= 0",
+};
+
+/* One pooled connection, owned by a single thread */
+typedef struct DbConn
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmts[STMT_COUNT];  /* Prepared on first use */
+    struct DbConn *next;
+} DbConn;
+
+static char db_file[512];
+static DbConn *pool = NULL;                       /* Every open connection */
+static size_t pool_size = 0;
+static unsigned db_generation = 0;                /* 0 = closed; bumped per db_init */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t db_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t db_write_seq = 0;                 /* Bumped after each file commit */
+
+static __thread DbConn *thread_conn = NULL;
+static __thread unsigned thread_conn_generation = 0;
 
 /* Database schema */
 static const char *SCHEMA_SQL =
@@ -16,6 +127,7 @@ static const char *SCHEMA_SQL =
     "  password_hash TEXT NOT NULL,"
     "  quota_used INTEGER DEFAULT 0,"
     "  quota_limit INTEGER DEFAULT 104857600,"
+    "  weight INTEGER NOT NULL DEFAULT 1,"  /* Share of the workers (fair scheduling) */
     "  created_at INTEGER DEFAULT (strftime('%s', 'now'))"
     ");"
     ""
@@ -25,109 +137,308 @@ static const char *SCHEMA_SQL =
     "  filename TEXT NOT NULL,"
     "  size INTEGER NOT NULL,"
     "  timestamp INTEGER DEFAULT (strftime('%s', 'now')),"
+    "  physical_size INTEGER NOT NULL DEFAULT 0,"  /* Bytes its chunks take on disk */
+    "  codec TEXT NOT NULL DEFAULT 'none',"        /* At-rest compression */
     "  FOREIGN KEY (user_id) REFERENCES users(id) ON DELETE CASCADE,"
     "  UNIQUE(user_id, filename)"
     ");"
     ""
+    "CREATE TABLE IF NOT EXISTS chunks ("
+    "  hash BLOB PRIMARY KEY,"            /* SHA-256 of the content */
+    "  size INTEGER NOT NULL,"
+    "  refcount INTEGER NOT NULL DEFAULT 0"  /* file_chunks rows naming it */
+    ") WITHOUT ROWID;"
+    ""
+    "CREATE TABLE IF NOT EXISTS file_chunks ("
+    "  file_id INTEGER NOT NULL,"
+    "  seq INTEGER NOT NULL,"
+    "  hash BLOB NOT NULL,"
+    "  PRIMARY KEY (file_id, seq),"
+    "  FOREIGN KEY (file_id) REFERENCES files(id) ON DELETE CASCADE"
+    ") WITHOUT ROWID;"
+    ""
     "CREATE INDEX IF NOT EXISTS idx_users_username ON users(username);"
     "CREATE INDEX IF NOT EXISTS idx_files_user_id ON files(user_id);"
-    "CREATE INDEX IF NOT EXISTS idx_files_composite ON files(user_id, filename);";
+    "CREATE INDEX IF NOT EXISTS idx_files_composite ON files(user_id, filename);"
+    "CREATE INDEX IF NOT EXISTS idx_chunks_orphans ON chunks(refcount) WHERE refcount <= 0;";
 
-int db_init(const char *db_path)
+/* Columns added after the first release: CREATE TABLE IF NOT EXISTS leaves
+ * older databases without them */
+static const struct
 {
-    if (!db_path)
+    const char *table;
+    const char *column;
+    const char *sql;
+} SCHEMA_MIGRATIONS[] = {
+    {"files", "physical_size", "ALTER TABLE files ADD COLUMN physical_size INTEGER NOT NULL DEFAULT 0"},
+    {"files", "codec", "ALTER TABLE files ADD COLUMN codec TEXT NOT NULL DEFAULT 'none'"},
+    {"users", "weight", "ALTER TABLE users ADD COLUMN weight INTEGER NOT NULL DEFAULT 1"},
+};
+
+/* -------------------- Pool Management -------------------- */
+
+static void db_conn_free(DbConn *conn)
+{
+    for (int i = 0; i < STMT_COUNT; i++)
     {
-        fprintf(stderr, "[Database] NULL database path\n");
-        return -1;
+        if (conn->stmts[i])
+            sqlite3_finalize(conn->stmts[i]);
     }
+    sqlite3_close(conn->db);
+    free(conn);
+}
 
-    pthread_mutex_lock(&db_mutex);
+static DbConn *db_conn_open(void)
+{
+    DbConn *conn = calloc(1, sizeof(DbConn));
+    if (!conn)
+    {
+        LOG_ERROR("Database", "Cannot allocate connection");
+        return NULL;
+    }
 
-    /* Open database with full mutex (thread-safe) */
-    int rc = sqlite3_open_v2(db_path, &db,
-                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX,
+    /* Single-threaded use per connection: no SQLite-internal mutexes */
+    int rc = sqlite3_open_v2(db_file, &conn->db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
                              NULL);
-
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] Cannot open database: %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "Cannot open database: %s", sqlite3_errmsg(conn->db));
+        sqlite3_close(conn->db);
+        free(conn);
+        return NULL;
+    }
+    sqlite3_busy_timeout(conn->db, DB_BUSY_TIMEOUT_MS);
+
+    return conn;
+}
+
+/* Link a connection into the pool and make it this thread's; returns the pool size */
+static size_t db_conn_adopt(DbConn *conn, unsigned generation)
+{
+    pthread_mutex_lock(&pool_mutex);
+    conn->next = pool;
+    pool = conn;
+    size_t size = ++pool_size;
+    pthread_mutex_unlock(&pool_mutex);
+
+    thread_conn = conn;
+    thread_conn_generation = generation;
+    return size;
+}
+
+/* Get (opening on first use) the calling thread's connection */
+static DbConn *db_acquire(void)
+{
+    unsigned generation = __atomic_load_n(&db_generation, __ATOMIC_ACQUIRE);
+    if (generation == 0)
+        return NULL;
+    if (thread_conn && thread_conn_generation == generation)
+        return thread_conn;
+
+    DbConn *conn = db_conn_open();
+    if (!conn)
+        return NULL;
+    size_t size = db_conn_adopt(conn, generation);
+    LOG_INFO("Database", "Opened connection for thread %lu (pool size %zu)",
+             (unsigned long)pthread_self(), size);
+    return conn;
+}
+
+/* Cached statement for this connection, compiled on first use */
+static sqlite3_stmt *db_stmt(DbConn *conn, stmt_id_t id)
+{
+    if (!conn->stmts[id])
+    {
+        int rc = sqlite3_prepare_v3(conn->db, STMT_SQL[id], -1, SQLITE_PREPARE_PERSISTENT,
+                                    &conn->stmts[id], NULL);
+        if (rc != SQLITE_OK)
+        {
+            LOG_ERROR("Database", "Prepare failed (%s): %s", STMT_SQL[id],
+                      sqlite3_errmsg(conn->db));
+            conn->stmts[id] = NULL;
+            return NULL;
+        }
+    }
+    return conn->stmts[id];
+}
+
+/* Return a statement to the cache: reset it and drop bound values */
+static void db_stmt_done(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+/* Run a parameterless cached statement (BEGIN/COMMIT/ROLLBACK) */
+static int db_exec_cached(DbConn *conn, stmt_id_t id)
+{
+    sqlite3_stmt *stmt = db_stmt(conn, id);
+    if (!stmt)
+        return SQLITE_ERROR;
+    int rc = sqlite3_step(stmt);
+    db_stmt_done(stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/* Abort the current write transaction and leave the writer section */
+static void db_rollback(DbConn *conn)
+{
+    db_exec_cached(conn, STMT_ROLLBACK);
+    pthread_mutex_unlock(&db_write_mutex);
+}
+
+/* -------------------- Lifecycle -------------------- */
+
+/* Add any SCHEMA_MIGRATIONS column the database is missing */
+static int db_migrate(sqlite3 *db)
+{
+    for (size_t i = 0; i < sizeof(SCHEMA_MIGRATIONS) / sizeof(SCHEMA_MIGRATIONS[0]); i++)
+    {
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info(?) WHERE name = ?", -1,
+                               &stmt, NULL) != SQLITE_OK)
+        {
+            LOG_ERROR("Database", "Schema check failed: %s", sqlite3_errmsg(db));
+            return -1;
+        }
+        sqlite3_bind_text(stmt, 1, SCHEMA_MIGRATIONS[i].table, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, SCHEMA_MIGRATIONS[i].column, -1, SQLITE_STATIC);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (rc == SQLITE_ROW)
+            continue;
+
+        char *err_msg = NULL;
+        if (rc != SQLITE_DONE || sqlite3_exec(db, SCHEMA_MIGRATIONS[i].sql, NULL, NULL, &err_msg) != SQLITE_OK)
+        {
+            LOG_ERROR("Database", "Adding %s.%s failed: %s", SCHEMA_MIGRATIONS[i].table,
+                      SCHEMA_MIGRATIONS[i].column, err_msg ? err_msg : sqlite3_errmsg(db));
+            sqlite3_free(err_msg);
+            return -1;
+        }
+        LOG_INFO("Database", "Added column %s.%s", SCHEMA_MIGRATIONS[i].table,
+                 SCHEMA_MIGRATIONS[i].column);
+    }
+    return 0;
+}
+
+int db_init(const char *db_path)
+{
+    if (!db_path)
+    {
+        LOG_ERROR("Database", "NULL database path");
         return -1;
     }
 
-    /* Enable WAL mode for better concurrency */
+    snprintf(db_file, sizeof(db_file), "%s", db_path);
+
+    /* The initializing thread's connection sets up WAL and the schema */
+    DbConn *conn = db_conn_open();
+    if (!conn)
+        return -1;
+
+    /* Enable WAL mode so readers on other connections run in parallel */
     char *err_msg = NULL;
-    rc = sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, &err_msg);
+    int rc = sqlite3_exec(conn->db, "PRAGMA journal_mode=WAL;", NULL, NULL, &err_msg);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] WAL mode failed: %s\n", err_msg);
+        LOG_ERROR("Database", "WAL mode failed: %s", err_msg);
         sqlite3_free(err_msg);
         /* Continue anyway - not critical */
     }
 
     /* Execute schema */
-    rc = sqlite3_exec(db, SCHEMA_SQL, NULL, NULL, &err_msg);
+    rc = sqlite3_exec(conn->db, SCHEMA_SQL, NULL, NULL, &err_msg);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] Schema creation failed: %s\n", err_msg);
+        LOG_ERROR("Database", "Schema creation failed: %s", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(db);
-        db = NULL;
-        pthread_mutex_unlock(&db_mutex);
+        db_conn_free(conn);
+        return -1;
+    }
+
+    if (db_migrate(conn->db) != 0)
+    {
+        db_conn_free(conn);
         return -1;
     }
 
-    pthread_mutex_unlock(&db_mutex);
-    printf("[Database] Initialized successfully at %s\n", db_path);
+    pthread_mutex_lock(&pool_mutex);
+    unsigned generation = ++db_generation;
+    if (generation == 0)
+        generation = ++db_generation;
+    pthread_mutex_unlock(&pool_mutex);
+
+    db_conn_adopt(conn, generation);
+
+    /* Uploads and deletes maintain quota_used by deltas; repair any drift
+     * (crash, manual edits) while nothing else is running */
+    int corrected = db_reconcile_quotas();
+    if (corrected > 0)
+        LOG_INFO("Database", "Reconciled quota_used for %d user(s)", corrected);
+
+    LOG_INFO("Database", "Initialized successfully at %s", db_path);
     return 0;
 }
 
 void db_close(void)
 {
-    pthread_mutex_lock(&db_mutex);
-    if (db)
+    /* Callers guarantee no other thread is still using the database */
+    pthread_mutex_lock(&pool_mutex);
+    size_t closed = pool_size;
+    __atomic_store_n(&db_generation, 0, __ATOMIC_RELEASE);
+    while (pool)
     {
-        sqlite3_close(db);
-        db = NULL;
-        printf("[Database] Closed successfully\n");
+        DbConn *next = pool->next;
+        db_conn_free(pool);
+        pool = next;
     }
-    pthread_mutex_unlock(&db_mutex);
+    pool_size = 0;
+    pthread_mutex_unlock(&pool_mutex);
+
+    thread_conn = NULL;
+    if (closed > 0)
+        LOG_INFO("Database", "Closed successfully (%zu connections)", closed);
 }
 
 sqlite3* db_get_connection(void)
 {
-    return db;
+    DbConn *conn = db_acquire();
+    return conn ? conn->db : NULL;
 }
 
+/* -------------------- User Operations -------------------- */
+
 int db_create_user(const char *username, const char *password_hash)
 {
-    if (!db || !username || !password_hash)
+    if (!username || !password_hash)
         return -1;
 
-    const char *sql = "INSERT INTO users (username, password_hash) VALUES (?, ?)";
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    pthread_mutex_lock(&db_mutex);
+    pthread_mutex_lock(&db_write_mutex);
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_CREATE_USER);
+    if (!stmt)
     {
-        fprintf(stderr, "[Database] Prepare failed (create_user): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+        pthread_mutex_unlock(&db_write_mutex);
         return -1;
     }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, password_hash, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = sqlite3_step(stmt);
+    db_stmt_done(stmt);
 
-    pthread_mutex_unlock(&db_mutex);
+    pthread_mutex_unlock(&db_write_mutex);
 
     if (rc == SQLITE_DONE)
     {
-        printf("[Database] User '%s' created\n", username);
+        LOG_DEBUG("Database", "User '%s' created", username);
         return 0;
     }
     else if (rc == SQLITE_CONSTRAINT)
@@ -137,289 +448,443 @@ int db_create_user(const char *username, const char *password_hash)
     }
     else
     {
-        fprintf(stderr, "[Database] Insert failed (create_user): %s\n", sqlite3_errmsg(db));
+        LOG_ERROR("Database", "Insert failed (create_user): %s", sqlite3_errmsg(conn->db));
         return -1;
     }
 }
 
 int db_user_exists(const char *username, bool *exists)
 {
-    if (!db || !username || !exists)
+    if (!username || !exists)
         return -1;
 
-    const char *sql = "SELECT 1 FROM users WHERE username = ? LIMIT 1";
-
-    pthread_mutex_lock(&db_mutex);
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
-    {
-        fprintf(stderr, "[Database] Prepare failed (user_exists): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_USER_EXISTS);
+    if (!stmt)
         return -1;
-    }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     *exists = (rc == SQLITE_ROW);
 
-    sqlite3_finalize(stmt);
-    pthread_mutex_unlock(&db_mutex);
-
+    db_stmt_done(stmt);
     return 0;
 }
 
 int db_verify_password(const char *username, const char *password_hash, bool *valid)
 {
-    if (!db || !username || !password_hash || !valid)
+    if (!username || !password_hash || !valid)
         return -1;
 
-    const char *sql = "SELECT password_hash FROM users WHERE username = ?";
-
-    pthread_mutex_lock(&db_mutex);
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
-    {
-        fprintf(stderr, "[Database] Prepare failed (verify_password): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_VERIFY_PASSWORD);
+    if (!stmt)
         return -1;
-    }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW)
     {
         const char *stored_hash = (const char*)sqlite3_column_text(stmt, 0);
         *valid = (strcmp(stored_hash, password_hash) == 0);
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
+        db_stmt_done(stmt);
         return 0;
     }
     else
     {
         /* User not found */
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
+        db_stmt_done(stmt);
         return -2;
     }
 }
 
 int db_get_user_quota(const char *username, size_t *quota_used, size_t *quota_limit)
 {
-    if (!db || !username || !quota_used || !quota_limit)
+    if (!username || !quota_used || !quota_limit)
         return -1;
 
-    const char *sql = "SELECT quota_used, quota_limit FROM users WHERE username = ?";
-
-    pthread_mutex_lock(&db_mutex);
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
-    {
-        fprintf(stderr, "[Database] Prepare failed (get_user_quota): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_GET_USER_QUOTA);
+    if (!stmt)
         return -1;
-    }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW)
     {
         *quota_used = sqlite3_column_int64(stmt, 0);
         *quota_limit = sqlite3_column_int64(stmt, 1);
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
+        db_stmt_done(stmt);
         return 0;
     }
     else
     {
         /* User not found */
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
+        db_stmt_done(stmt);
         return -2;
     }
 }
 
-int db_add_or_update_file(const char *username, const char *filename, size_t size)
+int db_get_user_weight(const char *username, int *weight)
 {
-    if (!db || !username || !filename)
+    if (!username || !weight)
         return -1;
 
-    pthread_mutex_lock(&db_mutex);
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    /* Begin transaction for atomicity */
-    char *err_msg = NULL;
-    int rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK)
-    {
-        fprintf(stderr, "[Database] BEGIN failed: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        pthread_mutex_unlock(&db_mutex);
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_GET_USER_WEIGHT);
+    if (!stmt)
         return -1;
-    }
 
-    /* Get user_id */
-    const char *sql_get_id = "SELECT id FROM users WHERE username = ?";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql_get_id, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
     {
-        fprintf(stderr, "[Database] Prepare failed (get user_id): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
-        return -1;
+        *weight = sqlite3_column_int(stmt, 0);
+        db_stmt_done(stmt);
+        return 0;
     }
 
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
+    /* User not found */
+    db_stmt_done(stmt);
+    return -2;
+}
+
+/* -------------------- File Operations -------------------- */
 
+/*
+ * Look up a user's id inside a write transaction.
+ * Returns 0 on success, -2 if the user does not exist, -1 on error.
+ */
+static int db_lookup_user_id(DbConn *conn, const char *username, int *user_id)
+{
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_GET_USER_ID);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW)
     {
-        fprintf(stderr, "[Database] User not found: %s\n", username);
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        db_stmt_done(stmt);
+        LOG_ERROR("Database", "User not found: %s", username);
         return -2;
     }
 
-    int user_id = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    *user_id = sqlite3_column_int(stmt, 0);
+    db_stmt_done(stmt);
+    return 0;
+}
 
-    /* Insert or replace file */
-    const char *sql_upsert =
-        "INSERT INTO files (user_id, filename, size, timestamp) "
-        "VALUES (?, ?, ?, strftime('%s', 'now')) "
-        "ON CONFLICT(user_id, filename) DO UPDATE SET "
-        "size = excluded.size, timestamp = excluded.timestamp";
+/*
+ * Id and current size of a file inside a write transaction.
+ * Returns 0 with *file_id and *size set, -3 if the file has no row, -1 on error.
+ */
+static int db_lookup_file(DbConn *conn, int user_id, const char *filename, int64_t *file_id,
+                          int64_t *size)
+{
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_GET_OLD_FILE);
+    if (!stmt)
+        return -1;
 
-    rc = sqlite3_prepare_v2(db, sql_upsert, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    int result = -1;
+    if (rc == SQLITE_ROW)
+    {
+        *file_id = sqlite3_column_int64(stmt, 0);
+        *size = sqlite3_column_int64(stmt, 1);
+        result = 0;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        result = -3;
+    }
+    else
+    {
+        LOG_ERROR("Database", "File lookup failed: %s", sqlite3_errmsg(conn->db));
+    }
+    db_stmt_done(stmt);
+    return result;
+}
+
+/*
+ * Apply a size delta to quota_used inside a write transaction, so a
+ * write costs O(1) regardless of how many files the user owns. The new
+ * totals are returned in *quota when it is non-NULL.
+ */
+static int db_adjust_quota(DbConn *conn, int user_id, int64_t delta, DbQuota *quota)
+{
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_ADJUST_QUOTA);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_int64(stmt, 1, delta);
+    sqlite3_bind_int(stmt, 2, user_id);
+
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW && quota)
     {
-        fprintf(stderr, "[Database] Prepare failed (upsert file): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        quota->quota_used = sqlite3_column_int64(stmt, 0);
+        quota->quota_limit = sqlite3_column_int64(stmt, 1);
+    }
+    db_stmt_done(stmt);
+
+    if (rc != SQLITE_ROW)
+    {
+        LOG_ERROR("Database", "Quota update failed: %s", sqlite3_errmsg(conn->db));
         return -1;
     }
+    return 0;
+}
 
-    sqlite3_bind_int(stmt, 1, user_id);
-    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 3, size);
+/* Run a cached statement bound to a single file id */
+static int db_exec_file_stmt(DbConn *conn, stmt_id_t id, int64_t file_id)
+{
+    sqlite3_stmt *stmt = db_stmt(conn, id);
+    if (!stmt)
+        return -1;
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_bind_int64(stmt, 1, file_id);
+    int rc = sqlite3_step(stmt);
+    db_stmt_done(stmt);
 
     if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "[Database] File upsert failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "%s failed: %s", STMT_SQL[id], sqlite3_errmsg(conn->db));
         return -1;
     }
+    return 0;
+}
 
-    /* Update quota_used */
-    const char *sql_quota =
-        "UPDATE users SET quota_used = "
-        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = ?) "
-        "WHERE id = ?";
+/* Drop a file's references to its chunks and forget its chunk list */
+static int db_release_file_chunks(DbConn *conn, int64_t file_id)
+{
+    if (db_exec_file_stmt(conn, STMT_RELEASE_CHUNKS, file_id) != 0)
+        return -1;
+    return db_exec_file_stmt(conn, STMT_DELETE_FILE_CHUNKS, file_id);
+}
+
+/* Record a file's chunk list, taking one reference per entry */
+static int db_ref_file_chunks(DbConn *conn, int64_t file_id, const DbChunk *chunks,
+                              size_t nchunks)
+{
+    sqlite3_stmt *ref = db_stmt(conn, STMT_REF_CHUNK);
+    sqlite3_stmt *add = db_stmt(conn, STMT_ADD_FILE_CHUNK);
+    if (!ref || !add)
+        return -1;
 
-    rc = sqlite3_prepare_v2(db, sql_quota, -1, &stmt, NULL);
+    for (size_t i = 0; i < nchunks; i++)
+    {
+        sqlite3_bind_blob(ref, 1, chunks[i].hash, DB_CHUNK_HASH_LEN, SQLITE_STATIC);
+        sqlite3_bind_int64(ref, 2, chunks[i].size);
+        int rc = sqlite3_step(ref);
+        db_stmt_done(ref);
+        if (rc != SQLITE_DONE)
+        {
+            LOG_ERROR("Database", "Chunk ref failed: %s", sqlite3_errmsg(conn->db));
+            return -1;
+        }
+
+        sqlite3_bind_int64(add, 1, file_id);
+        sqlite3_bind_int64(add, 2, (int64_t)i);
+        sqlite3_bind_blob(add, 3, chunks[i].hash, DB_CHUNK_HASH_LEN, SQLITE_STATIC);
+        rc = sqlite3_step(add);
+        db_stmt_done(add);
+        if (rc != SQLITE_DONE)
+        {
+            LOG_ERROR("Database", "File chunk insert failed: %s", sqlite3_errmsg(conn->db));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Commit a file change and stamp the quota snapshot with its write version */
+static int db_commit_file_change(DbConn *conn, DbQuota *quota)
+{
+    int rc = db_exec_cached(conn, STMT_COMMIT);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] Prepare failed (update quota): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "COMMIT failed: %s", sqlite3_errmsg(conn->db));
+        db_rollback(conn);
+        return -1;
+    }
+
+    /* Still under db_write_mutex: versions follow commit order */
+    uint64_t version = __atomic_add_fetch(&db_write_seq, 1, __ATOMIC_RELEASE);
+    if (quota)
+        quota->version = version;
+
+    pthread_mutex_unlock(&db_write_mutex);
+    return 0;
+}
+
+uint64_t db_write_version(void)
+{
+    return __atomic_load_n(&db_write_seq, __ATOMIC_ACQUIRE);
+}
+
+int db_add_or_update_file(const char *username, const char *filename, size_t size,
+                          uint64_t physical_size, const char *codec,
+                          const DbChunk *chunks, size_t nchunks, DbQuota *quota)
+{
+    if (!username || !filename || !codec)
+        return -1;
+
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    pthread_mutex_lock(&db_write_mutex);
+
+    /* Begin transaction for atomicity */
+    int rc = db_exec_cached(conn, STMT_BEGIN);
+    if (rc != SQLITE_OK)
+    {
+        LOG_ERROR("Database", "BEGIN failed: %s", sqlite3_errmsg(conn->db));
+        pthread_mutex_unlock(&db_write_mutex);
+        return -1;
+    }
+
+    /* Get user_id */
+    int user_id;
+    int result = db_lookup_user_id(conn, username, &user_id);
+    if (result != 0)
+    {
+        db_rollback(conn);
+        return result;
+    }
+
+    /* Size being replaced (0 for a new file) */
+    int64_t file_id = 0;
+    int64_t old_size = 0;
+    result = db_lookup_file(conn, user_id, filename, &file_id, &old_size);
+    if (result == -1)
+    {
+        db_rollback(conn);
+        return -1;
+    }
+
+    /* The old content's chunks lose a reference; orphans are left for
+     * the chunk store's collector */
+    if (result == 0 && db_release_file_chunks(conn, file_id) != 0)
+    {
+        db_rollback(conn);
+        return -1;
+    }
+
+    /* Insert or replace file */
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_UPSERT_FILE);
+    if (!stmt)
+    {
+        db_rollback(conn);
         return -1;
     }
 
     sqlite3_bind_int(stmt, 1, user_id);
-    sqlite3_bind_int(stmt, 2, user_id);
+    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, size);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)physical_size);
+    sqlite3_bind_text(stmt, 5, codec, -1, SQLITE_STATIC);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    if (rc == SQLITE_ROW)
+        file_id = sqlite3_column_int64(stmt, 0);
+    db_stmt_done(stmt);
 
-    if (rc != SQLITE_DONE)
+    if (rc != SQLITE_ROW)
     {
-        fprintf(stderr, "[Database] Quota update failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "File upsert failed: %s", sqlite3_errmsg(conn->db));
+        db_rollback(conn);
         return -1;
     }
 
-    /* Commit transaction */
-    rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK)
+    if (db_ref_file_chunks(conn, file_id, chunks, nchunks) != 0)
     {
-        fprintf(stderr, "[Database] COMMIT failed: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        db_rollback(conn);
         return -1;
     }
 
-    pthread_mutex_unlock(&db_mutex);
-    return 0;
+    /* Update quota_used by the size difference */
+    if (db_adjust_quota(conn, user_id, (int64_t)size - old_size, quota) != 0)
+    {
+        db_rollback(conn);
+        return -1;
+    }
+
+    /* Commit transaction */
+    return db_commit_file_change(conn, quota);
 }
 
-int db_remove_file(const char *username, const char *filename)
+int db_remove_file(const char *username, const char *filename, DbQuota *quota)
 {
-    if (!db || !username || !filename)
+    if (!username || !filename)
         return -1;
 
-    pthread_mutex_lock(&db_mutex);
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    pthread_mutex_lock(&db_write_mutex);
 
     /* Begin transaction */
-    char *err_msg = NULL;
-    int rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &err_msg);
+    int rc = db_exec_cached(conn, STMT_BEGIN);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] BEGIN failed: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "BEGIN failed: %s", sqlite3_errmsg(conn->db));
+        pthread_mutex_unlock(&db_write_mutex);
         return -1;
     }
 
     /* Get user_id */
-    const char *sql_get_id = "SELECT id FROM users WHERE username = ?";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, sql_get_id, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    int user_id;
+    int result = db_lookup_user_id(conn, username, &user_id);
+    if (result != 0)
     {
-        fprintf(stderr, "[Database] Prepare failed (get user_id): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
-        return -1;
+        db_rollback(conn);
+        return result;
     }
 
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-
-    if (rc != SQLITE_ROW)
+    /* Size being released */
+    int64_t file_id = 0;
+    int64_t old_size = 0;
+    result = db_lookup_file(conn, user_id, filename, &file_id, &old_size);
+    if (result != 0)
     {
-        fprintf(stderr, "[Database] User not found: %s\n", username);
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
-        return -2;
+        /* -3: file not found */
+        db_rollback(conn);
+        return result;
     }
 
-    int user_id = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    if (db_release_file_chunks(conn, file_id) != 0)
+    {
+        db_rollback(conn);
+        return -1;
+    }
 
     /* Delete file */
-    const char *sql_delete = "DELETE FROM files WHERE user_id = ? AND filename = ?";
-    rc = sqlite3_prepare_v2(db, sql_delete, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_DELETE_FILE);
+    if (!stmt)
     {
-        fprintf(stderr, "[Database] Prepare failed (delete file): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        db_rollback(conn);
         return -1;
     }
 
@@ -427,113 +892,219 @@ int db_remove_file(const char *username, const char *filename)
     sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
 
     rc = sqlite3_step(stmt);
-    int changes = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
+    int changes = sqlite3_changes(conn->db);
+    db_stmt_done(stmt);
 
     if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "[Database] File delete failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "File delete failed: %s", sqlite3_errmsg(conn->db));
+        db_rollback(conn);
         return -1;
     }
 
     if (changes == 0)
     {
         /* File not found */
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        db_rollback(conn);
         return -3;
     }
 
     /* Update quota_used */
-    const char *sql_quota =
-        "UPDATE users SET quota_used = "
-        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = ?) "
-        "WHERE id = ?";
-
-    rc = sqlite3_prepare_v2(db, sql_quota, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    if (db_adjust_quota(conn, user_id, -old_size, quota) != 0)
     {
-        fprintf(stderr, "[Database] Prepare failed (update quota): %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        db_rollback(conn);
         return -1;
     }
 
-    sqlite3_bind_int(stmt, 1, user_id);
-    sqlite3_bind_int(stmt, 2, user_id);
+    /* Commit transaction */
+    return db_commit_file_change(conn, quota);
+}
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+int db_get_file_size(const char *username, const char *filename, size_t *size)
+{
+    if (!username || !filename || !size)
+        return -1;
 
-    if (rc != SQLITE_DONE)
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_GET_FILE_SIZE);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
     {
-        fprintf(stderr, "[Database] Quota update failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        *size = sqlite3_column_int64(stmt, 0);
+        db_stmt_done(stmt);
+        return 0;
+    }
+    else
+    {
+        /* File not found */
+        db_stmt_done(stmt);
+        return -2;
+    }
+}
+
+int db_list_files(const char *username, const char *after, DbFileInfo *out, size_t max,
+                  size_t *count)
+{
+    if (!username || !after || !out || !count)
+        return -1;
+    *count = 0;
+
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_LIST_FILES);
+    if (!stmt)
         return -1;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, after, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, (int64_t)max);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && *count < max)
+    {
+        const char *name = (const char *)sqlite3_column_text(stmt, 0);
+        if (!name)
+            continue;
+        DbFileInfo *info = &out[*count];
+        snprintf(info->filename, sizeof(info->filename), "%s", name);
+        info->size = (uint64_t)sqlite3_column_int64(stmt, 1);
+        info->timestamp = sqlite3_column_int64(stmt, 2);
+        (*count)++;
     }
+    db_stmt_done(stmt);
 
-    /* Commit transaction */
-    rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK)
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
     {
-        fprintf(stderr, "[Database] COMMIT failed: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "File listing failed: %s", sqlite3_errmsg(conn->db));
         return -1;
     }
+    return 0;
+}
+
+/* -------------------- Chunk Operations -------------------- */
+
+int db_chunk_exists(const unsigned char *hash, bool *exists)
+{
+    if (!hash || !exists)
+        return -1;
+
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_CHUNK_EXISTS);
+    if (!stmt)
+        return -1;
 
-    pthread_mutex_unlock(&db_mutex);
+    sqlite3_bind_blob(stmt, 1, hash, DB_CHUNK_HASH_LEN, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    *exists = (rc == SQLITE_ROW);
+    db_stmt_done(stmt);
+
+    return (rc == SQLITE_ROW || rc == SQLITE_DONE) ? 0 : -1;
+}
+
+int db_list_orphan_chunks(DbChunk *out, size_t max, size_t *count)
+{
+    if (!out || !count)
+        return -1;
+    *count = 0;
+
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_LIST_ORPHAN_CHUNKS);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_int64(stmt, 1, (int64_t)max);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && *count < max)
+    {
+        const void *hash = sqlite3_column_blob(stmt, 0);
+        if (!hash || sqlite3_column_bytes(stmt, 0) != DB_CHUNK_HASH_LEN)
+            continue;
+        memcpy(out[*count].hash, hash, DB_CHUNK_HASH_LEN);
+        out[*count].size = (uint32_t)sqlite3_column_int64(stmt, 1);
+        (*count)++;
+    }
+    db_stmt_done(stmt);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+    {
+        LOG_ERROR("Database", "Orphan chunk scan failed: %s", sqlite3_errmsg(conn->db));
+        return -1;
+    }
     return 0;
 }
 
-int db_get_file_size(const char *username, const char *filename, size_t *size)
+int db_delete_orphan_chunks(const DbChunk *chunks, size_t count)
 {
-    if (!db || !username || !filename || !size)
+    if (!chunks)
         return -1;
 
-    const char *sql =
-        "SELECT f.size FROM files f "
-        "JOIN users u ON f.user_id = u.id "
-        "WHERE u.username = ? AND f.filename = ?";
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    pthread_mutex_lock(&db_mutex);
+    pthread_mutex_lock(&db_write_mutex);
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    int rc = db_exec_cached(conn, STMT_BEGIN);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "[Database] Prepare failed (get_file_size): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+        LOG_ERROR("Database", "BEGIN failed: %s", sqlite3_errmsg(conn->db));
+        pthread_mutex_unlock(&db_write_mutex);
         return -1;
     }
 
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_DELETE_ORPHAN_CHUNK);
+    if (!stmt)
+    {
+        db_rollback(conn);
+        return -1;
+    }
 
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW)
+    for (size_t i = 0; i < count; i++)
     {
-        *size = sqlite3_column_int64(stmt, 0);
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
-        return 0;
+        sqlite3_bind_blob(stmt, 1, chunks[i].hash, DB_CHUNK_HASH_LEN, SQLITE_STATIC);
+        rc = sqlite3_step(stmt);
+        db_stmt_done(stmt);
+        if (rc != SQLITE_DONE)
+        {
+            LOG_ERROR("Database", "Chunk delete failed: %s", sqlite3_errmsg(conn->db));
+            db_rollback(conn);
+            return -1;
+        }
     }
-    else
+
+    rc = db_exec_cached(conn, STMT_COMMIT);
+    if (rc != SQLITE_OK)
     {
-        /* File not found */
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&db_mutex);
-        return -2;
+        LOG_ERROR("Database", "COMMIT failed: %s", sqlite3_errmsg(conn->db));
+        db_rollback(conn);
+        return -1;
     }
+
+    pthread_mutex_unlock(&db_write_mutex);
+    return 0;
 }
 
+/* -------------------- Quota Operations -------------------- */
+
 int db_check_quota(const char *username, size_t additional_bytes, bool *has_quota)
 {
-    if (!db || !username || !has_quota)
+    if (!username || !has_quota)
         return -1;
 
     size_t quota_used, quota_limit;
@@ -542,37 +1113,64 @@ int db_check_quota(const char *username, size_t additional_bytes, bool *has_quot
     if (result != 0)
         return result;
 
-    *has_quota = (quota_used + additional_bytes) <= quota_limit;
+    *has_quota = quota_used <= quota_limit && additional_bytes <= quota_limit - quota_used;
     return 0;
 }
 
 int db_update_user_quota(const char *username)
 {
-    if (!db || !username)
+    if (!username)
         return -1;
 
-    const char *sql =
-        "UPDATE users SET quota_used = "
-        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = users.id) "
-        "WHERE username = ?";
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
 
-    pthread_mutex_lock(&db_mutex);
+    pthread_mutex_lock(&db_write_mutex);
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(conn, STMT_UPDATE_USER_QUOTA);
+    if (!stmt)
     {
-        fprintf(stderr, "[Database] Prepare failed (update_user_quota): %s\n", sqlite3_errmsg(db));
-        pthread_mutex_unlock(&db_mutex);
+        pthread_mutex_unlock(&db_write_mutex);
         return -1;
     }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = sqlite3_step(stmt);
+    db_stmt_done(stmt);
 
-    pthread_mutex_unlock(&db_mutex);
+    pthread_mutex_unlock(&db_write_mutex);
 
     return (rc == SQLITE_DONE) ? 0 : -1;
 }
+
+int db_reconcile_quotas(void)
+{
+    DbConn *conn = db_acquire();
+    if (!conn)
+        return -1;
+
+    /* Full recompute, only touching rows whose running total drifted */
+    const char *sql =
+        "UPDATE users SET quota_used = "
+        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = users.id) "
+        "WHERE quota_used != "
+        "(SELECT COALESCE(SUM(size), 0) FROM files WHERE user_id = users.id)";
+
+    pthread_mutex_lock(&db_write_mutex);
+
+    char *err_msg = NULL;
+    int rc = sqlite3_exec(conn->db, sql, NULL, NULL, &err_msg);
+    int corrected = sqlite3_changes(conn->db);
+
+    pthread_mutex_unlock(&db_write_mutex);
+
+    if (rc != SQLITE_OK)
+    {
+        LOG_ERROR("Database", "Quota reconciliation failed: %s", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    return corrected;
+}
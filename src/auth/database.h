@@ -4,15 +4,41 @@
 #include <sqlite3.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
+/* A user's quota totals as of a committed write */
+typedef struct DbQuota
+{
+    size_t quota_used;
+    size_t quota_limit;
+    uint64_t version;   /* db_write_version() right after the commit */
+} DbQuota;
+
+/* One content-addressed chunk of a stored file (see storage/chunk_store.h) */
+#define DB_CHUNK_HASH_LEN 32   /* SHA-256 */
+
+typedef struct DbChunk
+{
+    unsigned char hash[DB_CHUNK_HASH_LEN];
+    uint32_t size;
+} DbChunk;
+
+/* One row of a user's file listing */
+typedef struct DbFileInfo
+{
+    char filename[256];
+    uint64_t size;
+    int64_t timestamp;  /* Last upload, Unix time */
+} DbFileInfo;
+
 /* Initialize database and create schema */
 int db_init(const char *db_path);
 
-/* Close database connection */
+/* Close every pooled connection (all other threads must be done) */
 void db_close(void);
 
-/* Get thread-safe database connection */
+/* Get the calling thread's pooled connection (opened on first use) */
 sqlite3* db_get_connection(void);
 
 /* User operations */
@@ -20,14 +46,42 @@ int db_create_user(const char *username, const char *password_hash);
 int db_user_exists(const char *username, bool *exists);
 int db_verify_password(const char *username, const char *password_hash, bool *valid);
 int db_get_user_quota(const char *username, size_t *quota_used, size_t *quota_limit);
+/* Scheduling weight: the user's share of the workers (users.weight) */
+int db_get_user_weight(const char *username, int *weight);
 
-/* File operations */
-int db_add_or_update_file(const char *username, const char *filename, size_t size);
-int db_remove_file(const char *username, const char *filename);
+/* File operations (quota, if non-NULL, receives the user's new totals).
+ * A file's chunks (in order; NULL/0 for none) each hold one reference;
+ * replacing or removing the file drops the references of its old chunks.
+ * physical_size and codec record how the content is stored on disk; quota
+ * is charged on the logical size. */
+int db_add_or_update_file(const char *username, const char *filename, size_t size,
+                          uint64_t physical_size, const char *codec,
+                          const DbChunk *chunks, size_t nchunks, DbQuota *quota);
+int db_remove_file(const char *username, const char *filename, DbQuota *quota);
 int db_get_file_size(const char *username, const char *filename, size_t *size);
+/* Up to max of the user's files named after `after` ("" for the first), in
+ * name order: a keyset page served from the (user_id, filename) index */
+int db_list_files(const char *username, const char *after, DbFileInfo *out, size_t max,
+                  size_t *count);
 
 /* Quota operations */
 int db_check_quota(const char *username, size_t additional_bytes, bool *has_quota);
+
+/* Chunk operations */
+int db_chunk_exists(const unsigned char *hash, bool *exists);
+/* Up to max chunks no file references any more */
+int db_list_orphan_chunks(DbChunk *out, size_t max, size_t *count);
+/* Drop the rows of orphaned chunks (skipping any referenced again) */
+int db_delete_orphan_chunks(const DbChunk *chunks, size_t count);
+
+/* Number of file commits so far; orders quota snapshots for caches */
+uint64_t db_write_version(void);
+
+/* Recompute quota_used from the files table (slow: O(files) per user).
+ * Uploads and deletes adjust quota_used incrementally; these are for
+ * reconciliation only. db_reconcile_quotas runs at db_init and returns the
+ * number of users corrected, or -1 on error. */
 int db_update_user_quota(const char *username);
+int db_reconcile_quotas(void);
 
 #endif /* DATABASE_H */
@@ -1,24 +1,184 @@
 #include "user_metadata.h"
 #include "database.h"
+#include "../utils/logger.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+
+/*
+ * User cache
+ *
+ * Workers check user_exists() on every task and the connection side checks
+ * quota before every upload. Both are answered from this table once a user
+ * has been seen, so the hot path does no SQLite calls.
+ *
+ * Users are never deleted, so positive existence entries never go stale.
+ * quota_used changes only through user_add_file/user_remove_file, which
+ * store the totals their transaction committed. Every entry carries the
+ * db_write_version() it is current as of, and older snapshots never
+ * overwrite newer ones. This keeps a slow miss-path read from clobbering a
+ * concurrent commit. Unknown users are not cached because SIGNUP can create
+ * them at any time.
+ */
+
+#define USER_CACHE_BUCKETS 1024
+
+typedef struct UserCacheEntry
+{
+    char username[MAX_USERNAME_LEN];
+    size_t quota_used;
+    size_t quota_limit;
+    uint64_t version;               /* Write version the totals reflect */
+    struct UserCacheEntry *next;
+} UserCacheEntry;
+
+typedef struct
+{
+    pthread_rwlock_t lock;          /* Readers share; store/clear exclusive */
+    UserCacheEntry *head;
+} UserCacheBucket;
+
+static UserCacheBucket user_cache[USER_CACHE_BUCKETS];
+
+/* FNV-1a */
+static UserCacheBucket *user_cache_bucket(const char *username)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return &user_cache[hash % USER_CACHE_BUCKETS];
+}
+
+static void user_cache_init(void)
+{
+    for (int i = 0; i < USER_CACHE_BUCKETS; i++)
+    {
+        pthread_rwlock_init(&user_cache[i].lock, NULL);
+        user_cache[i].head = NULL;
+    }
+}
+
+static void user_cache_destroy(void)
+{
+    for (int i = 0; i < USER_CACHE_BUCKETS; i++)
+    {
+        UserCacheEntry *entry = user_cache[i].head;
+        while (entry)
+        {
+            UserCacheEntry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        user_cache[i].head = NULL;
+        pthread_rwlock_destroy(&user_cache[i].lock);
+    }
+}
+
+/* Returns true on a hit; quota outputs may be NULL */
+static bool user_cache_lookup(const char *username, size_t *quota_used, size_t *quota_limit)
+{
+    UserCacheBucket *bucket = user_cache_bucket(username);
+    bool hit = false;
+
+    pthread_rwlock_rdlock(&bucket->lock);
+    for (UserCacheEntry *entry = bucket->head; entry; entry = entry->next)
+    {
+        if (strcmp(entry->username, username) == 0)
+        {
+            if (quota_used)
+                *quota_used = entry->quota_used;
+            if (quota_limit)
+                *quota_limit = entry->quota_limit;
+            hit = true;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&bucket->lock);
+
+    return hit;
+}
+
+/* Insert or refresh an entry unless it already holds a newer snapshot */
+static void user_cache_store(const char *username, size_t quota_used, size_t quota_limit,
+                             uint64_t version)
+{
+    if (strlen(username) >= MAX_USERNAME_LEN)
+        return;
+
+    UserCacheBucket *bucket = user_cache_bucket(username);
+
+    pthread_rwlock_wrlock(&bucket->lock);
+    UserCacheEntry *entry = bucket->head;
+    while (entry && strcmp(entry->username, username) != 0)
+        entry = entry->next;
+
+    if (!entry)
+    {
+        entry = calloc(1, sizeof(UserCacheEntry));
+        if (!entry)
+        {
+            pthread_rwlock_unlock(&bucket->lock);
+            return;  /* Cache is best effort */
+        }
+        strcpy(entry->username, username);
+        entry->next = bucket->head;
+        bucket->head = entry;
+    }
+    else if (entry->version > version)
+    {
+        pthread_rwlock_unlock(&bucket->lock);
+        return;
+    }
+
+    entry->quota_used = quota_used;
+    entry->quota_limit = quota_limit;
+    entry->version = version;
+    pthread_rwlock_unlock(&bucket->lock);
+}
+
+/*
+ * Miss path: read the user's quota from the database and cache it.
+ * Returns the db_get_user_quota result (0, -2 user not found, -1 error).
+ */
+static int user_cache_load(const char *username, size_t *quota_used, size_t *quota_limit)
+{
+    /* Taken before the read: anything committed later is stamped newer */
+    uint64_t version = db_write_version();
+
+    size_t used, limit;
+    int result = db_get_user_quota(username, &used, &limit);
+    if (result != 0)
+        return result;
+
+    user_cache_store(username, used, limit, version);
+    if (quota_used)
+        *quota_used = used;
+    if (quota_limit)
+        *quota_limit = limit;
+    return 0;
+}
 
 int user_metadata_init(const char *db_path)
 {
     if (!db_path)
     {
-        fprintf(stderr, "[UserMetadata] NULL database path\n");
+        LOG_ERROR("UserMetadata", "NULL database path");
         return -1;
     }
 
     int result = db_init(db_path);
     if (result == 0)
     {
-        printf("[UserMetadata] Initialized with database: %s\n", db_path);
+        user_cache_init();
+        LOG_INFO("UserMetadata", "Initialized with database: %s", db_path);
     }
     else
     {
-        fprintf(stderr, "[UserMetadata] Failed to initialize database\n");
+        LOG_ERROR("UserMetadata", "Failed to initialize database");
     }
 
     return result;
@@ -27,14 +187,15 @@ int user_metadata_init(const char *db_path)
 void user_metadata_cleanup(void)
 {
     db_close();
-    printf("[UserMetadata] Cleanup complete\n");
+    user_cache_destroy();
+    LOG_INFO("UserMetadata", "Cleanup complete");
 }
 
 int user_create(const char *username, const char *password_hash)
 {
     if (!username || !password_hash)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_create\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_create");
         return -1;
     }
 
@@ -42,15 +203,15 @@ int user_create(const char *username, const char *password_hash)
 
     if (result == 0)
     {
-        printf("[UserMetadata] User '%s' created successfully\n", username);
+        LOG_DEBUG("UserMetadata", "User '%s' created successfully", username);
     }
     else if (result == -2)
     {
-        fprintf(stderr, "[UserMetadata] User '%s' already exists\n", username);
+        LOG_ERROR("UserMetadata", "User '%s' already exists", username);
     }
     else
     {
-        fprintf(stderr, "[UserMetadata] Failed to create user '%s'\n", username);
+        LOG_ERROR("UserMetadata", "Failed to create user '%s'", username);
     }
 
     return result;
@@ -61,23 +222,26 @@ bool user_exists(const char *username)
     if (!username)
         return false;
 
-    bool exists = false;
-    int result = db_user_exists(username, &exists);
+    if (user_cache_lookup(username, NULL, NULL))
+        return true;
 
+    int result = user_cache_load(username, NULL, NULL);
+    if (result == -2)
+        return false;
     if (result != 0)
     {
-        fprintf(stderr, "[UserMetadata] Error checking if user '%s' exists\n", username);
+        LOG_ERROR("UserMetadata", "Error checking if user '%s' exists", username);
         return false;
     }
 
-    return exists;
+    return true;
 }
 
 int user_verify_password(const char *username, const char *password_hash)
 {
     if (!username || !password_hash)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_verify_password\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_verify_password");
         return -1;
     }
 
@@ -91,11 +255,17 @@ int user_verify_password(const char *username, const char *password_hash)
     }
     else if (result != 0)
     {
-        fprintf(stderr, "[UserMetadata] Error verifying password for user '%s'\n", username);
+        LOG_ERROR("UserMetadata", "Error verifying password for user '%s'", username);
         return -1;
     }
 
-    return valid ? 0 : -3;  /* 0 = valid, -3 = invalid password */
+    if (!valid)
+        return -3;  /* Invalid password */
+
+    /* Warm the cache so this session's tasks never hit the database for it */
+    if (!user_cache_lookup(username, NULL, NULL))
+        user_cache_load(username, NULL, NULL);
+    return 0;
 }
 
 bool user_check_quota(const char *username, size_t additional_bytes)
@@ -103,41 +273,46 @@ bool user_check_quota(const char *username, size_t additional_bytes)
     if (!username)
         return false;
 
-    bool has_quota = false;
-    int result = db_check_quota(username, additional_bytes, &has_quota);
-
-    if (result != 0)
+    size_t quota_used, quota_limit;
+    if (!user_cache_lookup(username, &quota_used, &quota_limit) &&
+        user_cache_load(username, &quota_used, &quota_limit) != 0)
     {
-        fprintf(stderr, "[UserMetadata] Error checking quota for user '%s'\n", username);
+        LOG_ERROR("UserMetadata", "Error checking quota for user '%s'", username);
         return false;
     }
 
-    return has_quota;
+    /* additional_bytes comes from the client: compare without overflowing */
+    return quota_used <= quota_limit && additional_bytes <= quota_limit - quota_used;
 }
 
-int user_add_file(const char *username, const char *filename, size_t size)
+int user_add_file(const char *username, const char *filename, size_t size,
+                  uint64_t physical_size, const char *codec,
+                  const DbChunk *chunks, size_t nchunks)
 {
     if (!username || !filename)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_add_file\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_add_file");
         return -1;
     }
 
-    int result = db_add_or_update_file(username, filename, size);
+    DbQuota quota;
+    int result = db_add_or_update_file(username, filename, size, physical_size, codec,
+                                       chunks, nchunks, &quota);
 
     if (result == 0)
     {
-        printf("[UserMetadata] File '%s' added/updated for user '%s' (%zu bytes)\n",
-               filename, username, size);
+        user_cache_store(username, quota.quota_used, quota.quota_limit, quota.version);
+        LOG_DEBUG("UserMetadata",
+                  "File '%s' added/updated for user '%s' (%zu bytes, %lu on disk, %s)", filename,
+                  username, size, (unsigned long)physical_size, codec);
     }
     else if (result == -2)
     {
-        fprintf(stderr, "[UserMetadata] User '%s' not found\n", username);
+        LOG_ERROR("UserMetadata", "User '%s' not found", username);
     }
     else
     {
-        fprintf(stderr, "[UserMetadata] Failed to add file '%s' for user '%s'\n",
-                filename, username);
+        LOG_ERROR("UserMetadata", "Failed to add file '%s' for user '%s'", filename, username);
     }
 
     return result;
@@ -147,28 +322,29 @@ int user_remove_file(const char *username, const char *filename)
 {
     if (!username || !filename)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_remove_file\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_remove_file");
         return -1;
     }
 
-    int result = db_remove_file(username, filename);
+    DbQuota quota;
+    int result = db_remove_file(username, filename, &quota);
 
     if (result == 0)
     {
-        printf("[UserMetadata] File '%s' removed for user '%s'\n", filename, username);
+        user_cache_store(username, quota.quota_used, quota.quota_limit, quota.version);
+        LOG_DEBUG("UserMetadata", "File '%s' removed for user '%s'", filename, username);
     }
     else if (result == -2)
     {
-        fprintf(stderr, "[UserMetadata] User '%s' not found\n", username);
+        LOG_ERROR("UserMetadata", "User '%s' not found", username);
     }
     else if (result == -3)
     {
-        fprintf(stderr, "[UserMetadata] File '%s' not found for user '%s'\n", filename, username);
+        LOG_ERROR("UserMetadata", "File '%s' not found for user '%s'", filename, username);
     }
     else
     {
-        fprintf(stderr, "[UserMetadata] Failed to remove file '%s' for user '%s'\n",
-                filename, username);
+        LOG_ERROR("UserMetadata", "Failed to remove file '%s' for user '%s'", filename, username);
     }
 
     return result;
@@ -178,7 +354,7 @@ int user_get_file_size(const char *username, const char *filename, size_t *size)
 {
     if (!username || !filename || !size)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_get_file_size\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_get_file_size");
         return -1;
     }
 
@@ -191,8 +367,25 @@ int user_get_file_size(const char *username, const char *filename, size_t *size)
     }
     else if (result != 0)
     {
-        fprintf(stderr, "[UserMetadata] Error getting file size for '%s/%s'\n",
-                username, filename);
+        LOG_ERROR("UserMetadata", "Error getting file size for '%s/%s'", username, filename);
+    }
+
+    return result;
+}
+
+int user_list_files(const char *username, const char *after, DbFileInfo *out, size_t max,
+                    size_t *count)
+{
+    if (!username || !after || !out || !count)
+    {
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_list_files");
+        return -1;
+    }
+
+    int result = db_list_files(username, after, out, max, count);
+    if (result != 0)
+    {
+        LOG_ERROR("UserMetadata", "Error listing files for '%s'", username);
     }
 
     return result;
@@ -202,20 +395,35 @@ int user_get_quota(const char *username, size_t *quota_used, size_t *quota_limit
 {
     if (!username || !quota_used || !quota_limit)
     {
-        fprintf(stderr, "[UserMetadata] Invalid parameters for user_get_quota\n");
+        LOG_ERROR("UserMetadata", "Invalid parameters for user_get_quota");
         return -1;
     }
 
-    int result = db_get_user_quota(username, quota_used, quota_limit);
+    if (user_cache_lookup(username, quota_used, quota_limit))
+        return 0;
+
+    int result = user_cache_load(username, quota_used, quota_limit);
 
     if (result == -2)
     {
-        fprintf(stderr, "[UserMetadata] User '%s' not found\n", username);
+        LOG_ERROR("UserMetadata", "User '%s' not found", username);
     }
     else if (result != 0)
     {
-        fprintf(stderr, "[UserMetadata] Error getting quota for user '%s'\n", username);
+        LOG_ERROR("UserMetadata", "Error getting quota for user '%s'", username);
     }
 
     return result;
 }
+
+int user_get_weight(const char *username)
+{
+    int weight = 1;
+    if (!username || db_get_user_weight(username, &weight) != 0)
+    {
+        LOG_ERROR("UserMetadata", "Cannot read weight of '%s', using 1",
+                  username ? username : "(null)");
+        return 1;
+    }
+    return weight;
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include "database.h"
 
 #define MAX_USERNAME_LEN 64
 #define MAX_PASSWORD_HASH_LEN 65  // SHA256 hex + null terminator
@@ -26,8 +27,11 @@ int user_verify_password(const char *username, const char *password_hash);
 /* Check if user has enough quota for additional bytes */
 bool user_check_quota(const char *username, size_t additional_bytes);
 
-/* Add or update file in user's metadata */
-int user_add_file(const char *username, const char *filename, size_t size);
+/* Add or update file in user's metadata, recording its chunk list and
+ * how it is stored (physical_size bytes on disk, codec "none"/"zlib") */
+int user_add_file(const char *username, const char *filename, size_t size,
+                  uint64_t physical_size, const char *codec,
+                  const DbChunk *chunks, size_t nchunks);
 
 /* Remove file from user's metadata */
 int user_remove_file(const char *username, const char *filename);
@@ -35,7 +39,14 @@ int user_remove_file(const char *username, const char *filename);
 /* Get file size */
 int user_get_file_size(const char *username, const char *filename, size_t *size);
 
+/* One page of the user's files, in name order, after cursor `after` */
+int user_list_files(const char *username, const char *after, DbFileInfo *out, size_t max,
+                    size_t *count);
+
 /* Get user quota information */
 int user_get_quota(const char *username, size_t *quota_used, size_t *quota_limit);
 
+/* Scheduling weight of the user (1 if it cannot be read) */
+int user_get_weight(const char *username);
+
 #endif /* USER_METADATA_H */
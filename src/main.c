@@ -1,10 +1,18 @@
 #include "server.h"
 #include "threads/client_thread.h"
 #include "threads/worker_thread.h"
+#include "threads/reactor_thread.h"
+#include "threads/admin_thread.h"
+#include "threads/reaper_thread.h"
 #include "queue/client_queue.h"
-#include "queue/task_queue.h"
+#include "queue/task_lanes.h"
 #include "auth/user_metadata.h"
 #include "sync/file_locks.h"
+#include "storage/upload_stream.h"
+#include "storage/chunk_store.h"
+#include "utils/metrics.h"
+#include "utils/obj_pool.h"
+#include "utils/network_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,14 +21,26 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <getopt.h>
 
 /* -------------------- Global Variable Definitions -------------------- */
 volatile sig_atomic_t keep_running = 1;
 int listen_fd = -1;
 
 ClientQueue client_queue;
-TaskQueue task_queue;
+TaskLanes task_lanes;
 SessionManager session_manager;  /* Global session manager (Phase 2.1) */
+ServerConfig server_config = {
+    .mode = SERVER_MODE_THREADS,
+    .io_threads = DEFAULT_IO_THREAD_COUNT,
+    .upload_chunk_size = DEFAULT_UPLOAD_CHUNK_SIZE,
+    .queue_impl = QUEUE_IMPL_LOCKFREE,
+    .storage_backend = STORAGE_BACKEND_URING,
+    .compress_at_rest = true,
+    .log_level = LOG_LEVEL_INFO,
+    .admin_port = DEFAULT_ADMIN_PORT,
+    .idle_timeout = DEFAULT_IDLE_TIMEOUT,
+};
 
 pthread_t client_threads[CLIENT_THREAD_COUNT];
 pthread_t worker_threads[WORKER_THREAD_COUNT];
@@ -49,40 +69,185 @@ void int_handler(int signo)
 
     /* Step 2: Signal queues to stop accepting new items */
     client_queue_signal_shutdown(&client_queue);
-    task_queue_signal_shutdown(&task_queue);
+    task_lanes_signal_shutdown(&task_lanes);
 
     printf("[Signal] Shutdown signal sent to all queues\n");
 }
 
+/* -------------------- Command Line -------------------- */
+static void print_usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [options] [port] [queue_capacity]\n", progname);
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  -m, --mode threads|epoll   Connection engine (default: threads)\n");
+    fprintf(stderr, "  -t, --io-threads N         Reactor I/O threads in epoll mode (default: %d)\n",
+            DEFAULT_IO_THREAD_COUNT);
+    fprintf(stderr, "  -c, --chunk-size BYTES     Upload streaming chunk size (default: %d)\n",
+            DEFAULT_UPLOAD_CHUNK_SIZE);
+    fprintf(stderr, "  -q, --queue lockfree|mutex Client queue implementation (default: lockfree)\n");
+    fprintf(stderr, "  -s, --storage uring|sync   Worker file I/O backend (default: uring)\n");
+    fprintf(stderr, "  -z, --compress on|off      Store compressible uploads compressed (default: on)\n");
+    fprintf(stderr, "  -l, --log-level LEVEL      debug|info|warn|error|off (default: info)\n");
+    fprintf(stderr, "  -a, --admin-port PORT      Metrics endpoint on 127.0.0.1, 0 = off (default: %s)\n",
+            DEFAULT_ADMIN_PORT);
+    fprintf(stderr, "  -i, --idle-timeout SEC     Close sessions idle this long, 0 = never (default: %d)\n",
+            DEFAULT_IDLE_TIMEOUT);
+    fprintf(stderr, "  -h, --help                 Show this help message\n");
+}
+
+static int parse_options(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"io-threads", required_argument, NULL, 't'},
+        {"chunk-size", required_argument, NULL, 'c'},
+        {"queue", required_argument, NULL, 'q'},
+        {"storage", required_argument, NULL, 's'},
+        {"compress", required_argument, NULL, 'z'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"admin-port", required_argument, NULL, 'a'},
+        {"idle-timeout", required_argument, NULL, 'i'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:t:c:q:s:z:l:a:i:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "threads") == 0)
+                server_config.mode = SERVER_MODE_THREADS;
+            else if (strcmp(optarg, "epoll") == 0)
+                server_config.mode = SERVER_MODE_EPOLL;
+            else
+            {
+                fprintf(stderr, "Unknown mode '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            server_config.io_threads = atoi(optarg);
+            if (server_config.io_threads <= 0 || server_config.io_threads > MAX_IO_THREAD_COUNT)
+            {
+                fprintf(stderr, "I/O thread count must be between 1 and %d\n", MAX_IO_THREAD_COUNT);
+                return -1;
+            }
+            break;
+        case 'c':
+        {
+            long chunk = atol(optarg);
+            if (chunk <= 0 || chunk > MAX_UPLOAD_CHUNK_SIZE)
+            {
+                fprintf(stderr, "Chunk size must be between 1 and %d bytes\n", MAX_UPLOAD_CHUNK_SIZE);
+                return -1;
+            }
+            server_config.upload_chunk_size = (size_t)chunk;
+            break;
+        }
+        case 'q':
+            if (strcmp(optarg, "lockfree") == 0)
+                server_config.queue_impl = QUEUE_IMPL_LOCKFREE;
+            else if (strcmp(optarg, "mutex") == 0)
+                server_config.queue_impl = QUEUE_IMPL_MUTEX;
+            else
+            {
+                fprintf(stderr, "Unknown queue implementation '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "uring") == 0)
+                server_config.storage_backend = STORAGE_BACKEND_URING;
+            else if (strcmp(optarg, "sync") == 0)
+                server_config.storage_backend = STORAGE_BACKEND_SYNC;
+            else
+            {
+                fprintf(stderr, "Unknown storage backend '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'z':
+            if (strcmp(optarg, "on") == 0)
+                server_config.compress_at_rest = true;
+            else if (strcmp(optarg, "off") == 0)
+                server_config.compress_at_rest = false;
+            else
+            {
+                fprintf(stderr, "Unknown compression setting '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'l':
+            if (!log_level_parse(optarg, &server_config.log_level))
+            {
+                fprintf(stderr, "Unknown log level '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'a':
+            server_config.admin_port = strcmp(optarg, "0") == 0 ? NULL : optarg;
+            break;
+        case 'i':
+            server_config.idle_timeout = atoi(optarg);
+            if (server_config.idle_timeout < 0)
+            {
+                fprintf(stderr, "Idle timeout must be 0 (never) or a number of seconds\n");
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /* -------------------- Main Function -------------------- */
 int main(int argc, char *argv[])
 {
     const char *port = DEFAULT_PORT;
     int queue_capacity = DEFAULT_QUEUE_CAPACITY;
 
-    if (argc >= 2)
-        port = argv[1];
-    if (argc >= 3)
-        queue_capacity = atoi(argv[2]);
+    if (parse_options(argc, argv) != 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (optind < argc)
+        port = argv[optind];
+    if (optind + 1 < argc)
+        queue_capacity = atoi(argv[optind + 1]);
     if (queue_capacity <= 0)
         queue_capacity = DEFAULT_QUEUE_CAPACITY;
 
+    /* Asynchronous logging; every exit path drains what is still buffered */
+    if (logger_init(server_config.log_level) != 0)
+        fprintf(stderr, "Logger thread unavailable, logging synchronously\n");
+    atexit(logger_shutdown);
+
     /* Initialize queues */
-    if (client_queue_init(&client_queue, queue_capacity) != 0 ||
-        task_queue_init(&task_queue, TASK_QUEUE_CAPACITY) != 0)
+    if (client_queue_init(&client_queue, queue_capacity, server_config.queue_impl) != 0 ||
+        task_lanes_init(&task_lanes, TASK_QUEUE_CAPACITY, TASK_QUEUE_USER_CAPACITY) != 0)
     {
         fprintf(stderr, "Queue initialization failed\n");
         return 1;
     }
+    LOG_INFO("Main", "Using %s client queue, per-user fair task lanes",
+             server_config.queue_impl == QUEUE_IMPL_LOCKFREE ? "lock-free" : "mutex");
+    LOG_INFO("Main", "Using %s worker file I/O",
+             server_config.storage_backend == STORAGE_BACKEND_URING ? "io_uring" : "synchronous");
 
     /* Initialize session manager (Phase 2.1) */
     if (session_manager_init(&session_manager) != 0)
     {
         fprintf(stderr, "Session manager initialization failed\n");
         client_queue_destroy(&client_queue);
-        task_queue_destroy(&task_queue);
+        task_lanes_destroy(&task_lanes);
         return 1;
     }
+    session_manager_set_timeouts(&session_manager, server_config.idle_timeout, AUTH_TIMEOUT);
 
     /* Initialize user metadata system with SQLite database */
     if (user_metadata_init("storage/stash.db") != 0)
@@ -90,22 +255,34 @@ int main(int argc, char *argv[])
         fprintf(stderr, "User metadata initialization failed\n");
         session_manager_destroy(&session_manager);
         client_queue_destroy(&client_queue);
-        task_queue_destroy(&task_queue);
+        task_lanes_destroy(&task_lanes);
         return 1;
     }
-    printf("User metadata system initialized\n");
+    LOG_INFO("Main", "User metadata system initialized");
+
+    /* Content-addressed chunk store (needs the database) */
+    if (chunk_store_init(server_config.compress_at_rest) != 0)
+    {
+        fprintf(stderr, "Chunk store initialization failed\n");
+        user_metadata_cleanup();
+        session_manager_destroy(&session_manager);
+        client_queue_destroy(&client_queue);
+        task_lanes_destroy(&task_lanes);
+        return 1;
+    }
+    upload_stream_expire_partials(UPLOAD_PARTIAL_MAX_AGE);
 
     /* Initialize file lock manager (Phase 2.5) */
-    if (file_lock_manager_init(&global_file_lock_manager, MAX_FILE_LOCKS) != 0)
+    if (file_lock_manager_init(&global_file_lock_manager, FILE_LOCK_INITIAL_BUCKETS) != 0)
     {
         fprintf(stderr, "File lock manager initialization failed\n");
         user_metadata_cleanup();
         session_manager_destroy(&session_manager);
         client_queue_destroy(&client_queue);
-        task_queue_destroy(&task_queue);
+        task_lanes_destroy(&task_lanes);
         return 1;
     }
-    printf("File lock manager initialized\n");
+    LOG_INFO("Main", "File lock manager initialized");
 
     /* Setup server socket */
     struct addrinfo hints, *res, *rp;
@@ -136,26 +313,26 @@ int main(int argc, char *argv[])
     freeaddrinfo(res);
     if (rp == NULL)
     {
-        fprintf(stderr, "[Main] Failed to bind to port %s\n", port);
+        LOG_ERROR("Main", "Failed to bind to port %s", port);
         perror("bind");
         file_lock_manager_destroy(&global_file_lock_manager);
         user_metadata_cleanup();
         session_manager_destroy(&session_manager);
         client_queue_destroy(&client_queue);
-        task_queue_destroy(&task_queue);
+        task_lanes_destroy(&task_lanes);
         return 1;
     }
 
     if (listen(listen_fd, LISTEN_BACKLOG) != 0)
     {
-        fprintf(stderr, "[Main] Failed to listen on socket\n");
+        LOG_ERROR("Main", "Failed to listen on socket");
         perror("listen");
         close(listen_fd);
         file_lock_manager_destroy(&global_file_lock_manager);
         user_metadata_cleanup();
         session_manager_destroy(&session_manager);
         client_queue_destroy(&client_queue);
-        task_queue_destroy(&task_queue);
+        task_lanes_destroy(&task_lanes);
         return 1;
     }
 
@@ -176,114 +353,163 @@ int main(int argc, char *argv[])
     /* Ignore SIGPIPE (write to closed socket) - handle errors instead */
     signal(SIGPIPE, SIG_IGN);
 
-    printf("Server listening on port %s\n", port);
+    LOG_INFO("Main", "Server listening on port %s", port);
+
+    /* Metrics stay available while the server drains at shutdown */
+    if (server_config.admin_port && admin_start(server_config.admin_port) != 0)
+        LOG_WARN("Main", "Admin endpoint unavailable, continuing without metrics");
+
+    /* Runs until the connections have drained: it also frees client
+     * threads stuck on idle clients at shutdown, and collects orphaned
+     * chunks */
+    if (reaper_start() != 0)
+        LOG_WARN("Main", "Reaper unavailable, idle sessions stay open and orphaned chunks "
+                 "are only collected at startup");
+    else if (server_config.idle_timeout > 0)
+        LOG_INFO("Main", "Closing sessions idle for %ds (unauthenticated: %ds)",
+                 server_config.idle_timeout, AUTH_TIMEOUT);
 
     /* Create thread pools */
-    printf("[Main] Creating worker thread pool (%d threads)...\n", WORKER_THREAD_COUNT);
+    LOG_INFO("Main",
+             "Creating worker thread pool (%d threads, %d reserved for interactive tasks)...",
+             WORKER_THREAD_COUNT, INTERACTIVE_WORKER_COUNT);
     for (int i = 0; i < WORKER_THREAD_COUNT; i++)
     {
-        int rc = pthread_create(&worker_threads[i], NULL, worker_worker, NULL);
+        task_lane_t lane = i < INTERACTIVE_WORKER_COUNT ? TASK_LANE_INTERACTIVE : TASK_LANE_BULK;
+        int rc = pthread_create(&worker_threads[i], NULL, worker_worker, (void *)(intptr_t)lane);
         if (rc != 0)
         {
-            fprintf(stderr, "[Main] Failed to create worker thread %d: %s\n", i, strerror(rc));
+            LOG_ERROR("Main", "Failed to create worker thread %d: %s", i, strerror(rc));
             /* Continue with fewer threads rather than failing completely */
         }
     }
 
-    printf("[Main] Creating client thread pool (%d threads)...\n", CLIENT_THREAD_COUNT);
-    for (int i = 0; i < CLIENT_THREAD_COUNT; i++)
+    if (server_config.mode == SERVER_MODE_EPOLL)
     {
-        int rc = pthread_create(&client_threads[i], NULL, client_worker, NULL);
-        if (rc != 0)
+        /* Reactor I/O threads accept and serve connections themselves */
+        LOG_INFO("Main", "Starting epoll reactor (%d I/O threads)...", server_config.io_threads);
+        if (reactor_start(listen_fd, server_config.io_threads) != 0)
         {
-            fprintf(stderr, "[Main] Failed to create client thread %d: %s\n", i, strerror(rc));
-            /* Continue with fewer threads rather than failing completely */
+            LOG_ERROR("Main", "Failed to start reactor");
+            keep_running = 0;
         }
-    }
 
-    /* Accept loop */
-    while (keep_running)
+        /* Serve until shutdown: loops exit once keep_running is cleared and
+         * every in-flight task has been answered (workers are still running) */
+        reactor_join();
+    }
+    else
     {
-        struct sockaddr_storage cli_addr;
-        socklen_t cli_len = sizeof(cli_addr);
-        int cfd = accept(listen_fd, (struct sockaddr *)&cli_addr, &cli_len);
-        if (cfd < 0)
+        LOG_INFO("Main", "Creating client thread pool (%d threads)...", CLIENT_THREAD_COUNT);
+        for (int i = 0; i < CLIENT_THREAD_COUNT; i++)
         {
-            if (errno == EINTR)
-                continue;
-            perror("accept");
-            break;
+            int rc = pthread_create(&client_threads[i], NULL, client_worker, NULL);
+            if (rc != 0)
+            {
+                LOG_ERROR("Main", "Failed to create client thread %d: %s", i, strerror(rc));
+                /* Continue with fewer threads rather than failing completely */
+            }
         }
-        if (client_queue_push(&client_queue, cfd) != 0)
+
+        /* Accept loop */
+        while (keep_running)
         {
-            fprintf(stderr, "[Main] Client queue full, rejecting connection\n");
-            const char *reject_msg = "ERROR: Server busy, please try again later\n";
-            send(cfd, reject_msg, strlen(reject_msg), 0);
-            close(cfd);
+            struct sockaddr_storage cli_addr;
+            socklen_t cli_len = sizeof(cli_addr);
+            int cfd = accept(listen_fd, (struct sockaddr *)&cli_addr, &cli_len);
+            if (cfd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("accept");
+                break;
+            }
+            socket_set_keepalive(cfd, TCP_KEEPALIVE_IDLE, TCP_KEEPALIVE_INTERVAL,
+                                 TCP_KEEPALIVE_COUNT);
+            if (client_queue_push(&client_queue, cfd) != 0)
+            {
+                LOG_WARN("Main", "Client queue full, rejecting connection");
+                const char *reject_msg = "ERROR: Server busy, please try again later\n";
+                send(cfd, reject_msg, strlen(reject_msg), 0);
+                close(cfd);
+            }
         }
     }
 
     /* -------------------- Shutdown Sequence (Phase 2.7) -------------------- */
-    printf("\n[Main] ========================================\n");
-    printf("[Main] GRACEFUL SHUTDOWN INITIATED\n");
-    printf("[Main] ========================================\n");
+    LOG_INFO("Main", "========================================");
+    LOG_INFO("Main", "GRACEFUL SHUTDOWN INITIATED");
+    LOG_INFO("Main", "========================================");
 
     /* Ensure queues are signaled (may have been done by signal handler) */
     client_queue_signal_shutdown(&client_queue);
-    task_queue_signal_shutdown(&task_queue);
+    task_lanes_signal_shutdown(&task_lanes);
 
-    /* Wait for client threads to finish processing their current clients */
-    printf("[Main] Step 1: Waiting for client threads to finish...\n");
-    for (int i = 0; i < CLIENT_THREAD_COUNT; i++)
+    if (server_config.mode == SERVER_MODE_EPOLL)
     {
-        void *retval;
-        int rc = pthread_join(client_threads[i], &retval);
-        if (rc == 0)
-            printf("[Main]   Client thread %d joined successfully\n", i);
-        else
-            fprintf(stderr, "[Main]   Error joining client thread %d: %d\n", i, rc);
+        /* Already joined above, after draining in-flight tasks */
+        LOG_INFO("Main", "Step 1: All I/O threads terminated");
+    }
+    else
+    {
+        /* Wait for client threads to finish processing their current clients */
+        LOG_INFO("Main", "Step 1: Waiting for client threads to finish...");
+        for (int i = 0; i < CLIENT_THREAD_COUNT; i++)
+        {
+            void *retval;
+            int rc = pthread_join(client_threads[i], &retval);
+            if (rc == 0)
+                LOG_INFO("Main", "Client thread %d joined successfully", i);
+            else
+                LOG_ERROR("Main", "Error joining client thread %d: %d", i, rc);
+        }
+        LOG_INFO("Main", "All client threads terminated");
     }
-    printf("[Main] All client threads terminated\n");
 
     /* Wait for worker threads to finish processing their current tasks */
-    printf("[Main] Step 2: Waiting for worker threads to finish...\n");
+    LOG_INFO("Main", "Step 2: Waiting for worker threads to finish...");
     for (int i = 0; i < WORKER_THREAD_COUNT; i++)
     {
         void *retval;
         int rc = pthread_join(worker_threads[i], &retval);
         if (rc == 0)
-            printf("[Main]   Worker thread %d joined successfully\n", i);
+            LOG_INFO("Main", "Worker thread %d joined successfully", i);
         else
-            fprintf(stderr, "[Main]   Error joining worker thread %d: %d\n", i, rc);
+            LOG_ERROR("Main", "Error joining worker thread %d: %d", i, rc);
     }
-    printf("[Main] All worker threads terminated\n");
+    LOG_INFO("Main", "All worker threads terminated");
+
+    reaper_stop();
+    admin_join();
+    metrics_log_summary();
+    obj_pool_log_summary();
 
     /* Clean up resources in reverse order of initialization */
-    printf("[Main] Step 3: Cleaning up resources...\n");
+    LOG_INFO("Main", "Step 3: Cleaning up resources...");
 
-    printf("[Main]   Destroying file lock manager...\n");
+    LOG_INFO("Main", "Destroying file lock manager...");
     file_lock_manager_destroy(&global_file_lock_manager);
 
     /* Print final statistics (Phase 2.9) - BEFORE destroying session manager */
     uint64_t total_created, peak_count;
     session_get_statistics(&session_manager, NULL, &total_created, &peak_count);
-    printf("[Main] Session statistics: %lu total created, %lu peak concurrent\n",
-           total_created, peak_count);
+    LOG_INFO("Main", "Session statistics: %lu total created, %lu peak concurrent", total_created,
+             peak_count);
 
-    printf("[Main]   Destroying session manager...\n");
+    LOG_INFO("Main", "Destroying session manager...");
     session_manager_destroy(&session_manager);
 
-    printf("[Main]   Destroying client queue...\n");
+    LOG_INFO("Main", "Destroying client queue...");
     client_queue_destroy(&client_queue);
 
-    printf("[Main]   Destroying task queue...\n");
-    task_queue_destroy(&task_queue);
+    LOG_INFO("Main", "Destroying task lanes...");
+    task_lanes_destroy(&task_lanes);
 
-    printf("[Main]   Cleaning up user metadata system...\n");
+    LOG_INFO("Main", "Cleaning up user metadata system...");
     user_metadata_cleanup();
 
-    printf("[Main] ========================================\n");
-    printf("[Main] SERVER SHUTDOWN COMPLETE\n");
-    printf("[Main] ========================================\n");
+    LOG_INFO("Main", "========================================");
+    LOG_INFO("Main", "SERVER SHUTDOWN COMPLETE");
+    LOG_INFO("Main", "========================================");
     return 0;
 }
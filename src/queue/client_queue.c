@@ -3,10 +3,17 @@
 #include <stdio.h>
 #include <errno.h>
 
-int client_queue_init(ClientQueue *q, int capacity)
+int client_queue_init(ClientQueue *q, int capacity, queue_impl_t impl)
 {
     if (!q || capacity <= 0)
         return -1;
+    q->impl = impl;
+    if (impl == QUEUE_IMPL_LOCKFREE)
+    {
+        q->fds = NULL;
+        q->capacity = capacity;
+        return mpmc_ring_init(&q->ring, capacity);
+    }
     q->fds = calloc(capacity, sizeof(int));
     if (!q->fds)
         return -1;
@@ -40,6 +47,11 @@ void client_queue_destroy(ClientQueue *q)
 {
     if (!q)
         return;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        mpmc_ring_destroy(&q->ring);
+        return;
+    }
     pthread_mutex_lock(&q->mtx);
     q->shutdown = true;
     pthread_cond_broadcast(&q->not_empty);
@@ -57,6 +69,12 @@ int client_queue_push(ClientQueue *q, int fd)
 {
     if (!q)
         return -1;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        if (mpmc_ring_is_shutdown(&q->ring))
+            return -1;
+        return mpmc_ring_push(&q->ring, (uintptr_t)fd);
+    }
     int err = 0;
     pthread_mutex_lock(&q->mtx);
     while (q->size == q->capacity && !q->shutdown)
@@ -84,6 +102,13 @@ int client_queue_pop(ClientQueue *q)
 {
     if (!q)
         return -1;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        uintptr_t value;
+        if (mpmc_ring_pop(&q->ring, &value) != 0)
+            return -1;
+        return (int)value;
+    }
     int fd = -1;
     pthread_mutex_lock(&q->mtx);
     while (q->size == 0 && !q->shutdown)
@@ -110,9 +135,24 @@ void client_queue_signal_shutdown(ClientQueue *q)
 {
     if (!q)
         return;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        mpmc_ring_shutdown(&q->ring);
+        return;
+    }
     pthread_mutex_lock(&q->mtx);
     q->shutdown = true;
     pthread_cond_broadcast(&q->not_empty);
     pthread_cond_broadcast(&q->not_full);
     pthread_mutex_unlock(&q->mtx);
 }
+
+int client_queue_size(ClientQueue *q)
+{
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+        return (int)mpmc_ring_size(&q->ring);
+    pthread_mutex_lock(&q->mtx);
+    int size = q->size;
+    pthread_mutex_unlock(&q->mtx);
+    return size;
+}
@@ -3,9 +3,14 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include "mpmc_ring.h"
 
 typedef struct ClientQueue
 {
+    queue_impl_t impl;
+    MpmcRing ring; // QUEUE_IMPL_LOCKFREE: fds are stored directly in the ring
+
+    // QUEUE_IMPL_MUTEX
     int *fds;     // circular buffer of file descriptors
     int capacity; // max number of entries
     int head;     // index of next pop
@@ -17,8 +22,9 @@ typedef struct ClientQueue
     bool shutdown; // set to true to wake all waiting threads during shutdown
 } ClientQueue;
 
-// Initialize queue; returns 0 on success, -1 on error
-int client_queue_init(ClientQueue *q, int capacity);
+// Initialize queue; returns 0 on success, -1 on error.
+// QUEUE_IMPL_LOCKFREE rounds capacity up to a power of two.
+int client_queue_init(ClientQueue *q, int capacity, queue_impl_t impl);
 
 // Destroy queue resources
 void client_queue_destroy(ClientQueue *q);
@@ -33,4 +39,7 @@ int client_queue_pop(ClientQueue *q);
 // Signal shutdown to wake any waiting producers/consumers
 void client_queue_signal_shutdown(ClientQueue *q);
 
+// Number of queued fds (a snapshot, for metrics)
+int client_queue_size(ClientQueue *q);
+
 #endif /* CLIENT_QUEUE_H */
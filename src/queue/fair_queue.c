@@ -0,0 +1,193 @@
+#include "fair_queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct FairNode
+{
+    Task *task;
+    uint32_t cost;
+    FairNode *next;
+};
+
+struct FairUser
+{
+    char username[64];
+    int weight;
+    int64_t deficit;
+    FairNode *head;         /* Subqueue, oldest first */
+    FairNode *tail;
+    int queued;
+    FairUser *next_active;  /* DRR ring */
+    FairUser *next_bucket;  /* Hash chain (also the free list) */
+};
+
+static unsigned hash_username(const char *s)
+{
+    unsigned h = 5381;
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+int fair_queue_init(FairQueue *q, int capacity, int max_per_user)
+{
+    if (!q || capacity <= 0 || max_per_user <= 0)
+        return -1;
+    memset(q, 0, sizeof(*q));
+
+    q->nodes = calloc(capacity, sizeof(FairNode));
+    q->users = calloc(capacity, sizeof(FairUser));
+    q->nbuckets = capacity;
+    q->buckets = calloc(q->nbuckets, sizeof(FairUser *));
+    if (!q->nodes || !q->users || !q->buckets)
+    {
+        fair_queue_destroy(q);
+        return -1;
+    }
+
+    for (int i = capacity - 1; i >= 0; i--)
+    {
+        q->nodes[i].next = q->free_nodes;
+        q->free_nodes = &q->nodes[i];
+        q->users[i].next_bucket = q->free_users;
+        q->free_users = &q->users[i];
+    }
+    q->max_per_user = max_per_user;
+    return 0;
+}
+
+void fair_queue_destroy(FairQueue *q)
+{
+    if (!q)
+        return;
+    free(q->nodes);
+    free(q->users);
+    free(q->buckets);
+    q->nodes = NULL;
+    q->users = NULL;
+    q->buckets = NULL;
+}
+
+static FairUser **user_slot(FairQueue *q, const char *username)
+{
+    FairUser **slot = &q->buckets[hash_username(username) % q->nbuckets];
+    while (*slot && strcmp((*slot)->username, username) != 0)
+        slot = &(*slot)->next_bucket;
+    return slot;
+}
+
+int fair_queue_push(FairQueue *q, Task *t, int weight, uint32_t cost)
+{
+    FairUser **slot = user_slot(q, t->username);
+    FairUser *u = *slot;
+
+    if (!q->free_nodes || (u && u->queued >= q->max_per_user))
+        return -1;
+
+    if (!u)
+    {
+        /* Every user here holds a task, so a free node implies a free user */
+        u = q->free_users;
+        q->free_users = u->next_bucket;
+        memset(u, 0, sizeof(*u));
+        memcpy(u->username, t->username, sizeof(u->username) - 1);
+        *slot = u;
+
+        /* Join the back of the ring with no credit */
+        q->active_users++;
+        if (q->active_tail)
+            q->active_tail->next_active = u;
+        else
+            q->active_head = u;
+        q->active_tail = u;
+    }
+    /* Latest weight wins (it can change between logins) */
+    u->weight = weight < 1 ? 1 : weight > FAIR_WEIGHT_MAX ? FAIR_WEIGHT_MAX : weight;
+
+    FairNode *n = q->free_nodes;
+    q->free_nodes = n->next;
+    n->task = t;
+    n->cost = cost ? cost : 1;
+    n->next = NULL;
+    if (u->tail)
+        u->tail->next = n;
+    else
+        u->head = n;
+    u->tail = n;
+    u->queued++;
+    q->size++;
+    return 0;
+}
+
+int fair_queue_pop(FairQueue *q, Task **out)
+{
+    if (!q->active_head)
+        return -1;
+
+    /* Rotate until the head user can afford its next task */
+    FairUser *u = q->active_head;
+    int rotations = 0;
+    while (u->deficit < (int64_t)u->head->cost)
+    {
+        if (rotations == q->active_users)
+        {
+            /* A whole round and nobody could pay (large tasks): grant at
+             * once the rounds it takes until the first of them can */
+            int64_t rounds = INT64_MAX;
+            for (FairUser *v = q->active_head; v; v = v->next_active)
+            {
+                int64_t quantum = (int64_t)FAIR_QUANTUM * v->weight;
+                int64_t need = ((int64_t)v->head->cost - v->deficit + quantum - 1) / quantum;
+                if (need < rounds)
+                    rounds = need;
+            }
+            /* Leave the last round to the loop, so ring order decides */
+            if (rounds > 1)
+            {
+                for (FairUser *v = q->active_head; v; v = v->next_active)
+                    v->deficit += (rounds - 1) * FAIR_QUANTUM * v->weight;
+            }
+            rotations = 0;
+        }
+
+        u->deficit += (int64_t)FAIR_QUANTUM * u->weight;
+        rotations++;
+        if (u != q->active_tail)
+        {
+            q->active_head = u->next_active;
+            u->next_active = NULL;
+            q->active_tail->next_active = u;
+            q->active_tail = u;
+        }
+        u = q->active_head;
+    }
+
+    FairNode *n = u->head;
+    u->head = n->next;
+    if (!u->head)
+        u->tail = NULL;
+    u->deficit -= n->cost;
+    u->queued--;
+    q->size--;
+    *out = n->task;
+    n->next = q->free_nodes;
+    q->free_nodes = n;
+
+    if (u->queued == 0)
+    {
+        /* Leave the ring (it is the head) and the table */
+        q->active_head = u->next_active;
+        if (!q->active_head)
+            q->active_tail = NULL;
+        q->active_users--;
+        *user_slot(q, u->username) = u->next_bucket;
+        u->next_bucket = q->free_users;
+        q->free_users = u;
+    }
+    return 0;
+}
+
+bool fair_queue_empty(const FairQueue *q)
+{
+    return q->size == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef FAIR_QUEUE_H
+#define FAIR_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "task_queue.h"
+
+/*
+ * Per-user fair task queue (deficit round robin)
+ *
+ * Each user with queued tasks has a FIFO subqueue and a place in the
+ * active ring. A pop serves the user at the head of the ring while its
+ * deficit covers the cost of its next task; otherwise the user earns
+ * FAIR_QUANTUM * weight more deficit and moves to the back. Over time
+ * every backlogged user gets a share of the pops (by cost) proportional
+ * to its weight, however many tasks or connections it has. A user whose
+ * subqueue empties leaves the ring and its deficit resets, so idle users
+ * cannot bank credit.
+ *
+ * Admission is bounded per user as well as in total: one user can hold
+ * at most max_per_user queued tasks, so it cannot fill the queue and
+ * lock the others out.
+ *
+ * Not thread-safe: the caller (TaskLanes) serializes every call.
+ */
+
+#define FAIR_QUANTUM 1         /* Cost units a weight-1 user earns per round */
+#define FAIR_WEIGHT_MAX 100
+
+typedef struct FairNode FairNode;
+typedef struct FairUser FairUser;
+
+typedef struct FairQueue
+{
+    FairNode *nodes;         /* capacity task slots */
+    FairNode *free_nodes;
+    FairUser *users;         /* capacity user slots (a user holds >= 1 task) */
+    FairUser *free_users;
+    FairUser **buckets;      /* Users with queued tasks, by username hash */
+    int nbuckets;
+    FairUser *active_head;   /* DRR ring, served from the head */
+    FairUser *active_tail;
+    int active_users;
+    int max_per_user;
+    int size;
+} FairQueue;
+
+/* Returns 0, or -1 if out of memory */
+int fair_queue_init(FairQueue *q, int capacity, int max_per_user);
+void fair_queue_destroy(FairQueue *q);
+
+/**
+ * Queue a task on its user's subqueue (the queue holds the pointer, not a
+ * copy, until the task is popped)
+ * @param weight The user's share (clamped to 1..FAIR_WEIGHT_MAX)
+ * @param cost   What serving the task uses up (>= 1)
+ * @return 0, or -1 if the queue or the user's share of it is full
+ */
+int fair_queue_push(FairQueue *q, Task *t, int weight, uint32_t cost);
+
+/* Take the next task in DRR order. Returns 0, or -1 if empty. */
+int fair_queue_pop(FairQueue *q, Task **out);
+
+bool fair_queue_empty(const FairQueue *q);
+
+#endif /* FAIR_QUEUE_H */
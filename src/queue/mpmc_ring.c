@@ -0,0 +1,224 @@
+#include "mpmc_ring.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Retries (yielding the CPU) before a blocked push/pop parks on the futex */
+#define MPMC_SPIN_YIELDS 16
+
+static void futex_wait(uint32_t *addr, uint32_t expected)
+{
+    /* Returns immediately if *addr != expected; spurious wakeups are fine */
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+int mpmc_ring_init(MpmcRing *r, int capacity)
+{
+    if (!r || capacity <= 0)
+        return -1;
+
+    size_t size = 2;
+    while (size < (size_t)capacity)
+        size <<= 1;
+
+    r->cells = calloc(size, sizeof(MpmcCell));
+    if (!r->cells)
+        return -1;
+    for (size_t i = 0; i < size; i++)
+        r->cells[i].seq = i;
+
+    r->mask = size - 1;
+    r->enqueue_pos = 0;
+    r->dequeue_pos = 0;
+    r->data_event = 0;
+    r->space_event = 0;
+    r->pop_waiters = 0;
+    r->push_waiters = 0;
+    r->shutdown = false;
+    return 0;
+}
+
+void mpmc_ring_destroy(MpmcRing *r)
+{
+    if (!r)
+        return;
+    free(r->cells);
+    r->cells = NULL;
+}
+
+bool mpmc_ring_try_push(MpmcRing *r, uintptr_t value)
+{
+    size_t pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        MpmcCell *cell = &r->cells[pos & r->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0)
+        {
+            /* Cell is free for this lap; claim it */
+            if (__atomic_compare_exchange_n(&r->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                cell->value = value;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            /* CAS failure reloaded pos */
+        }
+        else if (dif < 0)
+        {
+            return false;  /* Consumer of the previous lap hasn't freed it: full */
+        }
+        else
+        {
+            pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+bool mpmc_ring_try_pop(MpmcRing *r, uintptr_t *value)
+{
+    size_t pos = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        MpmcCell *cell = &r->cells[pos & r->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&r->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *value = cell->value;
+                /* Hand the cell to the producer one lap ahead */
+                __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if (dif < 0)
+        {
+            return false;  /* Producer hasn't published this cell yet: empty */
+        }
+        else
+        {
+            pos = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Wake one parked thread on the other side, if any. The fence pairs with
+ * the waiter's increment + retry: either we see the waiter, or the waiter's
+ * retry sees the cell we just published.
+ */
+static void wake_one(uint32_t *event, int *waiters)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_add_fetch(event, 1, __ATOMIC_RELEASE);
+        futex_wake(event, 1);
+    }
+}
+
+int mpmc_ring_push(MpmcRing *r, uintptr_t value)
+{
+    int spins = 0;
+    for (;;)
+    {
+        if (mpmc_ring_try_push(r, value))
+        {
+            wake_one(&r->data_event, &r->pop_waiters);
+            return 0;
+        }
+        if (mpmc_ring_is_shutdown(r))
+            return -1;
+        /* A consumer is usually about to free a cell; parking costs two syscalls */
+        if (spins++ < MPMC_SPIN_YIELDS)
+        {
+            sched_yield();
+            continue;
+        }
+
+        /* Full: announce ourselves, recheck, then sleep until space_event moves */
+        uint32_t event = __atomic_load_n(&r->space_event, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&r->push_waiters, 1, __ATOMIC_SEQ_CST);
+        if (mpmc_ring_try_push(r, value))
+        {
+            __atomic_sub_fetch(&r->push_waiters, 1, __ATOMIC_RELAXED);
+            wake_one(&r->data_event, &r->pop_waiters);
+            return 0;
+        }
+        if (!mpmc_ring_is_shutdown(r))
+            futex_wait(&r->space_event, event);
+        __atomic_sub_fetch(&r->push_waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int mpmc_ring_pop(MpmcRing *r, uintptr_t *value)
+{
+    int spins = 0;
+    for (;;)
+    {
+        if (mpmc_ring_try_pop(r, value))
+        {
+            wake_one(&r->space_event, &r->push_waiters);
+            return 0;
+        }
+        if (mpmc_ring_is_shutdown(r))
+            return -1;
+        if (spins++ < MPMC_SPIN_YIELDS)
+        {
+            sched_yield();
+            continue;
+        }
+
+        /* Empty: announce ourselves, recheck, then sleep until data_event moves */
+        uint32_t event = __atomic_load_n(&r->data_event, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&r->pop_waiters, 1, __ATOMIC_SEQ_CST);
+        if (mpmc_ring_try_pop(r, value))
+        {
+            __atomic_sub_fetch(&r->pop_waiters, 1, __ATOMIC_RELAXED);
+            wake_one(&r->space_event, &r->push_waiters);
+            return 0;
+        }
+        if (!mpmc_ring_is_shutdown(r))
+            futex_wait(&r->data_event, event);
+        __atomic_sub_fetch(&r->pop_waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void mpmc_ring_shutdown(MpmcRing *r)
+{
+    if (!r)
+        return;
+    __atomic_store_n(&r->shutdown, true, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&r->data_event, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&r->space_event, 1, __ATOMIC_RELEASE);
+    futex_wake(&r->data_event, INT_MAX);
+    futex_wake(&r->space_event, INT_MAX);
+}
+
+bool mpmc_ring_is_shutdown(MpmcRing *r)
+{
+    return __atomic_load_n(&r->shutdown, __ATOMIC_ACQUIRE);
+}
+
+size_t mpmc_ring_size(MpmcRing *r)
+{
+    size_t dequeued = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+    size_t enqueued = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+    /* A pop racing between the two loads can briefly put dequeue ahead */
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
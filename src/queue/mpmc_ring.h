@@ -0,0 +1,79 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer ring (Vyukov-style)
+ *
+ * Each cell carries a sequence number that tells producers and consumers
+ * whether it is free for the current lap, so a push or pop is one CAS on the
+ * shared position plus one store to the cell - no lock is ever taken.
+ *
+ * The blocking variants retry with sched_yield() for a short while when the
+ * ring is empty (pop) or full (push), then park on a futex. Waker and
+ * sleeper coordinate through a waiter count and an event counter, so a
+ * push/pop that finds nobody parked never makes a futex syscall.
+ *
+ * Values are uintptr_t: pointers or small integers (fds, pool indices).
+ */
+
+/* Queue implementation selected for TaskQueue/ClientQueue */
+typedef enum
+{
+    QUEUE_IMPL_MUTEX,     /* Legacy mutex + condvar circular buffer */
+    QUEUE_IMPL_LOCKFREE   /* MpmcRing with futex parking */
+} queue_impl_t;
+
+#define MPMC_CACHELINE 64
+
+typedef struct MpmcCell
+{
+    size_t seq;
+    uintptr_t value;
+} MpmcCell;
+
+typedef struct MpmcRing
+{
+    MpmcCell *cells;
+    size_t mask;                 /* Capacity - 1 (capacity is a power of two) */
+
+    /* Producers and consumers each own a cache line */
+    _Alignas(MPMC_CACHELINE) size_t enqueue_pos;
+    _Alignas(MPMC_CACHELINE) size_t dequeue_pos;
+
+    /* Futex words: bumped whenever a parked consumer/producer should recheck */
+    _Alignas(MPMC_CACHELINE) uint32_t data_event;
+    uint32_t space_event;
+    int pop_waiters;
+    int push_waiters;
+    bool shutdown;
+} MpmcRing;
+
+/* Initialize with room for at least capacity values; returns 0 or -1 */
+int mpmc_ring_init(MpmcRing *r, int capacity);
+
+/* Free the cells; no thread may be using the ring */
+void mpmc_ring_destroy(MpmcRing *r);
+
+/* Non-blocking; return false if the ring is full/empty */
+bool mpmc_ring_try_push(MpmcRing *r, uintptr_t value);
+bool mpmc_ring_try_pop(MpmcRing *r, uintptr_t *value);
+
+/* Block while full. Returns 0, or -1 once shut down and still full */
+int mpmc_ring_push(MpmcRing *r, uintptr_t value);
+
+/* Block while empty. Returns 0, or -1 once shut down and drained */
+int mpmc_ring_pop(MpmcRing *r, uintptr_t *value);
+
+/* Wake every parked thread; later blocking calls stop waiting */
+void mpmc_ring_shutdown(MpmcRing *r);
+
+bool mpmc_ring_is_shutdown(MpmcRing *r);
+
+/* Values queued; approximate while producers or consumers are active */
+size_t mpmc_ring_size(MpmcRing *r);
+
+#endif /* MPMC_RING_H */
@@ -0,0 +1,175 @@
+#include "task_lanes.h"
+#include "../utils/metrics.h"
+#include <string.h>
+
+int task_lanes_init(TaskLanes *l, int capacity, int max_per_user)
+{
+    if (!l)
+        return -1;
+    for (int i = 0; i < TASK_LANE_COUNT; i++)
+    {
+        if (fair_queue_init(&l->lanes[i], capacity, max_per_user) != 0)
+        {
+            while (--i >= 0)
+                fair_queue_destroy(&l->lanes[i]);
+            return -1;
+        }
+        pthread_cond_init(&l->wake[i], NULL);
+        l->waiting[i] = 0;
+    }
+    if (obj_pool_init(&l->tasks, "task", sizeof(Task), 1, NULL, NULL) != 0)
+    {
+        for (int i = 0; i < TASK_LANE_COUNT; i++)
+        {
+            fair_queue_destroy(&l->lanes[i]);
+            pthread_cond_destroy(&l->wake[i]);
+        }
+        return -1;
+    }
+    pthread_mutex_init(&l->mtx, NULL);
+    l->shutdown = false;
+    return 0;
+}
+
+void task_lanes_destroy(TaskLanes *l)
+{
+    if (!l)
+        return;
+    for (int i = 0; i < TASK_LANE_COUNT; i++)
+    {
+        fair_queue_destroy(&l->lanes[i]);
+        pthread_cond_destroy(&l->wake[i]);
+    }
+    pthread_mutex_destroy(&l->mtx);
+    obj_pool_destroy(&l->tasks);
+}
+
+task_lane_t task_lane(const Task *t)
+{
+    switch (t->type)
+    {
+    case TASK_LIST:
+    case TASK_DELETE:
+    case TASK_UPLOAD_OFFSET:
+        return TASK_LANE_INTERACTIVE;
+    case TASK_UPLOAD:
+        /* The worker chunks and hashes the whole file */
+        return t->filesize <= TASK_LANE_SMALL_BYTES ? TASK_LANE_INTERACTIVE : TASK_LANE_BULK;
+    case TASK_DOWNLOAD:
+        /* Size unknown until the worker opens it, unless a short range */
+        return t->length > 0 && t->length <= TASK_LANE_SMALL_BYTES ? TASK_LANE_INTERACTIVE
+                                                                   : TASK_LANE_BULK;
+    default:
+        /* Delta sync reads or rebuilds the whole stored file */
+        return TASK_LANE_BULK;
+    }
+}
+
+const char *task_lane_name(task_lane_t lane)
+{
+    return lane == TASK_LANE_INTERACTIVE ? "interactive" : "bulk";
+}
+
+/* DRR cost: one unit plus one per TASK_COST_UNIT bytes the task moves
+ * (downloads without a range count as one: their size is not known yet,
+ * and the bytes go out on the I/O threads, not the worker) */
+static uint32_t task_cost(const Task *t)
+{
+    uint64_t bytes = t->type == TASK_DOWNLOAD ? t->length : t->filesize;
+    uint64_t units = bytes / TASK_COST_UNIT;
+    return units >= UINT32_MAX ? UINT32_MAX : (uint32_t)units + 1;
+}
+
+int task_lanes_push(TaskLanes *l, const Task *t)
+{
+    if (!l || !t)
+        return -1;
+
+    Task *queued = obj_pool_alloc(&l->tasks);
+    if (!queued)
+        return -1;
+    *queued = *t;
+
+    task_lane_t lane = task_lane(t);
+    memset(&queued->timing, 0, sizeof(queued->timing));
+    queued->timing.queued = metrics_now();
+    pthread_mutex_lock(&l->mtx);
+    int rc = l->shutdown ? -1
+                         : fair_queue_push(&l->lanes[lane], queued, t->weight, task_cost(t));
+    if (rc == 0)
+    {
+        /* Interactive tasks fall to a bulk worker if no interactive one is parked */
+        if (l->waiting[lane] > 0)
+            pthread_cond_signal(&l->wake[lane]);
+        else if (lane == TASK_LANE_INTERACTIVE && l->waiting[TASK_LANE_BULK] > 0)
+            pthread_cond_signal(&l->wake[TASK_LANE_BULK]);
+    }
+    pthread_mutex_unlock(&l->mtx);
+
+    if (rc != 0)
+        obj_pool_free(queued);
+    if (rc == 0 && task_has_body(t->type))
+    {
+        metrics_add_received(t->body_len);
+        metrics_inflight_add(METRIC_INFLIGHT_UPLOAD, (int64_t)t->body_len);
+    }
+    return rc;
+}
+
+/* Home lane first; bulk workers then steal interactive tasks */
+static bool lanes_try_take(TaskLanes *l, task_lane_t home, Task **out)
+{
+    if (fair_queue_pop(&l->lanes[home], out) == 0)
+        return true;
+    return home == TASK_LANE_BULK && fair_queue_pop(&l->lanes[TASK_LANE_INTERACTIVE], out) == 0;
+}
+
+int task_lanes_pop(TaskLanes *l, task_lane_t home, Task **out, bool block)
+{
+    if (!l || !out)
+        return -1;
+
+    pthread_mutex_lock(&l->mtx);
+    int rc = 0;
+    while (!lanes_try_take(l, home, out))
+    {
+        if (!block || l->shutdown)
+        {
+            rc = -1;  /* Nothing to take, or shut down and drained */
+            break;
+        }
+        l->waiting[home]++;
+        pthread_cond_wait(&l->wake[home], &l->mtx);
+        l->waiting[home]--;
+    }
+    pthread_mutex_unlock(&l->mtx);
+
+    if (rc == 0)
+        metrics_observe(METRIC_STAGE_QUEUE, (*out)->type, metrics_now() - (*out)->timing.queued);
+    return rc;
+}
+
+void task_lanes_release(TaskLanes *l, Task *t)
+{
+    (void)l;
+    obj_pool_free(t);
+}
+
+void task_lanes_signal_shutdown(TaskLanes *l)
+{
+    if (!l)
+        return;
+    pthread_mutex_lock(&l->mtx);
+    l->shutdown = true;
+    for (int i = 0; i < TASK_LANE_COUNT; i++)
+        pthread_cond_broadcast(&l->wake[i]);
+    pthread_mutex_unlock(&l->mtx);
+}
+
+int task_lanes_depth(TaskLanes *l, task_lane_t lane)
+{
+    pthread_mutex_lock(&l->mtx);
+    int depth = l->lanes[lane].size;
+    pthread_mutex_unlock(&l->mtx);
+    return depth;
+}
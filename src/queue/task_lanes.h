@@ -0,0 +1,88 @@
+#ifndef TASK_LANES_H
+#define TASK_LANES_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "task_queue.h"
+#include "fair_queue.h"
+#include "../utils/obj_pool.h"
+
+/*
+ * Size-class lanes in front of the worker pool
+ *
+ * Tasks are split by how much work a worker does for them:
+ * - TASK_LANE_INTERACTIVE: metadata-only operations (LIST, DELETE,
+ *   UPLOAD_OFFSET) and transfers of at most TASK_LANE_SMALL_BYTES
+ * - TASK_LANE_BULK: everything else (large uploads, downloads, delta sync)
+ *
+ * A worker has a home lane: the interactive workers only ever take
+ * interactive tasks, so a LIST never waits behind a multi-GB ingest. Bulk
+ * workers take bulk tasks first and steal interactive ones whenever their
+ * lane is empty. Stealing is one-way on purpose: an interactive worker
+ * that picked up a bulk task would no longer be reserved for interactive
+ * work.
+ *
+ * Queued tasks live in a pool (utils/obj_pool.h): push copies the
+ * caller's Task into a pooled one once, the lanes pass pointers, and the
+ * worker hands it back with task_lanes_release when it is done.
+ *
+ * Within a lane, users are served by deficit round robin (fair_queue.h),
+ * weighted by users.weight and charged one unit per TASK_COST_UNIT bytes
+ * a task moves, so no user can monopolize the workers by opening more
+ * connections or queueing more tasks. Every lane operation runs under one
+ * mutex; workers park on their home lane's condition variable.
+ */
+
+#define TASK_LANE_SMALL_BYTES (1024 * 1024)
+#define TASK_COST_UNIT (1024 * 1024)
+
+typedef enum
+{
+    TASK_LANE_INTERACTIVE,
+    TASK_LANE_BULK,
+    TASK_LANE_COUNT
+} task_lane_t;
+
+typedef struct TaskLanes
+{
+    FairQueue lanes[TASK_LANE_COUNT];
+    pthread_mutex_t mtx;
+    pthread_cond_t wake[TASK_LANE_COUNT];  /* Parked workers, by home lane */
+    int waiting[TASK_LANE_COUNT];
+    bool shutdown;
+    ObjPool tasks;                         /* Queued and running tasks */
+} TaskLanes;
+
+/* Initialize with capacity tasks per lane, at most max_per_user of them
+ * from one user; returns 0 or -1 */
+int task_lanes_init(TaskLanes *l, int capacity, int max_per_user);
+void task_lanes_destroy(TaskLanes *l);
+
+/* Lane a task belongs to (by type and the bytes the worker will touch) */
+task_lane_t task_lane(const Task *t);
+const char *task_lane_name(task_lane_t lane);
+
+/* Queue a copy of a task on its lane (t can be reused at once). Returns 0,
+ * or -1 if the lane or the user's share of it is full, or once shut down */
+int task_lanes_push(TaskLanes *l, const Task *t);
+
+/**
+ * Take the next task for a worker whose home lane is home
+ * @param out The task, owned by the caller until task_lanes_release
+ * @param block Park until a task arrives (or shutdown) instead of failing
+ * @return 0, or -1 if nothing could be taken (with block: shut down and
+ *         every lane the worker serves is drained)
+ */
+int task_lanes_pop(TaskLanes *l, task_lane_t home, Task **out, bool block);
+
+/* Give back a popped task once it is finished (any thread) */
+void task_lanes_release(TaskLanes *l, Task *t);
+
+/* Refuse new tasks and wake every parked worker to drain what is queued */
+void task_lanes_signal_shutdown(TaskLanes *l);
+
+/* Tasks queued on a lane (a snapshot, for metrics) */
+int task_lanes_depth(TaskLanes *l, task_lane_t lane);
+
+#endif /* TASK_LANES_H */
@@ -2,10 +2,36 @@
 #include <stdlib.h>
 #include <string.h>
 
-int task_queue_init(TaskQueue *q, int capacity)
+static int task_queue_init_lockfree(TaskQueue *q, int capacity)
+{
+    q->pool = calloc(capacity, sizeof(Task));
+    if (!q->pool)
+        return -1;
+    if (mpmc_ring_init(&q->free_slots, capacity) != 0)
+    {
+        free(q->pool);
+        return -1;
+    }
+    if (mpmc_ring_init(&q->ready, capacity) != 0)
+    {
+        mpmc_ring_destroy(&q->free_slots);
+        free(q->pool);
+        return -1;
+    }
+    /* Only capacity slots exist, so ready can never overflow */
+    for (int i = 0; i < capacity; i++)
+        mpmc_ring_try_push(&q->free_slots, (uintptr_t)i);
+    q->capacity = capacity;
+    return 0;
+}
+
+int task_queue_init(TaskQueue *q, int capacity, queue_impl_t impl)
 {
     if (!q || capacity <= 0)
         return -1;
+    q->impl = impl;
+    if (impl == QUEUE_IMPL_LOCKFREE)
+        return task_queue_init_lockfree(q, capacity);
     q->tasks = calloc(capacity, sizeof(Task));
     if (!q->tasks)
         return -1;
@@ -24,6 +50,14 @@ void task_queue_destroy(TaskQueue *q)
 {
     if (!q)
         return;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        mpmc_ring_destroy(&q->ready);
+        mpmc_ring_destroy(&q->free_slots);
+        free(q->pool);
+        q->pool = NULL;
+        return;
+    }
     pthread_mutex_lock(&q->mtx);
     q->shutdown = true;
     pthread_cond_broadcast(&q->not_empty);
@@ -39,6 +73,20 @@ int task_queue_push(TaskQueue *q, Task *t)
 {
     if (!q || !t)
         return -1;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        uintptr_t slot;
+        if (mpmc_ring_is_shutdown(&q->ready) || mpmc_ring_pop(&q->free_slots, &slot) != 0)
+            return -1;
+        if (mpmc_ring_is_shutdown(&q->ready))
+        {
+            mpmc_ring_push(&q->free_slots, slot);
+            return -1;
+        }
+        q->pool[slot] = *t;
+        mpmc_ring_push(&q->ready, slot);
+        return 0;
+    }
     pthread_mutex_lock(&q->mtx);
     while (q->size == q->capacity && !q->shutdown)
         pthread_cond_wait(&q->not_full, &q->mtx);
@@ -59,6 +107,16 @@ int task_queue_pop(TaskQueue *q, Task *out)
 {
     if (!q || !out)
         return -1;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        /* Drains whatever is queued before reporting shutdown */
+        uintptr_t slot;
+        if (mpmc_ring_pop(&q->ready, &slot) != 0)
+            return -1;
+        *out = q->pool[slot];
+        mpmc_ring_push(&q->free_slots, slot);
+        return 0;
+    }
     pthread_mutex_lock(&q->mtx);
     while (q->size == 0 && !q->shutdown)
         pthread_cond_wait(&q->not_empty, &q->mtx);
@@ -75,13 +133,56 @@ int task_queue_pop(TaskQueue *q, Task *out)
     return 0;
 }
 
+int task_queue_try_pop(TaskQueue *q, Task *out)
+{
+    if (!q || !out)
+        return -1;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        uintptr_t slot;
+        if (!mpmc_ring_try_pop(&q->ready, &slot))
+            return -1;
+        *out = q->pool[slot];
+        mpmc_ring_push(&q->free_slots, slot);
+        return 0;
+    }
+    pthread_mutex_lock(&q->mtx);
+    if (q->size == 0)
+    {
+        pthread_mutex_unlock(&q->mtx);
+        return -1;
+    }
+    *out = q->tasks[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->size--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mtx);
+    return 0;
+}
+
 void task_queue_signal_shutdown(TaskQueue *q)
 {
     if (!q)
         return;
+    if (q->impl == QUEUE_IMPL_LOCKFREE)
+    {
+        mpmc_ring_shutdown(&q->ready);
+        mpmc_ring_shutdown(&q->free_slots);
+        return;
+    }
     pthread_mutex_lock(&q->mtx);
     q->shutdown = true;
     pthread_cond_broadcast(&q->not_empty);
     pthread_cond_broadcast(&q->not_full);
     pthread_mutex_unlock(&q->mtx);
 }
+
+bool task_has_body(task_type_t type)
+{
+    return type == TASK_UPLOAD || type == TASK_UPLOAD_DELTA || type == TASK_DOWNLOAD_DELTA;
+}
+
+bool task_writes(task_type_t type)
+{
+    return type == TASK_UPLOAD || type == TASK_UPLOAD_DELTA || type == TASK_DELETE;
+}
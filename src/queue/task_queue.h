@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "mpmc_ring.h"
 
 /* -------------------- Task Types -------------------- */
 typedef enum
@@ -12,24 +13,58 @@ typedef enum
     TASK_UPLOAD,
     TASK_DOWNLOAD,
     TASK_DELETE,
-    TASK_LIST
+    TASK_LIST,
+    TASK_SIGNATURE,      // delta sync: signature of the stored file
+    TASK_UPLOAD_DELTA,   // delta sync: rebuild the file from a streamed delta
+    TASK_DOWNLOAD_DELTA, // delta sync: delta against a streamed client signature
+    TASK_UPLOAD_OFFSET   // resumable upload: bytes of a partial upload already stored
 } task_type_t;
 
+/* Stage times of a task, for the metrics (ns; 0 = stage not reached) */
+typedef struct TaskTiming
+{
+    uint64_t queued;     // task_lanes_push time (monotonic clock)
+    uint64_t lock;       // file lock wait
+    uint64_t disk;       // storing the body, file syscall, signature/delta
+    uint64_t db;         // metadata queries and updates
+} TaskTiming;
+
 /* -------------------- Task Definition -------------------- */
 typedef struct Task
 {
     task_type_t type;
     uint64_t session_id; // session ID for result delivery (Phase 2.1)
+    uint64_t seq;        // session completion slot (response_begin)
     char username[64];   // username (authenticated user)
-    char filename[256];  // file name for upload/download/delete
-    char temp_path[512]; // optional temp path for upload
-    size_t filesize;     // file size for upload/download
-    void *data_buffer;   // buffer for upload data (for UPLOAD tasks)
+    int weight;          // user's fair scheduling weight (Session.weight)
+    char filename[256];  // file name for upload/download/delete; LIST: cursor
+    char temp_path[512]; // temp file holding the streamed request body
+    size_t filesize;     // body size (for UPLOAD also the file size)
+    uint64_t offset;     // DOWNLOAD: range start; resumed UPLOAD: first body byte
+    uint64_t length;     // DOWNLOAD: range length, 0 = to the end; LIST: page size
+    bool resumable;      // UPLOAD body kept as a partial if the connection drops
+    bool compressed;     // UPLOAD body / DOWNLOAD reply in compress.h segments
+    size_t body_len;     // body bytes following the request on the wire
+    TaskTiming timing;   // filled in by task_lanes and the worker
 } Task;
 
 /* -------------------- Queue Struct -------------------- */
+/*
+ * QUEUE_IMPL_MUTEX copies Tasks through a mutex-protected circular buffer.
+ * QUEUE_IMPL_LOCKFREE copies each Task once into a preallocated pool slot
+ * and passes only the slot index through lock-free rings: free_slots holds
+ * unused indices (empty == queue full), ready holds queued ones.
+ */
 typedef struct TaskQueue
 {
+    queue_impl_t impl;
+
+    /* QUEUE_IMPL_LOCKFREE */
+    Task *pool;
+    MpmcRing free_slots;
+    MpmcRing ready;
+
+    /* QUEUE_IMPL_MUTEX */
     Task *tasks;
     int capacity;
     int head;
@@ -42,10 +77,17 @@ typedef struct TaskQueue
 } TaskQueue;
 
 /* -------------------- Function Prototypes -------------------- */
-int task_queue_init(TaskQueue *q, int capacity);
+int task_queue_init(TaskQueue *q, int capacity, queue_impl_t impl);
 void task_queue_destroy(TaskQueue *q);
 int task_queue_push(TaskQueue *q, Task *t);
 int task_queue_pop(TaskQueue *q, Task *out);
+int task_queue_try_pop(TaskQueue *q, Task *out); /* -1 if nothing is queued */
 void task_queue_signal_shutdown(TaskQueue *q);
 
+/* Task arrives with a body in temp_path (UPLOAD and the delta requests) */
+bool task_has_body(task_type_t type);
+
+/* Task replaces or removes the file (UPLOAD, UPLOAD_DELTA, DELETE) */
+bool task_writes(task_type_t type);
+
 #endif
@@ -4,24 +4,62 @@
 #include <signal.h>
 #include <pthread.h>
 #include "queue/client_queue.h"
-#include "queue/task_queue.h"
+#include "queue/task_lanes.h"
 #include "session/session_manager.h"
+#include "utils/logger.h"
 
 /* -------------------- Configuration Constants -------------------- */
 #define DEFAULT_PORT "10985"
+#define DEFAULT_ADMIN_PORT "10986"  /* Metrics endpoint, loopback only */
 #define DEFAULT_QUEUE_CAPACITY 64
 #define LISTEN_BACKLOG 128
 #define CLIENT_THREAD_COUNT 4
 #define WORKER_THREAD_COUNT 4
-#define TASK_QUEUE_CAPACITY 128
+#define INTERACTIVE_WORKER_COUNT 1   /* Workers reserved for TASK_LANE_INTERACTIVE */
+#define TASK_QUEUE_CAPACITY 128      /* Per lane */
+#define TASK_QUEUE_USER_CAPACITY 32  /* Per lane and user */
+#define DEFAULT_IO_THREAD_COUNT 2
+#define MAX_IO_THREAD_COUNT 64
+#define DEFAULT_IDLE_TIMEOUT 300     /* Seconds; sessions silent this long are closed */
+#define AUTH_TIMEOUT 30              /* Seconds to authenticate after connecting */
+#define TCP_KEEPALIVE_IDLE 60        /* Dead peer detection: probe after 60s of silence, */
+#define TCP_KEEPALIVE_INTERVAL 10    /* every 10s, */
+#define TCP_KEEPALIVE_COUNT 6        /* drop after 6 unanswered (2 minutes total) */
+
+/* -------------------- Server Configuration -------------------- */
+typedef enum
+{
+    SERVER_MODE_THREADS,  /* One client thread per connection (ClientQueue) */
+    SERVER_MODE_EPOLL     /* Event-driven reactor, connections multiplexed */
+} server_mode_t;
+
+typedef enum
+{
+    STORAGE_BACKEND_SYNC,   /* Blocking rename/open/unlink, one task at a time */
+    STORAGE_BACKEND_URING   /* Per-worker io_uring, file syscalls batched across tasks */
+} storage_backend_t;
+
+typedef struct ServerConfig
+{
+    server_mode_t mode;   /* Connection engine */
+    int io_threads;       /* Reactor I/O threads (epoll mode) */
+    size_t upload_chunk_size; /* Bytes buffered per upload before hitting disk */
+    queue_impl_t queue_impl;  /* ClientQueue implementation */
+    storage_backend_t storage_backend; /* Worker file I/O path */
+    bool compress_at_rest;    /* Store compressible uploads' chunks compressed */
+    log_level_t log_level;    /* Least severe level logged */
+    const char *admin_port;   /* Metrics endpoint port, NULL = disabled */
+    int idle_timeout;         /* Seconds before an idle session is closed, 0 = never */
+} ServerConfig;
 
 /* -------------------- Global Variables -------------------- */
 extern volatile sig_atomic_t keep_running;
 extern int listen_fd;
 
 extern ClientQueue client_queue;
-extern TaskQueue task_queue;
+extern TaskLanes task_lanes;
 extern SessionManager session_manager;  /* Global session manager (Phase 2.1) */
+extern ServerConfig server_config;
 
 extern pthread_t client_threads[CLIENT_THREAD_COUNT];
 extern pthread_t worker_threads[WORKER_THREAD_COUNT];
@@ -1,81 +1,259 @@
 #include "response_queue.h"
+#include "../storage/chunk_store.h"
+#include "../utils/metrics.h"
+#include "../utils/obj_pool.h"
 #include <string.h>
 #include <stdlib.h>
 
+/* -------------------- Response Buffers -------------------- */
+
+/* Size classes; larger bodies come from malloc */
+static const size_t buf_class_sizes[RESPONSE_BUF_CLASSES] = {1024, 16 * 1024, 256 * 1024};
+static const char *const buf_class_names[RESPONSE_BUF_CLASSES] = {"buf_1k", "buf_16k",
+                                                                  "buf_256k"};
+static ObjPool buf_pools[RESPONSE_BUF_CLASSES];
+static bool buf_pools_ready;
+static pthread_once_t buf_pools_once = PTHREAD_ONCE_INIT;
+static uint64_t buf_oversize;
+
+/* Precedes every buffer: the pool it returns to, NULL if malloc'd */
+#define BUF_HEADER 16
+
+static void buf_pools_init(void)
+{
+    for (int i = 0; i < RESPONSE_BUF_CLASSES; i++)
+    {
+        if (obj_pool_init(&buf_pools[i], buf_class_names[i], BUF_HEADER + buf_class_sizes[i], 4,
+                          NULL, NULL) != 0)
+        {
+            while (--i >= 0)
+                obj_pool_destroy(&buf_pools[i]);
+            return;
+        }
+    }
+    buf_pools_ready = true;
+}
+
+void *response_buf_alloc(size_t size)
+{
+    pthread_once(&buf_pools_once, buf_pools_init);
+
+    ObjPool *pool = NULL;
+    for (int i = 0; buf_pools_ready && i < RESPONSE_BUF_CLASSES && !pool; i++)
+        if (size <= buf_class_sizes[i])
+            pool = &buf_pools[i];
+
+    char *buf;
+    if (pool)
+    {
+        buf = obj_pool_alloc(pool);
+    }
+    else
+    {
+        buf = malloc(BUF_HEADER + size);
+        __atomic_fetch_add(&buf_oversize, 1, __ATOMIC_RELAXED);
+    }
+    if (!buf)
+        return NULL;
+    *(ObjPool **)buf = pool;
+    return buf + BUF_HEADER;
+}
+
+void response_buf_free(void *data)
+{
+    if (!data)
+        return;
+
+    char *buf = (char *)data - BUF_HEADER;
+    if (*(ObjPool **)buf)
+        obj_pool_free(buf);
+    else
+        free(buf);
+}
+
+uint64_t response_buf_oversize_count(void)
+{
+    return __atomic_load_n(&buf_oversize, __ATOMIC_RELAXED);
+}
+
+/* -------------------- Completion Slots -------------------- */
+
+static void completion_reset(Completion *c)
+{
+    c->status = RESPONSE_SUCCESS;
+    c->message[0] = '\0';
+    c->data = NULL;
+    c->data_size = 0;
+    c->file = NULL;
+    c->file_size = 0;
+    c->ready = false;
+    c->op = -1;
+    c->started_ns = 0;
+    c->taken_ns = 0;
+}
+
+void completion_release(Completion *c)
+{
+    if (!c)
+        return;
+
+    if (c->data)
+    {
+        response_buf_free(c->data);
+        c->data = NULL;
+    }
+    c->data_size = 0;
+    if (c->file)
+    {
+        chunk_stream_close(c->file);
+        c->file = NULL;
+    }
+    c->file_size = 0;
+}
+
 int response_init(Response *resp)
 {
     if (!resp)
         return -1;
 
-    resp->status = RESPONSE_SUCCESS;
-    memset(resp->message, 0, sizeof(resp->message));
-    resp->data = NULL;
-    resp->data_size = 0;
-    resp->ready = false;
+    for (int i = 0; i < RESPONSE_MAX_INFLIGHT; i++)
+        completion_reset(&resp->slots[i]);
+    resp->next_seq = 0;
+    resp->next_reply = 0;
+    resp->notify = NULL;
+    resp->notify_ctx = NULL;
 
     if (pthread_mutex_init(&resp->mtx, NULL) != 0)
         return -1;
 
-    if (pthread_cond_init(&resp->cv, NULL) != 0)
-    {
-        pthread_mutex_destroy(&resp->mtx);
-        return -1;
-    }
-
     return 0;
 }
 
-void response_destroy(Response *resp)
+void response_reset(Response *resp)
 {
     if (!resp)
         return;
 
     pthread_mutex_lock(&resp->mtx);
-    if (resp->data)
+    for (int i = 0; i < RESPONSE_MAX_INFLIGHT; i++)
     {
-        free(resp->data);
-        resp->data = NULL;
+        completion_release(&resp->slots[i]);
+        completion_reset(&resp->slots[i]);
     }
+    resp->next_seq = 0;
+    resp->next_reply = 0;
+    resp->notify = NULL;
+    resp->notify_ctx = NULL;
+    pthread_mutex_unlock(&resp->mtx);
+}
+
+void response_destroy(Response *resp)
+{
+    if (!resp)
+        return;
+
+    pthread_mutex_lock(&resp->mtx);
+    for (int i = 0; i < RESPONSE_MAX_INFLIGHT; i++)
+        completion_release(&resp->slots[i]);
     pthread_mutex_unlock(&resp->mtx);
 
     pthread_mutex_destroy(&resp->mtx);
-    pthread_cond_destroy(&resp->cv);
 }
 
-void response_set(Response *resp, response_status_t status, const char *message,
-                  void *data, size_t data_size)
+void response_set_notify(Response *resp, void (*notify)(void *ctx), void *ctx)
 {
     if (!resp)
         return;
 
     pthread_mutex_lock(&resp->mtx);
+    resp->notify = notify;
+    resp->notify_ctx = ctx;
+    pthread_mutex_unlock(&resp->mtx);
+}
+
+int response_begin(Response *resp, int op, uint64_t *seq)
+{
+    if (!resp || response_pending(resp) >= RESPONSE_MAX_INFLIGHT)
+        return -1;
+
+    /* The slot is free: no worker touches it until the task is queued */
+    Completion *c = &resp->slots[resp->next_seq % RESPONSE_MAX_INFLIGHT];
+    c->op = op;
+    c->started_ns = metrics_now();
+    *seq = resp->next_seq++;
+    return 0;
+}
+
+int response_pending(const Response *resp)
+{
+    return (int)(resp->next_seq - resp->next_reply);
+}
+
+static Completion *response_slot(Response *resp, uint64_t seq)
+{
+    return &resp->slots[seq % RESPONSE_MAX_INFLIGHT];
+}
 
-    resp->status = status;
+/* Publish a result: caller holds resp->mtx */
+static void response_publish(Response *resp, Completion *c, response_status_t status,
+                             const char *message)
+{
+    c->status = status;
     if (message)
     {
-        strncpy(resp->message, message, sizeof(resp->message) - 1);
-        resp->message[sizeof(resp->message) - 1] = '\0';
+        strncpy(c->message, message, sizeof(c->message) - 1);
+        c->message[sizeof(c->message) - 1] = '\0';
     }
+    c->ready = true;
 
-    resp->data = data;
-    resp->data_size = data_size;
-    resp->ready = true;
+    if (resp->notify)
+        resp->notify(resp->notify_ctx);
+}
+
+void response_set(Response *resp, uint64_t seq, response_status_t status, const char *message,
+                  void *data, size_t data_size)
+{
+    if (!resp)
+        return;
 
-    pthread_cond_signal(&resp->cv);
+    pthread_mutex_lock(&resp->mtx);
+    Completion *c = response_slot(resp, seq);
+    c->data = data;
+    c->data_size = data_size;
+    response_publish(resp, c, status, message);
     pthread_mutex_unlock(&resp->mtx);
 }
 
-int response_wait(Response *resp)
+void response_set_file(Response *resp, uint64_t seq, response_status_t status,
+                       const char *message, ChunkStream *file, size_t file_size)
 {
     if (!resp)
-        return -1;
+        return;
+
+    pthread_mutex_lock(&resp->mtx);
+    Completion *c = response_slot(resp, seq);
+    c->file = file;
+    c->file_size = file_size;
+    response_publish(resp, c, status, message);
+    pthread_mutex_unlock(&resp->mtx);
+}
+
+bool response_take(Response *resp, Completion *out)
+{
+    if (!resp || response_pending(resp) == 0)
+        return false;
 
     pthread_mutex_lock(&resp->mtx);
-    while (!resp->ready)
+    Completion *c = response_slot(resp, resp->next_reply);
+    bool ready = c->ready;
+    if (ready)
     {
-        pthread_cond_wait(&resp->cv, &resp->mtx);
+        *out = *c;
+        out->taken_ns = metrics_now();
+        completion_reset(c);
+        resp->next_reply++;
     }
     pthread_mutex_unlock(&resp->mtx);
 
-    return 0;
+    return ready;
 }
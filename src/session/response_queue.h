@@ -4,6 +4,26 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+struct ChunkStream;  /* storage/chunk_store.h */
+
+/*
+ * Per-session completion queue (worker -> connection)
+ *
+ * The connection side reserves a sequence number for every task it queues
+ * (response_begin) and stamps it on the Task. A worker posts the result into
+ * that sequence's slot (response_set / response_set_file) and fires the
+ * notify hook; nobody blocks on the worker. The connection side then takes
+ * results strictly in sequence order (response_take), so replies go out in
+ * request order even when several workers finish out of order.
+ *
+ * A session never has more than RESPONSE_MAX_INFLIGHT tasks outstanding,
+ * and must not be destroyed while any are (response_pending() > 0).
+ */
+
+#define RESPONSE_MAX_INFLIGHT 8
+#define RESPONSE_BUF_CLASSES 3   /* Pooled size classes for Completion.data (1K, 16K, 256K) */
 
 /* Response status codes */
 typedef enum
@@ -12,32 +32,85 @@ typedef enum
     RESPONSE_ERROR = -1,
     RESPONSE_FILE_NOT_FOUND = -2,
     RESPONSE_QUOTA_EXCEEDED = -3,
-    RESPONSE_PERMISSION_DENIED = -4
+    RESPONSE_PERMISSION_DENIED = -4,
+    RESPONSE_BUSY = -5,            // Task queue full, task never ran
+    RESPONSE_CONFLICT = -6         // Delta does not apply to the stored file
 } response_status_t;
 
-/* Response structure for worker->client communication */
-typedef struct Response
+/* One finished task. After response_take the caller owns data and file. */
+typedef struct Completion
 {
     response_status_t status;
     char message[512];     // Error message or info
-    void *data;            // Optional data (for download)
+    void *data;            // Optional in-memory data (e.g. list output), from response_buf_alloc
     size_t data_size;      // Size of data
+    struct ChunkStream *file; // Optional file body (download), NULL if none
+    size_t file_size;      // Bytes of file to send (zero-copy, sendfile)
     bool ready;            // Result is ready
-    pthread_mutex_t mtx;
-    pthread_cond_t cv;     // Client waits on this
+    int op;                // task_type_t of the task (metrics)
+    uint64_t started_ns;   // Task queued (response_begin), monotonic clock
+    uint64_t taken_ns;     // Result taken by the connection (response_take)
+} Completion;
+
+/* Completion slots for one session */
+typedef struct Response
+{
+    Completion slots[RESPONSE_MAX_INFLIGHT]; // Indexed by seq % RESPONSE_MAX_INFLIGHT
+    uint64_t next_seq;     // Sequence for the next task (connection side only)
+    uint64_t next_reply;   // Sequence of the next result to take (connection side only)
+    pthread_mutex_t mtx;   // Protects slots
+    void (*notify)(void *ctx); // Completion hook (reactor loop / client thread eventfd)
+    void *notify_ctx;          // Argument passed to notify
 } Response;
 
 /* Initialize a response structure */
 int response_init(Response *resp);
 
-/* Destroy a response structure */
+/* Release any bodies never taken and empty every slot for a new session
+ * (keeps the mutex, unlike destroy + init) */
+void response_reset(Response *resp);
+
+/* Destroy a response structure (frees any bodies never taken) */
 void response_destroy(Response *resp);
 
-/* Worker fills response and signals client */
-void response_set(Response *resp, response_status_t status, const char *message,
+/* Install a hook run (under resp->mtx) whenever a result becomes ready.
+ * Once this returns, no worker is still running the previous hook. */
+void response_set_notify(Response *resp, void (*notify)(void *ctx), void *ctx);
+
+/* Reserve the next sequence number for a task (op: its task_type_t) about
+ * to be queued. Returns 0, or -1 if RESPONSE_MAX_INFLIGHT tasks are already
+ * outstanding. */
+int response_begin(Response *resp, int op, uint64_t *seq);
+
+/* Tasks queued but whose result has not been taken yet */
+int response_pending(const Response *resp);
+
+/* Worker fills the result for seq and fires the notify hook */
+void response_set(Response *resp, uint64_t seq, response_status_t status, const char *message,
                   void *data, size_t data_size);
 
-/* Client waits for response (blocks until ready) */
-int response_wait(Response *resp);
+/* Worker hands an opened file to the connection for zero-copy sending;
+ * the Response owns file until the result is taken */
+void response_set_file(Response *resp, uint64_t seq, response_status_t status,
+                       const char *message, struct ChunkStream *file, size_t file_size);
+
+/* Take the next result in sequence order if it has arrived.
+ * Returns true and fills *out (transferring data/file ownership). */
+bool response_take(Response *resp, Completion *out);
+
+/* Release a taken result's body (frees data, closes file) */
+void completion_release(Completion *c);
+
+/*
+ * Buffers for Completion.data. Sizes up to the largest class come from
+ * per-class object pools (utils/obj_pool.h), so replies like LIST pages do
+ * not go through malloc; anything larger is malloc'd and counted. Free
+ * with response_buf_free (completion_release does), never free().
+ */
+void *response_buf_alloc(size_t size);
+void response_buf_free(void *data);
+
+/* Buffers too large for any class since start */
+uint64_t response_buf_oversize_count(void);
 
 #endif /* RESPONSE_QUEUE_H */
@@ -1,15 +1,139 @@
 #include "session_manager.h"
+#include "../sync/rcu.h"
+#include "../utils/logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <linux/sockios.h>
 
-/* Hash function for session IDs */
-static uint32_t hash_session_id(uint64_t session_id)
+/* Slot of a removed session: lookups probe past it, inserts may reuse it */
+#define SESSION_TOMBSTONE ((Session *)1)
+
+/* Deferred releases after which a disconnect runs the grace period itself
+ * rather than wait for the reaper's rcu_reclaim */
+#define SESSION_RCU_BACKLOG 1024
+
+/* -------------------- Session Table -------------------- */
+
+/* IDs are sequential, so the low bits spread them over the table */
+static size_t hash_session_id(const SessionTable *table, uint64_t session_id)
+{
+    return (size_t)session_id & table->mask;
+}
+
+static SessionTable *table_alloc(size_t capacity)
+{
+    SessionTable *table = calloc(1, sizeof(SessionTable) + capacity * sizeof(Session *));
+    if (table)
+        table->mask = capacity - 1;
+    return table;
+}
+
+static void table_free_rcu(RcuHead *head)
+{
+    free((char *)head - offsetof(SessionTable, rcu));
+}
+
+/* Lock-free probe; call inside an RCU read section or with manager_mtx.
+ * Returns the session's slot (and the session, as read) or NULL. */
+static Session **table_find(SessionTable *table, uint64_t session_id, Session **found)
+{
+    size_t index = hash_session_id(table, session_id);
+    for (size_t probe = 0; probe <= table->mask; probe++)
+    {
+        Session **slot = &table->slots[index];
+        Session *session = __atomic_load_n(slot, __ATOMIC_SEQ_CST);
+        if (session == NULL)
+            break;
+        if (session != SESSION_TOMBSTONE && session->session_id == session_id)
+        {
+            *found = session;
+            return slot;
+        }
+        index = (index + 1) & table->mask;
+    }
+    *found = NULL;
+    return NULL;
+}
+
+/* First free slot (empty or tombstone) on session_id's probe path; the
+ * table always has one because it is rebuilt at 50% use */
+static Session **table_free_slot(SessionTable *table, uint64_t session_id)
+{
+    size_t index = hash_session_id(table, session_id);
+    while (table->slots[index] != NULL && table->slots[index] != SESSION_TOMBSTONE)
+        index = (index + 1) & table->mask;
+    return &table->slots[index];
+}
+
+/*
+ * Make room for one more session (manager_mtx held). Once live sessions
+ * plus tombstones would pass half the slots, copy the live sessions into
+ * a table sized for at most 25% load, publish it, and hand the old one
+ * to rcu_call (waiting for the grace period here would stall every
+ * connect and disconnect on manager_mtx). Returns -1 only if memory runs
+ * out with the current table full.
+ */
+static int table_reserve(SessionManager *mgr)
+{
+    SessionTable *old = mgr->table;
+    size_t capacity = old->mask + 1;
+    if ((old->used + 1) * 2 <= capacity)
+        return 0;
+
+    while ((mgr->active_session_count + 1) * 4 > capacity)
+        capacity *= 2;
+    SessionTable *table = table_alloc(capacity);
+    if (!table)
+    {
+        LOG_ERROR("SessionManager", "Failed to grow session table to %zu slots", capacity);
+        return old->used + 1 < old->mask + 1 ? 0 : -1;
+    }
+
+    for (size_t i = 0; i <= old->mask; i++)
+    {
+        Session *session = old->slots[i];
+        if (session && session != SESSION_TOMBSTONE)
+        {
+            *table_free_slot(table, session->session_id) = session;
+            table->used++;
+        }
+    }
+
+    __atomic_store_n(&mgr->table, table, __ATOMIC_RELEASE);
+    rcu_call(&old->rcu, table_free_rcu);
+
+    LOG_DEBUG("SessionManager", "Session table rebuilt: %zu slots, %zu sessions", capacity,
+              table->used);
+    return 0;
+}
+
+/* Pool hooks: a Session's locks live as long as the pooled object, so
+ * connecting costs no mutex setup */
+static void session_object_init(void *obj)
+{
+    Session *session = obj;
+    response_init(&session->response);
+    pthread_mutex_init(&session->session_mtx, NULL);
+}
+
+static void session_object_fini(void *obj)
+{
+    Session *session = obj;
+    response_destroy(&session->response);
+    pthread_mutex_destroy(&session->session_mtx);
+}
+
+/* Return a session to the pool (its socket is already closed) */
+static void session_free(Session *session)
 {
-    return (uint32_t)(session_id % MAX_SESSIONS);
+    response_reset(&session->response);
+    obj_pool_free(session);
 }
 
 /* -------------------- SessionManager Functions -------------------- */
@@ -19,13 +143,26 @@ int session_manager_init(SessionManager *mgr)
     if (!mgr)
         return -1;
 
-    /* Initialize session array to NULL */
-    memset(mgr->sessions, 0, sizeof(mgr->sessions));
+    mgr->table = table_alloc(SESSION_TABLE_INITIAL_CAPACITY);
+    if (!mgr->table)
+    {
+        perror("[SessionManager] Failed to allocate session table");
+        return -1;
+    }
 
     /* Initialize manager mutex */
     if (pthread_mutex_init(&mgr->manager_mtx, NULL) != 0)
     {
         perror("[SessionManager] Failed to init mutex");
+        free(mgr->table);
+        return -1;
+    }
+
+    if (obj_pool_init(&mgr->session_pool, "session", sizeof(Session), 1, session_object_init,
+                      session_object_fini) != 0)
+    {
+        pthread_mutex_destroy(&mgr->manager_mtx);
+        free(mgr->table);
         return -1;
     }
 
@@ -37,7 +174,14 @@ int session_manager_init(SessionManager *mgr)
     mgr->active_session_count = 0;
     mgr->peak_session_count = 0;
 
-    printf("[SessionManager] Initialized (max sessions: %d)\n", MAX_SESSIONS);
+    /* Reaping is off until session_manager_set_timeouts */
+    timer_wheel_init(&mgr->idle_wheel, (uint64_t)time(NULL));
+    mgr->idle_timeout = 0;
+    mgr->auth_timeout = 0;
+    mgr->reaped_session_count = 0;
+
+    LOG_INFO("SessionManager", "Initialized (%d slots, grows on demand)",
+             SESSION_TABLE_INITIAL_CAPACITY);
     return 0;
 }
 
@@ -46,41 +190,45 @@ void session_manager_destroy(SessionManager *mgr)
     if (!mgr)
         return;
 
+    /* Destroyed sessions and replaced tables still waiting on rcu_call
+     * (the reaper, which reclaims them, has stopped) */
+    rcu_reclaim();
+
     pthread_mutex_lock(&mgr->manager_mtx);
 
-    /* Clean up all remaining sessions (Phase 2.7: Enhanced cleanup) */
+    /* Clean up all remaining sessions (Phase 2.7: Enhanced cleanup). Every
+     * thread that could hold a reference has been joined by now. */
     int active_sessions = 0;
-    for (int i = 0; i < MAX_SESSIONS; i++)
+    SessionTable *table = mgr->table;
+    for (size_t i = 0; i <= table->mask; i++)
     {
-        if (mgr->sessions[i])
+        Session *session = table->slots[i];
+        if (session && session != SESSION_TOMBSTONE)
         {
-            Session *session = mgr->sessions[i];
             active_sessions++;
-
-            /* Mark inactive and destroy response */
             session->is_active = false;
-            response_destroy(&session->response);
-            pthread_mutex_destroy(&session->session_mtx);
 
             /* Close socket if still open */
             if (session->socket_fd >= 0)
             {
-                printf("[SessionManager] Closing socket %d for session %lu\n",
-                       session->socket_fd, session->session_id);
+                LOG_DEBUG("SessionManager", "Closing socket %d for session %lu", session->socket_fd,
+                          session->session_id);
                 shutdown(session->socket_fd, SHUT_RDWR);
                 close(session->socket_fd);
                 session->socket_fd = -1;
             }
 
-            free(session);
-            mgr->sessions[i] = NULL;
+            session_free(session);
         }
     }
+    free(table);
+    mgr->table = NULL;
 
     pthread_mutex_unlock(&mgr->manager_mtx);
     pthread_mutex_destroy(&mgr->manager_mtx);
+    obj_pool_destroy(&mgr->session_pool);
 
-    printf("[SessionManager] Destroyed (%d active sessions cleaned up)\n", active_sessions);
+    LOG_INFO("SessionManager", "Destroyed (%d active sessions cleaned up)", active_sessions);
 }
 
 uint64_t session_create(SessionManager *mgr, int socket_fd)
@@ -88,44 +236,25 @@ uint64_t session_create(SessionManager *mgr, int socket_fd)
     if (!mgr || socket_fd < 0)
         return 0;
 
-    /* Allocate session structure */
-    Session *session = (Session *)calloc(1, sizeof(Session));
+    /* Take a session from the pool (its mutexes and completion slots
+     * are ready; everything else is left from its previous use) */
+    Session *session = obj_pool_alloc(&mgr->session_pool);
     if (!session)
     {
-        perror("[SessionManager] Failed to allocate session");
+        LOG_ERROR("SessionManager", "Failed to allocate session");
         return 0;
     }
 
-    pthread_mutex_lock(&mgr->manager_mtx);
-
-    /* Generate unique session ID */
-    uint64_t session_id = mgr->next_session_id++;
-    
-    /* Find slot in hash table (linear probing) */
-    uint32_t index = hash_session_id(session_id);
-    uint32_t probe_count = 0;
-    
-    while (mgr->sessions[index] != NULL && probe_count < MAX_SESSIONS)
-    {
-        index = (index + 1) % MAX_SESSIONS;
-        probe_count++;
-    }
-
-    if (probe_count >= MAX_SESSIONS)
-    {
-        /* Table is full */
-        pthread_mutex_unlock(&mgr->manager_mtx);
-        free(session);
-        fprintf(stderr, "[SessionManager] Session table full\n");
-        return 0;
-    }
-
-    /* Initialize session */
-    session->session_id = session_id;
+    /* Initialize session (not visible to lookups until it is inserted) */
     session->socket_fd = socket_fd;
     session->is_authenticated = false;
+    session->deflate = false;
+    session->weight = 0;
     session->is_active = true;
+    session->refs = 1;  /* The table's */
     memset(session->username, 0, sizeof(session->username));
+    session->idle_timer.next = session->idle_timer.prev = NULL;
+    session->reap_next = NULL;
 
     /* Initialize session lifetime tracking (Phase 2.9) */
     time_t now = time(NULL);
@@ -134,28 +263,37 @@ uint64_t session_create(SessionManager *mgr, int socket_fd)
     session->last_activity = now;
     session->operations_count = 0;
 
-    /* Initialize response structure */
-    if (response_init(&session->response) != 0)
+    pthread_mutex_lock(&mgr->manager_mtx);
+
+    if (table_reserve(mgr) != 0)
     {
         pthread_mutex_unlock(&mgr->manager_mtx);
-        free(session);
-        fprintf(stderr, "[SessionManager] Failed to init response\n");
+        session_free(session);
+        LOG_ERROR("SessionManager", "Session table full");
         return 0;
     }
 
-    /* Initialize per-session mutex */
-    if (pthread_mutex_init(&session->session_mtx, NULL) != 0)
+    /* Generate unique session ID */
+    uint64_t session_id = mgr->next_session_id++;
+    session->session_id = session_id;
+
+    /* Insert into hash table; the release store publishes the initialized session */
+    SessionTable *table = mgr->table;
+    Session **slot = table_free_slot(table, session_id);
+    if (*slot == NULL)
+        table->used++;
+    __atomic_store_n(slot, session, __ATOMIC_RELEASE);
+
+    /* First look at the earlier of the two deadlines; session_expire
+     * re-arms at whichever applies then */
+    if (mgr->idle_timeout > 0)
     {
-        pthread_mutex_unlock(&mgr->manager_mtx);
-        response_destroy(&session->response);
-        free(session);
-        fprintf(stderr, "[SessionManager] Failed to init session mutex\n");
-        return 0;
+        time_t first = mgr->idle_timeout;
+        if (mgr->auth_timeout > 0 && mgr->auth_timeout < first)
+            first = mgr->auth_timeout;
+        timer_wheel_add(&mgr->idle_wheel, &session->idle_timer, (uint64_t)(now + first));
     }
 
-    /* Insert into hash table */
-    mgr->sessions[index] = session;
-
     /* Update statistics (Phase 2.9) */
     mgr->total_sessions_created++;
     mgr->active_session_count++;
@@ -167,11 +305,12 @@ uint64_t session_create(SessionManager *mgr, int socket_fd)
     /* Read statistics before unlocking (to avoid data race) */
     uint64_t active_count = mgr->active_session_count;
     uint64_t peak_count = mgr->peak_session_count;
+    size_t index = (size_t)(slot - table->slots);
 
     pthread_mutex_unlock(&mgr->manager_mtx);
 
-    printf("[SessionManager] Created session %lu (fd=%d, slot=%u, active=%lu/%lu peak)\n",
-           session_id, socket_fd, index, active_count, peak_count);
+    LOG_DEBUG("SessionManager", "Created session %lu (fd=%d, slot=%zu, active=%lu/%lu peak)",
+              session_id, socket_fd, index, active_count, peak_count);
 
     return session_id;
 }
@@ -181,44 +320,29 @@ Session *session_get(SessionManager *mgr, uint64_t session_id)
     if (!mgr || session_id == 0)
         return NULL;
 
-    pthread_mutex_lock(&mgr->manager_mtx);
-
-    /* Search hash table (linear probing) */
-    uint32_t index = hash_session_id(session_id);
-    uint32_t probe_count = 0;
+    /* The read section keeps the table and any session found in it from
+     * being freed until the reference is taken */
+    Session *session;
+    rcu_read_lock();
+    table_find(__atomic_load_n(&mgr->table, __ATOMIC_SEQ_CST), session_id, &session);
+    if (session && !session->is_active)
+        session = NULL;
+    if (session)
+        __atomic_fetch_add(&session->refs, 1, __ATOMIC_RELAXED);
+    rcu_read_unlock();
+
+    return session;
+}
 
-    while (probe_count < MAX_SESSIONS)
-    {
-        Session *session = mgr->sessions[index];
-        
-        if (session == NULL)
-        {
-            /* Empty slot, session not found */
-            break;
-        }
-        
-        if (session->session_id == session_id)
-        {
-            /* Found the session, check if active */
-            if (session->is_active)
-            {
-                pthread_mutex_unlock(&mgr->manager_mtx);
-                return session;
-            }
-            else
-            {
-                /* Session exists but is inactive */
-                pthread_mutex_unlock(&mgr->manager_mtx);
-                return NULL;
-            }
-        }
-        
-        index = (index + 1) % MAX_SESSIONS;
-        probe_count++;
-    }
+void session_put(Session *session)
+{
+    if (session && __atomic_sub_fetch(&session->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        session_free(session);
+}
 
-    pthread_mutex_unlock(&mgr->manager_mtx);
-    return NULL;
+static void session_put_rcu(RcuHead *head)
+{
+    session_put((Session *)((char *)head - offsetof(Session, rcu)));
 }
 
 void session_mark_inactive(SessionManager *mgr, uint64_t session_id)
@@ -226,36 +350,16 @@ void session_mark_inactive(SessionManager *mgr, uint64_t session_id)
     if (!mgr || session_id == 0)
         return;
 
-    pthread_mutex_lock(&mgr->manager_mtx);
-
-    /* Find session in hash table */
-    uint32_t index = hash_session_id(session_id);
-    uint32_t probe_count = 0;
-
-    while (probe_count < MAX_SESSIONS)
+    Session *session;
+    rcu_read_lock();
+    table_find(__atomic_load_n(&mgr->table, __ATOMIC_SEQ_CST), session_id, &session);
+    if (session)
     {
-        Session *session = mgr->sessions[index];
-        
-        if (session == NULL)
-        {
-            break;
-        }
-        
-        if (session->session_id == session_id)
-        {
-            /* Mark session as inactive */
-            session->is_active = false;
-            
-            printf("[SessionManager] Session %lu marked inactive\n", session_id);
-            pthread_mutex_unlock(&mgr->manager_mtx);
-            return;
-        }
-        
-        index = (index + 1) % MAX_SESSIONS;
-        probe_count++;
+        /* Mark session as inactive */
+        session->is_active = false;
+        LOG_DEBUG("SessionManager", "Session %lu marked inactive", session_id);
     }
-
-    pthread_mutex_unlock(&mgr->manager_mtx);
+    rcu_read_unlock();
 }
 
 void session_destroy(SessionManager *mgr, uint64_t session_id)
@@ -266,57 +370,45 @@ void session_destroy(SessionManager *mgr, uint64_t session_id)
     pthread_mutex_lock(&mgr->manager_mtx);
 
     /* Find session in hash table */
-    uint32_t index = hash_session_id(session_id);
-    uint32_t probe_count = 0;
-
-    while (probe_count < MAX_SESSIONS)
+    Session *session;
+    Session **slot = table_find(mgr->table, session_id, &session);
+    if (!slot)
     {
-        Session *session = mgr->sessions[index];
-        
-        if (session == NULL)
-        {
-            break;
-        }
-        
-        if (session->session_id == session_id)
-        {
-            /* Mark inactive first */
-            session->is_active = false;
-            
-            /* Destroy response (frees any data) */
-            response_destroy(&session->response);
-            
-            /* Destroy session mutex */
-            pthread_mutex_destroy(&session->session_mtx);
-            
-            /* Close socket if not already closed */
-            if (session->socket_fd >= 0)
-            {
-                close(session->socket_fd);
-                session->socket_fd = -1;
-            }
-            
-            /* Update statistics (Phase 2.9) */
-            if (mgr->active_session_count > 0)
-            {
-                mgr->active_session_count--;
-            }
+        pthread_mutex_unlock(&mgr->manager_mtx);
+        return;
+    }
 
-            /* Free session and remove from table */
-            free(session);
-            mgr->sessions[index] = NULL;
+    /* Mark inactive first, then unlink (the slot stays a tombstone so
+     * probes for other sessions continue past it) */
+    session->is_active = false;
+    __atomic_store_n(slot, SESSION_TOMBSTONE, __ATOMIC_RELEASE);
+    timer_wheel_del(&session->idle_timer);
 
-            printf("[SessionManager] Session %lu destroyed (active=%lu)\n",
-                   session_id, mgr->active_session_count);
-            pthread_mutex_unlock(&mgr->manager_mtx);
-            return;
-        }
-        
-        index = (index + 1) % MAX_SESSIONS;
-        probe_count++;
+    /* Close socket if not already closed (under session_mtx: the reaper
+     * must not shut down a reused descriptor number) */
+    pthread_mutex_lock(&session->session_mtx);
+    if (session->socket_fd >= 0)
+    {
+        close(session->socket_fd);
+        session->socket_fd = -1;
     }
+    pthread_mutex_unlock(&session->session_mtx);
+
+    /* Update statistics (Phase 2.9) */
+    if (mgr->active_session_count > 0)
+    {
+        mgr->active_session_count--;
+    }
+    uint64_t active_count = mgr->active_session_count;
 
     pthread_mutex_unlock(&mgr->manager_mtx);
+
+    LOG_DEBUG("SessionManager", "Session %lu destroyed (active=%lu)", session_id, active_count);
+
+    /* Lookups that found the session before it was unlinked have taken
+     * their reference once the grace period ends; then drop the table's */
+    if (rcu_call(&session->rcu, session_put_rcu) >= SESSION_RCU_BACKLOG)
+        rcu_reclaim();
 }
 
 void session_set_username(Session *session, const char *username)
@@ -336,8 +428,7 @@ void session_set_username(Session *session, const char *username)
 
     pthread_mutex_unlock(&session->session_mtx);
 
-    printf("[SessionManager] Session %lu authenticated as '%s'\n",
-           session->session_id, username);
+    LOG_DEBUG("SessionManager", "Session %lu authenticated as '%s'", session->session_id, username);
 }
 
 /* -------------------- Phase 2.9 Enhancement Functions -------------------- */
@@ -396,10 +487,11 @@ void session_print_active(SessionManager *mgr)
     time_t now = time(NULL);
     int count = 0;
 
-    for (int i = 0; i < MAX_SESSIONS; i++)
+    SessionTable *table = mgr->table;
+    for (size_t i = 0; i <= table->mask; i++)
     {
-        Session *session = mgr->sessions[i];
-        if (session && session->is_active)
+        Session *session = table->slots[i];
+        if (session && session != SESSION_TOMBSTONE && session->is_active)
         {
             count++;
             pthread_mutex_lock(&session->session_mtx);
@@ -442,3 +534,108 @@ bool session_is_idle(Session *session, time_t timeout_seconds)
     return is_idle;
 }
 
+/* -------------------- Idle Reaping -------------------- */
+
+typedef struct
+{
+    SessionManager *mgr;
+    time_t now;
+    Session *expired;                     /* Collected for shutdown after the pass */
+} ReapPass;
+
+/* Bytes queued on the socket that the peer has not acknowledged yet */
+static int socket_unsent(int fd)
+{
+    int unsent = 0;
+    return ioctl(fd, SIOCOUTQ, &unsent) == 0 ? unsent : 0;
+}
+
+/* A session's timer fired (manager_mtx held): re-arm it at the real
+ * deadline, or collect the session if that has passed */
+static void session_expire(TimerNode *timer, void *ctx)
+{
+    ReapPass *pass = ctx;
+    SessionManager *mgr = pass->mgr;
+    Session *session = (Session *)((char *)timer - offsetof(Session, idle_timer));
+    if (!session->is_active)
+        return;
+
+    pthread_mutex_lock(&session->session_mtx);
+    time_t deadline = session->last_activity + mgr->idle_timeout;
+    if (!session->is_authenticated && mgr->auth_timeout > 0)
+        deadline = session->created_at + mgr->auth_timeout;
+    /* Output still draining: the peer is reading, slowly */
+    if (session->is_authenticated && deadline <= pass->now && session->socket_fd >= 0 &&
+        socket_unsent(session->socket_fd) > 0)
+        deadline = pass->now + mgr->idle_timeout;
+    pthread_mutex_unlock(&session->session_mtx);
+
+    if (deadline > pass->now)
+    {
+        timer_wheel_add(&mgr->idle_wheel, timer, (uint64_t)deadline);
+        return;
+    }
+
+    /* The reference keeps the session alive until its socket is shut down */
+    __atomic_fetch_add(&session->refs, 1, __ATOMIC_RELAXED);
+    session->reap_next = pass->expired;
+    pass->expired = session;
+    mgr->reaped_session_count++;
+}
+
+void session_manager_set_timeouts(SessionManager *mgr, time_t idle_timeout, time_t auth_timeout)
+{
+    if (!mgr)
+        return;
+
+    pthread_mutex_lock(&mgr->manager_mtx);
+    mgr->idle_timeout = idle_timeout > 0 ? idle_timeout : 0;
+    mgr->auth_timeout = auth_timeout > 0 ? auth_timeout : 0;
+    pthread_mutex_unlock(&mgr->manager_mtx);
+}
+
+size_t session_reap_idle(SessionManager *mgr, time_t now)
+{
+    if (!mgr)
+        return 0;
+
+    ReapPass pass = {.mgr = mgr, .now = now, .expired = NULL};
+    pthread_mutex_lock(&mgr->manager_mtx);
+    timer_wheel_advance(&mgr->idle_wheel, (uint64_t)now, session_expire, &pass);
+    pthread_mutex_unlock(&mgr->manager_mtx);
+
+    size_t reaped = 0;
+    while (pass.expired)
+    {
+        Session *session = pass.expired;
+        pass.expired = session->reap_next;
+
+        pthread_mutex_lock(&session->session_mtx);
+        bool authenticated = session->is_authenticated;
+        time_t idle = now - session->last_activity;
+        if (session->socket_fd >= 0)
+            shutdown(session->socket_fd, SHUT_RDWR);
+        pthread_mutex_unlock(&session->session_mtx);
+
+        if (authenticated || mgr->auth_timeout == 0)
+            LOG_INFO("SessionManager", "Session %lu idle for %lds, closing", session->session_id,
+                     (long)idle);
+        else
+            LOG_INFO("SessionManager", "Session %lu not authenticated within %lds, closing",
+                     session->session_id, (long)mgr->auth_timeout);
+        session_put(session);
+        reaped++;
+    }
+    return reaped;
+}
+
+uint64_t session_reaped_count(SessionManager *mgr)
+{
+    if (!mgr)
+        return 0;
+
+    pthread_mutex_lock(&mgr->manager_mtx);
+    uint64_t count = mgr->reaped_session_count;
+    pthread_mutex_unlock(&mgr->manager_mtx);
+    return count;
+}
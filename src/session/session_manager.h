@@ -5,9 +5,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "response_queue.h"
+#include "../utils/timer_wheel.h"
+#include "../utils/obj_pool.h"
+#include "../sync/rcu.h"
 
 #define MAX_USERNAME_LEN 64
-#define MAX_SESSIONS 256
+#define SESSION_TABLE_INITIAL_CAPACITY 256  /* Slots; the table doubles as it fills */
 
 /* Forward declarations */
 typedef struct Session Session;
@@ -23,31 +26,64 @@ typedef struct Session
     int socket_fd;                        /* Client socket descriptor */
     char username[MAX_USERNAME_LEN];      /* Authenticated username (empty until auth) */
     bool is_authenticated;                /* Authentication status */
+    bool deflate;                         /* v2: compressed bodies negotiated */
+    int weight;                           /* Fair scheduling weight (users.weight, read at auth) */
     volatile bool is_active;              /* Session active flag (checked by workers) */
     Response response;                    /* Response structure for this session */
     pthread_mutex_t session_mtx;          /* Mutex for per-session operations */
+    int refs;                             /* Table's reference + one per session_get */
 
     /* Session lifetime tracking (Phase 2.9 enhancements) */
     time_t created_at;                    /* Session creation timestamp */
     time_t authenticated_at;              /* Authentication timestamp (0 if not authenticated) */
     time_t last_activity;                 /* Last activity timestamp */
     uint64_t operations_count;            /* Number of operations performed */
+
+    /* Idle reaping (manager_mtx) */
+    TimerNode idle_timer;                 /* Next time the reaper looks at the session */
+    Session *reap_next;                   /* Sessions expired by one reaper pass */
+
+    RcuHead rcu;                          /* Table's reference, dropped after a grace period */
 } Session;
 
+/**
+ * Open-addressing hash table of sessions (linear probing on session_id).
+ * Slots are NULL (never used), SESSION_TOMBSTONE (removed) or a Session*.
+ * A full table is never modified in place to grow: a larger copy is
+ * published and the old one freed after an RCU grace period.
+ */
+typedef struct SessionTable
+{
+    size_t mask;                          /* Capacity - 1 (capacity is a power of two) */
+    size_t used;                          /* Live slots + tombstones */
+    RcuHead rcu;                          /* Freed after a grace period once replaced */
+    Session *slots[];
+} SessionTable;
+
 /**
  * SessionManager structure - manages all active sessions
- * Thread-safe hash table mapping session_id → Session*
+ * Concurrent hash map session_id → Session*: lookups are lock-free (RCU
+ * read sections, see sync/rcu.h), writers serialize on manager_mtx
  */
 typedef struct SessionManager
 {
-    Session *sessions[MAX_SESSIONS];      /* Hash table of sessions */
-    pthread_mutex_t manager_mtx;          /* Protects the session map */
+    SessionTable *table;                  /* Current table (swapped on resize) */
+    pthread_mutex_t manager_mtx;          /* Serializes create/destroy/resize */
+    ObjPool session_pool;                 /* Sessions, locks initialized once per object */
     uint64_t next_session_id;             /* Counter for session ID generation */
 
     /* Session statistics (Phase 2.9 enhancements) */
     uint64_t total_sessions_created;      /* Total sessions created since start */
     uint64_t active_session_count;        /* Current number of active sessions */
     uint64_t peak_session_count;          /* Peak concurrent sessions */
+
+    /* Idle reaping: one timer per session on a wheel ticking in seconds.
+     * Activity only updates last_activity; a timer that fires early is
+     * re-armed from it, so the wheel is touched about once per timeout. */
+    TimerWheel idle_wheel;
+    time_t idle_timeout;                  /* Seconds without activity, 0 = never reap */
+    time_t auth_timeout;                  /* Seconds to authenticate after connecting */
+    uint64_t reaped_session_count;        /* Sessions closed by the reaper */
 } SessionManager;
 
 /* -------------------- Function Prototypes -------------------- */
@@ -72,16 +108,24 @@ void session_manager_destroy(SessionManager *mgr);
 uint64_t session_create(SessionManager *mgr, int socket_fd);
 
 /**
- * Get a session by ID (thread-safe)
+ * Get a session by ID (lock-free)
  * @param mgr Session manager
  * @param session_id Session ID to look up
  * @return Session pointer if found and active, NULL otherwise
- * 
- * IMPORTANT: Caller must hold reference while using the session.
- * The session remains valid as long as is_active is true.
+ *
+ * IMPORTANT: The session is returned with a reference held; release it
+ * with session_put when done. The memory stays valid until then even if
+ * the session is destroyed meanwhile.
  */
 Session *session_get(SessionManager *mgr, uint64_t session_id);
 
+/**
+ * Release a reference taken by session_get
+ * The session is freed when its last reference goes
+ * @param session Session pointer (NULL is ignored)
+ */
+void session_put(Session *session);
+
 /**
  * Mark a session as inactive (client disconnected)
  * This signals to workers that they should not deliver results
@@ -92,7 +136,9 @@ void session_mark_inactive(SessionManager *mgr, uint64_t session_id);
 
 /**
  * Destroy and remove a session from the manager
- * This should be called after the client thread finishes
+ * This should be called after the client thread finishes. The socket is
+ * closed at once; the Session itself is freed once every reference from
+ * session_get has been put.
  * @param mgr Session manager
  * @param session_id Session ID to destroy
  */
@@ -134,6 +180,33 @@ void session_get_statistics(SessionManager *mgr, uint64_t *active_count,
  */
 void session_print_active(SessionManager *mgr);
 
+/**
+ * Set the reaper's timeouts for sessions created from now on
+ * @param mgr Session manager
+ * @param idle_timeout Seconds without activity before a session is closed (0 = never)
+ * @param auth_timeout Seconds a session may stay unauthenticated (used only
+ *                     when idle_timeout is set)
+ */
+void session_manager_set_timeouts(SessionManager *mgr, time_t idle_timeout, time_t auth_timeout);
+
+/**
+ * Close sessions whose timeout has passed (reaper thread, about once a second)
+ * The socket is shut down, so the connection's owner sees EOF and tears
+ * the session down as for a client disconnect. A session with unsent
+ * output on its socket is busy, not idle (dead peers are caught by TCP
+ * keepalive and TCP_USER_TIMEOUT instead).
+ * @param mgr Session manager
+ * @param now Current time
+ * @return Number of sessions closed
+ */
+size_t session_reap_idle(SessionManager *mgr, time_t now);
+
+/**
+ * Sessions closed by the reaper since start
+ * @param mgr Session manager
+ */
+uint64_t session_reaped_count(SessionManager *mgr);
+
 /**
  * Check if session has been idle for too long
  * @param session Session pointer
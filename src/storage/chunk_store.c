@@ -0,0 +1,1185 @@
+#include "chunk_store.h"
+#include "fastcdc.h"
+#include "../auth/user_metadata.h"
+#include "../utils/logger.h"
+#include "../utils/metrics.h"
+#include "../utils/obj_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <openssl/sha.h>
+
+#define CHUNK_READ_BUF_SIZE (4 * FASTCDC_MAX_SIZE)
+#define CHUNK_GC_BATCH 256
+#define MANIFEST_READ_SIZE (64 * 1024)  /* Manifests are parsed this much at a time */
+#define CHUNK_HEX_LEN (DB_CHUNK_HASH_LEN * 2)
+#define ENCODED_PREFIX_SIZE 8
+#define STREAM_KEEP_BYTES (256 * 1024)  /* Largest array a pooled stream keeps between uses */
+
+/* chunk_stream_encode sends each chunk as a single segment */
+_Static_assert(FASTCDC_MAX_SIZE <= COMPRESS_SEGMENT_MAX, "chunk larger than a segment");
+
+/*
+ * Streams come from a pool and keep their arrays (and capacities) from one
+ * download to the next, so opening a file of a size seen before allocates
+ * nothing; arrays past STREAM_KEEP_BYTES are freed on close.
+ */
+struct ChunkStream
+{
+    DbChunk *chunks;          /* In send order */
+    size_t count;
+    size_t chunks_cap;
+    DbChunk *pinned;          /* Same chunks sorted by hash, for the collector */
+    size_t pinned_count;      /* count may shrink (chunk_stream_range), this doesn't */
+    size_t pinned_cap;
+    size_t cur;               /* Chunk being sent */
+    int fd;                   /* Its descriptor, -1 until opened */
+    off_t off;                /* Bytes of it already sent */
+    uint32_t last_len;        /* chunk_stream_range: bytes of the last chunk to send, 0 = all */
+    bool plain;               /* Legacy file: fd is the whole body */
+    off_t base;               /* Legacy file: where the current piece starts in it */
+    unsigned char *raw;       /* Chunk stored compressed, inflated (allocated on first use) */
+    unsigned char *packed;    /* Its compressed bytes, read before inflating (likewise) */
+    bool inflated;            /* The chunk being sent is in raw */
+    bool encoded;             /* chunk_stream_encode: sending segments */
+    uint32_t *stored;         /* chunk_stream_encode: on-disk size of each chunk */
+    size_t stored_cap;
+    unsigned char head[ENCODED_PREFIX_SIZE + COMPRESS_SEGMENT_HEADER];
+    size_t head_len;          /* Encoded: size prefix / segment header to send first */
+    size_t head_off;
+    uint64_t *starts;         /* chunk_stream_pread: file offset of each chunk */
+    size_t starts_cap;
+    bool starts_ready;        /* starts filled in for this file */
+    int read_fd;              /* chunk_stream_pread: open chunk, -1 if none */
+    size_t read_idx;
+    bool read_inflated;       /* chunk_stream_pread: read_idx is in raw */
+    size_t size;              /* File size, counted as in-flight download bytes */
+    char *manifest;           /* Block of manifest text, while opening */
+    size_t manifest_cap;
+    struct ChunkStream *prev; /* Pinned stream list */
+    struct ChunkStream *next;
+};
+
+/* Serializes commit against collect, and guards the pinned stream list */
+static pthread_mutex_t store_mtx = PTHREAD_MUTEX_INITIALIZER;
+static ChunkStream *pinned_streams = NULL;
+static ObjPool stream_pool;
+static bool stream_pool_ready;
+static pthread_once_t stream_pool_once = PTHREAD_ONCE_INIT;
+static uint64_t chunk_tmp_seq = 0;
+static bool store_compress = false;
+static bool collect_pending = false;  /* chunk_store_schedule_collect since the last pass */
+
+/* -------------------- Helpers -------------------- */
+
+static void hash_to_hex(const unsigned char *hash, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < DB_CHUNK_HASH_LEN; i++)
+    {
+        hex[i * 2] = digits[hash[i] >> 4];
+        hex[i * 2 + 1] = digits[hash[i] & 0x0f];
+    }
+    hex[CHUNK_HEX_LEN] = '\0';
+}
+
+static int hex_to_hash(const char *hex, unsigned char *hash)
+{
+    for (int i = 0; i < DB_CHUNK_HASH_LEN; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return -1;
+        hash[i] = (unsigned char)byte;
+    }
+    return 0;
+}
+
+static void chunk_path(const unsigned char *hash, char *path, size_t len)
+{
+    char hex[CHUNK_HEX_LEN + 1];
+    hash_to_hex(hash, hex);
+    snprintf(path, len, CHUNK_STORE_DIR "/%.2s/%s", hex, hex);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Store one chunk: temp file then rename, so a chunk path only ever names
+ * complete content (two uploads racing on a new chunk write identical data) */
+static int chunk_publish(const DbChunk *chunk, const void *data, size_t len)
+{
+    char path[128];
+    char tmp[160];
+    chunk_path(chunk->hash, path, sizeof(path));
+    uint64_t seq = __atomic_add_fetch(&chunk_tmp_seq, 1, __ATOMIC_RELAXED);
+    /* Hidden temp name in the same directory: CHUNK_STORE_DIR "/xx/" */
+    int dir_len = (int)sizeof(CHUNK_STORE_DIR) + 3;
+    snprintf(tmp, sizeof(tmp), "%.*s.tmp-%lu", dir_len, path, (unsigned long)seq);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int rc = write_all(fd, data, len);
+    int saved_errno = errno;
+    if (close(fd) != 0 && rc == 0)
+    {
+        saved_errno = errno;
+        rc = -1;
+    }
+    if (rc != 0)
+    {
+        unlink(tmp);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        int saved_errno = errno;
+        unlink(tmp);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/* Size of a stored chunk on disk (less than its content if compressed), -1 if missing */
+static off_t chunk_stored_size(const unsigned char *hash)
+{
+    char path[128];
+    struct stat st;
+    chunk_path(hash, path, sizeof(path));
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/* Open a stored chunk; stored receives its size on disk */
+static int chunk_open(const DbChunk *chunk, off_t *stored)
+{
+    char path[128];
+    chunk_path(chunk->hash, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_ERROR("ChunkStore", "Missing chunk '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    *stored = st.st_size;
+    return fd;
+}
+
+/* Read a chunk stored compressed (stored < its size) and inflate it into
+ * cs->raw; both buffers are kept for the stream's next chunks */
+static int chunk_inflate(ChunkStream *cs, int fd, off_t stored, const DbChunk *chunk)
+{
+    if (!cs->raw)
+        cs->raw = malloc(FASTCDC_MAX_SIZE);
+    if (!cs->packed)
+        cs->packed = malloc(FASTCDC_MAX_SIZE);
+    if (!cs->raw || !cs->packed || stored <= 0 || chunk->size > FASTCDC_MAX_SIZE)
+    {
+        errno = cs->raw && cs->packed ? EIO : ENOMEM;
+        return -1;
+    }
+
+    ssize_t n = pread(fd, cs->packed, (size_t)stored, 0);
+    if (n == stored)
+        n = decompress_block(cs->packed, (size_t)stored, cs->raw, chunk->size);
+    if (n != (ssize_t)chunk->size)
+    {
+        /* Truncated or corrupt */
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static int chunk_list_append(ChunkList *list, const DbChunk *chunk, off_t offset, bool fresh,
+                             off_t stored)
+{
+    if (list->count == list->capacity)
+    {
+        size_t cap = list->capacity ? list->capacity * 2 : 64;
+        DbChunk *chunks = realloc(list->chunks, cap * sizeof(DbChunk));
+        if (chunks)
+            list->chunks = chunks;
+        off_t *offsets = realloc(list->offsets, cap * sizeof(off_t));
+        if (offsets)
+            list->offsets = offsets;
+        bool *flags = realloc(list->fresh, cap * sizeof(bool));
+        if (flags)
+            list->fresh = flags;
+        if (!chunks || !offsets || !flags)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        list->capacity = cap;
+    }
+
+    list->chunks[list->count] = *chunk;
+    list->offsets[list->count] = offset;
+    list->fresh[list->count] = fresh;
+    list->count++;
+    list->total += chunk->size;
+    list->physical += (uint64_t)stored;
+    if (stored < (off_t)chunk->size)
+        list->codec = COMPRESS_ZLIB;
+    return 0;
+}
+
+void chunk_list_free(ChunkList *list)
+{
+    if (!list)
+        return;
+    free(list->chunks);
+    free(list->offsets);
+    free(list->fresh);
+    memset(list, 0, sizeof(*list));
+}
+
+/* -------------------- Lifecycle -------------------- */
+
+/* Move the <xx> directories of a store that lived in storage/chunks,
+ * where they shared the namespace with a user called "chunks" (whose own
+ * files stay where they are) */
+static int chunk_store_migrate(void)
+{
+    int moved = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        char from[64], to[64];
+        struct stat st;
+        snprintf(from, sizeof(from), CHUNK_STORE_LEGACY_DIR "/%02x", i);
+        snprintf(to, sizeof(to), CHUNK_STORE_DIR "/%02x", i);
+        if (stat(from, &st) != 0 || !S_ISDIR(st.st_mode))
+            continue;
+        if (rename(from, to) != 0)
+        {
+            LOG_ERROR("ChunkStore", "Cannot move %s to %s: %s", from, to, strerror(errno));
+            return -1;
+        }
+        moved++;
+    }
+
+    if (moved > 0)
+    {
+        rmdir(CHUNK_STORE_LEGACY_DIR);
+        LOG_INFO("ChunkStore", "Moved the chunk store from %s to %s", CHUNK_STORE_LEGACY_DIR,
+                 CHUNK_STORE_DIR);
+    }
+    return 0;
+}
+
+int chunk_store_init(bool compress)
+{
+    store_compress = compress;
+    mkdir("storage", 0777);
+    if (mkdir(CHUNK_STORE_DIR, 0777) != 0 && errno != EEXIST)
+    {
+        LOG_ERROR("ChunkStore", "Cannot create %s: %s", CHUNK_STORE_DIR, strerror(errno));
+        return -1;
+    }
+    if (chunk_store_migrate() != 0)
+        return -1;
+
+    for (int i = 0; i < 256; i++)
+    {
+        char dir[64];
+        snprintf(dir, sizeof(dir), CHUNK_STORE_DIR "/%02x", i);
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        {
+            LOG_ERROR("ChunkStore", "Cannot create %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    int collected = chunk_store_collect();
+    if (collected < 0)
+        return -1;
+
+    LOG_INFO("ChunkStore", "Initialized at %s (%d orphaned chunk(s) collected, compression %s)",
+             CHUNK_STORE_DIR, collected, compress ? "on" : "off");
+    return 0;
+}
+
+/* -------------------- Upload Path -------------------- */
+
+/* Fill buf[*end..] from fd; returns bytes now buffered past start, -1 on error */
+static ssize_t fill_buffer(int fd, uint8_t *buf, size_t *start, size_t *end, bool *eof)
+{
+    /* Keep the unconsumed tail at the front so a full max-size chunk fits */
+    if (*start > 0)
+    {
+        memmove(buf, buf + *start, *end - *start);
+        *end -= *start;
+        *start = 0;
+    }
+
+    while (!*eof && *end < CHUNK_READ_BUF_SIZE)
+    {
+        ssize_t n = read(fd, buf + *end, CHUNK_READ_BUF_SIZE - *end);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            *eof = true;
+        *end += (size_t)n;
+    }
+    return (ssize_t)(*end - *start);
+}
+
+static int write_manifest(const char *manifest_path, const ChunkList *list)
+{
+    FILE *fp = fopen(manifest_path, "we");
+    if (!fp)
+        return -1;
+
+    fputs(MANIFEST_MAGIC, fp);
+    fprintf(fp, "size %lu\n", (unsigned long)list->total);
+    for (size_t i = 0; i < list->count; i++)
+    {
+        char hex[CHUNK_HEX_LEN + 1];
+        hash_to_hex(list->chunks[i].hash, hex);
+        fprintf(fp, "%s %u\n", hex, (unsigned)list->chunks[i].size);
+    }
+
+    if (ferror(fp))
+    {
+        int saved_errno = errno;
+        fclose(fp);
+        errno = saved_errno;
+        return -1;
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int chunk_store_ingest(const char *body_path, const char *manifest_path, ChunkList *list)
+{
+    memset(list, 0, sizeof(*list));
+
+    int fd = open(body_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    uint8_t *buf = malloc(CHUNK_READ_BUF_SIZE);
+    if (!buf)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t start = 0, end = 0;
+    bool eof = false;
+    off_t offset = 0;
+    size_t reused = 0;
+    uint8_t *packed = NULL;   /* Compression buffer, if the body is worth compressing */
+    size_t packed_cap = compress_bound(FASTCDC_MAX_SIZE);
+    int rc = 0;
+
+    while (1)
+    {
+        if (end - start < FASTCDC_MAX_SIZE && !eof && fill_buffer(fd, buf, &start, &end, &eof) < 0)
+        {
+            rc = -1;
+            break;
+        }
+        if (start == end)
+            break;
+
+        /* Judge the whole body by its start; without the buffer chunks stay plain */
+        if (offset == 0 && store_compress && compress_worthwhile(buf, end))
+            packed = malloc(packed_cap);
+
+        DbChunk chunk;
+        chunk.size = (uint32_t)fastcdc_cut(buf + start, end - start);
+        SHA256(buf + start, chunk.size, chunk.hash);
+
+        off_t stored = chunk_stored_size(chunk.hash);
+        bool fresh = stored < 0;
+        if (fresh)
+        {
+            size_t len = packed ? compress_block(buf + start, chunk.size, packed, packed_cap) : 0;
+            if (chunk_publish(&chunk, len ? packed : buf + start, len ? len : chunk.size) != 0)
+            {
+                rc = -1;
+                break;
+            }
+            stored = (off_t)(len ? len : chunk.size);
+        }
+        else
+        {
+            reused++;
+        }
+
+        if (chunk_list_append(list, &chunk, offset, fresh, stored) != 0)
+        {
+            rc = -1;
+            break;
+        }
+        start += chunk.size;
+        offset += chunk.size;
+    }
+
+    int saved_errno = errno;
+    free(packed);
+    free(buf);
+    close(fd);
+
+    if (rc == 0 && write_manifest(manifest_path, list) != 0)
+    {
+        saved_errno = errno;
+        unlink(manifest_path);
+        rc = -1;
+    }
+
+    if (rc != 0)
+    {
+        LOG_ERROR("ChunkStore", "Ingest of '%s' failed: %s", body_path, strerror(saved_errno));
+        chunk_store_abort(list);
+        chunk_list_free(list);
+        errno = saved_errno;
+        return -1;
+    }
+
+    LOG_DEBUG("ChunkStore",
+              "Ingested '%s': %zu chunk(s), %zu already stored, %lu/%lu bytes on disk (%s)",
+              body_path, list->count, reused, (unsigned long)list->physical,
+              (unsigned long)list->total, compress_codec_name(list->codec));
+    return 0;
+}
+
+/* Put a chunk back from the upload body (the collector removed it after ingest) */
+static int chunk_restore(const DbChunk *chunk, int body_fd, off_t offset)
+{
+    void *data = malloc(chunk->size);
+    if (!data)
+        return -1;
+
+    ssize_t n = pread(body_fd, data, chunk->size, offset);
+    int rc = (n == (ssize_t)chunk->size) ? chunk_publish(chunk, data, chunk->size) : -1;
+    free(data);
+    return rc;
+}
+
+int chunk_store_commit(const ChunkList *list, const char *body_path, const char *username,
+                       const char *filename)
+{
+    int body_fd = -1;
+    int result = 0;
+
+    pthread_mutex_lock(&store_mtx);
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        if (chunk_stored_size(list->chunks[i].hash) >= 0)
+            continue;
+
+        if (body_fd < 0)
+            body_fd = open(body_path, O_RDONLY | O_CLOEXEC);
+        if (body_fd < 0 || chunk_restore(&list->chunks[i], body_fd, list->offsets[i]) != 0)
+        {
+            LOG_ERROR("ChunkStore", "Cannot restore collected chunk for '%s': %s", filename,
+                      strerror(errno));
+            result = -1;
+            break;
+        }
+    }
+
+    if (result == 0)
+        result = user_add_file(username, filename, list->total, list->physical,
+                               compress_codec_name(list->codec), list->chunks, list->count);
+
+    pthread_mutex_unlock(&store_mtx);
+
+    if (body_fd >= 0)
+        close(body_fd);
+    return result;
+}
+
+void chunk_store_abort(const ChunkList *list)
+{
+    pthread_mutex_lock(&store_mtx);
+    for (size_t i = 0; i < list->count; i++)
+    {
+        bool exists;
+        if (!list->fresh[i] || db_chunk_exists(list->chunks[i].hash, &exists) != 0 || exists)
+            continue;
+
+        char path[128];
+        chunk_path(list->chunks[i].hash, path, sizeof(path));
+        unlink(path);
+    }
+    pthread_mutex_unlock(&store_mtx);
+}
+
+/* -------------------- Garbage Collection -------------------- */
+
+static int chunk_cmp(const void *a, const void *b)
+{
+    return memcmp(((const DbChunk *)a)->hash, ((const DbChunk *)b)->hash, DB_CHUNK_HASH_LEN);
+}
+
+/* True if an open download still needs the chunk; caller holds store_mtx */
+static bool chunk_pinned(const DbChunk *chunk)
+{
+    for (ChunkStream *cs = pinned_streams; cs; cs = cs->next)
+    {
+        if (bsearch(chunk, cs->pinned, cs->pinned_count, sizeof(DbChunk), chunk_cmp))
+            return true;
+    }
+    return false;
+}
+
+int chunk_store_collect(void)
+{
+    DbChunk batch[CHUNK_GC_BATCH];
+    size_t count;
+
+    /* Cheap unlocked check first: usually there is nothing to do */
+    if (db_list_orphan_chunks(batch, CHUNK_GC_BATCH, &count) != 0)
+        return -1;
+    if (count == 0)
+        return 0;
+
+    int collected = 0;
+    pthread_mutex_lock(&store_mtx);
+
+    while (db_list_orphan_chunks(batch, CHUNK_GC_BATCH, &count) == 0 && count > 0)
+    {
+        size_t victims = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!chunk_pinned(&batch[i]))
+                batch[victims++] = batch[i];
+        }
+
+        /* Pinned orphans go on a later pass */
+        if (victims < count)
+            __atomic_store_n(&collect_pending, true, __ATOMIC_RELEASE);
+        if (victims == 0 || db_delete_orphan_chunks(batch, victims) != 0)
+            break;
+
+        for (size_t i = 0; i < victims; i++)
+        {
+            char path[128];
+            chunk_path(batch[i].hash, path, sizeof(path));
+            if (unlink(path) != 0 && errno != ENOENT)
+                LOG_ERROR("ChunkStore", "Cannot remove chunk '%s': %s", path, strerror(errno));
+        }
+        collected += (int)victims;
+
+        if (count < CHUNK_GC_BATCH)
+            break;
+    }
+
+    pthread_mutex_unlock(&store_mtx);
+
+    if (collected > 0)
+        LOG_INFO("ChunkStore", "Collected %d orphaned chunk(s)", collected);
+    return collected;
+}
+
+void chunk_store_schedule_collect(void)
+{
+    __atomic_store_n(&collect_pending, true, __ATOMIC_RELEASE);
+}
+
+int chunk_store_collect_scheduled(void)
+{
+    if (!__atomic_exchange_n(&collect_pending, false, __ATOMIC_ACQ_REL))
+        return 0;
+
+    int collected = chunk_store_collect();
+    if (collected < 0)
+        chunk_store_schedule_collect();
+    return collected;
+}
+
+/* -------------------- Download Path -------------------- */
+
+/* Make room for n elements in a stream's array, keeping its contents */
+static int array_reserve(void **array, size_t *cap, size_t n, size_t elem_size)
+{
+    if (n <= *cap)
+        return 0;
+    size_t want = *cap ? *cap : 64;
+    while (want < n)
+        want *= 2;
+    void *grown = realloc(*array, want * elem_size);
+    if (!grown)
+        return -1;
+    *array = grown;
+    *cap = want;
+    return 0;
+}
+
+/* Free an array a pooled stream should not hold on to */
+static void array_trim(void **array, size_t *cap, size_t elem_size)
+{
+    if (*cap * elem_size > STREAM_KEEP_BYTES)
+    {
+        free(*array);
+        *array = NULL;
+        *cap = 0;
+    }
+}
+
+/* Slabs come from malloc uninitialized: a fresh stream owns no arrays */
+static void stream_object_init(void *obj)
+{
+    memset(obj, 0, sizeof(ChunkStream));
+}
+
+static void stream_object_fini(void *obj)
+{
+    ChunkStream *cs = obj;
+    free(cs->starts);
+    free(cs->stored);
+    free(cs->raw);
+    free(cs->packed);
+    free(cs->pinned);
+    free(cs->chunks);
+    free(cs->manifest);
+}
+
+static void stream_pool_init(void)
+{
+    stream_pool_ready = obj_pool_init(&stream_pool, "stream", sizeof(ChunkStream), 1,
+                                      stream_object_init, stream_object_fini) == 0;
+}
+
+/* A stream from the pool, reset for a new file (arrays kept) */
+static ChunkStream *stream_alloc(void)
+{
+    pthread_once(&stream_pool_once, stream_pool_init);
+    ChunkStream *cs = stream_pool_ready ? obj_pool_alloc(&stream_pool) : NULL;
+    if (!cs)
+        return NULL;
+
+    cs->count = 0;
+    cs->pinned_count = 0;
+    cs->cur = 0;
+    cs->fd = -1;
+    cs->off = 0;
+    cs->last_len = 0;
+    cs->plain = false;
+    cs->base = 0;
+    cs->inflated = false;
+    cs->encoded = false;
+    cs->head_len = 0;
+    cs->head_off = 0;
+    cs->starts_ready = false;
+    cs->read_fd = -1;
+    cs->read_idx = 0;
+    cs->read_inflated = false;
+    cs->size = 0;
+    cs->prev = NULL;
+    cs->next = NULL;
+    return cs;
+}
+
+static void stream_free(ChunkStream *cs)
+{
+    array_trim((void **)&cs->chunks, &cs->chunks_cap, sizeof(DbChunk));
+    array_trim((void **)&cs->pinned, &cs->pinned_cap, sizeof(DbChunk));
+    array_trim((void **)&cs->stored, &cs->stored_cap, sizeof(uint32_t));
+    array_trim((void **)&cs->starts, &cs->starts_cap, sizeof(uint64_t));
+    array_trim((void **)&cs->manifest, &cs->manifest_cap, 1);
+    obj_pool_free(cs);
+}
+
+/* Add one "<hex> <size>" manifest line to cs->chunks */
+static int manifest_add_chunk(ChunkStream *cs, const char *line, uint64_t *total)
+{
+    char hex[CHUNK_HEX_LEN + 1];
+    unsigned int len;
+    if (sscanf(line, "%64s %u", hex, &len) != 2 || strlen(hex) != CHUNK_HEX_LEN)
+        return -1;
+
+    if (array_reserve((void **)&cs->chunks, &cs->chunks_cap, cs->count + 1,
+                      sizeof(DbChunk)) != 0)
+        return -1;
+    DbChunk *chunk = &cs->chunks[cs->count];
+    if (hex_to_hash(hex, chunk->hash) != 0)
+        return -1;
+    chunk->size = len;
+    *total += len;
+    cs->count++;
+    return 0;
+}
+
+/* Parse the manifest on fd into cs->chunks, MANIFEST_READ_SIZE at a time
+ * (a manifest has ~72 bytes per chunk, so a large file's runs to tens of
+ * MiB). Anything starting with MANIFEST_MAGIC is a manifest, whatever its
+ * size. Returns the file size it describes, -2 for a legacy plain file
+ * (no magic), or -1 if it can't be read or is malformed (errno set). */
+static int64_t read_manifest(ChunkStream *cs, int fd)
+{
+    char magic[sizeof(MANIFEST_MAGIC)];
+    size_t magic_len = strlen(MANIFEST_MAGIC);
+    ssize_t n = pread(fd, magic, magic_len, 0);
+    if (n < 0)
+        return -1;
+    if ((size_t)n != magic_len || memcmp(magic, MANIFEST_MAGIC, magic_len) != 0)
+        return -2;
+
+    if (array_reserve((void **)&cs->manifest, &cs->manifest_cap, MANIFEST_READ_SIZE + 1, 1) != 0)
+        return -1;
+
+    off_t offset = (off_t)magic_len;
+    size_t have = 0;
+    bool eof = false;
+    bool sized = false;
+    unsigned long size = 0;
+    uint64_t total = 0;
+    while (!eof)
+    {
+        n = pread(fd, cs->manifest + have, MANIFEST_READ_SIZE - have, offset);
+        if (n < 0)
+            return -1;
+        offset += n;
+        have += (size_t)n;
+        eof = n == 0;
+        if (eof && have > 0)
+            cs->manifest[have++] = '\n';  /* Last line without a newline */
+
+        /* Every complete line in the block; the rest moves to the front */
+        char *line = cs->manifest;
+        char *nl;
+        while ((nl = memchr(line, '\n', have - (size_t)(line - cs->manifest))) != NULL)
+        {
+            *nl = '\0';
+            int rc = sized ? manifest_add_chunk(cs, line, &total)
+                           : (sscanf(line, "size %lu", &size) == 1 ? 0 : -1);
+            if (rc != 0)
+            {
+                errno = EIO;
+                return -1;
+            }
+            sized = true;
+            line = nl + 1;
+        }
+        have -= (size_t)(line - cs->manifest);
+        if (have == MANIFEST_READ_SIZE)
+        {
+            /* A line longer than a block */
+            errno = EIO;
+            return -1;
+        }
+        memmove(cs->manifest, line, have);
+    }
+
+    if (!sized || total != size)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return (int64_t)size;
+}
+
+ChunkStream *chunk_stream_open(int fd, size_t *size)
+{
+    ChunkStream *cs = stream_alloc();
+    struct stat st;
+    int64_t total = -1;
+    if (cs && fstat(fd, &st) == 0)
+        total = read_manifest(cs, fd);
+    if (total == -1)
+    {
+        int saved_errno = cs ? errno : ENOMEM;
+        if (cs)
+            stream_free(cs);
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    size_t file_len = (size_t)st.st_size;
+
+    if (total == -2)
+    {
+        /* Legacy plain file: send it from its one descriptor in pieces no
+         * larger than a chunk (sizes are 32-bit; each is also one segment
+         * for chunk_stream_encode) */
+        size_t pieces = (file_len + FASTCDC_MAX_SIZE - 1) / FASTCDC_MAX_SIZE;
+        if (array_reserve((void **)&cs->chunks, &cs->chunks_cap, pieces ? pieces : 1,
+                          sizeof(DbChunk)) != 0)
+        {
+            stream_free(cs);
+            close(fd);
+            errno = ENOMEM;
+            return NULL;
+        }
+        size_t left = file_len;
+        for (size_t i = 0; i < pieces; i++, left -= FASTCDC_MAX_SIZE)
+        {
+            memset(&cs->chunks[i], 0, sizeof(DbChunk));
+            cs->chunks[i].size = (uint32_t)(left < FASTCDC_MAX_SIZE ? left : FASTCDC_MAX_SIZE);
+        }
+        cs->count = pieces;
+        cs->plain = true;
+        cs->fd = fd;
+        cs->size = file_len;
+        *size = file_len;
+        metrics_inflight_add(METRIC_INFLIGHT_DOWNLOAD, (int64_t)cs->size);
+        return cs;
+    }
+
+    close(fd);
+    cs->fd = -1;
+    *size = (size_t)total;
+
+    if (array_reserve((void **)&cs->pinned, &cs->pinned_cap, cs->count ? cs->count : 1,
+                      sizeof(DbChunk)) != 0)
+    {
+        stream_free(cs);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(cs->pinned, cs->chunks, cs->count * sizeof(DbChunk));
+    qsort(cs->pinned, cs->count, sizeof(DbChunk), chunk_cmp);
+    cs->pinned_count = cs->count;
+
+    pthread_mutex_lock(&store_mtx);
+    cs->next = pinned_streams;
+    if (pinned_streams)
+        pinned_streams->prev = cs;
+    pinned_streams = cs;
+    pthread_mutex_unlock(&store_mtx);
+
+    cs->size = (size_t)total;
+    metrics_inflight_add(METRIC_INFLIGHT_DOWNLOAD, (int64_t)cs->size);
+    return cs;
+}
+
+int64_t chunk_stream_range(ChunkStream *cs, uint64_t offset, uint64_t length)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < cs->count; i++)
+        total += cs->chunks[i].size;
+    if (offset > total)
+        return -1;
+    if (length == 0 || length > total - offset)
+        length = total - offset;
+
+    /* Skip whole chunks before the range, then start partway into one */
+    uint64_t start = 0;
+    while (cs->cur < cs->count && start + cs->chunks[cs->cur].size <= offset)
+        start += cs->chunks[cs->cur++].size;
+    cs->off = (off_t)(offset - start);
+    if (cs->plain)
+        cs->base = (off_t)start;  /* Pieces share the descriptor */
+
+    if (length == 0)
+    {
+        cs->count = cs->cur;
+        return 0;
+    }
+
+    /* Stop after the chunk holding the range's last byte, cut short there */
+    uint64_t end = offset + length;
+    size_t last = cs->cur;
+    while (start + cs->chunks[last].size < end)
+        start += cs->chunks[last++].size;
+    cs->last_len = (uint32_t)(end - start);
+    cs->count = last + 1;
+    return (int64_t)length;
+}
+
+/* Queue the segment header of the current chunk (encoded streams) */
+static void chunk_stream_queue_header(ChunkStream *cs)
+{
+    if (cs->head_off == cs->head_len)
+        cs->head_off = cs->head_len = 0;
+
+    const DbChunk *chunk = &cs->chunks[cs->cur];
+    uint32_t stored = cs->stored[cs->cur];
+    compress_segment_header(cs->head + cs->head_len,
+                            stored < chunk->size ? COMPRESS_ZLIB : COMPRESS_NONE,
+                            chunk->size, stored);
+    cs->head_len += COMPRESS_SEGMENT_HEADER;
+}
+
+int64_t chunk_stream_encode(ChunkStream *cs)
+{
+    if (array_reserve((void **)&cs->stored, &cs->stored_cap, cs->count ? cs->count : 1,
+                      sizeof(uint32_t)) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint64_t plain_size = 0;
+    int64_t total = ENCODED_PREFIX_SIZE;
+    for (size_t i = 0; i < cs->count; i++)
+    {
+        off_t stored = cs->plain ? (off_t)cs->chunks[i].size : chunk_stored_size(cs->chunks[i].hash);
+        if (stored <= 0 || stored > (off_t)cs->chunks[i].size)
+        {
+            /* Missing, or not a chunk this store wrote */
+            errno = EIO;
+            return -1;
+        }
+        cs->stored[i] = (uint32_t)stored;
+        plain_size += cs->chunks[i].size;
+        total += COMPRESS_SEGMENT_HEADER + stored;
+    }
+
+    for (int i = 0; i < ENCODED_PREFIX_SIZE; i++)
+        cs->head[i] = (unsigned char)(plain_size >> (8 * (ENCODED_PREFIX_SIZE - 1 - i)));
+    cs->head_len = ENCODED_PREFIX_SIZE;
+    cs->head_off = 0;
+    cs->encoded = true;
+    if (cs->count > 0)
+        chunk_stream_queue_header(cs);
+    return total;
+}
+
+bool chunk_stream_done(const ChunkStream *cs)
+{
+    return cs->cur >= cs->count && cs->head_off >= cs->head_len;
+}
+
+/* Bytes of the current chunk to send: its content, or what is on disk when encoded */
+static size_t chunk_stream_extent(const ChunkStream *cs)
+{
+    if (cs->encoded)
+        return cs->stored[cs->cur];
+    if (cs->cur + 1 == cs->count && cs->last_len)
+        return cs->last_len;
+    return cs->chunks[cs->cur].size;
+}
+
+/* Make sure the current chunk is open (and inflated if it has to be); -1 if
+ * it can't be (errno set) */
+static int chunk_stream_prepare(ChunkStream *cs)
+{
+    if (cs->fd >= 0)
+        return 0;
+
+    off_t stored;
+    cs->fd = chunk_open(&cs->chunks[cs->cur], &stored);
+    if (cs->fd < 0)
+        return -1;
+
+    /* Encoded streams send compressed chunks as they are */
+    cs->inflated = !cs->encoded && stored < (off_t)cs->chunks[cs->cur].size;
+    if (cs->inflated && chunk_inflate(cs, cs->fd, stored, &cs->chunks[cs->cur]) != 0)
+    {
+        int saved_errno = errno;
+        close(cs->fd);
+        cs->fd = -1;
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/* Move to the next chunk once the current one is fully sent */
+static void chunk_stream_advance(ChunkStream *cs)
+{
+    if ((size_t)cs->off < chunk_stream_extent(cs))
+        return;
+    if (cs->plain)
+    {
+        cs->base += cs->off;
+    }
+    else
+    {
+        close(cs->fd);
+        cs->fd = -1;
+    }
+    cs->off = 0;
+    cs->inflated = false;
+    cs->cur++;
+    if (cs->encoded && cs->cur < cs->count)
+        chunk_stream_queue_header(cs);
+}
+
+ssize_t chunk_stream_send(ChunkStream *cs, int sockfd)
+{
+    if (cs->head_off < cs->head_len)
+    {
+        ssize_t n = send(sockfd, cs->head + cs->head_off, cs->head_len - cs->head_off, MSG_NOSIGNAL);
+        if (n > 0)
+            cs->head_off += (size_t)n;
+        return n;
+    }
+    if (chunk_stream_done(cs))
+        return 0;
+    if (chunk_stream_prepare(cs) != 0)
+        return -1;
+
+    size_t remaining = chunk_stream_extent(cs) - (size_t)cs->off;
+    ssize_t n;
+    if (cs->inflated)
+    {
+        n = send(sockfd, cs->raw + cs->off, remaining, MSG_NOSIGNAL);
+    }
+    else
+    {
+        off_t pos = cs->base + cs->off;
+        n = sendfile(sockfd, cs->fd, &pos, remaining);
+        if (n == 0)
+        {
+            /* Chunk shorter than its manifest entry */
+            errno = EIO;
+            return -1;
+        }
+    }
+    if (n > 0)
+    {
+        cs->off += n;
+        chunk_stream_advance(cs);
+    }
+    return n;
+}
+
+ssize_t chunk_stream_send_all(ChunkStream *cs, int sockfd)
+{
+    size_t total = 0;
+
+    while (!chunk_stream_done(cs))
+    {
+        ssize_t n = chunk_stream_send(cs, sockfd);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (n <= 0)
+        {
+            LOG_ERROR("ChunkStore", "Send failed: %s", n < 0 ? strerror(errno) : "no progress");
+            break;
+        }
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t chunk_stream_pread(ChunkStream *cs, void *buf, size_t len, uint64_t offset)
+{
+    if (cs->plain)
+        return pread(cs->fd, buf, len, (off_t)offset);
+
+    if (!cs->starts_ready)
+    {
+        if (array_reserve((void **)&cs->starts, &cs->starts_cap, cs->count + 1,
+                          sizeof(uint64_t)) != 0)
+            return -1;
+        cs->starts_ready = true;
+        cs->starts[0] = 0;
+        for (size_t i = 0; i < cs->count; i++)
+            cs->starts[i + 1] = cs->starts[i] + cs->chunks[i].size;
+    }
+    if (offset >= cs->starts[cs->count])
+        return 0;
+
+    /* Last chunk starting at or before offset */
+    size_t lo = 0, hi = cs->count - 1;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi + 1) / 2;
+        if (cs->starts[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    if (cs->read_fd < 0 || cs->read_idx != lo)
+    {
+        if (cs->read_fd >= 0)
+            close(cs->read_fd);
+        off_t stored;
+        cs->read_fd = chunk_open(&cs->chunks[lo], &stored);
+        if (cs->read_fd < 0)
+            return -1;
+        cs->read_idx = lo;
+        cs->read_inflated = stored < (off_t)cs->chunks[lo].size;
+        if (cs->read_inflated && chunk_inflate(cs, cs->read_fd, stored, &cs->chunks[lo]) != 0)
+        {
+            int saved_errno = errno;
+            close(cs->read_fd);
+            cs->read_fd = -1;
+            errno = saved_errno;
+            return -1;
+        }
+    }
+
+    uint64_t within = offset - cs->starts[lo];
+    if (len > cs->chunks[lo].size - within)
+        len = cs->chunks[lo].size - within;
+    if (cs->read_inflated)
+    {
+        memcpy(buf, cs->raw + within, len);
+        return (ssize_t)len;
+    }
+
+    ssize_t n = pread(cs->read_fd, buf, len, (off_t)within);
+    if (n == 0)
+    {
+        /* Chunk shorter than its manifest entry */
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
+void chunk_stream_close(ChunkStream *cs)
+{
+    if (!cs)
+        return;
+
+    if (cs->fd >= 0)
+        close(cs->fd);
+    if (cs->read_fd >= 0)
+        close(cs->read_fd);
+    metrics_inflight_add(METRIC_INFLIGHT_DOWNLOAD, -(int64_t)cs->size);
+
+    if (!cs->plain)
+    {
+        pthread_mutex_lock(&store_mtx);
+        if (cs->prev)
+            cs->prev->next = cs->next;
+        else
+            pinned_streams = cs->next;
+        if (cs->next)
+            cs->next->prev = cs->prev;
+        pthread_mutex_unlock(&store_mtx);
+    }
+
+    stream_free(cs);
+}
@@ -0,0 +1,167 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../auth/database.h"
+#include "compress.h"
+
+/*
+ * Content-addressed chunk store (cross-user deduplication)
+ *
+ * Upload bodies are split with FastCDC and each chunk is stored once, in
+ * storage/.chunks/<xx>/<sha256 hex>, no matter how many files or users
+ * contain it (hidden, so no username can name it).
+ * storage/<user>/<filename> holds a small text manifest (the ordered chunk
+ * list) instead of the data, and the chunks/file_chunks tables count
+ * references. Content that is already stored costs no disk space or write
+ * bandwidth beyond its manifest.
+ *
+ * Lifecycle:
+ * - chunk_store_ingest writes chunks the store doesn't have yet, plus the
+ *   manifest (to a temp path the worker then renames into place)
+ * - chunk_store_commit records the file and its chunk references
+ * - replacing or deleting a file drops references and schedules a
+ *   collection; the reaper's next tick runs chunk_store_collect, which
+ *   removes chunks nothing references, except those an in-progress
+ *   download still has to send (they go on a later pass)
+ *
+ * store_mtx serializes commit (which may re-reference an orphan) against
+ * collect (which deletes orphans). Commit re-checks every chunk on disk and
+ * restores any the collector removed in between from the upload body.
+ *
+ * At-rest compression (chunk_store_init's compress): an upload whose
+ * first COMPRESS_SAMPLE_SIZE bytes compress well has each new chunk stored
+ * zlib-compressed when that saves COMPRESS_MIN_SAVING percent. A chunk
+ * file smaller than its manifest size is compressed; the hash is always of
+ * the plain content, so deduplication is unaffected. Streams inflate such
+ * chunks on the way out, or send them untouched as COMPRESS_ZLIB segments
+ * to clients that negotiated compression (chunk_stream_encode).
+ *
+ * Files written before the chunk store existed are plain files without a
+ * manifest header; downloads still serve them as-is.
+ */
+
+#define CHUNK_STORE_DIR "storage/.chunks"
+#define CHUNK_STORE_LEGACY_DIR "storage/chunks"  /* Before it was hidden; moved at init */
+#define MANIFEST_MAGIC "STASH-MANIFEST 1\n"
+
+/* Chunks of one upload, in file order */
+typedef struct ChunkList
+{
+    DbChunk *chunks;
+    off_t *offsets;     /* Where each chunk starts in the upload body */
+    bool *fresh;        /* Written by this upload rather than deduplicated */
+    size_t count;
+    size_t capacity;
+    uint64_t total;     /* Sum of chunk sizes */
+    uint64_t physical;  /* Sum of chunk sizes on disk */
+    compress_codec_t codec; /* COMPRESS_ZLIB if any chunk is stored compressed */
+} ChunkList;
+
+/* Sends a stored file's chunks to a socket in order (see chunk_stream_*) */
+typedef struct ChunkStream ChunkStream;
+
+/**
+ * Create the chunk directories and collect orphans left by a previous run
+ * (needs the database)
+ * @param compress Store new chunks of compressible uploads compressed
+ * @return 0 on success, -1 on error
+ */
+int chunk_store_init(bool compress);
+
+/**
+ * Chunk and hash an upload body, store the new chunks and write the
+ * manifest to manifest_path
+ * @return 0 on success, -1 on error (errno set; nothing to clean up)
+ */
+int chunk_store_ingest(const char *body_path, const char *manifest_path, ChunkList *list);
+
+/**
+ * Record username/filename as the ingested chunks (under store_mtx,
+ * restoring any chunk collected since ingest from body_path)
+ * @return user_add_file's result: 0 on success, -2 user not found, -1 on error
+ */
+int chunk_store_commit(const ChunkList *list, const char *body_path, const char *username,
+                       const char *filename);
+
+/**
+ * Undo an ingest that will not be committed: remove chunks it wrote that
+ * no file references
+ */
+void chunk_store_abort(const ChunkList *list);
+
+/* Free a ChunkList's arrays */
+void chunk_list_free(ChunkList *list);
+
+/**
+ * Delete chunks no file references any more
+ * @return Number of chunks removed, -1 on error
+ */
+int chunk_store_collect(void);
+
+/* Note that a file was replaced or deleted, so chunks may have lost their
+ * last reference (cheap; the collection itself happens later) */
+void chunk_store_schedule_collect(void);
+
+/**
+ * Run chunk_store_collect if one was scheduled since the last pass, or
+ * the last pass left pinned orphans behind (reaper tick)
+ * @return Number of chunks removed, -1 on error
+ */
+int chunk_store_collect_scheduled(void);
+
+/**
+ * Open a stored file for sending, given its open manifest (or legacy
+ * plain file). Takes ownership of fd. The stream pins its chunks against
+ * the collector until it is closed.
+ * @param size Output: file size in bytes
+ * @return Stream, or NULL on error (fd closed, errno set)
+ */
+ChunkStream *chunk_stream_open(int fd, size_t *size);
+
+/**
+ * Limit a freshly opened stream to length bytes starting at offset
+ * (resumed and byte-range downloads); length 0 means to the end
+ * @return Bytes the stream will now send, -1 if offset is past the end
+ */
+int64_t chunk_stream_range(ChunkStream *cs, uint64_t offset, uint64_t length);
+
+/**
+ * Switch a freshly opened, unranged stream to the compressed body format
+ * (compress.h): an 8-byte big-endian plain size, then one segment per
+ * chunk. Chunks stored compressed are sent as they are on disk.
+ * @return Bytes the stream will now send, -1 on error (errno set)
+ */
+int64_t chunk_stream_encode(ChunkStream *cs);
+
+/**
+ * Send the next piece of the stream with sendfile(2) (non-blocking sockets)
+ * @return Bytes sent (> 0), 0 once everything is sent, -1 on error
+ *         (errno set; EAGAIN means try again when writable)
+ */
+ssize_t chunk_stream_send(ChunkStream *cs, int sockfd);
+
+/**
+ * Send the rest of the stream on a blocking socket
+ * @return Bytes sent; fewer than remaining on error
+ */
+ssize_t chunk_stream_send_all(ChunkStream *cs, int sockfd);
+
+/**
+ * Read from the stored file at offset, like pread(2), instead of sending
+ * it (delta sync). A stream is either sent or read, not both.
+ * @return Bytes read (may be short at chunk boundaries), 0 at end of file,
+ *         -1 on error
+ */
+ssize_t chunk_stream_pread(ChunkStream *cs, void *buf, size_t len, uint64_t offset);
+
+/* True once every byte has been sent */
+bool chunk_stream_done(const ChunkStream *cs);
+
+/* Close the current chunk and unpin the stream (NULL is a no-op) */
+void chunk_stream_close(ChunkStream *cs);
+
+#endif /* CHUNK_STORE_H */
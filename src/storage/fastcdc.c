@@ -0,0 +1,52 @@
+#include "fastcdc.h"
+#include <pthread.h>
+
+/* 18 and 14 one-bits (normalization level 2 around a 2^16 average), taken
+ * from the top of the hash: the gear shift mixes high bits best */
+#define FASTCDC_MASK_S (((1ULL << 18) - 1) << (64 - 18))
+#define FASTCDC_MASK_L (((1ULL << 14) - 1) << (64 - 14))
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/* Fixed-seed splitmix64: the table must be identical on every run, or the
+ * same content would chunk differently across restarts and stop deduping */
+static void gear_init(void)
+{
+    uint64_t x = 0x5354415348434443ULL;  /* "STASHCDC" */
+    for (int i = 0; i < 256; i++)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t fastcdc_cut(const uint8_t *data, size_t len)
+{
+    pthread_once(&gear_once, gear_init);
+
+    if (len <= FASTCDC_MIN_SIZE)
+        return len;
+    if (len > FASTCDC_MAX_SIZE)
+        len = FASTCDC_MAX_SIZE;
+
+    size_t normal = len < FASTCDC_AVG_SIZE ? len : FASTCDC_AVG_SIZE;
+    uint64_t hash = 0;
+    size_t i = FASTCDC_MIN_SIZE;
+
+    for (; i < normal; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & FASTCDC_MASK_S))
+            return i + 1;
+    }
+    for (; i < len; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & FASTCDC_MASK_L))
+            return i + 1;
+    }
+    return len;
+}
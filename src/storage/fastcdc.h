@@ -0,0 +1,30 @@
+#ifndef FASTCDC_H
+#define FASTCDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FastCDC content-defined chunking
+ *
+ * Cut points depend only on the bytes around them (a rolling gear hash),
+ * not on their offset, so inserting or removing data early in a file only
+ * changes the chunks near the edit and identical content produces
+ * identical chunks in every file. Normalized chunking: a stricter mask
+ * before the average size and a looser one after keeps sizes clustered
+ * around FASTCDC_AVG_SIZE.
+ */
+
+#define FASTCDC_MIN_SIZE (16 * 1024)
+#define FASTCDC_AVG_SIZE (64 * 1024)
+#define FASTCDC_MAX_SIZE (256 * 1024)
+
+/**
+ * Length of the next chunk starting at data
+ * @param len Bytes available; pass at least FASTCDC_MAX_SIZE unless this is
+ *            the end of the input
+ * @return Chunk length (1..min(len, FASTCDC_MAX_SIZE)), 0 if len is 0
+ */
+size_t fastcdc_cut(const uint8_t *data, size_t len);
+
+#endif /* FASTCDC_H */
@@ -0,0 +1,338 @@
+#include "upload_stream.h"
+#include "../utils/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/* Distinguishes concurrent uploads from the same session */
+static uint64_t upload_seq = 0;
+
+/* <dir>/.upload-<session>-<seq>.tmp */
+static void temp_name(char *path, size_t len, const char *dir, uint64_t session_id)
+{
+    uint64_t seq = __atomic_add_fetch(&upload_seq, 1, __ATOMIC_RELAXED);
+    snprintf(path, len, "%s/" UPLOAD_TEMP_PREFIX "%lu-%lu.tmp",
+             dir, (unsigned long)session_id, (unsigned long)seq);
+}
+
+/* storage/<user>/.upload-<FNV-1a of filename>-<size>.part; filenames
+ * can be 255 bytes, so the name itself doesn't fit */
+static void partial_name(char *path, size_t len, const char *username, const char *filename,
+                         size_t expected)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)filename; *p; p++)
+        h = (h ^ *p) * 0x100000001b3ULL;
+    snprintf(path, len, "storage/%s/" UPLOAD_TEMP_PREFIX "%016lx-%zu" UPLOAD_PARTIAL_SUFFIX,
+             username, (unsigned long)h, expected);
+}
+
+int upload_stream_open_partial(UploadStream *up, const char *username, const char *filename,
+                               uint64_t session_id, size_t expected, size_t offset)
+{
+    if (!up || !username || !filename)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    up->fd = -1;
+    up->expected = expected;
+    up->written = 0;
+    up->partial = true;
+    up->session_id = session_id;
+    up->decoder = NULL;
+
+    char dir[128];
+    snprintf(dir, sizeof(dir), "storage/%s", username);
+    mkdir("storage", 0777);
+    mkdir(dir, 0777);
+
+    partial_name(up->temp_path, sizeof(up->temp_path), username, filename, expected);
+    int fd = open(up->temp_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR("UploadStream", "open failed for '%s': %s", up->temp_path, strerror(errno));
+        return -1;
+    }
+
+    /* A connection the server hasn't noticed is dead may still hold it */
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (offset > (size_t)st.st_size || offset > expected)
+    {
+        close(fd);
+        errno = ERANGE;
+        return -1;
+    }
+
+    /* Drop anything past offset (e.g. a torn last write) */
+    if (ftruncate(fd, (off_t)offset) != 0 || lseek(fd, (off_t)offset, SEEK_SET) < 0)
+    {
+        LOG_ERROR("UploadStream", "cannot resume '%s' at %zu: %s", up->temp_path, offset,
+                  strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    up->fd = fd;
+    up->written = offset;
+    return 0;
+}
+
+size_t upload_stream_partial_size(const char *username, const char *filename, size_t expected)
+{
+    char path[512];
+    struct stat st;
+    partial_name(path, sizeof(path), username, filename, expected);
+    if (stat(path, &st) != 0 || (size_t)st.st_size > expected)
+        return 0;
+    return (size_t)st.st_size;
+}
+
+int upload_stream_open(UploadStream *up, const char *username, uint64_t session_id,
+                       size_t expected)
+{
+    if (!up || !username)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    up->fd = -1;
+    up->expected = expected;
+    up->written = 0;
+    up->partial = false;
+    up->session_id = session_id;
+    up->decoder = NULL;
+
+    char dir[128];
+    snprintf(dir, sizeof(dir), "storage/%s", username);
+    mkdir("storage", 0777);
+    mkdir(dir, 0777);
+
+    temp_name(up->temp_path, sizeof(up->temp_path), dir, session_id);
+
+    up->fd = open(up->temp_path, O_WRONLY | O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC, 0644);
+    if (up->fd < 0)
+    {
+        LOG_ERROR("UploadStream", "open failed for '%s': %s", up->temp_path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void upload_stream_drop_decoder(UploadStream *up)
+{
+    if (!up->decoder)
+        return;
+    segment_decoder_free(up->decoder);
+    free(up->decoder);
+    up->decoder = NULL;
+}
+
+int upload_stream_decode(UploadStream *up)
+{
+    up->decoder = malloc(sizeof(SegmentDecoder));
+    if (!up->decoder)
+    {
+        upload_stream_abort(up);
+        errno = ENOMEM;
+        return -1;
+    }
+    segment_decoder_init(up->decoder);
+    return 0;
+}
+
+static int write_plain(UploadStream *up, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    while (len > 0)
+    {
+        ssize_t n = write(up->fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("UploadStream", "write failed for '%s': %s", up->temp_path, strerror(errno));
+            return -1;
+        }
+        p += n;
+        len -= n;
+        up->written += n;
+    }
+    return 0;
+}
+
+/* Decoder output: plain content, which must not outgrow the declared size */
+static int write_decoded(void *ctx, const void *data, size_t len)
+{
+    UploadStream *up = ctx;
+    if (len > up->expected - up->written)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    return write_plain(up, data, len);
+}
+
+int upload_stream_write(UploadStream *up, const void *data, size_t len)
+{
+    if (!up || up->fd < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (!up->decoder)
+        return write_plain(up, data, len);
+
+    int rc = segment_decoder_feed(up->decoder, data, len, write_decoded, up);
+    if (rc == -2)
+        errno = EBADMSG;
+    if (rc != 0 && errno == EBADMSG)
+        LOG_ERROR("UploadStream", "Malformed compressed body for '%s'", up->temp_path);
+    return rc == 0 ? 0 : -1;
+}
+
+int upload_stream_finish(UploadStream *up)
+{
+    if (!up || up->fd < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    bool decoded = up->decoder != NULL;
+    bool torn = decoded && !segment_decoder_idle(up->decoder);
+    upload_stream_drop_decoder(up);
+
+    int rc = close(up->fd);
+    up->fd = -1;
+    if (rc != 0)
+    {
+        int saved_errno = errno;
+        LOG_ERROR("UploadStream", "close failed for '%s': %s", up->temp_path, strerror(errno));
+        unlink(up->temp_path);
+        errno = saved_errno;
+        return -1;
+    }
+    if (torn || up->written != up->expected)
+    {
+        LOG_ERROR("UploadStream", "'%s' incomplete (%zu/%zu bytes)", up->temp_path, up->written,
+                  up->expected);
+        unlink(up->temp_path);
+        /* A plain body's length is framed; only decoding can come up short */
+        errno = decoded ? EBADMSG : EIO;
+        return -1;
+    }
+
+    if (up->partial)
+    {
+        /* The partial's name is shared by every upload of this file */
+        char dir[128];
+        char private_path[sizeof(up->temp_path)];
+        snprintf(dir, sizeof(dir), "%.*s",
+                 (int)(strrchr(up->temp_path, '/') - up->temp_path), up->temp_path);
+        temp_name(private_path, sizeof(private_path), dir, up->session_id);
+        if (rename(up->temp_path, private_path) != 0)
+        {
+            LOG_ERROR("UploadStream", "rename failed for '%s': %s", up->temp_path, strerror(errno));
+            unlink(up->temp_path);
+            return -1;
+        }
+        memcpy(up->temp_path, private_path, sizeof(up->temp_path));
+        up->partial = false;
+    }
+    return 0;
+}
+
+void upload_stream_abort(UploadStream *up)
+{
+    if (!up)
+        return;
+    upload_stream_drop_decoder(up);
+    if (up->fd >= 0)
+    {
+        close(up->fd);
+        up->fd = -1;
+        unlink(up->temp_path);
+    }
+}
+
+void upload_stream_suspend(UploadStream *up)
+{
+    if (!up || up->fd < 0)
+        return;
+    if (!up->partial)
+    {
+        upload_stream_abort(up);
+        return;
+    }
+
+    LOG_INFO("UploadStream", "Keeping '%s' (%zu/%zu bytes) for resume", up->temp_path, up->written,
+             up->expected);
+    upload_stream_drop_decoder(up);
+    close(up->fd);
+    up->fd = -1;
+}
+
+int upload_stream_expire_partials(time_t max_age)
+{
+    DIR *storage = opendir("storage");
+    if (!storage)
+        return 0;
+
+    time_t now = time(NULL);
+    size_t suffix_len = strlen(UPLOAD_PARTIAL_SUFFIX);
+    int removed = 0;
+    struct dirent *user;
+    while ((user = readdir(storage)) != NULL)
+    {
+        if (user->d_name[0] == '.')
+            continue;
+
+        char dir_path[300];
+        snprintf(dir_path, sizeof(dir_path), "storage/%s", user->d_name);
+        DIR *dir = opendir(dir_path);
+        if (!dir)
+            continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            size_t len = strlen(entry->d_name);
+            if (strncmp(entry->d_name, UPLOAD_TEMP_PREFIX, strlen(UPLOAD_TEMP_PREFIX)) != 0 ||
+                len < suffix_len || strcmp(entry->d_name + len - suffix_len, UPLOAD_PARTIAL_SUFFIX) != 0)
+                continue;
+
+            char path[600];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            if (stat(path, &st) == 0 && now - st.st_mtime > max_age && unlink(path) == 0)
+                removed++;
+        }
+        closedir(dir);
+    }
+    closedir(storage);
+
+    if (removed > 0)
+        LOG_INFO("UploadStream", "Removed %d abandoned partial upload(s)", removed);
+    return removed;
+}
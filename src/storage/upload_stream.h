@@ -0,0 +1,115 @@
+#ifndef UPLOAD_STREAM_H
+#define UPLOAD_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "compress.h"
+
+/*
+ * Streaming UPLOAD sink
+ *
+ * The connection side writes an upload body to a private temp file
+ * (storage/<user>/.upload-<session>-<seq>.tmp) one chunk at a time as it
+ * arrives, so peak memory per upload is one chunk rather than the whole
+ * file. The worker later renames the temp file over the destination while
+ * holding the file lock, which makes the new content appear atomically.
+ *
+ * Resumable uploads (v2) write to a partial file named after the target
+ * file and its total size, storage/<user>/.upload-<name hash>-<size>.part,
+ * which outlives a dropped connection. A reconnecting client asks how much
+ * of it is stored and sends only the rest. An flock keeps two connections
+ * from writing one partial at once; once complete, the partial is renamed
+ * to a private temp name before it is queued, so a new upload of the same
+ * file can start while a worker stores this one.
+ *
+ * A compressed body (upload_stream_decode) is decoded as it arrives, so
+ * the temp file and any partial always hold plain content and a resume
+ * offset counts plain bytes.
+ */
+
+#define DEFAULT_UPLOAD_CHUNK_SIZE (64 * 1024)
+#define MAX_UPLOAD_CHUNK_SIZE (64 * 1024 * 1024)
+#define UPLOAD_TEMP_PREFIX ".upload-"
+#define UPLOAD_PARTIAL_SUFFIX ".part"
+
+/* Partials nobody resumed for this long are removed at startup */
+#define UPLOAD_PARTIAL_MAX_AGE (24 * 60 * 60)
+
+typedef struct UploadStream
+{
+    int fd;               /* Temp file descriptor, -1 when closed */
+    char temp_path[512];  /* storage/<user>/.upload-<session>-<seq>.tmp */
+    size_t expected;      /* Declared body size */
+    size_t written;       /* Bytes stored so far */
+    bool partial;         /* temp_path is a resumable partial */
+    uint64_t session_id;  /* Names the private temp file a partial becomes */
+    SegmentDecoder *decoder; /* Compressed body, NULL if plain */
+} UploadStream;
+
+/**
+ * Create the temp file for a new upload
+ * @return 0 on success, -1 on error (errno set)
+ */
+int upload_stream_open(UploadStream *up, const char *username, uint64_t session_id,
+                       size_t expected);
+
+/**
+ * Open (or create) the resumable partial for username/filename and
+ * continue it at offset; offset 0 starts over
+ * @param expected Total file size
+ * @return 0 on success, -1 on error (errno set: EBUSY if another
+ *         connection is writing this partial, ERANGE if offset is past
+ *         the bytes stored)
+ */
+int upload_stream_open_partial(UploadStream *up, const char *username, const char *filename,
+                               uint64_t session_id, size_t expected, size_t offset);
+
+/**
+ * Bytes of an interrupted upload of username/filename (expected bytes in
+ * total) that are stored and can be resumed from; 0 if none
+ */
+size_t upload_stream_partial_size(const char *username, const char *filename, size_t expected);
+
+/**
+ * Treat the rest of the body as compress.h segments; expected stays the
+ * plain size
+ * @return 0 on success, -1 if out of memory (stream aborted)
+ */
+int upload_stream_decode(UploadStream *up);
+
+/**
+ * Append one chunk to the temp file (handles short writes)
+ * @return 0 on success, -1 on error (errno set; EBADMSG if a compressed
+ *         body is malformed)
+ */
+int upload_stream_write(UploadStream *up, const void *data, size_t len);
+
+/**
+ * Close the temp file once the whole body is stored (a partial is renamed
+ * to a private temp name, updating temp_path)
+ * @return 0 on success, -1 if the body is incomplete or close failed
+ *         (errno set; EBADMSG if a compressed body ended mid-segment or
+ *         decoded to the wrong size)
+ */
+int upload_stream_finish(UploadStream *up);
+
+/**
+ * Close and remove the temp file (safe to call on a closed stream)
+ */
+void upload_stream_abort(UploadStream *up);
+
+/**
+ * Close after the connection dropped mid-body: a partial is kept for the
+ * client to resume, anything else is removed like upload_stream_abort
+ */
+void upload_stream_suspend(UploadStream *up);
+
+/**
+ * Remove partials not written to for max_age seconds
+ * @return Number removed
+ */
+int upload_stream_expire_partials(time_t max_age);
+
+#endif /* UPLOAD_STREAM_H */
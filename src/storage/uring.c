@@ -0,0 +1,229 @@
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* RENAMEAT/UNLINKAT arrived in 5.11; older kernels reject them at completion
+ * time, so check up front and let the caller fall back to plain syscalls */
+static int uring_probe_ops(Uring *ring)
+{
+    static const int needed[] = {IORING_OP_OPENAT, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT};
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe)
+        return -1;
+
+    int rc = 0;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0)
+    {
+        rc = -1;
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+        {
+            int op = needed[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                errno = EOPNOTSUPP;
+                rc = -1;
+                break;
+            }
+        }
+    }
+
+    free(probe);
+    return rc;
+}
+
+/* Undo a partial uring_init, keeping its errno */
+static int uring_fail(Uring *ring)
+{
+    int saved_errno = errno;
+    uring_destroy(ring);
+    errno = saved_errno;
+    return -1;
+}
+
+int uring_init(Uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0)
+        return -1;
+    ring->ring_fd = fd;
+    ring->entries = p.sq_entries;
+
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_map_len > ring->sq_map_len)
+        ring->sq_map_len = ring->cq_map_len;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+        return uring_fail(ring);
+
+    if (single_mmap)
+    {
+        ring->cq_map = ring->sq_map;
+    }
+    else
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED)
+            return uring_fail(ring);
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        return uring_fail(ring);
+
+    char *sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (uring_probe_ops(ring) != 0)
+        return uring_fail(ring);
+    return 0;
+}
+
+void uring_destroy(Uring *ring)
+{
+    if (!ring || ring->ring_fd < 0)
+        return;
+
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map && ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->ring_fd);
+    ring->ring_fd = -1;
+}
+
+/* Claim the next SQE slot (zeroed), or NULL if the queue is full */
+static struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    if (tail - head >= ring->entries)
+        return NULL;
+
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+
+    /* Publish the entry; the kernel reads it on the next io_uring_enter */
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+    return sqe;
+}
+
+int uring_prep_openat(Uring *ring, const char *path, int flags, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = (uint32_t)flags;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_prep_renameat(Uring *ring, const char *oldpath, const char *newpath, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)oldpath;
+    sqe->len = (uint32_t)AT_FDCWD;  /* newdirfd */
+    sqe->addr2 = (uint64_t)(uintptr_t)newpath;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_prep_unlinkat(Uring *ring, const char *path, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_UNLINKAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr)
+{
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (1)
+    {
+        int rc = sys_io_uring_enter(ring->ring_fd, ring->sq_pending, wait_nr, flags);
+        if (rc >= 0)
+        {
+            ring->sq_pending -= (unsigned)rc;
+            if (ring->sq_pending == 0 || wait_nr == 0)
+                return 0;
+            continue;  /* Partial submit: push the rest */
+        }
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+bool uring_reap(Uring *ring, uint64_t *user_data, int *res)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring wrapper (raw syscalls, no liburing)
+ *
+ * One ring per worker thread, never shared, so no locking. Workers queue
+ * the file syscalls of several tasks as SQEs, submit them with one
+ * io_uring_enter, and finish each task when its CQE arrives. Only the
+ * opcodes the worker needs are wrapped.
+ */
+
+typedef struct Uring
+{
+    int ring_fd;
+    unsigned entries;
+
+    /* Submission queue (shared with the kernel) */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending;      /* SQEs queued but not yet submitted */
+
+    /* Completion queue (shared with the kernel) */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;             /* == sq_map with IORING_FEAT_SINGLE_MMAP */
+    size_t cq_map_len;
+    size_t sqes_len;
+} Uring;
+
+/**
+ * Create a ring with room for 'entries' submissions and check that the
+ * kernel supports every opcode wrapped below
+ * @return 0 on success, -1 on error (errno set; EOPNOTSUPP if an opcode is missing)
+ */
+int uring_init(Uring *ring, unsigned entries);
+
+/**
+ * Unmap and close the ring (no operations may be in flight)
+ */
+void uring_destroy(Uring *ring);
+
+/**
+ * Queue an operation; user_data comes back in its completion
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_prep_openat(Uring *ring, const char *path, int flags, uint64_t user_data);
+int uring_prep_renameat(Uring *ring, const char *oldpath, const char *newpath, uint64_t user_data);
+int uring_prep_unlinkat(Uring *ring, const char *path, uint64_t user_data);
+
+/**
+ * Submit everything queued and wait until at least wait_nr completions
+ * are available (0 = don't wait)
+ * @return 0 on success, -1 on error (errno set)
+ */
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+
+/**
+ * Pop one completion if available
+ * @param user_data Output: value given when the operation was queued
+ * @param res Output: syscall result (>= 0) or -errno
+ * @return true if a completion was returned
+ */
+bool uring_reap(Uring *ring, uint64_t *user_data, int *res);
+
+#endif /* URING_H */
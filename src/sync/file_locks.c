@@ -1,4 +1,5 @@
 #include "file_locks.h"
+#include "../utils/logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +8,7 @@
 FileLockManager global_file_lock_manager;
 
 /* Simple hash function for filepath */
-static unsigned int hash_filepath(const char *filepath, int capacity)
+static unsigned int hash_filepath(const char *filepath)
 {
     unsigned int hash = 5381;
     int c;
@@ -17,48 +18,82 @@ static unsigned int hash_filepath(const char *filepath, int capacity)
         hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
     }
 
-    return hash % capacity;
+    return hash;
+}
+
+/* Low bits pick the shard, the rest pick the bucket within it */
+static FileLockShard *shard_for(FileLockManager *manager, unsigned int hash)
+{
+    return &manager->shards[hash % FILE_LOCK_SHARDS];
+}
+
+static int bucket_for(const FileLockShard *shard, unsigned int hash)
+{
+    return (int)((hash / FILE_LOCK_SHARDS) % (unsigned int)shard->nbuckets);
+}
+
+/* Double a shard's bucket array; caller holds shard->mtx.
+ * On allocation failure the shard keeps working with longer chains. */
+static void shard_grow(FileLockShard *shard)
+{
+    int new_nbuckets = shard->nbuckets * 2;
+    FileLock **new_buckets = calloc((size_t)new_nbuckets, sizeof(FileLock *));
+    if (!new_buckets)
+        return;
+
+    int old_nbuckets = shard->nbuckets;
+    FileLock **old_buckets = shard->buckets;
+    shard->buckets = new_buckets;
+    shard->nbuckets = new_nbuckets;
+
+    for (int i = 0; i < old_nbuckets; i++)
+    {
+        FileLock *lock = old_buckets[i];
+        while (lock)
+        {
+            FileLock *next = lock->next;
+            int b = bucket_for(shard, lock->hash);
+            lock->next = new_buckets[b];
+            new_buckets[b] = lock;
+            lock = next;
+        }
+    }
+
+    free(old_buckets);
 }
 
 /* Initialize the file lock manager */
-int file_lock_manager_init(FileLockManager *manager, int capacity)
+int file_lock_manager_init(FileLockManager *manager, int initial_buckets)
 {
-    if (!manager || capacity <= 0)
+    if (!manager || initial_buckets <= 0)
         return -1;
 
-    manager->capacity = capacity;
+    int per_shard = initial_buckets / FILE_LOCK_SHARDS;
+    if (per_shard < 1)
+        per_shard = 1;
 
-    /* Initialize all lock slots as unused */
-    for (int i = 0; i < capacity; i++)
+    for (int i = 0; i < FILE_LOCK_SHARDS; i++)
     {
-        manager->locks[i].filepath[0] = '\0';
-        manager->locks[i].ref_count = 0;
-        manager->locks[i].in_use = false;
+        FileLockShard *shard = &manager->shards[i];
+        shard->buckets = calloc((size_t)per_shard, sizeof(FileLock *));
+        shard->nbuckets = per_shard;
+        shard->count = 0;
 
-        /* Initialize the file-specific mutex */
-        if (pthread_mutex_init(&manager->locks[i].mtx, NULL) != 0)
+        if (!shard->buckets || pthread_mutex_init(&shard->mtx, NULL) != 0)
         {
-            /* Clean up previously initialized mutexes */
+            free(shard->buckets);
+            /* Clean up previously initialized shards */
             for (int j = 0; j < i; j++)
             {
-                pthread_mutex_destroy(&manager->locks[j].mtx);
+                pthread_mutex_destroy(&manager->shards[j].mtx);
+                free(manager->shards[j].buckets);
             }
             return -1;
         }
     }
 
-    /* Initialize the global manager mutex */
-    if (pthread_mutex_init(&manager->manager_mtx, NULL) != 0)
-    {
-        /* Clean up all file mutexes */
-        for (int i = 0; i < capacity; i++)
-        {
-            pthread_mutex_destroy(&manager->locks[i].mtx);
-        }
-        return -1;
-    }
-
-    printf("[FileLockManager] Initialized with capacity %d\n", capacity);
+    LOG_INFO("FileLockManager", "Initialized with %d shards (%d buckets)", FILE_LOCK_SHARDS,
+             per_shard * FILE_LOCK_SHARDS);
     return 0;
 }
 
@@ -68,20 +103,112 @@ void file_lock_manager_destroy(FileLockManager *manager)
     if (!manager)
         return;
 
-    /* Destroy all lock mutexes */
-    for (int i = 0; i < manager->capacity; i++)
+    for (int i = 0; i < FILE_LOCK_SHARDS; i++)
     {
-        pthread_mutex_destroy(&manager->locks[i].mtx);
+        FileLockShard *shard = &manager->shards[i];
+
+        /* Workers are joined by now; anything left is a leaked acquire */
+        for (int b = 0; b < shard->nbuckets; b++)
+        {
+            FileLock *lock = shard->buckets[b];
+            while (lock)
+            {
+                FileLock *next = lock->next;
+                pthread_rwlock_destroy(&lock->rwlock);
+                free(lock);
+                lock = next;
+            }
+        }
+
+        free(shard->buckets);
+        shard->buckets = NULL;
+        shard->nbuckets = 0;
+        shard->count = 0;
+        pthread_mutex_destroy(&shard->mtx);
     }
 
-    /* Destroy the global manager mutex */
-    pthread_mutex_destroy(&manager->manager_mtx);
+    LOG_INFO("FileLockManager", "Destroyed");
+}
+
+/* Look up or create the lock for filepath and take a reference */
+static FileLock *file_lock_ref(FileLockManager *manager, const char *filepath, int *ref_count_out)
+{
+    unsigned int hash = hash_filepath(filepath);
+    FileLockShard *shard = shard_for(manager, hash);
+
+    pthread_mutex_lock(&shard->mtx);
 
-    printf("[FileLockManager] Destroyed\n");
+    /* Look for existing lock in this bucket's chain */
+    int b = bucket_for(shard, hash);
+    FileLock *lock = shard->buckets[b];
+    while (lock && (lock->hash != hash || strcmp(lock->filepath, filepath) != 0))
+        lock = lock->next;
+
+    if (lock)
+    {
+        lock->ref_count++;
+    }
+    else
+    {
+        /* Not found - create new lock */
+        lock = malloc(sizeof(FileLock));
+        if (!lock || pthread_rwlock_init(&lock->rwlock, NULL) != 0)
+        {
+            pthread_mutex_unlock(&shard->mtx);
+            free(lock);
+            LOG_ERROR("FileLockManager", "Failed to allocate lock for '%s'", filepath);
+            return NULL;
+        }
+        memcpy(lock->filepath, filepath, MAX_FILEPATH_LEN);
+        lock->ref_count = 1;
+        lock->hash = hash;
+        lock->next = shard->buckets[b];
+        shard->buckets[b] = lock;
+
+        if (++shard->count > shard->nbuckets * 2)
+            shard_grow(shard);
+    }
+
+    *ref_count_out = lock->ref_count;
+    pthread_mutex_unlock(&shard->mtx);
+    return lock;
+}
+
+/* Drop a reference taken by file_lock_ref, freeing the lock at zero */
+static void file_lock_unref(FileLockManager *manager, FileLock *file_lock)
+{
+    FileLockShard *shard = shard_for(manager, file_lock->hash);
+    pthread_mutex_lock(&shard->mtx);
+
+    /* Decrement ref_count */
+    file_lock->ref_count--;
+
+    /* If no more references, unlink and free it */
+    if (file_lock->ref_count <= 0)
+    {
+        FileLock **link = &shard->buckets[bucket_for(shard, file_lock->hash)];
+        while (*link && *link != file_lock)
+            link = &(*link)->next;
+        if (*link)
+            *link = file_lock->next;
+        shard->count--;
+
+        LOG_DEBUG("FileLockManager", "Released lock for '%s' (freed)", file_lock->filepath);
+        pthread_rwlock_destroy(&file_lock->rwlock);
+        free(file_lock);
+    }
+    else
+    {
+        LOG_DEBUG("FileLockManager", "Released lock for '%s' (ref_count=%d)", file_lock->filepath,
+                  file_lock->ref_count);
+    }
+
+    pthread_mutex_unlock(&shard->mtx);
 }
 
 /* Acquire a file lock (creates if doesn't exist) */
-FileLock *file_lock_acquire(FileLockManager *manager, const char *username, const char *filename)
+FileLock *file_lock_acquire(FileLockManager *manager, const char *username, const char *filename,
+                            file_lock_mode_t mode)
 {
     if (!manager || !username || !filename)
         return NULL;
@@ -90,55 +217,49 @@ FileLock *file_lock_acquire(FileLockManager *manager, const char *username, cons
     char filepath[MAX_FILEPATH_LEN];
     snprintf(filepath, sizeof(filepath), "%s/%s", username, filename);
 
-    /* Lock the global manager */
-    pthread_mutex_lock(&manager->manager_mtx);
+    int ref_count;
+    FileLock *lock = file_lock_ref(manager, filepath, &ref_count);
+    if (!lock)
+        return NULL;
 
-    /* Look for existing lock or empty slot */
-    unsigned int hash = hash_filepath(filepath, manager->capacity);
-    unsigned int index = hash;
-    FileLock *lock = NULL;
-    int attempts = 0;
+    /* Acquire the file-specific lock; ref_count keeps it alive while we wait */
+    if (mode == FILE_LOCK_SHARED)
+        pthread_rwlock_rdlock(&lock->rwlock);
+    else
+        pthread_rwlock_wrlock(&lock->rwlock);
 
-    while (attempts < manager->capacity)
-    {
-        if (manager->locks[index].in_use && strcmp(manager->locks[index].filepath, filepath) == 0)
-        {
-            /* Found existing lock for this file */
-            lock = &manager->locks[index];
-            lock->ref_count++;
-            break;
-        }
-        else if (!manager->locks[index].in_use)
-        {
-            /* Found empty slot - create new lock */
-            lock = &manager->locks[index];
-            strncpy(lock->filepath, filepath, MAX_FILEPATH_LEN - 1);
-            lock->filepath[MAX_FILEPATH_LEN - 1] = '\0';
-            lock->ref_count = 1;
-            lock->in_use = true;
-            break;
-        }
+    LOG_DEBUG("FileLockManager", "Acquired %s lock for '%s' (ref_count=%d)",
+              mode == FILE_LOCK_SHARED ? "shared" : "exclusive", filepath, ref_count);
 
-        /* Linear probing */
-        index = (index + 1) % manager->capacity;
-        attempts++;
-    }
+    return lock;
+}
+
+int file_lock_try_acquire(FileLockManager *manager, const char *username, const char *filename,
+                          file_lock_mode_t mode, FileLock **out)
+{
+    if (!manager || !username || !filename || !out)
+        return -1;
 
-    /* Unlock the global manager */
-    pthread_mutex_unlock(&manager->manager_mtx);
+    char filepath[MAX_FILEPATH_LEN];
+    snprintf(filepath, sizeof(filepath), "%s/%s", username, filename);
 
+    int ref_count;
+    FileLock *lock = file_lock_ref(manager, filepath, &ref_count);
     if (!lock)
+        return -1;
+
+    int rc = mode == FILE_LOCK_SHARED ? pthread_rwlock_tryrdlock(&lock->rwlock)
+                                      : pthread_rwlock_trywrlock(&lock->rwlock);
+    if (rc != 0)
     {
-        fprintf(stderr, "[FileLockManager] ERROR: Lock table full (capacity=%d)\n", manager->capacity);
-        return NULL;
+        file_lock_unref(manager, lock);
+        return -2;
     }
 
-    /* Acquire the file-specific lock */
-    pthread_mutex_lock(&lock->mtx);
-
-    printf("[FileLockManager] Acquired lock for '%s' (ref_count=%d)\n", filepath, lock->ref_count);
-
-    return lock;
+    LOG_DEBUG("FileLockManager", "Acquired %s lock for '%s' (ref_count=%d)",
+              mode == FILE_LOCK_SHARED ? "shared" : "exclusive", filepath, ref_count);
+    *out = lock;
+    return 0;
 }
 
 /* Release a file lock */
@@ -147,31 +268,7 @@ void file_lock_release(FileLockManager *manager, FileLock *file_lock)
     if (!manager || !file_lock)
         return;
 
-    char filepath_copy[MAX_FILEPATH_LEN];
-    strncpy(filepath_copy, file_lock->filepath, MAX_FILEPATH_LEN - 1);
-    filepath_copy[MAX_FILEPATH_LEN - 1] = '\0';
-
-    /* Unlock the file-specific mutex first */
-    pthread_mutex_unlock(&file_lock->mtx);
-
-    /* Lock the global manager */
-    pthread_mutex_lock(&manager->manager_mtx);
-
-    /* Decrement ref_count */
-    file_lock->ref_count--;
-
-    /* If no more references, mark slot as unused */
-    if (file_lock->ref_count <= 0)
-    {
-        file_lock->in_use = false;
-        file_lock->filepath[0] = '\0';
-        printf("[FileLockManager] Released lock for '%s' (freed)\n", filepath_copy);
-    }
-    else
-    {
-        printf("[FileLockManager] Released lock for '%s' (ref_count=%d)\n", filepath_copy, file_lock->ref_count);
-    }
-
-    /* Unlock the global manager */
-    pthread_mutex_unlock(&manager->manager_mtx);
+    /* Unlock the file-specific rwlock first */
+    pthread_rwlock_unlock(&file_lock->rwlock);
+    file_lock_unref(manager, file_lock);
 }
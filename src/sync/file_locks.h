@@ -11,34 +11,53 @@
  * operations on the same file (e.g., simultaneous upload/delete).
  *
  * Design:
- * - Global hash table maps (username, filename) -> FileLock
- * - Each FileLock has a mutex and reference count
- * - Locks are created on-demand and destroyed when ref_count reaches 0
- * - Global mutex protects the lock map itself
+ * - Lock map is split into FILE_LOCK_SHARDS shards by hash of
+ *   "username/filename"; each shard has its own mutex and chained buckets,
+ *   so acquires on unrelated files rarely contend
+ * - Each FileLock is a reader/writer lock with a reference count: downloads
+ *   take it shared and run in parallel, upload/delete take it exclusive
+ * - Locks are allocated on demand and freed when ref_count reaches 0;
+ *   a shard doubles its bucket array when its load factor exceeds 2
  */
 
-#define MAX_FILE_LOCKS 1024
+#define FILE_LOCK_SHARDS 64
+#define FILE_LOCK_INITIAL_BUCKETS 1024   // Across all shards
 #define MAX_FILEPATH_LEN 320  // username(64) + "/" + filename(256)
 
+typedef enum
+{
+    FILE_LOCK_SHARED,       /* Readers (DOWNLOAD) */
+    FILE_LOCK_EXCLUSIVE     /* Writers (UPLOAD, DELETE) */
+} file_lock_mode_t;
+
 /* File lock structure */
 typedef struct FileLock
 {
     char filepath[MAX_FILEPATH_LEN];  /* Key: "username/filename" */
-    pthread_mutex_t mtx;              /* Protects access to this specific file */
-    int ref_count;                    /* Number of operations holding this lock */
-    bool in_use;                      /* Whether this slot is occupied */
+    pthread_rwlock_t rwlock;          /* Protects access to this specific file */
+    int ref_count;                    /* Holders and waiters; guarded by shard mtx */
+    unsigned int hash;                /* Cached for rehashing */
+    struct FileLock *next;            /* Bucket chain */
 } FileLock;
 
+/* One independently locked slice of the lock map */
+typedef struct FileLockShard
+{
+    pthread_mutex_t mtx;              /* Protects buckets, nbuckets, count */
+    FileLock **buckets;
+    int nbuckets;
+    int count;
+} FileLockShard;
+
 /* File lock manager (global) */
 typedef struct FileLockManager
 {
-    FileLock locks[MAX_FILE_LOCKS];   /* Array of file locks (simple hash table) */
-    int capacity;                     /* Size of the array */
-    pthread_mutex_t manager_mtx;      /* Protects the lock map */
+    FileLockShard shards[FILE_LOCK_SHARDS];
 } FileLockManager;
 
-/* Initialize the file lock manager */
-int file_lock_manager_init(FileLockManager *manager, int capacity);
+/* Initialize the file lock manager with an initial bucket count
+ * (spread across shards; the table grows as needed) */
+int file_lock_manager_init(FileLockManager *manager, int initial_buckets);
 
 /* Destroy the file lock manager */
 void file_lock_manager_destroy(FileLockManager *manager);
@@ -47,23 +66,28 @@ void file_lock_manager_destroy(FileLockManager *manager);
  * Returns: pointer to the acquired FileLock, or NULL on error
  *
  * This function:
- * 1. Locks the global manager mutex
- * 2. Looks up or creates a FileLock for the given username/filename
- * 3. Increments ref_count
- * 4. Unlocks the global manager mutex
- * 5. Locks the file-specific mutex
- * 6. Returns the FileLock pointer
+ * 1. Locks the shard mutex for the given username/filename
+ * 2. Looks up or creates the FileLock and increments ref_count
+ * 3. Unlocks the shard mutex
+ * 4. Takes the file rwlock in the requested mode
+ * 5. Returns the FileLock pointer
  */
-FileLock *file_lock_acquire(FileLockManager *manager, const char *username, const char *filename);
+FileLock *file_lock_acquire(FileLockManager *manager, const char *username, const char *filename,
+                            file_lock_mode_t mode);
+
+/* Try to acquire a file lock without blocking
+ * Returns: 0 with *out set, -2 if the file is locked in a conflicting mode,
+ * -1 on error. Lets a thread that already holds other file locks avoid
+ * waiting on this one (which could deadlock). */
+int file_lock_try_acquire(FileLockManager *manager, const char *username, const char *filename,
+                          file_lock_mode_t mode, FileLock **out);
 
-/* Release a file lock
+/* Release a file lock (either mode)
  *
  * This function:
- * 1. Unlocks the file-specific mutex
- * 2. Locks the global manager mutex
- * 3. Decrements ref_count
- * 4. If ref_count == 0, marks the lock slot as unused
- * 5. Unlocks the global manager mutex
+ * 1. Unlocks the file rwlock
+ * 2. Locks the shard mutex and decrements ref_count
+ * 3. If ref_count == 0, unlinks and frees the FileLock
  */
 void file_lock_release(FileLockManager *manager, FileLock *file_lock);
 
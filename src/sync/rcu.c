@@ -0,0 +1,134 @@
+#include "rcu.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * One thread's reader state. seq is odd while the thread is inside a
+ * read-side section; rcu_synchronize waits for each odd seq it sees to
+ * change. A thread that exits gives its record back (in_use = 0) for the
+ * next new thread.
+ */
+typedef struct RcuReader
+{
+    _Alignas(64) uint64_t seq;
+    int in_use;
+    struct RcuReader *next;   /* All records, newest first; never unlinked */
+} RcuReader;
+
+static RcuReader *readers;
+static RcuHead *deferred;      /* rcu_call'ed, newest first */
+static size_t deferred_count;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static __thread RcuReader *thread_reader;
+
+static void reader_release(void *arg)
+{
+    RcuReader *r = arg;
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void reader_key_create(void)
+{
+    pthread_key_create(&reader_key, reader_release);
+}
+
+/* The calling thread's record: reuse one given back by an exited thread,
+ * else allocate one */
+static RcuReader *reader_acquire(void)
+{
+    RcuReader *r;
+    for (r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &expected, 1, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!r)
+    {
+        r = aligned_alloc(64, sizeof(RcuReader));
+        if (!r)
+            abort();  /* Readers cannot fail; this is a few bytes per thread */
+        r->seq = 0;
+        r->in_use = 1;
+        r->next = __atomic_load_n(&readers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&readers, &r->next, r, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_once(&reader_key_once, reader_key_create);
+    pthread_setspecific(reader_key, r);
+    thread_reader = r;
+    return r;
+}
+
+void rcu_read_lock(void)
+{
+    RcuReader *r = thread_reader ? thread_reader : reader_acquire();
+    /* The odd seq must be visible before the section's loads of protected
+     * pointers: a store-load ordering, which only seq_cst on both sides
+     * gives (pairs with the fence in rcu_synchronize). On x86 that makes
+     * this store an xchg, a full barrier of some tens of cycles, paid
+     * once per section; the loads themselves stay plain movs. */
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_SEQ_CST);
+}
+
+void rcu_read_unlock(void)
+{
+    RcuReader *r = thread_reader;
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+void rcu_synchronize(void)
+{
+    /* Orders the caller's unlink before the scan: a section that starts
+     * after it cannot find what was unlinked */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (RcuReader *r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        uint64_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1))
+            continue;
+        /* Sections are a few loads long; yield in case the reader is preempted */
+        while (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == seq)
+            sched_yield();
+    }
+}
+
+size_t rcu_call(RcuHead *head, void (*func)(RcuHead *head))
+{
+    head->func = func;
+    head->next = __atomic_load_n(&deferred, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&deferred, &head->next, head, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+    return __atomic_add_fetch(&deferred_count, 1, __ATOMIC_RELAXED);
+}
+
+size_t rcu_reclaim(void)
+{
+    /* Everything in the batch was unlinked before it was queued, so a
+     * grace period that starts after taking the batch covers all of it */
+    RcuHead *head = __atomic_exchange_n(&deferred, NULL, __ATOMIC_ACQUIRE);
+    if (!head)
+        return 0;
+    rcu_synchronize();
+
+    size_t count = 0;
+    while (head)
+    {
+        RcuHead *next = head->next;
+        head->func(head);
+        head = next;
+        count++;
+    }
+    __atomic_sub_fetch(&deferred_count, count, __ATOMIC_RELAXED);
+    return count;
+}
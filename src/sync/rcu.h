@@ -0,0 +1,57 @@
+#ifndef RCU_H
+#define RCU_H
+
+/*
+ * Read-copy-update style grace periods
+ *
+ * Readers wrap lock-free traversals of shared structures in
+ * rcu_read_lock/rcu_read_unlock; the pair costs two stores to a counter
+ * the thread owns (the first a full barrier), and never blocks. A writer that unlinks
+ * something calls rcu_synchronize before freeing it: that waits until
+ * every read-side section already running when it was called has ended,
+ * so no reader can still hold a pointer to what was unlinked.
+ *
+ * Inside a section, load the shared pointers a writer may unlink with
+ * __ATOMIC_SEQ_CST. Each thread registers a reader record the first time
+ * it reads (records of exited threads are reused). Read-side sections
+ * must be short and must not nest or block; writers serialize among
+ * themselves.
+ *
+ * A writer that must not wait (it holds a lock, or is on a connection's
+ * teardown path) hands the object to rcu_call instead: objects queue up
+ * and one rcu_reclaim, run periodically by the reaper thread, covers all
+ * of them with a single grace period.
+ */
+
+#include <stddef.h>
+
+/* Embedded in an object whose release is deferred with rcu_call */
+typedef struct RcuHead
+{
+    struct RcuHead *next;
+    void (*func)(struct RcuHead *head);
+} RcuHead;
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+/* Wait for every read-side section in progress to end (never call it
+ * inside one) */
+void rcu_synchronize(void);
+
+/**
+ * Run func(head) after a grace period, from a later rcu_reclaim; does not
+ * block. Call it once the object is unlinked.
+ * @return Objects now waiting; a caller that may block can rcu_reclaim
+ *         itself if that grows large
+ */
+size_t rcu_call(RcuHead *head, void (*func)(RcuHead *head));
+
+/**
+ * Wait for one grace period, then run the callbacks of everything
+ * rcu_call queued before it (never call it inside a read-side section)
+ * @return Number of callbacks run
+ */
+size_t rcu_reclaim(void);
+
+#endif /* RCU_H */
@@ -0,0 +1,191 @@
+#include "admin_thread.h"
+#include "../server.h"
+#include "../utils/metrics.h"
+#include "../utils/network_utils.h"
+#include "../utils/obj_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define ADMIN_POLL_MS 200         /* How often the idle loop checks keep_running */
+#define ADMIN_REQUEST_MAX 2048
+#define ADMIN_RECV_TIMEOUT_SEC 1  /* A scraper that stalls mid-request is dropped */
+
+static int admin_fd = -1;
+static pthread_t admin_thread;
+static bool admin_running = false;
+
+/* Gauges owned by the queues and the session manager */
+static void admin_write_gauges(FILE *out)
+{
+    fprintf(out, "# HELP stash_queue_depth Entries waiting in each queue\n");
+    fprintf(out, "# TYPE stash_queue_depth gauge\n");
+    fprintf(out, "stash_queue_depth{queue=\"client\"} %d\n", client_queue_size(&client_queue));
+    for (int lane = 0; lane < TASK_LANE_COUNT; lane++)
+        fprintf(out, "stash_queue_depth{queue=\"%s\"} %d\n", task_lane_name(lane),
+                task_lanes_depth(&task_lanes, lane));
+
+    uint64_t active, total, peak;
+    session_get_statistics(&session_manager, &active, &total, &peak);
+    fprintf(out, "# HELP stash_sessions_active Sessions currently open\n");
+    fprintf(out, "# TYPE stash_sessions_active gauge\n");
+    fprintf(out, "stash_sessions_active %lu\n", active);
+    fprintf(out, "# HELP stash_sessions_peak Most sessions open at once\n");
+    fprintf(out, "# TYPE stash_sessions_peak gauge\n");
+    fprintf(out, "stash_sessions_peak %lu\n", peak);
+    fprintf(out, "# HELP stash_sessions_total Sessions created\n");
+    fprintf(out, "# TYPE stash_sessions_total counter\n");
+    fprintf(out, "stash_sessions_total %lu\n", total);
+    fprintf(out, "# HELP stash_sessions_reaped_total Sessions closed for being idle\n");
+    fprintf(out, "# TYPE stash_sessions_reaped_total counter\n");
+    fprintf(out, "stash_sessions_reaped_total %lu\n", session_reaped_count(&session_manager));
+
+    obj_pool_write(out);
+    fprintf(out, "# HELP stash_response_buf_oversize_total Reply bodies too large for a pool\n");
+    fprintf(out, "# TYPE stash_response_buf_oversize_total counter\n");
+    fprintf(out, "stash_response_buf_oversize_total %lu\n", response_buf_oversize_count());
+}
+
+static void admin_reply(int cfd, const char *status, const char *body, size_t body_len)
+{
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: close\r\n\r\n",
+                     status, body_len);
+    if (send_full(cfd, head, n) == n && body_len > 0)
+        send_full(cfd, body, body_len);
+}
+
+static void admin_serve(int cfd)
+{
+    struct timeval tv = {.tv_sec = ADMIN_RECV_TIMEOUT_SEC};
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    /* Only the request line matters; read until the header ends */
+    char req[ADMIN_REQUEST_MAX];
+    size_t len = 0;
+    while (len < sizeof(req) - 1)
+    {
+        ssize_t n = recv(cfd, req + len, sizeof(req) - 1 - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+    req[len] = '\0';
+
+    if (strncmp(req, "GET /metrics ", 13) != 0 && strncmp(req, "GET /metrics\r", 13) != 0)
+    {
+        const char *msg = "Not found\n";
+        admin_reply(cfd, "404 Not Found", msg, strlen(msg));
+        return;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (!out)
+    {
+        admin_reply(cfd, "500 Internal Server Error", "", 0);
+        return;
+    }
+    metrics_write(out);
+    admin_write_gauges(out);
+    fclose(out);
+
+    admin_reply(cfd, "200 OK", body, body_len);
+    free(body);
+}
+
+static void *admin_main(void *arg)
+{
+    (void)arg;
+    struct pollfd pfd = {.fd = admin_fd, .events = POLLIN};
+
+    while (keep_running)
+    {
+        int rc = poll(&pfd, 1, ADMIN_POLL_MS);
+        if (rc < 0 && errno != EINTR)
+        {
+            LOG_ERROR("Admin", "poll: %s", strerror(errno));
+            break;
+        }
+        if (rc <= 0)
+            continue;
+
+        int cfd = accept(admin_fd, NULL, NULL);
+        if (cfd < 0)
+            continue;
+        admin_serve(cfd);
+        close(cfd);
+    }
+    return NULL;
+}
+
+int admin_start(const char *port)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int s = getaddrinfo("127.0.0.1", port, &hints, &res);
+    if (s != 0)
+    {
+        LOG_ERROR("Admin", "getaddrinfo: %s", gai_strerror(s));
+        return -1;
+    }
+
+    admin_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (admin_fd >= 0)
+    {
+        int yes = 1;
+        setsockopt(admin_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(admin_fd, res->ai_addr, res->ai_addrlen) != 0 || listen(admin_fd, 8) != 0)
+        {
+            LOG_ERROR("Admin", "Failed to listen on 127.0.0.1:%s: %s", port, strerror(errno));
+            close(admin_fd);
+            admin_fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (admin_fd < 0)
+        return -1;
+
+    int rc = pthread_create(&admin_thread, NULL, admin_main, NULL);
+    if (rc != 0)
+    {
+        LOG_ERROR("Admin", "Failed to create admin thread: %s", strerror(rc));
+        close(admin_fd);
+        admin_fd = -1;
+        return -1;
+    }
+    admin_running = true;
+
+    LOG_INFO("Admin", "Metrics on http://127.0.0.1:%s/metrics", port);
+    return 0;
+}
+
+void admin_join(void)
+{
+    if (!admin_running)
+        return;
+    pthread_join(admin_thread, NULL);
+    admin_running = false;
+    close(admin_fd);
+    admin_fd = -1;
+}
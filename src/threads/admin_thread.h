@@ -0,0 +1,25 @@
+#ifndef ADMIN_THREAD_H
+#define ADMIN_THREAD_H
+
+/*
+ * Local admin endpoint
+ *
+ * One thread serves GET /metrics over plain HTTP/1.0 on 127.0.0.1 only:
+ * the pipeline histograms and counters (utils/metrics.h) plus gauges for
+ * the client queue, the task lanes and sessions, in the Prometheus text
+ * format. Requests are answered one at a time and the connection closed,
+ * which is all a scraper needs. The thread exits once keep_running is
+ * cleared.
+ */
+
+/**
+ * Bind the admin port on the loopback interface and start serving
+ * @param port Port to listen on
+ * @return 0 on success, -1 on error
+ */
+int admin_start(const char *port);
+
+/* Wait for the admin thread to exit (no-op if it was never started) */
+void admin_join(void);
+
+#endif /* ADMIN_THREAD_H */
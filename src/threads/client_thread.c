@@ -4,17 +4,624 @@
 #include "../queue/task_queue.h"
 #include "../session/response_queue.h"
 #include "../session/session_manager.h"
-#include "../auth/auth.h"
-#include "../auth/user_metadata.h"
 #include "../utils/network_utils.h"
+#include "../storage/upload_stream.h"
+#include "../storage/chunk_store.h"
+#include "command_handler.h"
+#include "../utils/logger.h"
+#include "../utils/metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
 
+/*
+ * Stream an UPLOAD body into a temp file, one chunk at a time.
+ * 'extra' holds body bytes that arrived together with the command line.
+ * A resumable upload continues its partial file at t->offset and keeps it
+ * if the connection drops; a compressed one is decoded as it arrives.
+ * Returns 0 when the body is stored (t->temp_path set), an errno value
+ * (> 0) if it was fully received but could not be stored, -1 if the
+ * connection failed.
+ */
+static int receive_upload(int cfd, Session *session, Task *t, const char *extra,
+                          size_t extra_len)
+{
+    UploadStream up;
+    size_t body_len = t->body_len;
+    int rc = t->resumable
+                 ? upload_stream_open_partial(&up, t->username, t->filename, t->session_id,
+                                              t->filesize, t->offset)
+                 : upload_stream_open(&up, t->username, t->session_id, t->filesize);
+    if (rc == 0 && t->compressed)
+        rc = upload_stream_decode(&up);
+    int error = rc == 0 ? 0 : (errno ? errno : EIO);
+
+    if (extra_len > body_len)
+        extra_len = body_len;
+    if (extra_len > 0 && !error && upload_stream_write(&up, extra, extra_len) != 0)
+    {
+        error = errno ? errno : EIO;
+        upload_stream_abort(&up);
+    }
+
+    size_t received = extra_len;
+    size_t chunk_size = server_config.upload_chunk_size;
+    char *chunk = malloc(chunk_size);
+    if (!chunk)
+    {
+        upload_stream_abort(&up);
+        return -1;
+    }
+
+    while (received < body_len)
+    {
+        size_t want = body_len - received;
+        if (want > chunk_size)
+            want = chunk_size;
+
+        ssize_t bytes = recv(cfd, chunk, want, 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: Upload incomplete (received %zu/%zu)",
+                      t->session_id, received, body_len);
+            free(chunk);
+            if (!error)
+                upload_stream_suspend(&up);
+            return -1;
+        }
+        session_update_activity(session);
+
+        /* Keep draining the body after a write error so the stream stays in sync */
+        if (!error && upload_stream_write(&up, chunk, bytes) != 0)
+        {
+            error = errno ? errno : EIO;
+            upload_stream_abort(&up);
+        }
+        received += bytes;
+    }
+    free(chunk);
+
+    if (error)
+        return error;
+    if (upload_stream_finish(&up) != 0)
+        return errno ? errno : EIO;
+
+    memcpy(t->temp_path, up.temp_path, sizeof(t->temp_path));
+    return 0;
+}
+
+/* -------------------- Completions -------------------- */
+
+/* A dispatched task remembered until its result has been sent */
+typedef struct
+{
+    Task task;
+    uint8_t reply_type;               /* v2 reply type */
+    uint32_t reply_tag;               /* v2 tag echoed on the reply */
+} InFlight;
+
+/*
+ * Connection state for one client. Workers never hand results to a waiting
+ * thread: they post them into the session's completion slots and the notify
+ * hook bumps event_fd, which the connection polls next to its socket. While
+ * workers do disk I/O the thread keeps reading and dispatching requests.
+ */
+typedef struct
+{
+    int cfd;
+    Session *session;           /* Reference from session_get, put on close */
+    int event_fd;
+    InFlight inflight[RESPONSE_MAX_INFLIGHT]; /* Indexed by seq % RESPONSE_MAX_INFLIGHT */
+} ClientConn;
+
+/* Called by a worker (under the response mutex) when a result is ready */
+static void client_notify(void *ctx)
+{
+    ClientConn *conn = (ClientConn *)ctx;
+    uint64_t one = 1;
+    if (write(conn->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("ClientThread", "eventfd write: %s", strerror(errno));
+}
+
+/* Returns 0, or -1 with errno set */
+static int client_conn_open(ClientConn *conn, int cfd, Session *session)
+{
+    conn->cfd = cfd;
+    conn->session = session;
+    conn->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (conn->event_fd < 0)
+        return -1;
+    response_set_notify(&session->response, client_notify, conn);
+    return 0;
+}
+
+/*
+ * Wait for a completion, or (if watch_socket) for the socket to become
+ * readable. Returns true if the socket is readable, false if only a
+ * completion arrived (or poll failed; the caller rechecks both).
+ */
+static bool client_conn_wait(ClientConn *conn, bool watch_socket)
+{
+    struct pollfd fds[2] = {
+        {.fd = conn->event_fd, .events = POLLIN},
+        {.fd = conn->cfd, .events = POLLIN},
+    };
+
+    int n = poll(fds, watch_socket ? 2 : 1, -1);
+    if (n < 0)
+        return false;
+
+    if (fds[0].revents & POLLIN)
+    {
+        uint64_t count;
+        if (read(conn->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            LOG_ERROR("ClientThread", "eventfd read: %s", strerror(errno));
+    }
+    return watch_socket && (fds[1].revents & (POLLIN | POLLHUP | POLLERR));
+}
+
+/*
+ * Tear down a connection: wait out tasks still in flight (their results
+ * are discarded - workers must never post into a freed session), then
+ * destroy the session, which closes the socket.
+ */
+static void client_conn_close(ClientConn *conn)
+{
+    Response *resp = &conn->session->response;
+    uint64_t session_id = conn->session->session_id;
+
+    if (response_pending(resp) > 0)
+        LOG_INFO("ClientThread", "Session %lu: waiting for %d in-flight task(s) before closing",
+                 session_id, response_pending(resp));
+    while (response_pending(resp) > 0)
+    {
+        Completion done;
+        if (response_take(resp, &done))
+            completion_release(&done);
+        else
+            client_conn_wait(conn, false);
+    }
+
+    response_set_notify(resp, NULL, NULL);
+    close(conn->event_fd);
+
+    session_mark_inactive(&session_manager, session_id);
+    session_destroy(&session_manager, session_id);
+    session_put(conn->session);
+}
+
+/*
+ * Queue a task and remember it until its result is sent.
+ * Returns 0, or -1 if the session has no free completion slot.
+ */
+static int client_conn_dispatch(ClientConn *conn, Task *t, uint8_t reply_type, uint32_t reply_tag)
+{
+    if (command_dispatch(conn->session, t) != 0)
+        return -1;
+
+    InFlight *f = &conn->inflight[t->seq % RESPONSE_MAX_INFLIGHT];
+    f->task = *t;
+    f->reply_type = reply_type;
+    f->reply_tag = reply_tag;
+    return 0;
+}
+
+/* Text protocol: queue one task and wait for its result */
+static void run_task(ClientConn *conn, Task *t, Completion *done)
+{
+    uint64_t session_id = conn->session->session_id;
+
+    client_conn_dispatch(conn, t, 0, 0);  /* Text sessions never have another in flight */
+
+    LOG_DEBUG("ClientThread", "Session %lu: Waiting for worker...", session_id);
+    while (!response_take(&conn->session->response, done))
+        client_conn_wait(conn, false);
+
+    LOG_DEBUG("ClientThread", "Session %lu: Got response: %s", session_id, done->message);
+}
+
+/* Text protocol: send a result's body (file or data) followed by its message */
+static int send_text_completion(ClientConn *conn, Completion *done)
+{
+    uint64_t session_id = conn->session->session_id;
+    int cfd = conn->cfd;
+    int rc = 0;
+
+    if (done->file)
+    {
+        /* DOWNLOAD: zero-copy from the chunks the worker opened */
+        ssize_t sent = chunk_stream_send_all(done->file, cfd);
+        if (sent != (ssize_t)done->file_size)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: failed to send file (%zd/%zu bytes)",
+                      session_id, sent, done->file_size);
+            rc = -1;
+        }
+    }
+    if (rc == 0 && done->data && done->data_size > 0)
+    {
+        ssize_t sent = send_full(cfd, done->data, done->data_size);
+        if (sent != (ssize_t)done->data_size)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: failed to send response data (%zd/%zu bytes)",
+                      session_id, sent, done->data_size);
+            rc = -1;
+        }
+    }
+    if (rc == 0 && strlen(done->message) > 0)
+    {
+        if (send_full(cfd, done->message, strlen(done->message)) < 0)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: failed to send response message", session_id);
+            rc = -1;
+        }
+    }
+
+    if (rc == 0)
+        metrics_reply(done->op, done->status, done->started_ns, done->taken_ns,
+                      done->file_size + done->data_size);
+    completion_release(done);
+    return rc;
+}
+
+/* -------------------- Protocol v2 (frames) -------------------- */
+
+/*
+ * Exact-length reader for frames. Bytes that arrived in the same recv as
+ * the PROTO line are consumed before the socket is read again, so clients
+ * may pipeline frames right behind the switch.
+ */
+typedef struct
+{
+    int fd;
+    char buf[512];
+    size_t len;
+    size_t off;
+} FrameReader;
+
+static int frame_read(FrameReader *r, void *dst, size_t len)
+{
+    size_t have = r->len - r->off;
+    if (have > len)
+        have = len;
+    memcpy(dst, r->buf + r->off, have);
+    r->off += have;
+
+    size_t rest = len - have;
+    if (rest > 0 && recv_full(r->fd, (char *)dst + have, rest) != (ssize_t)rest)
+        return -1;
+    return 0;
+}
+
+/* Discard a body we are not going to store (rejected request) */
+static int frame_skip(FrameReader *r, uint64_t len)
+{
+    char scratch[4096];
+    while (len > 0)
+    {
+        size_t n = len > sizeof(scratch) ? sizeof(scratch) : (size_t)len;
+        if (frame_read(r, scratch, n) != 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Send a header whose payload follows at once. MSG_MORE lets the two share
+ * segments instead of the header going out alone and the payload waiting
+ * on the peer's delayed ACK (Nagle). */
+static int send_header_more(int cfd, const unsigned char *raw)
+{
+    ssize_t n;
+    do
+        n = send(cfd, raw, FRAME_HEADER_SIZE, MSG_MORE);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return -1;
+    if (n < FRAME_HEADER_SIZE &&
+        send_full(cfd, raw + n, FRAME_HEADER_SIZE - n) != FRAME_HEADER_SIZE - n)
+        return -1;
+    return 0;
+}
+
+static int send_frame(int cfd, uint8_t type, uint8_t status, uint32_t tag,
+                      const void *payload, size_t len)
+{
+    FrameHeader hdr = {.type = type, .status = status, .tag = tag, .payload_len = len};
+    unsigned char buf[FRAME_HEADER_SIZE + 512];
+
+    frame_encode_header(&hdr, buf);
+
+    /* Small replies go out in one send */
+    if (len <= sizeof(buf) - FRAME_HEADER_SIZE)
+    {
+        if (len > 0)
+            memcpy(buf + FRAME_HEADER_SIZE, payload, len);
+        size_t total = FRAME_HEADER_SIZE + len;
+        return send_full(cfd, buf, total) == (ssize_t)total ? 0 : -1;
+    }
+
+    if (send_header_more(cfd, buf) != 0)
+        return -1;
+    return send_full(cfd, payload, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int send_text_frame(int cfd, uint8_t type, uint8_t status, uint32_t tag, const char *msg)
+{
+    return send_frame(cfd, type, status, tag, msg, strlen(msg));
+}
+
+/*
+ * Send a worker's result as one reply frame. The payload is the body
+ * (file or in-memory data) when there is one, otherwise the message text.
+ * Releases the completion.
+ */
+static int send_response_frame(int cfd, uint8_t type, uint32_t tag, Completion *done)
+{
+    uint8_t status = command_frame_status(done->status);
+    int rc;
+
+    if (done->file)
+    {
+        /* DOWNLOAD: header, then zero-copy from the chunks the worker opened */
+        FrameHeader hdr = {.type = type, .status = status, .tag = tag,
+                           .payload_len = done->file_size};
+        unsigned char raw[FRAME_HEADER_SIZE];
+        frame_encode_header(&hdr, raw);
+
+        rc = 0;
+        if (send_header_more(cfd, raw) != 0 ||
+            chunk_stream_send_all(done->file, cfd) != (ssize_t)done->file_size)
+            rc = -1;
+    }
+    else if (done->data && done->data_size > 0)
+    {
+        rc = send_frame(cfd, type, status, tag, done->data, done->data_size);
+    }
+    else
+    {
+        rc = send_text_frame(cfd, type, status, tag, done->message);
+    }
+
+    if (rc == 0)
+        metrics_reply(done->op, done->status, done->started_ns, done->taken_ns,
+                      done->file_size + done->data_size);
+    completion_release(done);
+    return rc;
+}
+
+/* Send every result that is ready, in request order. Returns -1 on send failure. */
+static int flush_completions(ClientConn *conn)
+{
+    Response *resp = &conn->session->response;
+
+    while (response_pending(resp) > 0)
+    {
+        uint64_t seq = resp->next_reply;
+        Completion done;
+        if (!response_take(resp, &done))
+            break;
+
+        InFlight *f = &conn->inflight[seq % RESPONSE_MAX_INFLIGHT];
+        LOG_DEBUG("ClientThread", "Session %lu: Got response (tag=%u): %s",
+                  conn->session->session_id, f->reply_tag, done.message);
+        if (send_response_frame(conn->cfd, f->reply_type, f->reply_tag, &done) != 0)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: failed to send reply frame",
+                      conn->session->session_id);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Block until every in-flight task whose result must come first has been
+ * answered: all of them (everything == true, before an immediate reply so
+ * replies stay in request order), or just those that conflict with t.
+ */
+static int wait_inflight(ClientConn *conn, const Task *t, bool everything)
+{
+    Response *resp = &conn->session->response;
+
+    while (1)
+    {
+        if (flush_completions(conn) != 0)
+            return -1;
+
+        bool blocked = false;
+        for (uint64_t seq = resp->next_reply; seq < resp->next_seq && !blocked; seq++)
+        {
+            const Task *earlier = &conn->inflight[seq % RESPONSE_MAX_INFLIGHT].task;
+            blocked = everything || command_conflicts(earlier, t);
+        }
+        if (!blocked)
+            return 0;
+
+        client_conn_wait(conn, false);
+    }
+}
+
+/*
+ * Serve a connection that switched to protocol v2 until it quits or
+ * disconnects. 'pending' holds bytes received after the PROTO line.
+ * Up to RESPONSE_MAX_INFLIGHT requests run at once; replies go out in
+ * request order as their results arrive. Always closes the connection.
+ */
+static void serve_framed(ClientConn *conn, const char *pending, size_t pending_len)
+{
+    int cfd = conn->cfd;
+    Session *session = conn->session;
+    Response *resp = &session->response;
+    uint64_t session_id = session->session_id;
+    FrameReader reader = {.fd = cfd, .len = 0, .off = 0};
+
+    if (pending_len > sizeof(reader.buf))
+        pending_len = sizeof(reader.buf);
+    memcpy(reader.buf, pending, pending_len);
+    reader.len = pending_len;
+
+    if (send_success(cfd, session->deflate ? PROTO_NEGOTIATE_OK_DEFLATE : PROTO_NEGOTIATE_OK) != 0)
+        goto disconnect;
+    LOG_INFO("ClientThread", "Session %lu: Switched to protocol v2%s", session_id,
+             session->deflate ? " (deflate)" : "");
+
+    while (1)
+    {
+        unsigned char raw[FRAME_HEADER_SIZE];
+        FrameHeader hdr;
+        char name[FRAME_MAX_NAME + 1];
+        char payload[FRAME_MAX_INLINE_PAYLOAD + 1];
+
+        if (flush_completions(conn) != 0)
+            goto disconnect;
+
+        /* Read the next request only when it has a slot; otherwise wait
+         * for results. Buffered bytes count as readable. */
+        bool slot_free = response_pending(resp) < RESPONSE_MAX_INFLIGHT;
+        bool buffered = reader.off < reader.len;
+        if (!slot_free || (!buffered && response_pending(resp) > 0))
+        {
+            if (!client_conn_wait(conn, slot_free && !buffered))
+                continue;
+        }
+
+        if (frame_read(&reader, raw, sizeof(raw)) != 0)
+        {
+            LOG_INFO("ClientThread", "Session %lu: client disconnected", session_id);
+            goto disconnect;
+        }
+        session_update_activity(session);
+        frame_decode_header(raw, &hdr);
+
+        uint8_t reply_type = hdr.type | FRAME_REPLY;
+        if (frame_validate_request(&hdr) != 0)
+        {
+            LOG_ERROR("ClientThread", "Session %lu: malformed frame (type=%u), closing", session_id,
+                      hdr.type);
+            if (wait_inflight(conn, NULL, true) == 0)
+                send_text_frame(cfd, reply_type, FRAME_STATUS_BAD_REQUEST, hdr.tag,
+                                "ERROR: Malformed frame\n");  /* Best effort */
+            goto disconnect;
+        }
+
+        /* Name and inline payload are small; bodies are streamed below */
+        size_t inline_len = (size_t)frame_inline_len(&hdr);
+        if (frame_read(&reader, name, hdr.name_len) != 0 ||
+            frame_read(&reader, payload, inline_len) != 0)
+        {
+            LOG_INFO("ClientThread", "Session %lu: client disconnected", session_id);
+            goto disconnect;
+        }
+        name[hdr.name_len] = '\0';
+        payload[inline_len] = '\0';
+
+        LOG_DEBUG("ClientThread", "Session %lu: Frame %s '%s' (tag=%u, payload=%lu)", session_id,
+                  frame_type_name(hdr.type), name, hdr.tag, (unsigned long)hdr.payload_len);
+
+        if (hdr.type == FRAME_QUIT)
+        {
+            if (wait_inflight(conn, NULL, true) == 0)
+                send_text_frame(cfd, reply_type, FRAME_STATUS_OK, hdr.tag, "Goodbye!\n");
+            LOG_INFO("ClientThread", "Session %lu: user quit", session_id);
+            goto disconnect;
+        }
+
+        /* Authentication phase (nothing can be in flight yet) */
+        if (!session->is_authenticated)
+        {
+            const char *reply = "ERROR: Please SIGNUP or LOGIN first\n";
+            if (hdr.type == FRAME_SIGNUP || hdr.type == FRAME_LOGIN)
+                reply = command_authenticate(session, hdr.type == FRAME_SIGNUP, name, payload);
+
+            uint8_t status = session->is_authenticated ? FRAME_STATUS_OK : FRAME_STATUS_ERROR;
+            if (send_text_frame(cfd, reply_type, status, hdr.tag, reply) != 0)
+                goto disconnect;
+            if (frame_has_body(hdr.type) && frame_skip(&reader, hdr.payload_len - inline_len) != 0)
+                goto disconnect;
+            if (session->is_authenticated)
+                LOG_INFO("ClientThread", "Session %lu: User '%s' authenticated", session_id,
+                         session->username);
+            continue;
+        }
+
+        Task t;
+        const char *reply;
+        uint8_t status;
+        if (hdr.type == FRAME_SIGNUP || hdr.type == FRAME_LOGIN)
+        {
+            reply = "ERROR: Already authenticated\n";
+            status = FRAME_STATUS_BAD_REQUEST;
+        }
+        else if (command_parse_frame(session, &hdr, name, (const unsigned char *)payload, &t,
+                                     &reply, &status) == COMMAND_TASK)
+        {
+            reply = NULL;
+        }
+
+        if (reply)
+        {
+            /* Reply (after earlier requests) so the client can stop early,
+             * then drop the body */
+            if (wait_inflight(conn, NULL, true) != 0 ||
+                send_text_frame(cfd, reply_type, status, hdr.tag, reply) != 0)
+                goto disconnect;
+            if (frame_has_body(hdr.type) && frame_skip(&reader, hdr.payload_len - inline_len) != 0)
+                goto disconnect;
+            continue;
+        }
+
+        if (task_has_body(t.type))
+        {
+            size_t body_len = t.body_len;
+            LOG_DEBUG("ClientThread", "Session %lu: Receiving %zu bytes for %s", session_id,
+                      body_len, t.filename);
+
+            /* Hand over body bytes already buffered behind the header */
+            size_t extra_len = reader.len - reader.off;
+            if (extra_len > body_len)
+                extra_len = body_len;
+            const char *extra = reader.buf + reader.off;
+            reader.off += extra_len;
+
+            int rc = receive_upload(cfd, session, &t, extra, extra_len);
+            if (rc < 0)
+                goto disconnect;
+            if (rc > 0)
+            {
+                reply = command_upload_error(rc, &status);
+                if (wait_inflight(conn, NULL, true) != 0 ||
+                    send_text_frame(cfd, reply_type, status, hdr.tag, reply) != 0)
+                    goto disconnect;
+                continue;
+            }
+        }
+
+        /* Keep pipelined requests sequential where they touch the same data */
+        if (wait_inflight(conn, &t, false) != 0 ||
+            client_conn_dispatch(conn, &t, reply_type, hdr.tag) != 0)
+        {
+            if (task_has_body(t.type))
+                unlink(t.temp_path);
+            goto disconnect;
+        }
+    }
+
+disconnect:
+    client_conn_close(conn);
+}
+
+/* -------------------- Client Thread -------------------- */
+
 /* Client thread: handles authentication, then queues file operations to workers */
 void *client_worker(void *arg)
 {
@@ -30,7 +637,7 @@ void *client_worker(void *arg)
         uint64_t session_id = session_create(&session_manager, cfd);
         if (session_id == 0)
         {
-            fprintf(stderr, "[ClientThread] Failed to create session\n");
+            LOG_ERROR("ClientThread", "Failed to create session");
             close(cfd);
             continue;
         }
@@ -39,28 +646,32 @@ void *client_worker(void *arg)
         Session *session = session_get(&session_manager, session_id);
         if (!session)
         {
-            fprintf(stderr, "[ClientThread] Failed to get session %lu\n", session_id);
-            close(cfd);
+            LOG_ERROR("ClientThread", "Failed to get session %lu", session_id);
+            session_mark_inactive(&session_manager, session_id);
+            session_destroy(&session_manager, session_id);
+            continue;
+        }
+
+        ClientConn conn;
+        if (client_conn_open(&conn, cfd, session) != 0)
+        {
+            LOG_ERROR("ClientThread", "Cannot set up the connection of session %lu: %s",
+                      session_id, strerror(errno));
+            session_mark_inactive(&session_manager, session_id);
             session_destroy(&session_manager, session_id);
+            session_put(session);
             continue;
         }
 
-        printf("[ClientThread] Session %lu created (fd=%d)\n", session_id, cfd);
+        LOG_INFO("ClientThread", "Session %lu created (fd=%d)", session_id, cfd);
 
         char cmd[512];
 
         /* Send welcome message */
-        const char *welcome_msg =
-            "Welcome to StashCLI Server :))\n"
-            "Please authenticate first:\n"
-            "SIGNUP <username> <password>\n"
-            "LOGIN <username> <password>\n";
-        if (send_success(cfd, welcome_msg) != 0)
+        if (send_success(cfd, WELCOME_MESSAGE) != 0)
         {
-            fprintf(stderr, "[ClientThread] Session %lu: failed to send welcome message\n", session_id);
-            session_mark_inactive(&session_manager, session_id);
-            session_destroy(&session_manager, session_id);
-            goto next_client;
+            LOG_ERROR("ClientThread", "Session %lu: failed to send welcome message", session_id);
+            goto disconnect;
         }
 
         /* Authentication loop */
@@ -70,11 +681,11 @@ void *client_worker(void *arg)
             if (n <= 0)
             {
                 /* Client disconnected during auth */
-                printf("[ClientThread] Session %lu: client disconnected during auth\n", session_id);
-                session_mark_inactive(&session_manager, session_id);
-                session_destroy(&session_manager, session_id);
-                goto next_client;
+                LOG_INFO("ClientThread", "Session %lu: client disconnected during auth",
+                         session_id);
+                goto disconnect;
             }
+            session_update_activity(session);
             cmd[n] = '\0';
 
             /* Remove newline */
@@ -82,86 +693,40 @@ void *client_worker(void *arg)
             if (newline)
                 *newline = '\0';
 
-            printf("[ClientThread] Session %lu: Auth command: %s\n", session_id, cmd);
-
-            char username[MAX_USERNAME_LEN];
-            char password[256];
-
-            /* Handle SIGNUP */
-            if (sscanf(cmd, "SIGNUP %63s %255s", username, password) == 2)
+            /* Protocol v2 negotiation; frames may follow in the same segment */
+            if (command_is_proto_switch(cmd, &session->deflate))
             {
-                int result = user_signup(username, password);
-                if (result == 0)
-                {
-                    if (send_success(cfd, "SIGNUP OK\n") != 0)
-                    {
-                        fprintf(stderr, "[ClientThread] Session %lu: failed to send SIGNUP OK\n", session_id);
-                        session_mark_inactive(&session_manager, session_id);
-                        session_destroy(&session_manager, session_id);
-                        goto next_client;
-                    }
-                    session_set_username(session, username);
-                }
-                else if (result == -2)
-                {
-                    send_error(cfd, "SIGNUP ERROR: User already exists\n");
-                }
-                else
-                {
-                    send_error(cfd, "SIGNUP ERROR: Database operation failed\n");
-                }
+                size_t used = newline ? (size_t)(newline + 1 - cmd) : (size_t)n;
+                serve_framed(&conn, cmd + used, n - used);
+                goto next_client;
             }
-            /* Handle LOGIN */
-            else if (sscanf(cmd, "LOGIN %63s %255s", username, password) == 2)
+
+            LOG_DEBUG("ClientThread", "Session %lu: Auth command: %s", session_id, cmd);
+
+            const char *reply = command_handle_auth(session, cmd);
+            if (session->is_authenticated)
             {
-                int result = user_login(username, password);
-                if (result == 0)
-                {
-                    if (send_success(cfd, "LOGIN OK\n") != 0)
-                    {
-                        fprintf(stderr, "[ClientThread] Session %lu: failed to send LOGIN OK\n", session_id);
-                        session_mark_inactive(&session_manager, session_id);
-                        session_destroy(&session_manager, session_id);
-                        goto next_client;
-                    }
-                    session_set_username(session, username);
-                }
-                else if (result == -2)
+                if (send_success(cfd, reply) != 0)
                 {
-                    send_error(cfd, "LOGIN ERROR: User not found\n");
-                }
-                else if (result == -3)
-                {
-                    send_error(cfd, "LOGIN ERROR: Invalid password\n");
-                }
-                else
-                {
-                    send_error(cfd, "LOGIN ERROR: Database operation failed\n");
+                    LOG_ERROR("ClientThread", "Session %lu: failed to send auth reply", session_id);
+                    goto disconnect;
                 }
             }
             else
             {
-                send_error(cfd, "ERROR: Please SIGNUP or LOGIN first\n");
+                send_error(cfd, reply);
             }
         }
 
         /* User is now authenticated, show file commands */
-        const char *file_menu =
-            "\nAuthenticated! Available commands:\n"
-            "UPLOAD <filename> <size>\n"
-            "DOWNLOAD <filename>\n"
-            "DELETE <filename>\n"
-            "LIST\n"
-            "QUIT\n";
-        if (send_success(cfd, file_menu) != 0)
+        if (send_success(cfd, FILE_MENU_MESSAGE) != 0)
         {
-            fprintf(stderr, "[ClientThread] Session %lu: failed to send file menu\n", session_id);
-            session_mark_inactive(&session_manager, session_id);
-            session_destroy(&session_manager, session_id);
-            goto next_client;
+            LOG_ERROR("ClientThread", "Session %lu: failed to send file menu", session_id);
+            goto disconnect;
         }
 
-        printf("[ClientThread] Session %lu: User '%s' authenticated\n", session_id, session->username);
+        LOG_INFO("ClientThread", "Session %lu: User '%s' authenticated", session_id,
+                 session->username);
 
         /* File operation loop */
         while (1)
@@ -170,183 +735,93 @@ void *client_worker(void *arg)
             if (n <= 0)
             {
                 /* Client disconnected */
-                printf("[ClientThread] Session %lu: client disconnected\n", session_id);
-                session_mark_inactive(&session_manager, session_id);
-                session_destroy(&session_manager, session_id);
-                goto next_client;
+                LOG_INFO("ClientThread", "Session %lu: client disconnected", session_id);
+                goto disconnect;
             }
+            session_update_activity(session);
             cmd[n] = '\0';
-            printf("[ClientThread] Session %lu: File command: %s\n", session_id, cmd);
 
-            /* Handle QUIT */
-            if (strncmp(cmd, "QUIT", 4) == 0)
+            char *line_end = strchr(cmd, '\n');
+            if (line_end)
             {
-                send_success(cfd, "Goodbye!\n");  /* Best effort, ignore error */
-                printf("[ClientThread] Session %lu: user quit\n", session_id);
-                session_mark_inactive(&session_manager, session_id);
-                session_destroy(&session_manager, session_id);
-                goto next_client;
+                *line_end = '\0';
+                bool proto_switch = command_is_proto_switch(cmd, &session->deflate);
+                *line_end = '\n';
+                if (proto_switch)
+                {
+                    size_t used = line_end + 1 - cmd;
+                    serve_framed(&conn, cmd + used, n - used);
+                    goto next_client;
+                }
             }
 
-            /* Prepare task structure (Phase 2.1: use session_id instead of Response*) */
+            LOG_DEBUG("ClientThread", "Session %lu: File command: %s", session_id, cmd);
+
             Task t;
-            memset(&t, 0, sizeof(t));
-            t.session_id = session_id;
-            strncpy(t.username, session->username, sizeof(t.username) - 1);
-            t.username[sizeof(t.username) - 1] = '\0';  /* Ensure null-termination */
-            t.data_buffer = NULL;
-
-            /* Parse command */
-            if (sscanf(cmd, "UPLOAD %255s %zu", t.filename, &t.filesize) == 2)
+            const char *reply;
+            command_result_t parsed = command_parse(session, cmd, &t, &reply);
+
+            /* Handle QUIT */
+            if (parsed == COMMAND_QUIT)
             {
-                /* Check quota before receiving data */
-                if (!user_check_quota(session->username, t.filesize))
-                {
-                    send_error(cfd, "UPLOAD ERROR: Quota exceeded\n");
-                    continue;
-                }
+                send_success(cfd, "Goodbye!\n");  /* Best effort, ignore error */
+                LOG_INFO("ClientThread", "Session %lu: user quit", session_id);
+                goto disconnect;
+            }
 
-                t.type = TASK_UPLOAD;
-                printf("[ClientThread] Session %lu: Receiving %zu bytes for %s\n", 
-                       session_id, t.filesize, t.filename);
+            if (parsed == COMMAND_REJECTED)
+            {
+                send_error(cfd, reply);
+                continue;
+            }
 
-                /* Allocate buffer */
-                t.data_buffer = malloc(t.filesize);
-                if (!t.data_buffer)
-                {
-                    send_error(cfd, "UPLOAD ERROR: Server memory allocation failed\n");
-                    fprintf(stderr, "[ClientThread] Session %lu: malloc failed for %zu bytes\n",
-                           session_id, t.filesize);
-                    continue;
-                }
+            if (t.type == TASK_UPLOAD)
+            {
+                LOG_DEBUG("ClientThread", "Session %lu: Receiving %zu bytes for %s", session_id,
+                          t.filesize, t.filename);
 
                 /* Find leftover bytes */
                 char *newline = strchr(cmd, '\n');
-                size_t received = 0;
+                const char *extra = NULL;
+                size_t extra_len = 0;
                 if (newline && *(newline + 1) != '\0')
                 {
-                    char *extra = newline + 1;
-                    size_t extra_len = n - (extra - cmd);
-                    if (extra_len > t.filesize)
-                        extra_len = t.filesize;
-                    memcpy(t.data_buffer, extra, extra_len);
-                    received = extra_len;
+                    extra = newline + 1;
+                    extra_len = n - (extra - cmd);
                 }
 
-                /* Read remaining bytes using recv_full */
-                if (received < t.filesize)
+                int rc = receive_upload(cfd, session, &t, extra, extra_len);
+                if (rc < 0)
                 {
-                    ssize_t bytes = recv_full(cfd, (char *)t.data_buffer + received,
-                                             t.filesize - received);
-                    if (bytes < 0)
-                    {
-                        fprintf(stderr, "[ClientThread] Session %lu: recv_full error: %s\n",
-                               session_id, strerror(errno));
-                        send_error(cfd, "UPLOAD ERROR: Network receive error\n");
-                        free(t.data_buffer);
-                        continue;
-                    }
-                    else if (bytes != (ssize_t)(t.filesize - received))
-                    {
-                        fprintf(stderr, "[ClientThread] Session %lu: Upload incomplete (received %zu/%zu)\n",
-                               session_id, received + bytes, t.filesize);
-                        send_error(cfd, "UPLOAD ERROR: Incomplete data transfer\n");
-                        free(t.data_buffer);
-                        continue;
-                    }
-                    received += bytes;
+                    send_error(cfd, "UPLOAD ERROR: Incomplete data transfer\n");
+                    goto disconnect;
+                }
+                if (rc > 0)
+                {
+                    send_error(cfd, "UPLOAD ERROR: File write failed\n");
+                    continue;
                 }
 
-                printf("[ClientThread] Session %lu: Received all %zu bytes, queueing\n", 
-                       session_id, received);
-            }
-            else if (sscanf(cmd, "DOWNLOAD %255s", t.filename) == 1)
-            {
-                t.type = TASK_DOWNLOAD;
-            }
-            else if (sscanf(cmd, "DELETE %255s", t.filename) == 1)
-            {
-                t.type = TASK_DELETE;
-            }
-            else if (strncmp(cmd, "LIST", 4) == 0)
-            {
-                t.type = TASK_LIST;
-            }
-            else
-            {
-                send_error(cfd, "ERROR: Invalid command\n");
-                continue;
-            }
-
-            /* Reset response for this task (Phase 2.1: reuse session response) */
-            pthread_mutex_lock(&session->response.mtx);
-            session->response.ready = false;
-            session->response.status = RESPONSE_SUCCESS;
-            memset(session->response.message, 0, sizeof(session->response.message));
-            if (session->response.data)
-            {
-                free(session->response.data);
-                session->response.data = NULL;
-            }
-            session->response.data_size = 0;
-            pthread_mutex_unlock(&session->response.mtx);
-
-            /* Queue task to workers (Phase 2.1: task contains session_id) */
-            if (task_queue_push(&task_queue, &t) != 0)
-            {
-                fprintf(stderr, "[ClientThread] Session %lu: Task queue full\n", session_id);
-                send_error(cfd, "ERROR: Server busy, please try again\n");
-                if (t.data_buffer)
-                    free(t.data_buffer);
-                continue;
-            }
-
-            /* Wait for worker response (Phase 2.1: wait on session response) */
-            printf("[ClientThread] Session %lu: Waiting for worker...\n", session_id);
-            response_wait(&session->response);
-            
-            /* Check if session is still active (worker may have found inactive session) */
-            if (!session->is_active)
-            {
-                printf("[ClientThread] Session %lu: became inactive while waiting\n", session_id);
-                session_destroy(&session_manager, session_id);
-                goto next_client;
+                LOG_DEBUG("ClientThread", "Session %lu: Received all %zu bytes, queueing",
+                          session_id, t.filesize);
             }
-            
-            printf("[ClientThread] Session %lu: Got response: %s\n", 
-                   session_id, session->response.message);
 
             /* Send response to client */
-            if (session->response.data && session->response.data_size > 0)
+            Completion done;
+            run_task(&conn, &t, &done);
+            if (send_text_completion(&conn, &done) != 0)
             {
-                ssize_t sent = send_full(cfd, session->response.data, session->response.data_size);
-                if (sent != (ssize_t)session->response.data_size)
-                {
-                    fprintf(stderr, "[ClientThread] Session %lu: failed to send response data (%zd/%zu bytes)\n",
-                           session_id, sent, session->response.data_size);
-                    /* Connection may be broken, disconnect */
-                    session_mark_inactive(&session_manager, session_id);
-                    session_destroy(&session_manager, session_id);
-                    goto next_client;
-                }
-            }
-            if (strlen(session->response.message) > 0)
-            {
-                if (send_full(cfd, session->response.message, strlen(session->response.message)) < 0)
-                {
-                    fprintf(stderr, "[ClientThread] Session %lu: failed to send response message\n", session_id);
-                    /* Connection may be broken, disconnect */
-                    session_mark_inactive(&session_manager, session_id);
-                    session_destroy(&session_manager, session_id);
-                    goto next_client;
-                }
+                /* Connection may be broken, disconnect */
+                goto disconnect;
             }
         }
 
+    disconnect:
+        client_conn_close(&conn);
     next_client:
         continue;
     }
 
-    printf("[ClientThread %lu] Exiting...\n", (unsigned long)pthread_self());
+    LOG_INFO("ClientThread", "Exiting...");
     return NULL;
 }
@@ -0,0 +1,416 @@
+#include "command_handler.h"
+#include "../auth/auth.h"
+#include "../auth/user_metadata.h"
+#include "../server.h"
+#include "../storage/upload_stream.h"
+#include "../utils/logger.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *const WELCOME_MESSAGE =
+    "Welcome to StashCLI Server :))\n"
+    "Please authenticate first:\n"
+    "SIGNUP <username> <password>\n"
+    "LOGIN <username> <password>\n";
+
+const char *const FILE_MENU_MESSAGE =
+    "\nAuthenticated! Available commands:\n"
+    "UPLOAD <filename> <size>\n"
+    "DOWNLOAD <filename> [<offset> <length>]\n"
+    "DELETE <filename>\n"
+    "LIST [<after>]\n"
+    "QUIT\n";
+
+bool command_is_proto_switch(const char *line, bool *deflate)
+{
+    size_t len = strlen(PROTO_NEGOTIATE_LINE);
+    if (strncmp(line, PROTO_NEGOTIATE_LINE, len) != 0)
+        return false;
+
+    /* Optional compression request */
+    *deflate = strncmp(line, PROTO_NEGOTIATE_DEFLATE, strlen(PROTO_NEGOTIATE_DEFLATE)) == 0;
+    if (*deflate)
+        len = strlen(PROTO_NEGOTIATE_DEFLATE);
+
+    /* Tolerate CRLF line endings */
+    return line[len] == '\0' || (line[len] == '\r' && line[len + 1] == '\0');
+}
+
+const char *command_authenticate(Session *session, bool signup,
+                                 const char *username, const char *password)
+{
+    /* The text parser enforces the length with %63s; frames carry arbitrary
+     * names. A username is a directory under storage/, so it must not be a
+     * path or a hidden name (those are the server's, e.g. the chunk store) */
+    if (username[0] == '\0' || username[0] == '.' || strlen(username) >= MAX_USERNAME_LEN ||
+        strchr(username, '/'))
+        return signup ? "SIGNUP ERROR: Invalid username\n" : "LOGIN ERROR: Invalid username\n";
+
+    if (signup)
+    {
+        int result = user_signup(username, password);
+        if (result == 0)
+        {
+            session_set_username(session, username);
+            session->weight = user_get_weight(username);
+            return "SIGNUP OK\n";
+        }
+        if (result == -2)
+            return "SIGNUP ERROR: User already exists\n";
+        return "SIGNUP ERROR: Database operation failed\n";
+    }
+
+    int result = user_login(username, password);
+    if (result == 0)
+    {
+        session_set_username(session, username);
+        session->weight = user_get_weight(username);
+        return "LOGIN OK\n";
+    }
+    if (result == -2)
+        return "LOGIN ERROR: User not found\n";
+    if (result == -3)
+        return "LOGIN ERROR: Invalid password\n";
+    return "LOGIN ERROR: Database operation failed\n";
+}
+
+const char *command_handle_auth(Session *session, const char *line)
+{
+    char username[MAX_USERNAME_LEN];
+    char password[256];
+
+    /* Handle SIGNUP */
+    if (sscanf(line, "SIGNUP %63s %255s", username, password) == 2)
+        return command_authenticate(session, true, username, password);
+
+    /* Handle LOGIN */
+    if (sscanf(line, "LOGIN %63s %255s", username, password) == 2)
+        return command_authenticate(session, false, username, password);
+
+    return "ERROR: Please SIGNUP or LOGIN first\n";
+}
+
+/* A name a file can be stored under: one path component, not a server
+ * temp file, and no control characters (LIST replies are tab- and
+ * line-delimited) */
+static bool valid_filename(const char *name)
+{
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+        strncmp(name, UPLOAD_TEMP_PREFIX, strlen(UPLOAD_TEMP_PREFIX)) == 0)
+        return false;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+    {
+        if (*p < 0x20 || *p == 0x7f || *p == '/')
+            return false;
+    }
+    return true;
+}
+
+/* A size as the client wrote it: decimal digits only (%zu would take
+ * "-1" as SIZE_MAX) */
+static bool parse_size(const char *text, size_t *size)
+{
+    if (*text < '0' || *text > '9')
+        return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE || *end != '\0' || value > SIZE_MAX)
+        return false;
+    *size = (size_t)value;
+    return true;
+}
+
+command_result_t command_parse(Session *session, const char *line, Task *t, const char **reply)
+{
+    *reply = NULL;
+
+    if (strncmp(line, "QUIT", 4) == 0)
+        return COMMAND_QUIT;
+
+    /* Prepare task structure (Phase 2.1: use session_id instead of Response*) */
+    memset(t, 0, sizeof(*t));
+    t->session_id = session->session_id;
+    memcpy(t->username, session->username, sizeof(t->username) - 1);
+    t->username[sizeof(t->username) - 1] = '\0';
+    t->weight = session->weight;
+
+    char size_text[32];
+    if (sscanf(line, "UPLOAD %255s %31s", t->filename, size_text) == 2)
+    {
+        if (!parse_size(size_text, &t->filesize))
+        {
+            *reply = "UPLOAD ERROR: Invalid size\n";
+            return COMMAND_REJECTED;
+        }
+        /* Check quota before receiving data */
+        if (!user_check_quota(session->username, t->filesize))
+        {
+            *reply = "UPLOAD ERROR: Quota exceeded\n";
+            return COMMAND_REJECTED;
+        }
+        t->type = TASK_UPLOAD;
+        t->body_len = t->filesize;
+    }
+    else if (sscanf(line, "DOWNLOAD %255s", t->filename) == 1)
+    {
+        /* Optional byte range; a length of 0 reads to the end. Either
+         * both numbers or neither, and nothing after them. */
+        char offset_text[32], length_text[32], extra[2];
+        size_t offset = 0, length = 0;
+        int fields = sscanf(line, "DOWNLOAD %*s %31s %31s %1s", offset_text, length_text, extra);
+        if (fields > 0 && (fields != 2 || !parse_size(offset_text, &offset) ||
+                           !parse_size(length_text, &length)))
+        {
+            *reply = "DOWNLOAD ERROR: Invalid range\n";
+            return COMMAND_REJECTED;
+        }
+        t->offset = offset;
+        t->length = length;
+        t->type = TASK_DOWNLOAD;
+    }
+    else if (sscanf(line, "DELETE %255s", t->filename) == 1)
+    {
+        t->type = TASK_DELETE;
+    }
+    else if (strncmp(line, "LIST", 4) == 0)
+    {
+        /* Optional cursor: continue after that name */
+        sscanf(line, "LIST %255s", t->filename);
+        t->type = TASK_LIST;
+    }
+    else
+    {
+        *reply = "ERROR: Invalid command\n";
+        return COMMAND_REJECTED;
+    }
+
+    if (t->type != TASK_LIST && !valid_filename(t->filename))
+    {
+        *reply = "ERROR: Invalid filename\n";
+        return COMMAND_REJECTED;
+    }
+
+    return COMMAND_TASK;
+}
+
+command_result_t command_parse_frame(Session *session, const FrameHeader *hdr, const char *name,
+                                     const unsigned char *payload, Task *t, const char **reply,
+                                     uint8_t *status)
+{
+    *reply = NULL;
+    *status = FRAME_STATUS_OK;
+
+    if (hdr->type == FRAME_QUIT)
+        return COMMAND_QUIT;
+
+    memset(t, 0, sizeof(*t));
+    t->session_id = session->session_id;
+    memcpy(t->username, session->username, sizeof(t->username) - 1);
+    t->username[sizeof(t->username) - 1] = '\0';
+    t->weight = session->weight;
+
+    if (hdr->type == FRAME_LIST)
+    {
+        /* Name: cursor (empty = first page); payload: optional page size */
+        if (hdr->payload_len != 0 && hdr->payload_len != 8)
+        {
+            *reply = "LIST ERROR: Malformed page size\n";
+            *status = FRAME_STATUS_BAD_REQUEST;
+            return COMMAND_REJECTED;
+        }
+        snprintf(t->filename, sizeof(t->filename), "%s", name);
+        if (hdr->payload_len == 8)
+            t->length = frame_get_u64(payload);
+        t->type = TASK_LIST;
+        return COMMAND_TASK;
+    }
+
+    if (strlen(name) >= sizeof(t->filename) || !valid_filename(name))
+    {
+        *reply = "ERROR: Invalid filename\n";
+        *status = FRAME_STATUS_BAD_REQUEST;
+        return COMMAND_REJECTED;
+    }
+    strcpy(t->filename, name);
+
+    /* Compressed bodies only once negotiated */
+    bool deflate = (hdr->status & FRAME_FLAG_DEFLATE) != 0;
+    if (deflate && !session->deflate)
+    {
+        *reply = "ERROR: Compression was not negotiated\n";
+        *status = FRAME_STATUS_BAD_REQUEST;
+        return COMMAND_REJECTED;
+    }
+
+    switch (hdr->type)
+    {
+    case FRAME_UPLOAD:
+        /* A compressed body is prefixed with the plain size it decodes to */
+        t->filesize = deflate ? (size_t)frame_get_u64(payload) : (size_t)hdr->payload_len;
+        t->compressed = deflate;
+        /* Check quota before receiving data */
+        if (!user_check_quota(session->username, t->filesize))
+        {
+            *reply = "UPLOAD ERROR: Quota exceeded\n";
+            *status = FRAME_STATUS_QUOTA_EXCEEDED;
+            return COMMAND_REJECTED;
+        }
+        t->type = TASK_UPLOAD;
+        t->resumable = true;
+        break;
+    case FRAME_UPLOAD_RESUME:
+    {
+        t->filesize = (size_t)frame_get_u64(payload);
+        t->offset = frame_get_u64(payload + 8);
+        /* The rest of the payload is the body from offset to the end */
+        if (t->offset > t->filesize ||
+            hdr->payload_len - FRAME_RESUME_PREFIX_SIZE != t->filesize - t->offset)
+        {
+            *reply = "UPLOAD ERROR: Resume offset does not match the body\n";
+            *status = FRAME_STATUS_BAD_REQUEST;
+            return COMMAND_REJECTED;
+        }
+        if (!user_check_quota(session->username, t->filesize))
+        {
+            *reply = "UPLOAD ERROR: Quota exceeded\n";
+            *status = FRAME_STATUS_QUOTA_EXCEEDED;
+            return COMMAND_REJECTED;
+        }
+        t->type = TASK_UPLOAD;
+        t->resumable = true;
+        break;
+    }
+    case FRAME_UPLOAD_OFFSET:
+        if (hdr->payload_len != 8)
+        {
+            *reply = "ERROR: UPLOAD_OFFSET takes the total size\n";
+            *status = FRAME_STATUS_BAD_REQUEST;
+            return COMMAND_REJECTED;
+        }
+        t->filesize = (size_t)frame_get_u64(payload);
+        t->type = TASK_UPLOAD_OFFSET;
+        break;
+    case FRAME_DOWNLOAD:
+        if (hdr->payload_len == FRAME_RANGE_SIZE)
+        {
+            t->offset = frame_get_u64(payload);
+            t->length = frame_get_u64(payload + 8);
+        }
+        else if (hdr->payload_len != 0)
+        {
+            *reply = "DOWNLOAD ERROR: Malformed range\n";
+            *status = FRAME_STATUS_BAD_REQUEST;
+            return COMMAND_REJECTED;
+        }
+        if (deflate && hdr->payload_len != 0)
+        {
+            *reply = "DOWNLOAD ERROR: Ranges are sent uncompressed\n";
+            *status = FRAME_STATUS_BAD_REQUEST;
+            return COMMAND_REJECTED;
+        }
+        t->compressed = deflate;
+        t->type = TASK_DOWNLOAD;
+        break;
+    case FRAME_DELETE:
+        t->type = TASK_DELETE;
+        break;
+    case FRAME_SIGNATURE:
+        t->type = TASK_SIGNATURE;
+        break;
+    case FRAME_UPLOAD_DELTA:
+        /* The rebuilt size is only known from the delta: the worker
+         * checks quota once it has read it */
+        t->filesize = (size_t)hdr->payload_len;
+        t->type = TASK_UPLOAD_DELTA;
+        break;
+    case FRAME_DOWNLOAD_DELTA:
+        t->filesize = (size_t)hdr->payload_len;
+        t->type = TASK_DOWNLOAD_DELTA;
+        break;
+    default:
+        *reply = "ERROR: Invalid command\n";
+        *status = FRAME_STATUS_BAD_REQUEST;
+        return COMMAND_REJECTED;
+    }
+
+    /* Whatever of the payload wasn't read with the header */
+    if (task_has_body(t->type))
+        t->body_len = (size_t)(hdr->payload_len - frame_inline_len(hdr));
+    return COMMAND_TASK;
+}
+
+uint8_t command_frame_status(response_status_t status)
+{
+    switch (status)
+    {
+    case RESPONSE_SUCCESS:
+        return FRAME_STATUS_OK;
+    case RESPONSE_FILE_NOT_FOUND:
+        return FRAME_STATUS_NOT_FOUND;
+    case RESPONSE_QUOTA_EXCEEDED:
+        return FRAME_STATUS_QUOTA_EXCEEDED;
+    case RESPONSE_PERMISSION_DENIED:
+        return FRAME_STATUS_PERMISSION_DENIED;
+    case RESPONSE_BUSY:
+        return FRAME_STATUS_BUSY;
+    case RESPONSE_CONFLICT:
+        return FRAME_STATUS_CONFLICT;
+    default:
+        return FRAME_STATUS_ERROR;
+    }
+}
+
+const char *command_upload_error(int err, uint8_t *status)
+{
+    switch (err)
+    {
+    case EBUSY:
+        *status = FRAME_STATUS_BUSY;
+        return "UPLOAD ERROR: File is already being uploaded\n";
+    case ERANGE:
+        *status = FRAME_STATUS_BAD_REQUEST;
+        return "UPLOAD ERROR: Resume offset is past the stored data\n";
+    case EBADMSG:
+        *status = FRAME_STATUS_BAD_REQUEST;
+        return "UPLOAD ERROR: Malformed compressed body\n";
+    default:
+        *status = FRAME_STATUS_ERROR;
+        return "UPLOAD ERROR: File write failed\n";
+    }
+}
+
+int command_dispatch(Session *session, Task *t)
+{
+    if (response_begin(&session->response, t->type, &t->seq) != 0)
+        return -1;
+
+    /* Queue task to workers (Phase 2.1: task contains session_id) */
+    if (task_lanes_push(&task_lanes, t) != 0)
+    {
+        LOG_ERROR("CommandHandler", "Session %lu: Task queue full", session->session_id);
+        if (task_has_body(t->type))
+            unlink(t->temp_path);
+        response_set(&session->response, t->seq, RESPONSE_BUSY,
+                     "ERROR: Server busy, please try again\n", NULL, 0);
+    }
+    return 0;
+}
+
+bool command_conflicts(const Task *earlier, const Task *later)
+{
+    bool earlier_writes = task_writes(earlier->type);
+    bool later_writes = task_writes(later->type);
+
+    if (earlier->type == TASK_LIST || later->type == TASK_LIST)
+        return earlier_writes || later_writes;
+    if (!earlier_writes && !later_writes)
+        return false;  /* Concurrent reads (downloads, signatures) */
+    return strcmp(earlier->filename, later->filename) == 0;
+}
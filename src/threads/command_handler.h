@@ -0,0 +1,103 @@
+#ifndef COMMAND_HANDLER_H
+#define COMMAND_HANDLER_H
+
+#include "../queue/task_queue.h"
+#include "../session/session_manager.h"
+#include "stash_proto.h"
+
+/*
+ * Command handling shared by the thread-per-connection client threads and
+ * the epoll reactor, for both the text protocol and v2 frames
+ * (common/stash_proto.h). Everything here is socket-agnostic: callers own
+ * the I/O and decide what to do when a send fails.
+ */
+
+/* Greeting sent as soon as a connection is accepted */
+extern const char *const WELCOME_MESSAGE;
+
+/* Command menu sent once a session is authenticated */
+extern const char *const FILE_MENU_MESSAGE;
+
+/* Result of parsing one authenticated-phase command line */
+typedef enum
+{
+    COMMAND_TASK,     /* Task filled in, ready to queue (task_has_body: body still to receive) */
+    COMMAND_QUIT,     /* Client asked to disconnect */
+    COMMAND_REJECTED  /* Not queued, *reply holds the error to send */
+} command_result_t;
+
+/**
+ * Check whether a text line asks to switch the connection to v2 frames
+ * @param deflate Output: the client also asked for compressed bodies
+ */
+bool command_is_proto_switch(const char *line, bool *deflate);
+
+/**
+ * Run SIGNUP or LOGIN for a session
+ * @param signup true for SIGNUP, false for LOGIN
+ * @return Reply text; the session is authenticated iff session->is_authenticated
+ */
+const char *command_authenticate(Session *session, bool signup,
+                                 const char *username, const char *password);
+
+/**
+ * Handle one SIGNUP/LOGIN line
+ * @param session Session being authenticated (username set on success)
+ * @param line NUL-terminated command line without trailing newline
+ * @return Reply to send; the session is authenticated iff session->is_authenticated
+ */
+const char *command_handle_auth(Session *session, const char *line);
+
+/**
+ * Parse one file-operation line into a Task
+ * @param session Authenticated session issuing the command
+ * @param line NUL-terminated command line
+ * @param t Output task (zeroed and filled in)
+ * @param reply Output: error text when COMMAND_REJECTED
+ */
+command_result_t command_parse(Session *session, const char *line, Task *t, const char **reply);
+
+/**
+ * Turn a v2 request frame into a Task
+ * @param hdr Validated request header (UPLOAD payload_len becomes filesize)
+ * @param name NUL-terminated frame name (filename)
+ * @param payload Inline payload (frame_inline_len bytes)
+ * @param t Output task (zeroed and filled in)
+ * @param reply Output: error text when COMMAND_REJECTED
+ * @param status Output: frame status when COMMAND_REJECTED
+ */
+command_result_t command_parse_frame(Session *session, const FrameHeader *hdr, const char *name,
+                                     const unsigned char *payload, Task *t, const char **reply,
+                                     uint8_t *status);
+
+/**
+ * Map a worker response status onto a v2 reply status
+ */
+uint8_t command_frame_status(response_status_t status);
+
+/**
+ * Reply for an upload body that was received but not stored
+ * @param err Why (errno from the upload stream: EBUSY, ERANGE, ...)
+ * @param status Output: v2 reply status
+ */
+const char *command_upload_error(int err, uint8_t *status);
+
+/**
+ * Reserve a completion slot for a task and queue it to the workers
+ * If the task queue is full the task is dropped (body temp file removed)
+ * and a RESPONSE_BUSY result is posted in its slot, so the caller still
+ * collects exactly one result per dispatched task, in order.
+ * @return 0 once a result is on its way, -1 if the session already has
+ *         RESPONSE_MAX_INFLIGHT tasks outstanding (nothing dispatched)
+ */
+int command_dispatch(Session *session, Task *t);
+
+/**
+ * Check whether a task must wait for an earlier in-flight one of the same
+ * session, so pipelined requests keep their sequential meaning: anything on
+ * the same file unless both only read it, and LIST against anything that
+ * writes (UPLOAD, UPLOAD_DELTA, DELETE).
+ */
+bool command_conflicts(const Task *earlier, const Task *later);
+
+#endif /* COMMAND_HANDLER_H */
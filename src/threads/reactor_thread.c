@@ -0,0 +1,1155 @@
+#define _GNU_SOURCE  /* accept4 */
+#include "reactor_thread.h"
+#include "command_handler.h"
+#include "../server.h"
+#include "../queue/task_queue.h"
+#include "../session/response_queue.h"
+#include "../session/session_manager.h"
+#include "../storage/upload_stream.h"
+#include "../storage/chunk_store.h"
+#include "../utils/logger.h"
+#include "../utils/metrics.h"
+#include "../utils/network_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#define REACTOR_MAX_EVENTS 256
+#define REACTOR_POLL_TIMEOUT_MS 500
+/* Fits the largest inline v2 request: header + name + inline payload */
+#define CONN_INPUT_BUFFER 8192
+
+/* Per-connection protocol state */
+typedef enum
+{
+    CONN_AUTH,         /* Waiting for SIGNUP/LOGIN */
+    CONN_COMMAND,      /* Authenticated, waiting for a file command */
+    CONN_UPLOAD_BODY,  /* Receiving UPLOAD payload */
+    CONN_WAIT_WORKER,  /* Task queued, waiting for the worker's response */
+    CONN_CLOSING       /* Flush pending output, then close */
+} conn_state_t;
+
+typedef struct ReactorLoop ReactorLoop;
+
+typedef struct Connection
+{
+    int fd;
+    uint64_t session_id;
+    Session *session;                 /* Reference from session_get, put in conn_destroy */
+    ReactorLoop *loop;
+    conn_state_t state;
+    uint32_t events;                  /* Registered epoll interest */
+    bool registered;                  /* fd currently in the epoll set */
+    bool peer_closed;                 /* Peer gone, close once the worker answers */
+    int proto;                        /* PROTO_VERSION_TEXT or PROTO_VERSION_FRAMED */
+    uint8_t reply_type;               /* v2: reply type for the request in flight */
+    uint32_t reply_tag;               /* v2: tag echoed on that reply */
+    uint64_t discard_remaining;       /* v2: payload bytes of a rejected UPLOAD to drop */
+
+    char in_buf[CONN_INPUT_BUFFER];   /* Unparsed command bytes */
+    size_t in_len;
+
+    unsigned char out_hdr[FRAME_HEADER_SIZE]; /* v2 reply header, sent before the body */
+    size_t out_hdr_len;
+    size_t out_hdr_off;
+
+    char *out_buf;                    /* Pending text replies */
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+
+    char *out_data;                   /* Pending response payload (owned, response_buf_alloc) */
+    size_t out_data_len;
+    size_t out_data_off;
+
+    ChunkStream *out_file;            /* DOWNLOAD body sent with sendfile, NULL if none */
+
+    int reply_op;                     /* Task whose reply is being sent, -1 if none */
+    int reply_status;                 /* Its status, stamps and payload size, for metrics_reply */
+    uint64_t reply_started_ns;
+    uint64_t reply_taken_ns;
+    uint64_t reply_bytes;
+
+    Task task;                        /* Task being assembled (UPLOAD body) */
+    UploadStream upload;              /* Temp file receiving the body */
+    char *chunk;                      /* Receive buffer, upload_chunk_size bytes */
+    size_t upload_received;           /* Body bytes (a resumed upload starts at task.offset) */
+    int upload_error;                 /* Non-zero: body is drained but discarded (errno) */
+
+    struct Connection *prev;          /* Loop connection list */
+    struct Connection *next;
+    struct Connection *ready_next;    /* Loop completion list */
+    bool ready_queued;
+} Connection;
+
+struct ReactorLoop
+{
+    int index;
+    int epoll_fd;
+    int event_fd;                     /* Wakes the loop when workers complete */
+    pthread_t thread;
+    pthread_mutex_t ready_mtx;        /* Protects ready_head / ready_queued */
+    Connection *ready_head;
+    Connection *conns;
+    size_t conn_count;
+};
+
+static ReactorLoop *loops = NULL;
+static int loop_count = 0;
+static int reactor_listen_fd = -1;
+
+/* epoll data.ptr markers for the non-connection descriptors */
+static char listen_marker;
+static char wakeup_marker;
+
+static int conn_flush(Connection *conn);
+static int conn_process_input(Connection *conn);
+
+/* -------------------- Completion Hook -------------------- */
+
+/* Called by a worker (under the response mutex) when a result is ready */
+static void reactor_notify(void *ctx)
+{
+    Connection *conn = (Connection *)ctx;
+    ReactorLoop *loop = conn->loop;
+
+    pthread_mutex_lock(&loop->ready_mtx);
+    if (!conn->ready_queued)
+    {
+        conn->ready_queued = true;
+        conn->ready_next = loop->ready_head;
+        loop->ready_head = conn;
+    }
+    pthread_mutex_unlock(&loop->ready_mtx);
+
+    uint64_t one = 1;
+    if (write(loop->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("Reactor", "eventfd write: %s", strerror(errno));
+}
+
+/* -------------------- Connection Lifecycle -------------------- */
+
+static bool conn_has_output(const Connection *conn)
+{
+    return conn->out_hdr_off < conn->out_hdr_len || conn->out_file ||
+           conn->out_data_off < conn->out_data_len || conn->out_off < conn->out_len;
+}
+
+static bool conn_wants_input(const Connection *conn)
+{
+    if (conn->peer_closed || conn_has_output(conn))
+        return false;
+    return conn->state == CONN_AUTH || conn->state == CONN_COMMAND ||
+           conn->state == CONN_UPLOAD_BODY;
+}
+
+static void conn_update_interest(Connection *conn)
+{
+    if (conn->peer_closed)
+        return;
+
+    uint32_t want = 0;
+    if (conn_has_output(conn))
+        want = EPOLLOUT;
+    else if (conn_wants_input(conn))
+        want = EPOLLIN;
+
+    if (conn->registered && want == conn->events)
+        return;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = want;
+    ev.data.ptr = conn;
+    int op = conn->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(conn->loop->epoll_fd, op, conn->fd, &ev) != 0)
+    {
+        LOG_ERROR("Reactor", "epoll_ctl: %s", strerror(errno));
+        return;
+    }
+    conn->registered = true;
+    conn->events = want;
+}
+
+static void conn_unregister(Connection *conn)
+{
+    if (conn->registered)
+    {
+        epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->registered = false;
+    }
+}
+
+static void conn_destroy(Connection *conn)
+{
+    ReactorLoop *loop = conn->loop;
+
+    conn_unregister(conn);
+    response_set_notify(&conn->session->response, NULL, NULL);
+
+    /* Drop from the completion list if a late notification queued us */
+    pthread_mutex_lock(&loop->ready_mtx);
+    if (conn->ready_queued)
+    {
+        Connection **pp = &loop->ready_head;
+        while (*pp && *pp != conn)
+            pp = &(*pp)->ready_next;
+        if (*pp)
+            *pp = conn->ready_next;
+        conn->ready_queued = false;
+    }
+    pthread_mutex_unlock(&loop->ready_mtx);
+
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        loop->conns = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    loop->conn_count--;
+
+    /* A resumable upload keeps what it received for the client to resume */
+    if (conn->state == CONN_UPLOAD_BODY && !conn->upload_error)
+        upload_stream_suspend(&conn->upload);
+    free(conn->chunk);
+    free(conn->out_buf);
+    response_buf_free(conn->out_data);
+    chunk_stream_close(conn->out_file);
+
+    /* session_destroy closes the socket */
+    session_mark_inactive(&session_manager, conn->session_id);
+    session_destroy(&session_manager, conn->session_id);
+    session_put(conn->session);
+    free(conn);
+}
+
+/*
+ * Peer hung up or the socket failed. A connection with a task in flight is
+ * kept (out of the epoll set) until its worker answers, mirroring the
+ * client thread which always waits for the response it asked for.
+ */
+static void conn_shutdown(Connection *conn)
+{
+    if (conn->state == CONN_WAIT_WORKER)
+    {
+        conn_unregister(conn);
+        conn->peer_closed = true;
+        return;
+    }
+    conn_destroy(conn);
+}
+
+static void conn_open(ReactorLoop *loop, int cfd)
+{
+    Connection *conn = calloc(1, sizeof(Connection));
+    if (!conn)
+    {
+        LOG_ERROR("Reactor", "Failed to allocate connection");
+        close(cfd);
+        return;
+    }
+
+    uint64_t session_id = session_create(&session_manager, cfd);
+    Session *session = session_id ? session_get(&session_manager, session_id) : NULL;
+    if (!session)
+    {
+        LOG_ERROR("Reactor", "Failed to create session");
+        if (session_id)
+            session_destroy(&session_manager, session_id);
+        else
+            close(cfd);
+        free(conn);
+        return;
+    }
+
+    conn->fd = cfd;
+    conn->session_id = session_id;
+    conn->session = session;
+    conn->loop = loop;
+    conn->state = CONN_AUTH;
+    conn->proto = PROTO_VERSION_TEXT;
+    conn->reply_op = -1;
+
+    conn->next = loop->conns;
+    if (loop->conns)
+        loop->conns->prev = conn;
+    loop->conns = conn;
+    loop->conn_count++;
+
+    response_set_notify(&session->response, reactor_notify, conn);
+
+    LOG_INFO("Reactor", "Session %lu created (fd=%d, connections=%zu)", session_id, cfd,
+             loop->conn_count);
+
+    /* Queue welcome message (registers the fd as a side effect) */
+    size_t len = strlen(WELCOME_MESSAGE);
+    conn->out_buf = malloc(len);
+    if (!conn->out_buf)
+    {
+        conn_destroy(conn);
+        return;
+    }
+    memcpy(conn->out_buf, WELCOME_MESSAGE, len);
+    conn->out_cap = len;
+    conn->out_len = len;
+    conn_flush(conn);
+}
+
+/* -------------------- Output -------------------- */
+
+/*
+ * Write as much pending output as the socket accepts.
+ * Returns -1 if the connection was destroyed, 0 otherwise.
+ */
+static int conn_flush(Connection *conn)
+{
+    /* MSG_MORE: a header with a body behind it shares segments with the
+     * body rather than going out alone and stalling on delayed ACK */
+    int hdr_flags = MSG_NOSIGNAL;
+    if (conn->out_file || conn->out_data_off < conn->out_data_len || conn->out_off < conn->out_len)
+        hdr_flags |= MSG_MORE;
+    while (conn->out_hdr_off < conn->out_hdr_len)
+    {
+        ssize_t n = send(conn->fd, conn->out_hdr + conn->out_hdr_off,
+                         conn->out_hdr_len - conn->out_hdr_off, hdr_flags);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                conn_update_interest(conn);
+                return 0;
+            }
+            LOG_ERROR("Reactor", "Session %lu: send failed: %s", conn->session_id, strerror(errno));
+            conn_shutdown(conn);
+            return -1;
+        }
+        conn->out_hdr_off += n;
+    }
+    conn->out_hdr_len = 0;
+    conn->out_hdr_off = 0;
+
+    /* File body goes straight from the page cache to the socket */
+    while (conn->out_file && !chunk_stream_done(conn->out_file))
+    {
+        ssize_t n = chunk_stream_send(conn->out_file, conn->fd);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                conn_update_interest(conn);
+                return 0;
+            }
+            LOG_ERROR("Reactor", "Session %lu: sendfile failed: %s", conn->session_id,
+                      strerror(errno));
+            conn_shutdown(conn);
+            return -1;
+        }
+    }
+    if (conn->out_file)
+    {
+        chunk_stream_close(conn->out_file);
+        conn->out_file = NULL;
+    }
+
+    while (conn->out_data_off < conn->out_data_len)
+    {
+        ssize_t n = send(conn->fd, conn->out_data + conn->out_data_off,
+                         conn->out_data_len - conn->out_data_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                conn_update_interest(conn);
+                return 0;
+            }
+            LOG_ERROR("Reactor", "Session %lu: send failed: %s", conn->session_id, strerror(errno));
+            conn_shutdown(conn);
+            return -1;
+        }
+        conn->out_data_off += n;
+    }
+    if (conn->out_data)
+    {
+        response_buf_free(conn->out_data);
+        conn->out_data = NULL;
+        conn->out_data_len = 0;
+        conn->out_data_off = 0;
+    }
+
+    while (conn->out_off < conn->out_len)
+    {
+        ssize_t n = send(conn->fd, conn->out_buf + conn->out_off,
+                         conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                conn_update_interest(conn);
+                return 0;
+            }
+            LOG_ERROR("Reactor", "Session %lu: send failed: %s", conn->session_id, strerror(errno));
+            conn_shutdown(conn);
+            return -1;
+        }
+        conn->out_off += n;
+    }
+    conn->out_off = 0;
+    conn->out_len = 0;
+
+    if (conn->reply_op >= 0)
+    {
+        metrics_reply(conn->reply_op, conn->reply_status, conn->reply_started_ns,
+                      conn->reply_taken_ns, conn->reply_bytes);
+        conn->reply_op = -1;
+    }
+
+    if (conn->state == CONN_CLOSING)
+    {
+        conn_destroy(conn);
+        return -1;
+    }
+
+    conn_update_interest(conn);
+    return 0;
+}
+
+/* Append bytes to the output buffer. Returns -1 if the connection was destroyed. */
+static int conn_append(Connection *conn, const void *data, size_t len)
+{
+    if (conn->out_len + len > conn->out_cap)
+    {
+        size_t cap = conn->out_cap ? conn->out_cap : 256;
+        while (cap < conn->out_len + len)
+            cap *= 2;
+        char *grown = realloc(conn->out_buf, cap);
+        if (!grown)
+        {
+            LOG_ERROR("Reactor", "Session %lu: output buffer allocation failed", conn->session_id);
+            conn_shutdown(conn);
+            return -1;
+        }
+        conn->out_buf = grown;
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out_buf + conn->out_len, data, len);
+    conn->out_len += len;
+    return 0;
+}
+
+/* Queue a text reply and try to send it. Returns -1 if the connection was destroyed. */
+static int conn_send(Connection *conn, const char *msg)
+{
+    if (conn_append(conn, msg, strlen(msg)) < 0)
+        return -1;
+    return conn_flush(conn);
+}
+
+/* Queue a v2 frame with a text payload for the request in flight */
+static int conn_send_frame(Connection *conn, uint8_t status, const char *msg)
+{
+    size_t len = strlen(msg);
+    FrameHeader hdr = {.type = conn->reply_type, .status = status,
+                       .tag = conn->reply_tag, .payload_len = len};
+    unsigned char raw[FRAME_HEADER_SIZE];
+
+    frame_encode_header(&hdr, raw);
+    if (conn_append(conn, raw, sizeof(raw)) < 0 || conn_append(conn, msg, len) < 0)
+        return -1;
+    return conn_flush(conn);
+}
+
+/* Reply in whichever protocol the connection speaks */
+static int conn_reply(Connection *conn, uint8_t status, const char *msg)
+{
+    if (conn->proto == PROTO_VERSION_FRAMED)
+        return conn_send_frame(conn, status, msg);
+    return conn_send(conn, msg);
+}
+
+/* -------------------- Command Handling -------------------- */
+
+/* One task in flight per connection: the next command is read once it completes */
+static int conn_queue_task(Connection *conn)
+{
+    /* A full task queue still posts a (BUSY) completion, handled like any other */
+    command_dispatch(conn->session, &conn->task);
+    conn->state = CONN_WAIT_WORKER;
+    conn_update_interest(conn);
+    return 0;
+}
+
+/*
+ * Append received body bytes to the upload temp file. After a write error
+ * the rest of the body is still consumed (and dropped) so the command
+ * stream stays in sync.
+ */
+static void conn_write_body(Connection *conn, const char *data, size_t len)
+{
+    if (len > 0 && !conn->upload_error &&
+        upload_stream_write(&conn->upload, data, len) != 0)
+    {
+        conn->upload_error = errno ? errno : EIO;
+        upload_stream_abort(&conn->upload);
+    }
+    conn->upload_received += len;
+}
+
+/*
+ * Queue the upload once its declared size has arrived.
+ * Returns -1 if the connection was destroyed.
+ */
+static int conn_finish_body(Connection *conn)
+{
+    if (conn->upload_received < conn->task.body_len)
+        return 0;
+
+    /* Body complete: release the chunk buffer until the next upload */
+    free(conn->chunk);
+    conn->chunk = NULL;
+
+    if (!conn->upload_error && upload_stream_finish(&conn->upload) != 0)
+        conn->upload_error = errno ? errno : EIO;
+    if (conn->upload_error)
+    {
+        uint8_t status;
+        const char *reply = command_upload_error(conn->upload_error, &status);
+        conn->state = CONN_COMMAND;
+        return conn_reply(conn, status, reply);
+    }
+
+    LOG_DEBUG("Reactor", "Session %lu: Received all %zu bytes, queueing", conn->session_id,
+              conn->upload_received);
+    memcpy(conn->task.temp_path, conn->upload.temp_path, sizeof(conn->task.temp_path));
+    return conn_queue_task(conn);
+}
+
+static int conn_handle_auth(Connection *conn, const char *line)
+{
+    LOG_DEBUG("Reactor", "Session %lu: Auth command: %s", conn->session_id, line);
+
+    const char *reply = command_handle_auth(conn->session, line);
+    if (!conn->session->is_authenticated)
+        return conn_send(conn, reply);
+
+    conn->state = CONN_COMMAND;
+    LOG_INFO("Reactor", "Session %lu: User '%s' authenticated", conn->session_id,
+             conn->session->username);
+    if (conn_send(conn, reply) < 0)
+        return -1;
+    return conn_send(conn, FILE_MENU_MESSAGE);
+}
+
+static int conn_begin_upload(Connection *conn);
+
+static int conn_handle_command(Connection *conn, const char *line)
+{
+    LOG_DEBUG("Reactor", "Session %lu: File command: %s", conn->session_id, line);
+
+    const char *reply;
+    command_result_t parsed = command_parse(conn->session, line, &conn->task, &reply);
+
+    if (parsed == COMMAND_QUIT)
+    {
+        LOG_INFO("Reactor", "Session %lu: user quit", conn->session_id);
+        conn->state = CONN_CLOSING;
+        return conn_send(conn, "Goodbye!\n");
+    }
+
+    if (parsed == COMMAND_REJECTED)
+        return conn_send(conn, reply);
+
+    if (conn->task.type != TASK_UPLOAD)
+        return conn_queue_task(conn);
+
+    return conn_begin_upload(conn);
+}
+
+/*
+ * Start receiving the body of conn->task (task_has_body).
+ * Returns -1 if the connection was destroyed.
+ */
+static int conn_begin_upload(Connection *conn)
+{
+    size_t body_len = conn->task.body_len;
+    LOG_DEBUG("Reactor", "Session %lu: Receiving %zu bytes for %s", conn->session_id, body_len,
+              conn->task.filename);
+
+    if (!conn->chunk)
+    {
+        conn->chunk = malloc(server_config.upload_chunk_size);
+        if (!conn->chunk)
+        {
+            LOG_ERROR("Reactor", "Session %lu: chunk allocation failed", conn->session_id);
+            conn_destroy(conn);
+            return -1;
+        }
+    }
+
+    Task *t = &conn->task;
+    int rc = t->resumable
+                 ? upload_stream_open_partial(&conn->upload, t->username, t->filename,
+                                              conn->session_id, t->filesize, t->offset)
+                 : upload_stream_open(&conn->upload, t->username, conn->session_id, t->filesize);
+    if (rc == 0 && t->compressed)
+        rc = upload_stream_decode(&conn->upload);
+    conn->upload_error = rc == 0 ? 0 : (errno ? errno : EIO);
+    conn->upload_received = 0;
+    conn->state = CONN_UPLOAD_BODY;
+
+    /* Bytes already buffered behind the command line belong to the body */
+    size_t take = conn->in_len < body_len ? conn->in_len : body_len;
+    conn_write_body(conn, conn->in_buf, take);
+    memmove(conn->in_buf, conn->in_buf + take, conn->in_len - take);
+    conn->in_len -= take;
+    return conn_finish_body(conn);
+}
+
+/* Handle one v2 request frame. Returns -1 if the connection was destroyed. */
+static int conn_handle_frame(Connection *conn, const FrameHeader *hdr,
+                             const char *name, const char *payload)
+{
+    Session *session = conn->session;
+
+    LOG_DEBUG("Reactor", "Session %lu: Frame %s '%s' (tag=%u, payload=%lu)", conn->session_id,
+              frame_type_name(hdr->type), name, hdr->tag, (unsigned long)hdr->payload_len);
+
+    if (hdr->type == FRAME_QUIT)
+    {
+        LOG_INFO("Reactor", "Session %lu: user quit", conn->session_id);
+        conn->state = CONN_CLOSING;
+        return conn_send_frame(conn, FRAME_STATUS_OK, "Goodbye!\n");
+    }
+
+    /* Authentication phase */
+    if (!session->is_authenticated)
+    {
+        const char *reply = "ERROR: Please SIGNUP or LOGIN first\n";
+        if (hdr->type == FRAME_SIGNUP || hdr->type == FRAME_LOGIN)
+            reply = command_authenticate(session, hdr->type == FRAME_SIGNUP, name, payload);
+        else if (frame_has_body(hdr->type))
+            conn->discard_remaining = hdr->payload_len - frame_inline_len(hdr);
+
+        if (!session->is_authenticated)
+            return conn_send_frame(conn, FRAME_STATUS_ERROR, reply);
+
+        conn->state = CONN_COMMAND;
+        LOG_INFO("Reactor", "Session %lu: User '%s' authenticated", conn->session_id,
+                 session->username);
+        return conn_send_frame(conn, FRAME_STATUS_OK, reply);
+    }
+
+    const char *reply;
+    uint8_t status;
+    command_result_t parsed;
+    if (hdr->type == FRAME_SIGNUP || hdr->type == FRAME_LOGIN)
+    {
+        reply = "ERROR: Already authenticated\n";
+        status = FRAME_STATUS_BAD_REQUEST;
+        parsed = COMMAND_REJECTED;
+    }
+    else
+    {
+        parsed = command_parse_frame(session, hdr, name, (const unsigned char *)payload,
+                                     &conn->task, &reply, &status);
+    }
+
+    if (parsed == COMMAND_REJECTED)
+    {
+        if (frame_has_body(hdr->type))
+            conn->discard_remaining = hdr->payload_len - frame_inline_len(hdr);
+        return conn_send_frame(conn, status, reply);
+    }
+
+    if (!task_has_body(conn->task.type))
+        return conn_queue_task(conn);
+    return conn_begin_upload(conn);
+}
+
+/*
+ * Run the next buffered v2 frame.
+ * Returns 1 if a frame was handled, 0 if more input is needed,
+ * -1 if the connection was destroyed.
+ */
+static int conn_process_frame(Connection *conn)
+{
+    /* Drop the body of a rejected request first */
+    if (conn->discard_remaining > 0)
+    {
+        size_t drop = conn->in_len;
+        if (drop > conn->discard_remaining)
+            drop = (size_t)conn->discard_remaining;
+        memmove(conn->in_buf, conn->in_buf + drop, conn->in_len - drop);
+        conn->in_len -= drop;
+        conn->discard_remaining -= drop;
+        if (conn->discard_remaining > 0)
+            return 0;
+    }
+
+    if (conn->in_len < FRAME_HEADER_SIZE)
+        return 0;
+
+    FrameHeader hdr;
+    frame_decode_header((const unsigned char *)conn->in_buf, &hdr);
+    conn->reply_type = hdr.type | FRAME_REPLY;
+    conn->reply_tag = hdr.tag;
+
+    if (frame_validate_request(&hdr) != 0)
+    {
+        LOG_ERROR("Reactor", "Session %lu: malformed frame (type=%u), closing", conn->session_id,
+                  hdr.type);
+        conn->in_len = 0;
+        conn->state = CONN_CLOSING;
+        return conn_send_frame(conn, FRAME_STATUS_BAD_REQUEST, "ERROR: Malformed frame\n") < 0 ? -1 : 0;
+    }
+
+    /* Name and inline payload must be buffered; bodies are streamed */
+    size_t inline_len = (size_t)frame_inline_len(&hdr);
+    size_t need = FRAME_HEADER_SIZE + hdr.name_len + inline_len;
+    if (conn->in_len < need)
+        return 0;
+
+    char name[FRAME_MAX_NAME + 1];
+    char payload[FRAME_MAX_INLINE_PAYLOAD + 1];
+    memcpy(name, conn->in_buf + FRAME_HEADER_SIZE, hdr.name_len);
+    name[hdr.name_len] = '\0';
+    memcpy(payload, conn->in_buf + FRAME_HEADER_SIZE + hdr.name_len, inline_len);
+    payload[inline_len] = '\0';
+
+    /* Detach the frame before handling it (UPLOAD consumes what follows) */
+    memmove(conn->in_buf, conn->in_buf + need, conn->in_len - need);
+    conn->in_len -= need;
+
+    return conn_handle_frame(conn, &hdr, name, payload) < 0 ? -1 : 1;
+}
+
+/*
+ * Run every complete command line currently buffered.
+ * Stops while a reply is pending so responses stay in order.
+ * Returns -1 if the connection was destroyed.
+ */
+static int conn_process_input(Connection *conn)
+{
+    while ((conn->state == CONN_AUTH || conn->state == CONN_COMMAND) &&
+           !conn_has_output(conn))
+    {
+        if (conn->proto == PROTO_VERSION_FRAMED)
+        {
+            int rc = conn_process_frame(conn);
+            if (rc < 0)
+                return -1;
+            if (rc == 0)
+                break;
+            continue;
+        }
+
+        char *newline = memchr(conn->in_buf, '\n', conn->in_len);
+        if (!newline)
+        {
+            if (conn->in_len == sizeof(conn->in_buf))
+            {
+                conn->in_len = 0;
+                return conn_send(conn, "ERROR: Command too long\n");
+            }
+            break;
+        }
+
+        /* Detach the line before handling it (UPLOAD consumes what follows) */
+        char line[CONN_INPUT_BUFFER];
+        size_t line_len = newline - conn->in_buf;
+        memcpy(line, conn->in_buf, line_len);
+        line[line_len] = '\0';
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line[line_len - 1] = '\0';
+        memmove(conn->in_buf, newline + 1, conn->in_len - line_len - 1);
+        conn->in_len -= line_len + 1;
+
+        /* Protocol v2 negotiation: everything after this line is frames */
+        bool deflate;
+        if (command_is_proto_switch(line, &deflate))
+        {
+            LOG_INFO("Reactor", "Session %lu: Switched to protocol v2%s", conn->session_id,
+                     deflate ? " (deflate)" : "");
+            conn->proto = PROTO_VERSION_FRAMED;
+            conn->session->deflate = deflate;
+            if (conn_send(conn, deflate ? PROTO_NEGOTIATE_OK_DEFLATE : PROTO_NEGOTIATE_OK) < 0)
+                return -1;
+            continue;
+        }
+
+        int rc = (conn->state == CONN_AUTH) ? conn_handle_auth(conn, line)
+                                            : conn_handle_command(conn, line);
+        if (rc < 0)
+            return -1;
+    }
+
+    conn_update_interest(conn);
+    return 0;
+}
+
+static void conn_on_readable(Connection *conn)
+{
+    while (conn_wants_input(conn))
+    {
+        char *dst;
+        size_t room;
+        if (conn->state == CONN_UPLOAD_BODY)
+        {
+            dst = conn->chunk;
+            room = conn->task.body_len - conn->upload_received;
+            if (room > server_config.upload_chunk_size)
+                room = server_config.upload_chunk_size;
+        }
+        else
+        {
+            dst = conn->in_buf + conn->in_len;
+            room = sizeof(conn->in_buf) - conn->in_len;
+        }
+
+        ssize_t n = recv(conn->fd, dst, room, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            LOG_ERROR("Reactor", "Session %lu: recv failed: %s", conn->session_id, strerror(errno));
+            conn_shutdown(conn);
+            return;
+        }
+        if (n == 0)
+        {
+            LOG_INFO("Reactor", "Session %lu: client disconnected", conn->session_id);
+            conn_shutdown(conn);
+            return;
+        }
+        session_update_activity(conn->session);
+
+        if (conn->state == CONN_UPLOAD_BODY)
+        {
+            conn_write_body(conn, dst, n);
+            if (conn_finish_body(conn) < 0)
+                return;
+        }
+        else
+        {
+            conn->in_len += n;
+            if (conn_process_input(conn) < 0)
+                return;
+        }
+    }
+}
+
+/* Worker answered: move the result into the output buffers */
+static void conn_on_complete(Connection *conn)
+{
+    if (conn->state != CONN_WAIT_WORKER)
+        return;
+
+    Completion done;
+    if (!response_take(&conn->session->response, &done))
+        return;
+
+    char *message = done.message;
+    void *data = done.data;
+    size_t data_size = done.data_size;
+    ChunkStream *file = done.file;
+    size_t file_size = done.file_size;
+    response_status_t status = done.status;
+
+    conn->state = CONN_COMMAND;
+
+    if (conn->peer_closed)
+    {
+        LOG_INFO("Reactor", "Session %lu: dropping response for closed connection",
+                 conn->session_id);
+        response_buf_free(data);
+        chunk_stream_close(file);
+        conn_destroy(conn);
+        return;
+    }
+
+    LOG_DEBUG("Reactor", "Session %lu: Got response: %s", conn->session_id, message);
+
+    conn->reply_op = done.op;
+    conn->reply_status = status;
+    conn->reply_started_ns = done.started_ns;
+    conn->reply_taken_ns = done.taken_ns;
+    conn->reply_bytes = file_size + data_size;
+
+    /* v2: the payload is the body when there is one, otherwise the message */
+    if (conn->proto == PROTO_VERSION_FRAMED)
+    {
+        size_t payload_len = file ? file_size : (data && data_size > 0) ? data_size
+                                                                        : strlen(message);
+        FrameHeader hdr = {.type = conn->reply_type, .status = command_frame_status(status),
+                           .tag = conn->reply_tag, .payload_len = payload_len};
+        frame_encode_header(&hdr, conn->out_hdr);
+        conn->out_hdr_len = FRAME_HEADER_SIZE;
+        conn->out_hdr_off = 0;
+        if (file || (data && data_size > 0))
+            message[0] = '\0';
+    }
+
+    if (data && data_size > 0)
+    {
+        conn->out_data = data;
+        conn->out_data_len = data_size;
+        conn->out_data_off = 0;
+    }
+    else
+    {
+        response_buf_free(data);
+    }
+
+    conn->out_file = file;
+
+    int rc = message[0] ? conn_send(conn, message) : conn_flush(conn);
+    if (rc == 0)
+        conn_process_input(conn);
+}
+
+/* -------------------- Event Loop -------------------- */
+
+static void reactor_accept(ReactorLoop *loop)
+{
+    while (keep_running)
+    {
+        int cfd = accept4(reactor_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && keep_running)
+                LOG_ERROR("Reactor", "accept: %s", strerror(errno));
+            return;
+        }
+        socket_set_keepalive(cfd, TCP_KEEPALIVE_IDLE, TCP_KEEPALIVE_INTERVAL,
+                             TCP_KEEPALIVE_COUNT);
+        conn_open(loop, cfd);
+    }
+}
+
+static void reactor_drain_completions(ReactorLoop *loop)
+{
+    uint64_t count;
+    if (read(loop->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOG_ERROR("Reactor", "eventfd read: %s", strerror(errno));
+
+    while (1)
+    {
+        pthread_mutex_lock(&loop->ready_mtx);
+        Connection *conn = loop->ready_head;
+        if (conn)
+        {
+            loop->ready_head = conn->ready_next;
+            conn->ready_queued = false;
+        }
+        pthread_mutex_unlock(&loop->ready_mtx);
+
+        if (!conn)
+            break;
+        conn_on_complete(conn);
+    }
+}
+
+/* Stop accepting and close every connection that is not waiting on a worker */
+static void reactor_begin_drain(ReactorLoop *loop)
+{
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, reactor_listen_fd, NULL);
+
+    Connection *conn = loop->conns;
+    while (conn)
+    {
+        Connection *next = conn->next;
+        if (conn->state == CONN_WAIT_WORKER)
+        {
+            conn_unregister(conn);
+            conn->peer_closed = true;
+        }
+        else
+        {
+            conn_destroy(conn);
+        }
+        conn = next;
+    }
+
+    LOG_INFO("Reactor", "Draining (%zu connections awaiting workers)", loop->conn_count);
+}
+
+static void *reactor_loop(void *arg)
+{
+    ReactorLoop *loop = (ReactorLoop *)arg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    bool draining = false;
+
+    while (1)
+    {
+        if (!keep_running && !draining)
+        {
+            draining = true;
+            reactor_begin_drain(loop);
+        }
+        if (draining && loop->conn_count == 0)
+            break;
+
+        int n = epoll_wait(loop->epoll_fd, events, REACTOR_MAX_EVENTS, REACTOR_POLL_TIMEOUT_MS);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Reactor", "epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        /* Completions can destroy a connection that still has an event
+         * (HUP/ERR) later in this batch, so they run after it */
+        bool completions = false;
+        for (int i = 0; i < n; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+
+            if (ptr == &listen_marker)
+            {
+                if (!draining)
+                    reactor_accept(loop);
+                continue;
+            }
+            if (ptr == &wakeup_marker)
+            {
+                completions = true;
+                continue;
+            }
+
+            Connection *conn = (Connection *)ptr;
+            if (ev & EPOLLOUT)
+            {
+                if (conn_flush(conn) < 0)
+                    continue;
+                if (!conn_has_output(conn) && conn_process_input(conn) < 0)
+                    continue;
+            }
+            if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                if (conn_wants_input(conn))
+                    conn_on_readable(conn);
+                else if (ev & (EPOLLHUP | EPOLLERR))
+                    conn_shutdown(conn);
+            }
+        }
+
+        if (completions)
+            reactor_drain_completions(loop);
+    }
+
+    LOG_INFO("Reactor", "Exiting...");
+    return NULL;
+}
+
+/* -------------------- Public API -------------------- */
+
+int reactor_start(int listen_fd, int io_threads)
+{
+    if (listen_fd < 0 || io_threads <= 0)
+        return -1;
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        LOG_ERROR("Reactor", "fcntl O_NONBLOCK: %s", strerror(errno));
+        return -1;
+    }
+    reactor_listen_fd = listen_fd;
+
+    loops = calloc(io_threads, sizeof(ReactorLoop));
+    if (!loops)
+        return -1;
+
+    for (int i = 0; i < io_threads; i++)
+    {
+        ReactorLoop *loop = &loops[i];
+        loop->index = i;
+        pthread_mutex_init(&loop->ready_mtx, NULL);
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->event_fd < 0)
+        {
+            LOG_ERROR("Reactor", "epoll/eventfd setup: %s", strerror(errno));
+            loop_count = i + 1;
+            reactor_join();
+            return -1;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &wakeup_marker;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &ev);
+
+        /* EPOLLEXCLUSIVE: wake one loop per incoming connection */
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &listen_marker;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
+        {
+            LOG_ERROR("Reactor", "epoll_ctl listen: %s", strerror(errno));
+            loop_count = i + 1;
+            reactor_join();
+            return -1;
+        }
+    }
+    loop_count = io_threads;
+
+    for (int i = 0; i < io_threads; i++)
+    {
+        int rc = pthread_create(&loops[i].thread, NULL, reactor_loop, &loops[i]);
+        if (rc != 0)
+        {
+            LOG_ERROR("Reactor", "Failed to create I/O thread %d: %s", i, strerror(rc));
+            /* Loops already running keep serving; this one stays idle */
+            loops[i].thread = 0;
+        }
+    }
+
+    LOG_INFO("Reactor", "Started %d I/O threads", io_threads);
+    return 0;
+}
+
+void reactor_join(void)
+{
+    if (!loops)
+        return;
+
+    for (int i = 0; i < loop_count; i++)
+    {
+        ReactorLoop *loop = &loops[i];
+        if (loop->thread)
+        {
+            pthread_join(loop->thread, NULL);
+            LOG_INFO("Main", "I/O thread %d joined successfully", i);
+        }
+        if (loop->epoll_fd >= 0)
+            close(loop->epoll_fd);
+        if (loop->event_fd >= 0)
+            close(loop->event_fd);
+        pthread_mutex_destroy(&loop->ready_mtx);
+    }
+
+    free(loops);
+    loops = NULL;
+    loop_count = 0;
+}
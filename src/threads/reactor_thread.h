@@ -0,0 +1,33 @@
+#ifndef REACTOR_THREAD_H
+#define REACTOR_THREAD_H
+
+/*
+ * Event-driven connection engine (SERVER_MODE_EPOLL)
+ *
+ * A small pool of I/O threads, each running its own epoll loop, multiplexes
+ * every client connection. Each connection is a state machine
+ * (auth -> command -> upload body -> waiting for worker -> command ...),
+ * so concurrency is bounded by file descriptors rather than threads.
+ *
+ * All loops share the listening socket (EPOLLEXCLUSIVE) and accept directly.
+ * Workers hand results back through the session Response notify hook, which
+ * queues the connection on its loop's completion list and wakes the loop
+ * via an eventfd. A loop never blocks waiting for a worker.
+ */
+
+/**
+ * Start the reactor I/O threads
+ * @param listen_fd Bound, listening server socket (switched to non-blocking)
+ * @param io_threads Number of epoll loops to run
+ * @return 0 on success, -1 on error
+ */
+int reactor_start(int listen_fd, int io_threads);
+
+/**
+ * Wait for all I/O threads to exit and release reactor resources
+ * Loops exit once keep_running is cleared and every in-flight task
+ * has been answered.
+ */
+void reactor_join(void);
+
+#endif /* REACTOR_THREAD_H */
@@ -0,0 +1,69 @@
+#include "reaper_thread.h"
+#include "../server.h"
+#include "../storage/chunk_store.h"
+#include "../sync/rcu.h"
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define REAPER_INTERVAL_SEC 1  /* One wheel tick */
+
+static pthread_t reaper_thread;
+static pthread_mutex_t reaper_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reaper_cond = PTHREAD_COND_INITIALIZER;
+static bool reaper_running = false;
+static bool reaper_stopping = false;
+
+static void *reaper_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&reaper_mtx);
+    while (!reaper_stopping)
+    {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += REAPER_INTERVAL_SEC;
+        pthread_cond_timedwait(&reaper_cond, &reaper_mtx, &until);
+        if (reaper_stopping)
+            break;
+
+        pthread_mutex_unlock(&reaper_mtx);
+        session_reap_idle(&session_manager, time(NULL));
+        rcu_reclaim();
+        chunk_store_collect_scheduled();
+        pthread_mutex_lock(&reaper_mtx);
+    }
+    pthread_mutex_unlock(&reaper_mtx);
+
+    /* Stopped after the workers: whatever their last tasks released */
+    chunk_store_collect_scheduled();
+    return NULL;
+}
+
+int reaper_start(void)
+{
+    reaper_stopping = false;
+    int rc = pthread_create(&reaper_thread, NULL, reaper_main, NULL);
+    if (rc != 0)
+    {
+        LOG_ERROR("Reaper", "Failed to create reaper thread: %s", strerror(rc));
+        return -1;
+    }
+    reaper_running = true;
+    return 0;
+}
+
+void reaper_stop(void)
+{
+    if (!reaper_running)
+        return;
+
+    pthread_mutex_lock(&reaper_mtx);
+    reaper_stopping = true;
+    pthread_cond_signal(&reaper_cond);
+    pthread_mutex_unlock(&reaper_mtx);
+
+    pthread_join(reaper_thread, NULL);
+    reaper_running = false;
+}
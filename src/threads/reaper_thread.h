@@ -0,0 +1,27 @@
+#ifndef REAPER_THREAD_H
+#define REAPER_THREAD_H
+
+/*
+ * Idle-session reaper and background housekeeping
+ *
+ * One thread advances the session manager's timer wheel once a second
+ * (session_reap_idle): sessions that stayed silent past the idle timeout,
+ * or did not authenticate in time, have their socket shut down and are
+ * torn down by their connection like any disconnect. It keeps running
+ * while the server drains, so idle clients cannot hold up shutdown for
+ * longer than the timeout.
+ *
+ * The same tick collects orphaned chunks once an upload or delete has
+ * scheduled it (chunk_store_collect_scheduled), so workers don't scan
+ * for them after every write, and runs one RCU grace period for the
+ * sessions and session tables released since the last tick (rcu_reclaim),
+ * so disconnects don't each wait for one.
+ */
+
+/* Start the reaper thread. Returns 0 on success, -1 on error */
+int reaper_start(void);
+
+/* Stop the reaper thread and wait for it (no-op if it was never started) */
+void reaper_stop(void);
+
+#endif /* REAPER_THREAD_H */
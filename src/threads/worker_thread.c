@@ -5,462 +5,1149 @@
 #include "../session/session_manager.h"
 #include "../auth/user_metadata.h"
 #include "../sync/file_locks.h"
+#include "../storage/upload_stream.h"
+#include "../storage/uring.h"
+#include "../storage/chunk_store.h"
+#include "delta.h"
+#include "stash_proto.h"
+#include "../utils/logger.h"
+#include "../utils/metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
-#include <dirent.h>
+#include <inttypes.h>
+#include <sched.h>
+
+/* Tasks a worker keeps in its io_uring at once */
+#define WORKER_URING_DEPTH 32
+
+/*
+ * A task is handled in stages so its file syscall (rename of the manifest
+ * for UPLOAD, open for DOWNLOAD and SIGNATURE, unlink for DELETE) can either
+ * run inline or be batched with other tasks' syscalls on the worker's
+ * io_uring:
+ *   op_begin   - checks (LIST is handled entirely here)
+ *   op_ingest  - UPLOAD only: chunk the body into the chunk store, before
+ *                the lock so other tasks on the file aren't held up by it
+ *   op_lock    - the file lock
+ *   op_prepare - uploads and deletes: keep the file being replaced
+ *                (UPLOAD_DELTA first rebuilds the body from it, op_patch,
+ *                and ingests that)
+ *   syscall    - op_syscall_sync, or op_queue + a CQE
+ *   op_finish  - metadata update, lock release, response
+ *
+ * UPLOAD_DELTA then finishes like UPLOAD, DOWNLOAD_DELTA opens like
+ * DOWNLOAD but replies with a delta instead of the file.
+ */
+typedef struct WorkerOp
+{
+    Task *task;               /* From task_lanes_pop, released once finished */
+    FileLock *lock;
+    char path[512];           /* storage/<user>/<file>; must outlive the SQE */
+    char manifest_path[528];  /* UPLOAD: new manifest, renamed over path */
+    char backup_path[528];    /* UPLOAD, DELETE: hard link to the file being replaced */
+    bool has_backup;          /* UPLOAD, DELETE: path existed, backup_path links to it */
+    ChunkList chunks;         /* UPLOAD: chunks the manifest lists */
+    uint64_t queued;          /* SQE queued (metrics_now), for the disk stage */
+} WorkerOp;
+
+/* Add the time since start (metrics_now) to one of a task's stages */
+static void stage_add(uint64_t *stage, uint64_t start)
+{
+    *stage += metrics_now() - start;
+}
+
+/* Record the worker stages the task went through. Every task ends in
+ * exactly one deliver_response or deliver_file_response. */
+static void task_metrics_done(const Task *task)
+{
+    if (task->timing.lock)
+        metrics_observe(METRIC_STAGE_LOCK, task->type, task->timing.lock);
+    if (task->timing.disk)
+        metrics_observe(METRIC_STAGE_DISK, task->type, task->timing.disk);
+    if (task->timing.db)
+        metrics_observe(METRIC_STAGE_DB, task->type, task->timing.db);
+    if (task_has_body(task->type))
+        metrics_inflight_add(METRIC_INFLIGHT_UPLOAD, -(int64_t)task->body_len);
+}
+
+static bool task_user_exists(Task *task)
+{
+    uint64_t start = metrics_now();
+    bool exists = user_exists(task->username);
+    stage_add(&task->timing.db, start);
+    return exists;
+}
 
 /* Helper function to safely deliver response to session (Phase 2.1) */
-static void deliver_response(uint64_t session_id, response_status_t status,
+static void deliver_response(const Task *task, response_status_t status,
                             const char *message, void *data, size_t data_size)
 {
+    uint64_t session_id = task->session_id;
+    task_metrics_done(task);
+
     /* Look up session by ID */
     Session *session = session_get(&session_manager, session_id);
 
     if (!session)
     {
         /* Session not found or inactive - client disconnected */
-        printf("[Worker %lu] Session %lu not found or inactive, dropping response\n",
-               (unsigned long)pthread_self(), session_id);
+        LOG_INFO("Worker", "Session %lu not found or inactive, dropping response", session_id);
 
         /* Free data if allocated */
         if (data)
         {
-            free(data);
+            response_buf_free(data);
         }
         return;
     }
 
+    /* Update session activity tracking (Phase 2.9) - before the response is
+     * published, since the connection side may destroy the session as soon
+     * as it sees the result */
+    session_increment_operations(session);
+
+    LOG_DEBUG("Worker", "Delivering response to session %lu", session_id);
+
     /* Session is active, deliver response */
-    response_set(&session->response, status, message, data, data_size);
+    response_set(&session->response, task->seq, status, message, data, data_size);
+    session_put(session);
+}
+
+/* Deliver a file body (DOWNLOAD) for zero-copy sending by the connection side */
+static void deliver_file_response(const Task *task, const char *message,
+                                  ChunkStream *file, size_t file_size)
+{
+    uint64_t session_id = task->session_id;
+    task_metrics_done(task);
+    Session *session = session_get(&session_manager, session_id);
+
+    if (!session)
+    {
+        LOG_INFO("Worker", "Session %lu not found or inactive, dropping response", session_id);
+        chunk_stream_close(file);
+        return;
+    }
 
-    /* Update session activity tracking (Phase 2.9) */
     session_increment_operations(session);
 
-    printf("[Worker %lu] Response delivered to session %lu (ops=%lu)\n",
-           (unsigned long)pthread_self(), session_id, session->operations_count);
+    LOG_DEBUG("Worker", "Delivering file response to session %lu (%zu bytes)", session_id,
+              file_size);
+
+    response_set_file(&session->response, task->seq, RESPONSE_SUCCESS, message, file, file_size);
+    session_put(session);
 }
 
-/* Worker thread: handles ALL file operations including UPLOAD */
-void *worker_worker(void *arg)
+/* LIST rows, kept per worker and grown to the largest page asked for */
+static __thread DbFileInfo *list_rows;
+static __thread size_t list_rows_cap;
+
+static DbFileInfo *list_rows_reserve(size_t count)
+{
+    if (count > list_rows_cap)
+    {
+        DbFileInfo *rows = realloc(list_rows, count * sizeof(DbFileInfo));
+        if (!rows)
+            return NULL;
+        list_rows = rows;
+        list_rows_cap = count;
+    }
+    return list_rows;
+}
+
+/* LIST: one page of the user's files, read from the files table (no
+ * directory scan), in the format described in stash_proto.h */
+static void handle_list(Task *task)
+{
+    size_t limit = task->length ? (size_t)task->length : LIST_PAGE_DEFAULT;
+    if (limit > LIST_PAGE_MAX)
+        limit = LIST_PAGE_MAX;
+
+    /* One row past the page tells whether another page follows */
+    size_t count = 0;
+    DbFileInfo *files = list_rows_reserve(limit + 1);
+    uint64_t start = metrics_now();
+    int rc = files ? user_list_files(task->username, task->filename, files, limit + 1, &count) : -1;
+    stage_add(&task->timing.db, start);
+    if (rc != 0)
+    {
+        deliver_response(task, RESPONSE_ERROR, "LIST ERROR: Cannot read file list\n", NULL, 0);
+        return;
+    }
+    bool more = count > limit;
+    if (more)
+        count = limit;
+
+    /* Name, two 20-digit numbers, two tabs and a newline per line */
+    size_t capacity = sizeof("LIST MORE\n");
+    for (size_t i = 0; i < count; i++)
+        capacity += strlen(files[i].filename) + 43;
+
+    char *list_data = response_buf_alloc(capacity);
+    if (!list_data)
+    {
+        LOG_ERROR("Worker", "Allocation failed for list data (%zu bytes)", capacity);
+        deliver_response(task, RESPONSE_ERROR,
+                        "LIST ERROR: Server memory allocation failed\n", NULL, 0);
+        return;
+    }
+
+    size_t list_len = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        list_len += (size_t)snprintf(list_data + list_len, capacity - list_len,
+                                     "%s\t%" PRIu64 "\t%" PRId64 "\n", files[i].filename,
+                                     files[i].size, files[i].timestamp);
+    }
+    list_len += (size_t)snprintf(list_data + list_len, capacity - list_len, "%s",
+                                 more ? "LIST MORE\n" : "LIST END\n");
+
+    deliver_response(task, RESPONSE_SUCCESS, "", list_data, list_len);
+}
+
+/* UPLOAD_OFFSET: how much of an interrupted upload can be resumed (a
+ * stat of the partial, no lock needed) */
+static void handle_upload_offset(Task *task)
+{
+    if (!task_user_exists(task))
+    {
+        deliver_response(task, RESPONSE_ERROR, "UPLOAD FAILED: User not found\n", NULL, 0);
+        return;
+    }
+
+    unsigned char *data = response_buf_alloc(8);
+    if (!data)
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "UPLOAD ERROR: Server memory allocation failed\n", NULL, 0);
+        return;
+    }
+    uint64_t start = metrics_now();
+    size_t stored = upload_stream_partial_size(task->username, task->filename, task->filesize);
+    stage_add(&task->timing.disk, start);
+    frame_put_u64(data, stored);
+    LOG_DEBUG("Worker", "Upload offset: %s has %zu/%zu bytes", task->filename, stored,
+              task->filesize);
+    deliver_response(task, RESPONSE_SUCCESS, "", data, 8);
+}
+
+/* Validate a freshly popped task.
+ * Returns true if it still needs its file lock and syscall; false if it
+ * was answered here (LIST, unknown command, missing user). */
+static bool op_begin(WorkerOp *op)
 {
-    (void)arg;
-    Task task;
+    Task *task = op->task;
 
-    while (task_queue_pop(&task_queue, &task) == 0)
+    LOG_DEBUG("Worker", "Processing task type=%d for session=%lu user=%s", task->type,
+              task->session_id, task->username);
+
+    op->lock = NULL;
+    mkdir("storage", 0777);
+    snprintf(op->path, sizeof(op->path), "storage/%s", task->username);
+    mkdir(op->path, 0777);
+
+    const char *not_found;
+    switch (task->type)
     {
-        printf("[Worker %lu] Processing task type=%d for session=%lu user=%s\n",
-               (unsigned long)pthread_self(), task.type, task.session_id, task.username);
+    case TASK_UPLOAD:
+        not_found = "UPLOAD FAILED: User not found\n";
+        break;
+    case TASK_DOWNLOAD:
+        not_found = "DOWNLOAD FAILED: User not found\n";
+        break;
+    case TASK_DELETE:
+        not_found = "DELETE FAILED: User not found\n";
+        break;
+    case TASK_SIGNATURE:
+        not_found = "SIGNATURE FAILED: User not found\n";
+        break;
+    case TASK_UPLOAD_DELTA:
+        not_found = "UPLOAD FAILED: User not found\n";
+        break;
+    case TASK_DOWNLOAD_DELTA:
+        not_found = "DOWNLOAD FAILED: User not found\n";
+        break;
+    case TASK_LIST:
+        if (!task_user_exists(task))
+            deliver_response(task, RESPONSE_ERROR, "LIST FAILED: User not found\n", NULL, 0);
+        else
+            handle_list(task);
+        return false;
+    case TASK_UPLOAD_OFFSET:
+        handle_upload_offset(task);
+        return false;
+    default:
+        deliver_response(task, RESPONSE_ERROR, "UNKNOWN COMMAND\n", NULL, 0);
+        return false;
+    }
 
-        char path[512];
-        mkdir("storage", 0777);
-        snprintf(path, sizeof(path), "storage/%s", task.username);
-        mkdir(path, 0777);
+    /* Verify user exists */
+    if (!task_user_exists(task))
+    {
+        if (task_has_body(task->type))
+            unlink(task->temp_path);
+        deliver_response(task, RESPONSE_ERROR, not_found, NULL, 0);
+        return false;
+    }
 
-        switch (task.type)
+    snprintf(op->path, sizeof(op->path), "storage/%s/%s", task->username, task->filename);
+    return true;
+}
+
+/* Undo op_store_body for an upload that will not be published */
+static void op_drop_body(WorkerOp *op)
+{
+    unlink(op->manifest_path);
+    chunk_store_abort(&op->chunks);
+    chunk_list_free(&op->chunks);
+}
+
+/* Phase 2.5: Acquire the per-file lock (shared for tasks that only read the
+ * file - downloads of one file run in parallel - exclusive otherwise).
+ * Returns: 0 locked, -2 busy (non-blocking only), -1 failed (response sent) */
+static int op_lock(WorkerOp *op, bool blocking)
+{
+    Task *task = op->task;
+    file_lock_mode_t mode = task_writes(task->type) ? FILE_LOCK_EXCLUSIVE : FILE_LOCK_SHARED;
+    uint64_t start = metrics_now();
+
+    if (blocking)
+    {
+        op->lock = file_lock_acquire(&global_file_lock_manager, task->username, task->filename, mode);
+    }
+    else
+    {
+        int rc = file_lock_try_acquire(&global_file_lock_manager, task->username, task->filename,
+                                       mode, &op->lock);
+        if (rc == -2)
         {
-        case TASK_UPLOAD:
+            stage_add(&task->timing.lock, start);
+            return -2;
+        }
+        if (rc != 0)
+            op->lock = NULL;
+    }
+
+    stage_add(&task->timing.lock, start);
+    if (op->lock)
+        return 0;
+
+    if (task->type == TASK_UPLOAD)
+        op_drop_body(op);
+    if (task_has_body(task->type))
+        unlink(task->temp_path);
+
+    switch (task->type)
+    {
+    case TASK_UPLOAD:
+    case TASK_UPLOAD_DELTA:
+        deliver_response(task, RESPONSE_ERROR,
+                        "UPLOAD FAILED: Could not acquire file lock\n", NULL, 0);
+        break;
+    case TASK_DOWNLOAD:
+    case TASK_DOWNLOAD_DELTA:
+        deliver_response(task, RESPONSE_ERROR,
+                        "DOWNLOAD FAILED: Could not acquire file lock\n", NULL, 0);
+        break;
+    case TASK_SIGNATURE:
+        deliver_response(task, RESPONSE_ERROR,
+                        "SIGNATURE FAILED: Could not acquire file lock\n", NULL, 0);
+        break;
+    default:
+        deliver_response(task, RESPONSE_ERROR,
+                        "DELETE FAILED: Could not acquire file lock\n", NULL, 0);
+        break;
+    }
+    return -1;
+}
+
+/* Read a stored file through its ChunkStream (delta sync) */
+static ssize_t stream_read(void *ctx, void *buf, size_t len, uint64_t offset)
+{
+    return chunk_stream_pread((ChunkStream *)ctx, buf, len, offset);
+}
+
+static int upload_write(void *ctx, const void *buf, size_t len)
+{
+    return upload_stream_write((UploadStream *)ctx, buf, len);
+}
+
+/* UPLOAD_DELTA: rebuild the new content from the stored file and the delta
+ * body into a fresh upload temp file, which then replaces the body.
+ * Returns 0, or -1 with the response sent and the lock released. */
+static int op_patch(WorkerOp *op)
+{
+    Task *task = op->task;
+    response_status_t status = RESPONSE_ERROR;
+    const char *message = "UPLOAD ERROR: Cannot apply delta\n";
+    UploadStream up = {.fd = -1};
+    ChunkStream *base = NULL;
+    size_t base_size = 0;
+
+    int delta_fd = open(task->temp_path, O_RDONLY | O_CLOEXEC);
+    int base_fd = open(op->path, O_RDONLY | O_CLOEXEC);
+    if (base_fd < 0)
+    {
+        if (errno == ENOENT)
         {
-            /* Verify user exists */
-            if (!user_exists(task.username))
-            {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "UPLOAD FAILED: User not found\n", NULL, 0);
-                if (task.data_buffer)
-                    free(task.data_buffer);
-                break;
-            }
+            status = RESPONSE_FILE_NOT_FOUND;
+            message = "UPLOAD ERROR: File not found\n";
+        }
+        goto fail;
+    }
+    base = chunk_stream_open(base_fd, &base_size);
+    if (!base || delta_fd < 0)
+        goto fail;
 
-            /* Phase 2.5: Acquire per-file lock */
-            FileLock *file_lock = file_lock_acquire(&global_file_lock_manager, task.username, task.filename);
-            if (!file_lock)
-            {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "UPLOAD FAILED: Could not acquire file lock\n", NULL, 0);
-                if (task.data_buffer)
-                    free(task.data_buffer);
-                break;
-            }
+    DeltaFile old = {stream_read, base, base_size};
+    DeltaFile delta = {delta_fd_read, &delta_fd, task->filesize};
+    uint64_t target_size;
+    int rc = delta_read_header(&delta, &target_size);
+    if (rc != 0)
+    {
+        if (rc == -2)
+            message = "UPLOAD ERROR: Invalid delta\n";
+        goto fail;
+    }
 
-            /* Handle UPLOAD - write data_buffer to disk */
-            snprintf(path, sizeof(path), "storage/%s/%s", task.username, task.filename);
-            FILE *fp = fopen(path, "wb");
-            if (!fp)
-            {
-                fprintf(stderr, "[Worker] fopen failed for upload '%s': %s\n",
-                       path, strerror(errno));
-                file_lock_release(&global_file_lock_manager, file_lock);
-
-                /* Provide specific error message based on errno */
-                if (errno == EACCES || errno == EPERM)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "UPLOAD ERROR: Permission denied\n", NULL, 0);
-                }
-                else if (errno == ENOSPC)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "UPLOAD ERROR: No space left on device\n", NULL, 0);
-                }
-                else if (errno == ENAMETOOLONG)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "UPLOAD ERROR: Filename too long\n", NULL, 0);
-                }
-                else
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "UPLOAD ERROR: Cannot create file\n", NULL, 0);
-                }
-
-                if (task.data_buffer)
-                    free(task.data_buffer);
-                break;
-            }
+    /* Same check an UPLOAD of the rebuilt file gets before its body */
+    if (!user_check_quota(task->username, target_size))
+    {
+        status = RESPONSE_QUOTA_EXCEEDED;
+        message = "UPLOAD ERROR: Quota exceeded\n";
+        goto fail;
+    }
 
-            size_t written = fwrite(task.data_buffer, 1, task.filesize, fp);
-            int fwrite_error = ferror(fp);
-            if (fclose(fp) != 0)
-            {
-                fprintf(stderr, "[Worker] fclose failed for upload '%s': %s\n",
-                       path, strerror(errno));
-            }
+    if (upload_stream_open(&up, task->username, task->session_id, target_size) != 0)
+        goto fail;
+    rc = delta_apply(&old, &delta, upload_write, &up);
+    if (rc == -2)
+    {
+        /* The file changed since the client fetched its signature */
+        status = RESPONSE_CONFLICT;
+        message = "UPLOAD ERROR: Delta does not match the stored file\n";
+        goto fail;
+    }
+    if (rc != 0 || upload_stream_finish(&up) != 0)
+        goto fail;
 
-            if (fwrite_error || written != task.filesize)
-            {
-                fprintf(stderr, "[Worker] Upload incomplete: wrote %zu/%zu bytes, ferror=%d\n",
-                        written, task.filesize, fwrite_error);
-                file_lock_release(&global_file_lock_manager, file_lock);
-
-                /* Try to remove incomplete file */
-                if (remove(path) != 0)
-                {
-                    fprintf(stderr, "[Worker] Failed to remove incomplete file '%s': %s\n",
-                           path, strerror(errno));
-                }
-
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "UPLOAD ERROR: File write failed\n", NULL, 0);
-            }
-            else
-            {
-                printf("[Worker] Upload complete: %s (%zu bytes)\n", task.filename, written);
+    LOG_INFO("Worker", "Rebuilt %s from a %zu byte delta (%lu bytes)", task->filename,
+             task->filesize, (unsigned long)target_size);
+    chunk_stream_close(base);
+    close(delta_fd);
+    unlink(task->temp_path);
+    memcpy(task->temp_path, up.temp_path, sizeof(task->temp_path));
+    task->filesize = (size_t)target_size;
+    return 0;
 
-                /* Update file metadata in database */
-                int meta_result = user_add_file(task.username, task.filename, task.filesize);
+fail:
+    LOG_ERROR("Worker", "Delta upload of '%s' failed: %s", op->path, message);
+    upload_stream_abort(&up);
+    chunk_stream_close(base);
+    if (delta_fd >= 0)
+        close(delta_fd);
+    unlink(task->temp_path);
+    file_lock_release(&global_file_lock_manager, op->lock);
+    deliver_response(task, status, message, NULL, 0);
+    return -1;
+}
 
-                /* Release file lock */
-                file_lock_release(&global_file_lock_manager, file_lock);
+/* Reply to an upload that failed before its manifest was published */
+static void upload_failed(const Task *task, int saved_errno)
+{
+    if (saved_errno == ENOSPC)
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "UPLOAD ERROR: No space left on device\n", NULL, 0);
+    }
+    else
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "UPLOAD ERROR: Cannot create file\n", NULL, 0);
+    }
+}
 
-                if (meta_result != 0)
-                {
-                    fprintf(stderr, "[Worker] Warning: Failed to update metadata for '%s'\n",
-                            task.filename);
-                    /* File was written successfully, but metadata update failed */
-                    /* This is a warning, not a critical error */
-                }
+/* Store the upload body's chunks and write the new manifest.
+ * Returns 0, or -1 with the response sent and the lock (if held) released. */
+static int op_store_body(WorkerOp *op)
+{
+    Task *task = op->task;
+    uint64_t start = metrics_now();
 
-                deliver_response(task.session_id, RESPONSE_SUCCESS,
-                                "UPLOAD OK\n", NULL, 0);
-            }
+    snprintf(op->manifest_path, sizeof(op->manifest_path), "%s.manifest", task->temp_path);
+    int rc = chunk_store_ingest(task->temp_path, op->manifest_path, &op->chunks);
+    stage_add(&task->timing.disk, start);
+    if (rc == 0)
+        return 0;
 
-            /* Free the data buffer */
-            if (task.data_buffer)
-                free(task.data_buffer);
-            break;
+    int saved_errno = errno;
+    file_lock_release(&global_file_lock_manager, op->lock);
+    unlink(task->temp_path);
+    upload_failed(task, saved_errno);
+    return -1;
+}
+
+/* UPLOAD: store the body's chunks before taking the file lock. This
+ * doesn't touch the stored file, and chunk_store_commit restores any chunk
+ * collected in the meantime. UPLOAD_DELTA's body is rebuilt from the
+ * stored file, so it is ingested under the lock (op_prepare).
+ * Returns 0, or -1 with the response sent. */
+static int op_ingest(WorkerOp *op)
+{
+    if (op->task->type != TASK_UPLOAD)
+        return 0;
+    return op_store_body(op);
+}
+
+/* Uploads and deletes, under the lock: keep the file being replaced or
+ * deleted until the database agrees; finish_upload and finish_delete put
+ * it back if that update fails.
+ * Returns 0, or -1 with the response sent and the lock released. */
+static int op_prepare(WorkerOp *op)
+{
+    Task *task = op->task;
+    if (task->type == TASK_UPLOAD_DELTA && (op_patch(op) != 0 || op_store_body(op) != 0))
+        return -1;
+    if (task->type == TASK_DELETE)
+    {
+        snprintf(op->backup_path, sizeof(op->backup_path),
+                 "storage/%s/" UPLOAD_TEMP_PREFIX "delete-%lu-%lu.prev", task->username,
+                 (unsigned long)task->session_id, (unsigned long)task->seq);
+    }
+    else if (task->type == TASK_UPLOAD || task->type == TASK_UPLOAD_DELTA)
+    {
+        snprintf(op->backup_path, sizeof(op->backup_path), "%s.prev", task->temp_path);
+    }
+    else
+    {
+        return 0;
+    }
+
+    unlink(op->backup_path);
+    op->has_backup = link(op->path, op->backup_path) == 0;
+    if (op->has_backup || errno == ENOENT)
+        return 0;
+
+    int saved_errno = errno;
+    LOG_ERROR("Worker", "Cannot keep '%s' during %s: %s", op->path,
+              task->type == TASK_DELETE ? "delete" : "upload", strerror(saved_errno));
+    file_lock_release(&global_file_lock_manager, op->lock);
+    if (task->type == TASK_DELETE)
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "DELETE ERROR: Cannot delete file\n", NULL, 0);
+        return -1;
+    }
+
+    op_drop_body(op);
+    unlink(task->temp_path);
+    upload_failed(task, saved_errno);
+    return -1;
+}
+
+/* Run the task's file syscall inline; returns its result or -errno */
+static int op_syscall_sync(WorkerOp *op)
+{
+    uint64_t start = metrics_now();
+    int rc;
+    switch (op->task->type)
+    {
+    case TASK_UPLOAD:
+    case TASK_UPLOAD_DELTA:
+        /* The body's chunks are stored; publish the manifest
+         * atomically over the destination */
+        rc = rename(op->manifest_path, op->path);
+        break;
+    case TASK_DOWNLOAD:
+    case TASK_SIGNATURE:
+    case TASK_DOWNLOAD_DELTA:
+        rc = open(op->path, O_RDONLY | O_CLOEXEC);
+        break;
+    default:
+        rc = unlink(op->path);
+        break;
+    }
+    rc = rc < 0 ? -errno : rc;
+    stage_add(&op->task->timing.disk, start);
+    return rc;
+}
+
+/* Queue the task's file syscall on the ring; returns -1 if the SQ is full */
+static int op_queue(Uring *ring, WorkerOp *op, uint64_t user_data)
+{
+    op->queued = metrics_now();
+    switch (op->task->type)
+    {
+    case TASK_UPLOAD:
+    case TASK_UPLOAD_DELTA:
+        return uring_prep_renameat(ring, op->manifest_path, op->path, user_data);
+    case TASK_DOWNLOAD:
+    case TASK_SIGNATURE:
+    case TASK_DOWNLOAD_DELTA:
+        return uring_prep_openat(ring, op->path, O_RDONLY | O_CLOEXEC, user_data);
+    default:
+        return uring_prep_unlinkat(ring, op->path, user_data);
+    }
+}
+
+static void finish_upload(WorkerOp *op, int res)
+{
+    Task *task = op->task;
+
+    if (res < 0)
+    {
+        int saved_errno = -res;
+        LOG_ERROR("Worker", "rename failed for upload '%s' -> '%s': %s", op->manifest_path,
+                  op->path, strerror(saved_errno));
+        unlink(op->manifest_path);
+        if (op->has_backup)
+            unlink(op->backup_path);
+        chunk_store_abort(&op->chunks);
+        chunk_list_free(&op->chunks);
+        file_lock_release(&global_file_lock_manager, op->lock);
+
+        if (unlink(task->temp_path) != 0 && errno != ENOENT)
+        {
+            LOG_ERROR("Worker", "Failed to remove temp file '%s': %s", task->temp_path,
+                      strerror(errno));
         }
 
-        case TASK_DOWNLOAD:
+        /* Provide specific error message based on errno */
+        if (saved_errno == EACCES || saved_errno == EPERM)
         {
-            /* Verify user exists */
-            if (!user_exists(task.username))
-            {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD FAILED: User not found\n", NULL, 0);
-                break;
-            }
+            deliver_response(task, RESPONSE_ERROR,
+                            "UPLOAD ERROR: Permission denied\n", NULL, 0);
+        }
+        else if (saved_errno == ENOSPC)
+        {
+            deliver_response(task, RESPONSE_ERROR,
+                            "UPLOAD ERROR: No space left on device\n", NULL, 0);
+        }
+        else if (saved_errno == ENAMETOOLONG)
+        {
+            deliver_response(task, RESPONSE_ERROR,
+                            "UPLOAD ERROR: Filename too long\n", NULL, 0);
+        }
+        else
+        {
+            deliver_response(task, RESPONSE_ERROR,
+                            "UPLOAD ERROR: Cannot create file\n", NULL, 0);
+        }
+        return;
+    }
 
-            /* Phase 2.5: Acquire per-file lock */
-            FileLock *file_lock = file_lock_acquire(&global_file_lock_manager, task.username, task.filename);
-            if (!file_lock)
-            {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD FAILED: Could not acquire file lock\n", NULL, 0);
-                break;
-            }
+    /* Update file metadata and chunk references in database */
+    uint64_t start = metrics_now();
+    int meta_result = chunk_store_commit(&op->chunks, task->temp_path, task->username,
+                                         task->filename);
+    stage_add(&task->timing.db, start);
+    if (unlink(task->temp_path) != 0)
+    {
+        LOG_ERROR("Worker", "Failed to remove temp file '%s': %s", task->temp_path,
+                  strerror(errno));
+    }
 
-            snprintf(path, sizeof(path), "storage/%s/%s", task.username, task.filename);
-            FILE *fp = fopen(path, "rb");
-            if (!fp)
-            {
-                fprintf(stderr, "[Worker] fopen failed for download '%s': %s\n",
-                       path, strerror(errno));
-                file_lock_release(&global_file_lock_manager, file_lock);
-
-                /* Provide specific error message */
-                if (errno == ENOENT)
-                {
-                    deliver_response(task.session_id, RESPONSE_FILE_NOT_FOUND,
-                                    "DOWNLOAD ERROR: File not found\n", NULL, 0);
-                }
-                else if (errno == EACCES)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "DOWNLOAD ERROR: Permission denied\n", NULL, 0);
-                }
-                else
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "DOWNLOAD ERROR: Cannot open file\n", NULL, 0);
-                }
-                break;
-            }
+    if (meta_result != 0)
+    {
+        /* Nothing references the new chunks: put the old file back (its
+         * references are still in the database) and drop them */
+        LOG_ERROR("Worker", "Failed to update metadata for '%s'; upload rolled back",
+                  task->filename);
+        int rc = op->has_backup ? rename(op->backup_path, op->path) : unlink(op->path);
+        if (rc != 0)
+        {
+            LOG_ERROR("Worker", "Cannot restore '%s': %s", op->path, strerror(errno));
+        }
+        chunk_store_abort(&op->chunks);
+        chunk_list_free(&op->chunks);
+        file_lock_release(&global_file_lock_manager, op->lock);
+        deliver_response(task, RESPONSE_ERROR,
+                        "UPLOAD ERROR: Cannot record file\n", NULL, 0);
+        return;
+    }
 
-            /* Get file size */
-            if (fseek(fp, 0, SEEK_END) != 0)
-            {
-                fprintf(stderr, "[Worker] fseek failed for download '%s': %s\n",
-                       path, strerror(errno));
-                fclose(fp);
-                file_lock_release(&global_file_lock_manager, file_lock);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD ERROR: Cannot determine file size\n", NULL, 0);
-                break;
-            }
+    if (op->has_backup)
+        unlink(op->backup_path);
+    chunk_list_free(&op->chunks);
 
-            long file_size = ftell(fp);
-            if (file_size < 0)
-            {
-                fprintf(stderr, "[Worker] ftell failed for download '%s': %s\n",
-                       path, strerror(errno));
-                fclose(fp);
-                file_lock_release(&global_file_lock_manager, file_lock);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD ERROR: Cannot determine file size\n", NULL, 0);
-                break;
-            }
+    /* Release file lock */
+    file_lock_release(&global_file_lock_manager, op->lock);
 
-            if (fseek(fp, 0, SEEK_SET) != 0)
-            {
-                fprintf(stderr, "[Worker] fseek to start failed for download '%s': %s\n",
-                       path, strerror(errno));
-                fclose(fp);
-                file_lock_release(&global_file_lock_manager, file_lock);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD ERROR: File seek error\n", NULL, 0);
-                break;
-            }
+    LOG_INFO("Worker", "Upload complete: %s (%zu bytes)", task->filename, task->filesize);
+    deliver_response(task, RESPONSE_SUCCESS,
+                    "UPLOAD OK\n", NULL, 0);
 
-            /* Allocate buffer for file data */
-            void *file_data = malloc(file_size);
-            if (!file_data)
-            {
-                fclose(fp);
-                file_lock_release(&global_file_lock_manager, file_lock);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD FAILED: Memory allocation failed\n", NULL, 0);
-                break;
-            }
+    /* An overwrite may have orphaned the old content's chunks */
+    if (op->has_backup)
+        chunk_store_schedule_collect();
+}
 
-            /* Read entire file */
-            size_t read_bytes = fread(file_data, 1, file_size, fp);
-            int fread_error = ferror(fp);
-            if (fclose(fp) != 0)
-            {
-                fprintf(stderr, "[Worker] fclose failed for download '%s': %s\n",
-                       path, strerror(errno));
-            }
+static void finish_download(WorkerOp *op, int res)
+{
+    Task *task = op->task;
 
-            /* Phase 2.5: Release file lock after reading */
-            file_lock_release(&global_file_lock_manager, file_lock);
+    if (res < 0)
+    {
+        int saved_errno = -res;
+        LOG_ERROR("Worker", "open failed for download '%s': %s", op->path, strerror(saved_errno));
+        file_lock_release(&global_file_lock_manager, op->lock);
 
-            if (fread_error || read_bytes != (size_t)file_size)
-            {
-                fprintf(stderr, "[Worker] fread incomplete: read %zu/%ld bytes, ferror=%d\n",
-                       read_bytes, file_size, fread_error);
-                free(file_data);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DOWNLOAD ERROR: File read error\n", NULL, 0);
-                break;
-            }
+        /* Provide specific error message */
+        if (saved_errno == ENOENT)
+        {
+            deliver_response(task, RESPONSE_FILE_NOT_FOUND,
+                            "DOWNLOAD ERROR: File not found\n", NULL, 0);
+        }
+        else if (saved_errno == EACCES)
+        {
+            deliver_response(task, RESPONSE_ERROR,
+                            "DOWNLOAD ERROR: Permission denied\n", NULL, 0);
+        }
+        else
+        {
+            deliver_response(task, RESPONSE_ERROR,
+                            "DOWNLOAD ERROR: Cannot open file\n", NULL, 0);
+        }
+        return;
+    }
 
-            printf("[Worker] Download complete: %s (%ld bytes)\n", task.filename, file_size);
-            deliver_response(task.session_id, RESPONSE_SUCCESS,
-                            "\nDOWNLOAD OK\n", file_data, read_bytes);
-            break;
+    /* Read the manifest (takes ownership of the descriptor) */
+    size_t size;
+    ChunkStream *file = chunk_stream_open(res, &size);
+    if (!file)
+    {
+        LOG_ERROR("Worker", "manifest read failed for download '%s': %s", op->path,
+                  strerror(errno));
+        file_lock_release(&global_file_lock_manager, op->lock);
+        deliver_response(task, RESPONSE_ERROR,
+                        "DOWNLOAD ERROR: Cannot read file\n", NULL, 0);
+        return;
+    }
+
+    /* Phase 2.5: Release file lock once the manifest is read. Chunks are
+     * immutable and the stream pins them against collection, so an upload
+     * or delete of this file can't change what is sent. */
+    file_lock_release(&global_file_lock_manager, op->lock);
+
+    /* Byte range (resumed or partial download) */
+    if (task->offset > 0 || task->length > 0)
+    {
+        int64_t len = chunk_stream_range(file, task->offset, task->length);
+        if (len < 0)
+        {
+            chunk_stream_close(file);
+            deliver_response(task, RESPONSE_ERROR,
+                            "DOWNLOAD ERROR: Range out of bounds\n", NULL, 0);
+            return;
         }
+        size = (size_t)len;
+    }
 
-        case TASK_DELETE:
+    /* Negotiated compression: chunks stored compressed go out as they are */
+    if (task->compressed)
+    {
+        int64_t len = chunk_stream_encode(file);
+        if (len < 0)
         {
-            /* Verify user exists */
-            if (!user_exists(task.username))
-            {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DELETE FAILED: User not found\n", NULL, 0);
-                break;
-            }
+            chunk_stream_close(file);
+            deliver_response(task, RESPONSE_ERROR,
+                            "DOWNLOAD ERROR: Cannot read file\n", NULL, 0);
+            return;
+        }
+        size = (size_t)len;
+    }
+
+    /* Hand the stream to the connection side, which sends each chunk
+     * with sendfile(2): no heap buffer, no userspace copy */
+    LOG_INFO("Worker", "Download ready: %s (%zu bytes%s)", task->filename, size,
+             task->compressed ? ", compressed" : "");
+    deliver_file_response(task, "\nDOWNLOAD OK\n", file, size);
+}
 
-            /* Phase 2.5: Acquire per-file lock */
-            FileLock *file_lock = file_lock_acquire(&global_file_lock_manager, task.username, task.filename);
-            if (!file_lock)
+static void finish_delete(WorkerOp *op, int res)
+{
+    Task *task = op->task;
+
+    if (res == 0)
+    {
+        /* Update file metadata in database (-3: the file was never
+         * recorded, so there is nothing to update) */
+        uint64_t start = metrics_now();
+        int meta_result = user_remove_file(task->username, task->filename);
+        stage_add(&task->timing.db, start);
+
+        if (meta_result != 0 && meta_result != -3)
+        {
+            /* The database still lists the file and its chunk references:
+             * put it back */
+            LOG_ERROR("Worker", "Failed to update metadata for '%s'; delete rolled back",
+                      task->filename);
+            if (op->has_backup && rename(op->backup_path, op->path) != 0)
             {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "DELETE FAILED: Could not acquire file lock\n", NULL, 0);
-                break;
+                LOG_ERROR("Worker", "Cannot restore '%s': %s", op->path, strerror(errno));
             }
+            file_lock_release(&global_file_lock_manager, op->lock);
+            deliver_response(task, RESPONSE_ERROR,
+                            "DELETE ERROR: Cannot record deletion\n", NULL, 0);
+            return;
+        }
 
-            snprintf(path, sizeof(path), "storage/%s/%s", task.username, task.filename);
-            int remove_result = remove(path);
-            if (remove_result == 0)
-            {
-                printf("[Worker] Delete complete: %s\n", task.filename);
+        if (op->has_backup)
+            unlink(op->backup_path);
 
-                /* Update file metadata in database */
-                int meta_result = user_remove_file(task.username, task.filename);
+        /* Release file lock */
+        file_lock_release(&global_file_lock_manager, op->lock);
 
-                /* Release file lock */
-                file_lock_release(&global_file_lock_manager, file_lock);
+        LOG_INFO("Worker", "Delete complete: %s", task->filename);
+        deliver_response(task, RESPONSE_SUCCESS,
+                        "DELETE OK\n", NULL, 0);
 
-                if (meta_result != 0)
-                {
-                    fprintf(stderr, "[Worker] Warning: Failed to update metadata for deleted file '%s'\n",
-                            task.filename);
-                    /* File was deleted successfully, but metadata update failed */
-                    /* This is a warning, not a critical error */
-                }
+        chunk_store_schedule_collect();
+        return;
+    }
 
-                deliver_response(task.session_id, RESPONSE_SUCCESS,
-                                "DELETE OK\n", NULL, 0);
-            }
-            else
-            {
-                fprintf(stderr, "[Worker] remove failed for '%s': %s\n",
-                       path, strerror(errno));
-                file_lock_release(&global_file_lock_manager, file_lock);
-
-                /* Provide specific error message */
-                if (errno == ENOENT)
-                {
-                    deliver_response(task.session_id, RESPONSE_FILE_NOT_FOUND,
-                                    "DELETE ERROR: File not found\n", NULL, 0);
-                }
-                else if (errno == EACCES || errno == EPERM)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "DELETE ERROR: Permission denied\n", NULL, 0);
-                }
-                else
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "DELETE ERROR: Cannot delete file\n", NULL, 0);
-                }
-            }
-            break;
+    int saved_errno = -res;
+    LOG_ERROR("Worker", "unlink failed for '%s': %s", op->path, strerror(saved_errno));
+    if (op->has_backup)
+        unlink(op->backup_path);
+    file_lock_release(&global_file_lock_manager, op->lock);
+
+    /* Provide specific error message */
+    if (saved_errno == ENOENT)
+    {
+        deliver_response(task, RESPONSE_FILE_NOT_FOUND,
+                        "DELETE ERROR: File not found\n", NULL, 0);
+    }
+    else if (saved_errno == EACCES || saved_errno == EPERM)
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "DELETE ERROR: Permission denied\n", NULL, 0);
+    }
+    else
+    {
+        deliver_response(task, RESPONSE_ERROR,
+                        "DELETE ERROR: Cannot delete file\n", NULL, 0);
+    }
+}
+
+/* Open the stored file for reading (SIGNATURE, DOWNLOAD_DELTA) and
+ * release the lock; the stream pins the chunks. NULL if the open failed
+ * (response sent). */
+static ChunkStream *finish_open_stream(WorkerOp *op, int res, const char *prefix,
+                                       size_t *size)
+{
+    Task *task = op->task;
+    ChunkStream *file = NULL;
+    if (res >= 0)
+        file = chunk_stream_open(res, size);
+    file_lock_release(&global_file_lock_manager, op->lock);
+    if (file)
+        return file;
+
+    int saved_errno = res < 0 ? -res : errno;
+    char message[128];
+    LOG_ERROR("Worker", "open failed for %s '%s': %s", prefix, op->path, strerror(saved_errno));
+    snprintf(message, sizeof(message), "%s ERROR: %s\n", prefix,
+             saved_errno == ENOENT ? "File not found" : "Cannot open file");
+    deliver_response(task, saved_errno == ENOENT ? RESPONSE_FILE_NOT_FOUND : RESPONSE_ERROR,
+                     message, NULL, 0);
+    return NULL;
+}
+
+/* SIGNATURE: reply with the block signature of the stored file */
+static void finish_signature(WorkerOp *op, int res)
+{
+    Task *task = op->task;
+    size_t size;
+    ChunkStream *file = finish_open_stream(op, res, "SIGNATURE", &size);
+    if (!file)
+        return;
+
+    DeltaFile stored = {stream_read, file, size};
+    DeltaSignature sig;
+    uint64_t start = metrics_now();
+    int rc = delta_signature_build(&stored, &sig);
+    stage_add(&task->timing.disk, start);
+    chunk_stream_close(file);
+
+    unsigned char *data = NULL;
+    size_t data_len = 0;
+    if (rc == 0)
+    {
+        data_len = delta_signature_encoded_size(&sig);
+        data = response_buf_alloc(data_len);
+        if (data)
+            delta_signature_encode(&sig, data);
+        delta_signature_free(&sig);
+    }
+
+    if (!data)
+    {
+        LOG_ERROR("Worker", "Signature of '%s' failed", op->path);
+        deliver_response(task, RESPONSE_ERROR,
+                        "SIGNATURE ERROR: Cannot read file\n", NULL, 0);
+        return;
+    }
+
+    LOG_INFO("Worker", "Signature ready: %s (%zu bytes for %zu)", task->filename, data_len, size);
+    deliver_response(task, RESPONSE_SUCCESS, "", data, data_len);
+}
+
+/* Load the client's signature (the request body) and remove its temp file */
+static int read_signature_body(Task *task, DeltaSignature *sig)
+{
+    int rc = -1;
+    unsigned char *buf = malloc(task->filesize ? task->filesize : 1);
+    int fd = open(task->temp_path, O_RDONLY | O_CLOEXEC);
+    if (buf && fd >= 0 && delta_fd_read(&fd, buf, task->filesize, 0) == (ssize_t)task->filesize)
+        rc = delta_signature_decode(buf, task->filesize, sig);
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    unlink(task->temp_path);
+    return rc;
+}
+
+/* DOWNLOAD_DELTA: reply with the delta that turns the client's copy (as
+ * described by its signature) into the stored file. The delta goes to an
+ * unlinked temp file and is sent with sendfile like a download. */
+static void finish_download_delta(WorkerOp *op, int res)
+{
+    Task *task = op->task;
+    size_t size;
+    ChunkStream *file = finish_open_stream(op, res, "DOWNLOAD", &size);
+    if (!file)
+    {
+        unlink(task->temp_path);
+        return;
+    }
+
+    DeltaSignature sig;
+    if (read_signature_body(task, &sig) != 0)
+    {
+        chunk_stream_close(file);
+        deliver_response(task, RESPONSE_ERROR, "DOWNLOAD ERROR: Invalid signature\n", NULL, 0);
+        return;
+    }
+
+    char delta_path[528];
+    snprintf(delta_path, sizeof(delta_path), "%s.delta", task->temp_path);
+    int fd = open(delta_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        unlink(delta_path);
+
+    DeltaFile stored = {stream_read, file, size};
+    uint64_t start = metrics_now();
+    int rc = fd >= 0 ? delta_generate(&sig, &stored, delta_fd_write, &fd) : -1;
+    stage_add(&task->timing.disk, start);
+    delta_signature_free(&sig);
+    chunk_stream_close(file);
+
+    size_t delta_size = 0;
+    ChunkStream *delta = NULL;
+    if (rc == 0)
+        delta = chunk_stream_open(fd, &delta_size);  /* Takes the descriptor */
+    else if (fd >= 0)
+        close(fd);
+
+    if (!delta)
+    {
+        LOG_ERROR("Worker", "Delta for '%s' failed: %s", op->path, strerror(errno));
+        deliver_response(task, RESPONSE_ERROR, "DOWNLOAD ERROR: Cannot create delta\n", NULL, 0);
+        return;
+    }
+
+    LOG_INFO("Worker", "Delta ready: %s (%zu bytes for %zu)", task->filename, delta_size, size);
+    deliver_file_response(task, "DOWNLOAD OK\n", delta, delta_size);
+}
+
+/* Complete a task given its syscall result (>= 0, or -errno) */
+static void op_finish(WorkerOp *op, int res)
+{
+    switch (op->task->type)
+    {
+    case TASK_UPLOAD:
+    case TASK_UPLOAD_DELTA:
+        finish_upload(op, res);
+        break;
+    case TASK_DOWNLOAD:
+        finish_download(op, res);
+        break;
+    case TASK_SIGNATURE:
+        finish_signature(op, res);
+        break;
+    case TASK_DOWNLOAD_DELTA:
+        finish_download_delta(op, res);
+        break;
+    default:
+        finish_delete(op, res);
+        break;
+    }
+}
+
+/* One task at a time, blocking syscalls */
+static void worker_run_sync(task_lane_t lane)
+{
+    WorkerOp op;
+
+    while (task_lanes_pop(&task_lanes, lane, &op.task, true) == 0)
+    {
+        if (op_begin(&op) && op_ingest(&op) == 0 && op_lock(&op, true) == 0 &&
+            op_prepare(&op) == 0)
+            op_finish(&op, op_syscall_sync(&op));
+        task_lanes_release(&task_lanes, op.task);
+    }
+}
+
+/* Per-worker io_uring state: ops[] slots, free[] holds unused slot indices */
+typedef struct UringWorker
+{
+    task_lane_t lane;   /* Home lane */
+    Uring ring;
+    WorkerOp *ops;
+    int free[WORKER_URING_DEPTH];
+    int nfree;
+} UringWorker;
+
+static int uring_worker_pending(const UringWorker *w)
+{
+    return WORKER_URING_DEPTH - w->nfree;
+}
+
+/* Submit queued SQEs, wait for at least one completion (or all of them)
+ * and finish every task whose CQE has arrived */
+static void uring_worker_complete(UringWorker *w, bool all)
+{
+    while (uring_worker_pending(w) > 0)
+    {
+        if (uring_submit_and_wait(&w->ring, 1) != 0)
+        {
+            /* Only transient errors (EAGAIN/EBUSY) are expected here */
+            LOG_ERROR("Worker", "io_uring_enter failed: %s", strerror(errno));
+            sched_yield();
+            continue;
         }
 
-        case TASK_LIST:
+        uint64_t user_data;
+        int res;
+        while (uring_reap(&w->ring, &user_data, &res))
         {
-            /* Verify user exists */
-            if (!user_exists(task.username))
+            WorkerOp *op = &w->ops[user_data];
+            stage_add(&op->task->timing.disk, op->queued);
+            op_finish(op, res);
+            task_lanes_release(&task_lanes, op->task);
+            w->free[w->nfree++] = (int)user_data;
+        }
+
+        if (!all)
+            break;
+    }
+}
+
+/*
+ * Batch file syscalls across tasks: pull whatever is queued (up to
+ * WORKER_URING_DEPTH), queue one SQE per task, submit them with one
+ * io_uring_enter and finish tasks as their CQEs arrive.
+ *
+ * Locks are only try-acquired while other tasks are in flight. If one is
+ * busy (possibly held by one of our own in-flight tasks), everything in
+ * flight is completed first, so we hold no file locks while blocking.
+ */
+static void worker_run_uring(UringWorker *w)
+{
+    while (1)
+    {
+        while (w->nfree > 0)
+        {
+            int idx = w->free[w->nfree - 1];
+            WorkerOp *op = &w->ops[idx];
+
+            /* Block for work only when nothing is in flight */
+            int rc = task_lanes_pop(&task_lanes, w->lane, &op->task,
+                                    uring_worker_pending(w) == 0);
+            if (rc != 0)
             {
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "LIST FAILED: User not found\n", NULL, 0);
+                if (uring_worker_pending(w) == 0)
+                    return;  /* Shutdown and queue drained */
                 break;
             }
 
-            snprintf(path, sizeof(path), "storage/%s", task.username);
-            DIR *dir = opendir(path);
-            if (!dir)
+            if (!op_begin(op) || op_ingest(op) != 0)
             {
-                fprintf(stderr, "[Worker] opendir failed for '%s': %s\n",
-                       path, strerror(errno));
-
-                /* Provide specific error message */
-                if (errno == ENOENT)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "LIST ERROR: User directory not found\n", NULL, 0);
-                }
-                else if (errno == EACCES)
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "LIST ERROR: Permission denied\n", NULL, 0);
-                }
-                else
-                {
-                    deliver_response(task.session_id, RESPONSE_ERROR,
-                                    "LIST ERROR: Cannot open directory\n", NULL, 0);
-                }
-                break;
+                task_lanes_release(&task_lanes, op->task);
+                continue;
             }
 
-            /* Build list of files */
-            char list_buffer[4096] = {0};
-            struct dirent *entry;
-            errno = 0;  /* Reset errno before readdir */
-            while ((entry = readdir(dir)) != NULL)
+            int lock_rc = op_lock(op, uring_worker_pending(w) == 0);
+            if (lock_rc == -2)
             {
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                    continue;
-                /* Skip metadata file */
-                if (strcmp(entry->d_name, "metadata.txt") == 0 || strcmp(entry->d_name, "metadata.tmp") == 0)
-                    continue;
-
-                /* Check buffer space before adding */
-                size_t remaining = sizeof(list_buffer) - strlen(list_buffer) - 1;
-                size_t needed = strlen(entry->d_name) + 1; /* +1 for newline */
-                if (needed >= remaining)
-                {
-                    fprintf(stderr, "[Worker] LIST: buffer full, truncating file list\n");
-                    break;
-                }
-
-                strncat(list_buffer, entry->d_name, remaining);
-                strncat(list_buffer, "\n", remaining - strlen(entry->d_name));
-                errno = 0;  /* Reset errno for next iteration */
+                uring_worker_complete(w, true);
+                lock_rc = op_lock(op, true);
             }
-
-            /* Check for readdir error */
-            if (errno != 0)
+            if (lock_rc != 0 || op_prepare(op) != 0)
             {
-                fprintf(stderr, "[Worker] readdir failed: %s\n", strerror(errno));
+                task_lanes_release(&task_lanes, op->task);
+                continue;
             }
 
-            if (closedir(dir) != 0)
+            w->nfree--;
+            if (op_queue(&w->ring, op, (uint64_t)idx) != 0)
             {
-                fprintf(stderr, "[Worker] closedir failed: %s\n", strerror(errno));
+                /* Ring sized to WORKER_URING_DEPTH, so this should not happen */
+                op_finish(op, op_syscall_sync(op));
+                task_lanes_release(&task_lanes, op->task);
+                w->free[w->nfree++] = idx;
             }
+        }
 
-            strncat(list_buffer, "LIST END\n", sizeof(list_buffer) - strlen(list_buffer) - 1);
+        uring_worker_complete(w, false);
+    }
+}
 
-            /* Allocate and copy list data */
-            size_t list_len = strlen(list_buffer);
-            char *list_data = malloc(list_len + 1);
-            if (list_data)
-            {
-                strcpy(list_data, list_buffer);
-                deliver_response(task.session_id, RESPONSE_SUCCESS,
-                                "", list_data, list_len);
-            }
-            else
-            {
-                fprintf(stderr, "[Worker] malloc failed for list data (%zu bytes)\n", list_len + 1);
-                deliver_response(task.session_id, RESPONSE_ERROR,
-                                "LIST ERROR: Server memory allocation failed\n", NULL, 0);
-            }
-            break;
+/* Worker thread: handles ALL file operations including UPLOAD */
+void *worker_worker(void *arg)
+{
+    task_lane_t lane = (task_lane_t)(intptr_t)arg;
+    LOG_INFO("Worker", "Serving the %s lane", task_lane_name(lane));
+
+    if (server_config.storage_backend == STORAGE_BACKEND_URING)
+    {
+        UringWorker *w = calloc(1, sizeof(UringWorker));
+        if (w)
+        {
+            w->lane = lane;
+            w->ops = calloc(WORKER_URING_DEPTH, sizeof(WorkerOp));
         }
 
-        default:
-            deliver_response(task.session_id, RESPONSE_ERROR,
-                            "UNKNOWN COMMAND\n", NULL, 0);
-            break;
+        if (w && w->ops && uring_init(&w->ring, WORKER_URING_DEPTH) == 0)
+        {
+            for (int i = 0; i < WORKER_URING_DEPTH; i++)
+                w->free[w->nfree++] = i;
+
+            worker_run_uring(w);
+
+            uring_destroy(&w->ring);
+            free(w->ops);
+            free(w);
+            free(list_rows);
+            LOG_INFO("Worker", "Exiting...");
+            return NULL;
         }
+
+        LOG_ERROR("Worker", "io_uring unavailable (%s), using synchronous file I/O",
+                  strerror(errno));
+        if (w)
+            free(w->ops);
+        free(w);
     }
 
-    printf("[Worker %lu] Exiting...\n", (unsigned long)pthread_self());
+    worker_run_sync(lane);
+
+    free(list_rows);
+    LOG_INFO("Worker", "Exiting...");
     return NULL;
 }
@@ -1,7 +1,8 @@
 #ifndef WORKER_THREAD_H
 #define WORKER_THREAD_H
 
-/* Worker thread function - processes tasks from TaskQueue */
+/* Worker thread function - processes tasks from TaskLanes; arg is the
+ * worker's home lane (task_lane_t cast to a pointer) */
 void *worker_worker(void *arg);
 
 #endif /* WORKER_THREAD_H */
@@ -0,0 +1,295 @@
+#include "logger.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+log_level_t log_min_level = LOG_LEVEL_INFO;
+
+static const char *const LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+typedef struct LogRecord
+{
+    struct timespec ts;
+    log_level_t level;
+    const char *component;
+    char message[LOG_MESSAGE_MAX];
+} LogRecord;
+
+/*
+ * One thread's records. The owner is the only writer of head and the
+ * flusher the only writer of tail; each publishes its index with a release
+ * store after touching the slots. A thread that exits gives its ring back
+ * (in_use = 0) for the next new thread to continue.
+ */
+typedef struct LogRing
+{
+    LogRecord records[LOG_RING_SLOTS];
+    _Alignas(64) size_t head;
+    _Alignas(64) size_t tail;
+    uint64_t dropped;        /* Messages lost to a full ring (owner increments) */
+    uint64_t reported;       /* Drops already reported (flusher only) */
+    size_t drain_head;       /* head as of the current drain (flusher only) */
+    int in_use;
+    int id;
+    struct LogRing *next;    /* All rings, newest first; never unlinked */
+} LogRing;
+
+static LogRing *rings;       /* Head of the ring list */
+static int next_ring_id = 1;
+static pthread_key_t ring_key;
+static __thread LogRing *thread_ring;
+
+static pthread_t flusher;
+static bool running;         /* Flusher started and not yet stopped */
+static bool stopping;
+
+/* Batch buffers, one per stream (flusher only) */
+static char out_buf[64 * 1024];
+static char err_buf[16 * 1024];
+static size_t out_len;
+static size_t err_len;
+
+/* -------------------- Formatting -------------------- */
+
+static size_t format_line(char *buf, size_t cap, const struct timespec *ts, log_level_t level,
+                          int thread_id, const char *component, const char *message)
+{
+    struct tm tm;
+    time_t secs = ts->tv_sec;
+    localtime_r(&secs, &tm);
+    int n = snprintf(buf, cap, "%02d:%02d:%02d.%03ld %-5s t%d [%s] %s\n", tm.tm_hour, tm.tm_min,
+                     tm.tm_sec, ts->tv_nsec / 1000000, LEVEL_NAMES[level], thread_id, component,
+                     message);
+    if (n < 0)
+        return 0;
+    return (size_t)n < cap ? (size_t)n : cap - 1;
+}
+
+static void flush_buffers(void)
+{
+    if (out_len > 0)
+    {
+        fwrite(out_buf, 1, out_len, stdout);
+        fflush(stdout);
+        out_len = 0;
+    }
+    if (err_len > 0)
+    {
+        fwrite(err_buf, 1, err_len, stderr);
+        fflush(stderr);
+        err_len = 0;
+    }
+}
+
+/* Append one formatted line to its stream's batch */
+static void emit(const struct timespec *ts, log_level_t level, int thread_id,
+                 const char *component, const char *message)
+{
+    bool err = level >= LOG_LEVEL_WARN;
+    char *buf = err ? err_buf : out_buf;
+    size_t cap = err ? sizeof(err_buf) : sizeof(out_buf);
+    size_t *len = err ? &err_len : &out_len;
+
+    /* Room for the longest line: flush first if it may not fit */
+    if (cap - *len < LOG_MESSAGE_MAX + 64)
+        flush_buffers();
+    *len += format_line(buf + *len, cap - *len, ts, level, thread_id, component, message);
+}
+
+/* -------------------- Rings -------------------- */
+
+static void ring_release(void *arg)
+{
+    LogRing *r = arg;
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* The calling thread's ring: reuse one given back by an exited thread,
+ * else allocate one */
+static LogRing *ring_acquire(void)
+{
+    if (thread_ring)
+        return thread_ring;
+
+    LogRing *r;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &expected, 1, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!r)
+    {
+        r = calloc(1, sizeof(LogRing));
+        if (!r)
+            return NULL;
+        r->in_use = 1;
+        r->id = __atomic_fetch_add(&next_ring_id, 1, __ATOMIC_RELAXED);
+        r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_setspecific(ring_key, r);
+    thread_ring = r;
+    return r;
+}
+
+static bool record_before(const LogRecord *a, const LogRecord *b)
+{
+    return a->ts.tv_sec != b->ts.tv_sec ? a->ts.tv_sec < b->ts.tv_sec : a->ts.tv_nsec < b->ts.tv_nsec;
+}
+
+/* Move every record published so far into the batches, merged across
+ * rings in timestamp order */
+static void drain_rings(void)
+{
+    LogRing *all = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (LogRing *r = all; r; r = r->next)
+        r->drain_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    for (;;)
+    {
+        LogRing *next = NULL;
+        for (LogRing *r = all; r; r = r->next)
+        {
+            if (r->tail != r->drain_head &&
+                (!next || record_before(&r->records[r->tail & (LOG_RING_SLOTS - 1)],
+                                        &next->records[next->tail & (LOG_RING_SLOTS - 1)])))
+                next = r;
+        }
+        if (!next)
+            break;
+
+        const LogRecord *rec = &next->records[next->tail & (LOG_RING_SLOTS - 1)];
+        emit(&rec->ts, rec->level, next->id, rec->component, rec->message);
+        __atomic_store_n(&next->tail, next->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    for (LogRing *r = all; r; r = r->next)
+    {
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->reported)
+        {
+            char message[64];
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            snprintf(message, sizeof(message), "%lu message(s) dropped: log ring full",
+                     (unsigned long)(dropped - r->reported));
+            emit(&now, LOG_LEVEL_WARN, r->id, "Logger", message);
+            r->reported = dropped;
+        }
+    }
+    flush_buffers();
+}
+
+static void *flusher_main(void *arg)
+{
+    (void)arg;
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        drain_rings();
+        nanosleep(&interval, NULL);
+    }
+    drain_rings();
+    return NULL;
+}
+
+/* -------------------- API -------------------- */
+
+int logger_init(log_level_t level)
+{
+    log_min_level = level;
+    if (pthread_key_create(&ring_key, ring_release) != 0)
+        return -1;
+
+    stopping = false;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0)
+    {
+        pthread_key_delete(ring_key);
+        return -1;
+    }
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void logger_shutdown(void)
+{
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+
+    /* Later messages (from this thread) go out synchronously */
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+}
+
+bool log_level_parse(const char *name, log_level_t *level)
+{
+    static const char *const names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *level = (log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void log_message(log_level_t level, const char *component, const char *fmt, ...)
+{
+    if (level >= LOG_LEVEL_OFF)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    LogRing *r = __atomic_load_n(&running, __ATOMIC_ACQUIRE) ? ring_acquire() : NULL;
+    if (!r)
+    {
+        /* No flusher: format and write right here */
+        char message[LOG_MESSAGE_MAX];
+        char line[LOG_MESSAGE_MAX + 64];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(message, sizeof(message), fmt, ap);
+        va_end(ap);
+        size_t len = format_line(line, sizeof(line), &ts, level, 0, component, message);
+        fwrite(line, 1, len, level >= LOG_LEVEL_WARN ? stderr : stdout);
+        return;
+    }
+
+    size_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS)
+    {
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    LogRecord *rec = &r->records[head & (LOG_RING_SLOTS - 1)];
+    rec->ts = ts;
+    rec->level = level;
+    rec->component = component;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(rec->message, sizeof(rec->message), fmt, ap);
+    va_end(ap);
+
+    /* Strip the newline callers may still pass: the flusher adds one */
+    size_t len = strlen(rec->message);
+    if (len > 0 && rec->message[len - 1] == '\n')
+        rec->message[len - 1] = '\0';
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
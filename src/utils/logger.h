@@ -1,8 +1,75 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-/* Logging utility - placeholder for future implementation */
+#include <stdbool.h>
 
-/* Currently using printf/fprintf directly */
+/*
+ * Asynchronous structured logger
+ *
+ * Each thread formats its messages into its own fixed-size ring of
+ * records (single producer, single consumer: no lock, no syscall on the
+ * calling thread). A background flusher drains every ring each
+ * LOG_FLUSH_INTERVAL_MS and writes whole batches: DEBUG/INFO to stdout,
+ * WARN/ERROR to stderr, one line per record:
+ *
+ *   12:34:56.789 INFO  t3 [Worker] Upload complete: a.txt (42 bytes)
+ *
+ * tN numbers the thread that logged. Lines of different threads may
+ * interleave out of order within a batch; the timestamps are exact.
+ *
+ * A full ring drops the message rather than stall the caller, and the
+ * flusher reports how many were lost. A disabled level costs one
+ * compare: the LOG_* macros don't evaluate their arguments.
+ *
+ * Before logger_init and after logger_shutdown, messages are written
+ * synchronously.
+ */
+
+typedef enum
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+} log_level_t;
+
+#define LOG_RING_SLOTS 512       /* Records per thread (power of two) */
+#define LOG_MESSAGE_MAX 240      /* Longer messages are truncated */
+#define LOG_FLUSH_INTERVAL_MS 10
+
+/* Messages below this level are discarded (set once, before threads start) */
+extern log_level_t log_min_level;
+
+#define LOG_ENABLED(level) ((level) >= log_min_level)
+
+#define LOG_AT(level, component, ...)                      \
+    do                                                     \
+    {                                                      \
+        if (LOG_ENABLED(level))                            \
+            log_message((level), (component), __VA_ARGS__); \
+    } while (0)
+
+/* component is a string literal, e.g. LOG_INFO("Worker", "Upload complete: %s", name) */
+#define LOG_DEBUG(component, ...) LOG_AT(LOG_LEVEL_DEBUG, component, __VA_ARGS__)
+#define LOG_INFO(component, ...) LOG_AT(LOG_LEVEL_INFO, component, __VA_ARGS__)
+#define LOG_WARN(component, ...) LOG_AT(LOG_LEVEL_WARN, component, __VA_ARGS__)
+#define LOG_ERROR(component, ...) LOG_AT(LOG_LEVEL_ERROR, component, __VA_ARGS__)
+
+/**
+ * Start the flusher thread
+ * @return 0 on success, -1 on error (messages stay synchronous)
+ */
+int logger_init(log_level_t level);
+
+/* Drain every ring and stop the flusher (all other threads must be done) */
+void logger_shutdown(void);
+
+/* Parse "debug", "info", "warn", "error" or "off"; returns false if unknown */
+bool log_level_parse(const char *name, log_level_t *level);
+
+/* Record one message; use the LOG_* macros, which skip disabled levels */
+void log_message(log_level_t level, const char *component, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
 
 #endif /* LOGGER_H */
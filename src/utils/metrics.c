@@ -0,0 +1,229 @@
+#include "metrics.h"
+#include "logger.h"
+#include "../queue/task_queue.h"
+#include "../session/response_queue.h"
+#include <string.h>
+#include <time.h>
+
+_Static_assert(METRIC_OP_COUNT == TASK_UPLOAD_OFFSET + 1, "one metric op per task type");
+
+static const char *const STAGE_NAMES[METRIC_STAGE_COUNT] = {
+    "queue", "lock", "disk", "db", "send", "total"};
+
+static const char *const OP_NAMES[METRIC_OP_COUNT] = {
+    "upload", "download", "delete", "list",
+    "signature", "upload_delta", "download_delta", "upload_offset"};
+
+typedef enum
+{
+    RESULT_OK,
+    RESULT_ERROR,
+    RESULT_BUSY,
+    RESULT_COUNT
+} reply_result_t;
+
+static const char *const RESULT_NAMES[RESULT_COUNT] = {"ok", "error", "busy"};
+
+/* Exported `le` bounds: 2^k us for k in this range */
+#define EXPORT_MIN_MAGNITUDE 4
+#define EXPORT_MAX_MAGNITUDE 26
+
+static Histogram stages[METRIC_STAGE_COUNT][METRIC_OP_COUNT];
+static uint64_t replies[METRIC_OP_COUNT][RESULT_COUNT];
+static uint64_t received_bytes;
+static uint64_t sent_bytes;
+static int64_t inflight[METRIC_INFLIGHT_COUNT];
+
+/* -------------------- Histogram -------------------- */
+
+/* Values below HIST_SUB_BUCKETS get a bucket each; above, the power of
+ * two holding the value picks the row and the next HIST_SUB_BITS bits
+ * the bucket in it */
+static int bucket_index(uint64_t v)
+{
+    if (v < HIST_SUB_BUCKETS)
+        return (int)v;
+    int magnitude = 63 - __builtin_clzll(v);
+    if (magnitude > HIST_MAX_MAGNITUDE)
+        return HIST_BUCKETS - 1;
+    int shift = magnitude - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* First value past bucket idx */
+static uint64_t bucket_limit(int idx)
+{
+    if (idx < HIST_SUB_BUCKETS)
+        return (uint64_t)idx + 1;
+    int shift = (idx >> HIST_SUB_BITS) - 1;
+    uint64_t base = (uint64_t)(HIST_SUB_BUCKETS + (idx & (HIST_SUB_BUCKETS - 1))) << shift;
+    return base + (1ULL << shift);
+}
+
+void histogram_record(Histogram *h, uint64_t us)
+{
+    __atomic_fetch_add(&h->counts[bucket_index(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+}
+
+uint64_t histogram_count(const Histogram *h)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        n += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+    return n;
+}
+
+uint64_t histogram_quantile(const Histogram *h, double q)
+{
+    uint64_t total = histogram_count(h);
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+        if (seen > rank)
+            return bucket_limit(i) - 1;
+    }
+    return bucket_limit(HIST_BUCKETS - 1) - 1;
+}
+
+/* -------------------- Recording -------------------- */
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_observe(metric_stage_t stage, int op, uint64_t ns)
+{
+    if (stage < 0 || stage >= METRIC_STAGE_COUNT || op < 0 || op >= METRIC_OP_COUNT)
+        return;
+    histogram_record(&stages[stage][op], ns / 1000);
+}
+
+void metrics_reply(int op, int status, uint64_t started_ns, uint64_t taken_ns, uint64_t bytes)
+{
+    if (op < 0 || op >= METRIC_OP_COUNT)
+        return;
+
+    uint64_t now = metrics_now();
+    if (taken_ns)
+        metrics_observe(METRIC_STAGE_SEND, op, now - taken_ns);
+    if (started_ns)
+        metrics_observe(METRIC_STAGE_TOTAL, op, now - started_ns);
+
+    reply_result_t result = status == RESPONSE_SUCCESS ? RESULT_OK
+                            : status == RESPONSE_BUSY  ? RESULT_BUSY
+                                                       : RESULT_ERROR;
+    __atomic_fetch_add(&replies[op][result], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sent_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void metrics_add_received(uint64_t bytes)
+{
+    __atomic_fetch_add(&received_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void metrics_inflight_add(metric_inflight_t kind, int64_t bytes)
+{
+    __atomic_fetch_add(&inflight[kind], bytes, __ATOMIC_RELAXED);
+}
+
+/* -------------------- Export -------------------- */
+
+static void write_histogram(FILE *out, const char *stage, const char *op, const Histogram *h)
+{
+    uint64_t cumulative = 0;
+    int idx = 0;
+    for (int k = EXPORT_MIN_MAGNITUDE; k <= EXPORT_MAX_MAGNITUDE; k++)
+    {
+        /* Values below 2^k fill the buckets before 2^k's own */
+        int end = (k - HIST_SUB_BITS + 1) << HIST_SUB_BITS;
+        for (; idx < end; idx++)
+            cumulative += __atomic_load_n(&h->counts[idx], __ATOMIC_RELAXED);
+        fprintf(out, "stash_stage_duration_seconds_bucket{stage=\"%s\",op=\"%s\",le=\"%g\"} %lu\n",
+                stage, op, (double)(1ULL << k) / 1e6, (unsigned long)cumulative);
+    }
+    for (; idx < HIST_BUCKETS; idx++)
+        cumulative += __atomic_load_n(&h->counts[idx], __ATOMIC_RELAXED);
+
+    fprintf(out, "stash_stage_duration_seconds_bucket{stage=\"%s\",op=\"%s\",le=\"+Inf\"} %lu\n",
+            stage, op, (unsigned long)cumulative);
+    fprintf(out, "stash_stage_duration_seconds_sum{stage=\"%s\",op=\"%s\"} %.6f\n", stage, op,
+            (double)__atomic_load_n(&h->sum_us, __ATOMIC_RELAXED) / 1e6);
+    fprintf(out, "stash_stage_duration_seconds_count{stage=\"%s\",op=\"%s\"} %lu\n", stage, op,
+            (unsigned long)cumulative);
+}
+
+void metrics_write(FILE *out)
+{
+    fprintf(out, "# HELP stash_stage_duration_seconds Time tasks spend in each pipeline stage\n");
+    fprintf(out, "# TYPE stash_stage_duration_seconds histogram\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++)
+    {
+        for (int op = 0; op < METRIC_OP_COUNT; op++)
+        {
+            /* Pairs never recorded (e.g. the lock stage of LIST) are left out */
+            if (histogram_count(&stages[s][op]) > 0)
+                write_histogram(out, STAGE_NAMES[s], OP_NAMES[op], &stages[s][op]);
+        }
+    }
+
+    fprintf(out, "# HELP stash_replies_total Task replies written, by operation and result\n");
+    fprintf(out, "# TYPE stash_replies_total counter\n");
+    for (int op = 0; op < METRIC_OP_COUNT; op++)
+    {
+        for (int r = 0; r < RESULT_COUNT; r++)
+        {
+            uint64_t n = __atomic_load_n(&replies[op][r], __ATOMIC_RELAXED);
+            if (n > 0)
+                fprintf(out, "stash_replies_total{op=\"%s\",result=\"%s\"} %lu\n", OP_NAMES[op],
+                        RESULT_NAMES[r], (unsigned long)n);
+        }
+    }
+
+    fprintf(out, "# HELP stash_received_bytes_total Request body bytes queued to workers\n");
+    fprintf(out, "# TYPE stash_received_bytes_total counter\n");
+    fprintf(out, "stash_received_bytes_total %lu\n",
+            (unsigned long)__atomic_load_n(&received_bytes, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP stash_sent_bytes_total Reply payload bytes written\n");
+    fprintf(out, "# TYPE stash_sent_bytes_total counter\n");
+    fprintf(out, "stash_sent_bytes_total %lu\n",
+            (unsigned long)__atomic_load_n(&sent_bytes, __ATOMIC_RELAXED));
+
+    fprintf(out, "# HELP stash_inflight_bytes Bytes in the pipeline: upload bodies not yet "
+                 "stored, stored files open for reading\n");
+    fprintf(out, "# TYPE stash_inflight_bytes gauge\n");
+    fprintf(out, "stash_inflight_bytes{direction=\"upload\"} %ld\n",
+            (long)__atomic_load_n(&inflight[METRIC_INFLIGHT_UPLOAD], __ATOMIC_RELAXED));
+    fprintf(out, "stash_inflight_bytes{direction=\"download\"} %ld\n",
+            (long)__atomic_load_n(&inflight[METRIC_INFLIGHT_DOWNLOAD], __ATOMIC_RELAXED));
+}
+
+void metrics_log_summary(void)
+{
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++)
+    {
+        static Histogram merged;
+        memset(&merged, 0, sizeof(merged));
+        for (int op = 0; op < METRIC_OP_COUNT; op++)
+        {
+            for (int i = 0; i < HIST_BUCKETS; i++)
+                merged.counts[i] += __atomic_load_n(&stages[s][op].counts[i], __ATOMIC_RELAXED);
+        }
+
+        uint64_t n = histogram_count(&merged);
+        if (n > 0)
+            LOG_INFO("Metrics", "Stage %-5s: %lu task(s), p50 %lu us, p99 %lu us", STAGE_NAMES[s],
+                     (unsigned long)n, (unsigned long)histogram_quantile(&merged, 0.5),
+                     (unsigned long)histogram_quantile(&merged, 0.99));
+    }
+}
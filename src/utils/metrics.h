@@ -0,0 +1,84 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Pipeline metrics
+ *
+ * Every task is timed through the stages below, one latency histogram
+ * per (stage, operation), plus reply counters by result and byte
+ * counters. Recording is a few relaxed atomic adds, so any thread can
+ * record without a lock. metrics_write renders everything in the
+ * Prometheus text format (the admin endpoint adds the queue and session
+ * gauges it owns).
+ *
+ * Histograms are HDR-style log-linear: values in microseconds, each
+ * power of two split into HIST_SUB_BUCKETS linear buckets, so any
+ * recorded value is known to within 1/HIST_SUB_BUCKETS (12.5%) from 1 us
+ * up to 2^HIST_MAX_MAGNITUDE us. They are exported with power-of-two
+ * `le` bounds from 16 us to 67 s.
+ */
+
+typedef enum
+{
+    METRIC_STAGE_QUEUE,  /* Task queued until a worker takes it */
+    METRIC_STAGE_LOCK,   /* Waiting for the file lock */
+    METRIC_STAGE_DISK,   /* Storing the body, the file syscall, signatures and deltas */
+    METRIC_STAGE_DB,     /* Metadata queries and updates */
+    METRIC_STAGE_SEND,   /* Result taken until the reply is written */
+    METRIC_STAGE_TOTAL,  /* Task queued until the reply is written */
+    METRIC_STAGE_COUNT
+} metric_stage_t;
+
+/* Operations are task_type_t values */
+#define METRIC_OP_COUNT 8
+
+typedef enum
+{
+    METRIC_INFLIGHT_UPLOAD,    /* Upload bodies queued or being stored */
+    METRIC_INFLIGHT_DOWNLOAD,  /* Stored files open for reading, mostly replies being sent */
+    METRIC_INFLIGHT_COUNT
+} metric_inflight_t;
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_MAGNITUDE 40
+#define HIST_BUCKETS ((HIST_MAX_MAGNITUDE - HIST_SUB_BITS + 2) * HIST_SUB_BUCKETS)
+
+typedef struct Histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t sum_us;
+} Histogram;
+
+/* Record one value (thread-safe) */
+void histogram_record(Histogram *h, uint64_t us);
+
+/* Number of values recorded */
+uint64_t histogram_count(const Histogram *h);
+
+/* Upper bound (us) of the bucket holding quantile q (0..1); 0 if empty */
+uint64_t histogram_quantile(const Histogram *h, double q);
+
+/* Monotonic clock in nanoseconds, for stage timestamps */
+uint64_t metrics_now(void);
+
+/* Record a stage duration (ns) of an operation (task_type_t) */
+void metrics_observe(metric_stage_t stage, int op, uint64_t ns);
+
+/* A reply was written: records send and total time and counts the reply.
+ * status is the task's response_status_t, bytes its payload size. */
+void metrics_reply(int op, int status, uint64_t started_ns, uint64_t taken_ns, uint64_t bytes);
+
+void metrics_add_received(uint64_t bytes);
+void metrics_inflight_add(metric_inflight_t kind, int64_t bytes);
+
+/* Histograms and counters in Prometheus text format */
+void metrics_write(FILE *out);
+
+/* Log count, p50 and p99 of every stage (all operations together) */
+void metrics_log_summary(void);
+
+#endif /* METRICS_H */
@@ -1,5 +1,9 @@
 #include "network_utils.h"
+#include "logger.h"
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
@@ -95,7 +99,7 @@ ssize_t send_full(int sockfd, const void *buffer, size_t len)
             else if (errno == EPIPE)
             {
                 /* Broken pipe - client disconnected */
-                fprintf(stderr, "[NetworkUtils] send_full: broken pipe (client disconnected)\n");
+                LOG_ERROR("NetworkUtils", "send_full: broken pipe (client disconnected)");
                 return total_sent;
             }
             else
@@ -112,6 +116,53 @@ ssize_t send_full(int sockfd, const void *buffer, size_t len)
     return (ssize_t)total_sent;
 }
 
+/**
+ * sendfile_full - Send N bytes of a file to a socket without copying
+ *
+ * Loops over sendfile(2) until all requested bytes are sent.
+ * Returns early if the file is truncated or an unrecoverable error occurs.
+ */
+ssize_t sendfile_full(int sockfd, int file_fd, off_t offset, size_t len)
+{
+    size_t total_sent = 0;
+
+    while (total_sent < len)
+    {
+        ssize_t n = sendfile(sockfd, file_fd, &offset, len - total_sent);
+
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* Interrupted or would block, retry */
+                continue;
+            }
+            else if (errno == EPIPE)
+            {
+                /* Broken pipe - client disconnected */
+                LOG_ERROR("NetworkUtils", "sendfile_full: broken pipe (client disconnected)");
+                return total_sent;
+            }
+            else
+            {
+                /* Unrecoverable error */
+                perror("[NetworkUtils] sendfile_full error");
+                return total_sent;
+            }
+        }
+        else if (n == 0)
+        {
+            /* File shorter than expected */
+            LOG_ERROR("NetworkUtils", "sendfile_full: unexpected end of file");
+            return total_sent;
+        }
+
+        total_sent += n;
+    }
+
+    return (ssize_t)total_sent;
+}
+
 /**
  * send_error - Send an error message to client with proper error checking
  */
@@ -128,7 +179,7 @@ int send_error(int sockfd, const char *error_msg)
 
     if (sent != (ssize_t)len)
     {
-        fprintf(stderr, "[NetworkUtils] send_error: failed to send complete error message\n");
+        LOG_ERROR("NetworkUtils", "send_error: failed to send complete error message");
         return -1;
     }
 
@@ -151,7 +202,29 @@ int send_success(int sockfd, const char *success_msg)
 
     if (sent != (ssize_t)len)
     {
-        fprintf(stderr, "[NetworkUtils] send_success: failed to send complete success message\n");
+        LOG_ERROR("NetworkUtils", "send_success: failed to send complete success message");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * socket_set_keepalive - Enable TCP keepalive probes and a matching user timeout
+ */
+int socket_set_keepalive(int sockfd, int idle_sec, int interval_sec, int count)
+{
+    int on = 1;
+    unsigned int user_timeout_ms = (unsigned int)(idle_sec + interval_sec * count) * 1000;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) != 0 ||
+        setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle_sec, sizeof(idle_sec)) != 0 ||
+        setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval_sec, sizeof(interval_sec)) != 0 ||
+        setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) != 0 ||
+        setsockopt(sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout_ms,
+                   sizeof(user_timeout_ms)) != 0)
+    {
+        LOG_WARN("NetworkUtils", "socket_set_keepalive: %s", strerror(errno));
         return -1;
     }
 
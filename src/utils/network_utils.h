@@ -30,6 +30,21 @@ ssize_t recv_full(int sockfd, void *buffer, size_t len);
  */
 ssize_t send_full(int sockfd, const void *buffer, size_t len);
 
+/**
+ * sendfile_full - Send N bytes of a file to a socket without copying
+ *
+ * Uses sendfile(2) so file data goes from the page cache straight to the
+ * socket. Handles partial transfers until 'len' bytes are sent or an
+ * error occurs.
+ *
+ * @param sockfd: Socket file descriptor
+ * @param file_fd: Open file descriptor to read from
+ * @param offset: File offset to start at
+ * @param len: Number of bytes to send
+ * @return: Number of bytes sent (len on success, < len on error)
+ */
+ssize_t sendfile_full(int sockfd, int file_fd, off_t offset, size_t len);
+
 /**
  * send_error - Send an error message to client with proper error checking
  *
@@ -48,4 +63,21 @@ int send_error(int sockfd, const char *error_msg);
  */
 int send_success(int sockfd, const char *success_msg);
 
+/**
+ * socket_set_keepalive - Detect dead peers on an idle or stalled connection
+ *
+ * Enables TCP keepalive: after idle_sec without traffic the kernel probes
+ * every interval_sec and resets the connection after count unanswered
+ * probes. TCP_USER_TIMEOUT gets the same total so unacknowledged data
+ * does not keep a dead connection open for the retransmission timeout
+ * (~15 minutes) instead. Blocked reads and writes then fail with ETIMEDOUT.
+ *
+ * @param sockfd: Connected socket
+ * @param idle_sec: Seconds of silence before the first probe
+ * @param interval_sec: Seconds between probes
+ * @param count: Unanswered probes before the connection is dropped
+ * @return: 0 on success, -1 on error
+ */
+int socket_set_keepalive(int sockfd, int idle_sec, int interval_sec, int count);
+
 #endif /* NETWORK_UTILS_H */
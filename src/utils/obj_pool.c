@@ -0,0 +1,334 @@
+#include "obj_pool.h"
+#include "logger.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define POOL_ALIGN 16
+#define POOL_ROUND(n) (((n) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+
+/* Precedes every object; pool says where obj_pool_free returns it */
+struct PoolSlot
+{
+    ObjPool *pool;
+    PoolSlot *next;               /* Free list link while the object is free */
+};
+
+struct PoolSlab
+{
+    PoolSlab *next;
+};
+
+#define SLOT_HEADER POOL_ROUND(sizeof(PoolSlot))
+#define SLAB_HEADER POOL_ROUND(sizeof(PoolSlab))
+
+/* A thread's free objects of one pool */
+typedef struct PoolCache
+{
+    PoolSlot *head;
+    int count;
+    unsigned generation;          /* Of the pool the objects belong to */
+    uint64_t allocs;              /* Not yet folded into the pool's counters */
+    uint64_t frees;
+} PoolCache;
+
+static ObjPool *registry[OBJ_POOL_MAX];
+static unsigned registry_generation;
+static pthread_mutex_t registry_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread PoolCache thread_caches[OBJ_POOL_MAX];
+static __thread bool thread_registered;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void *slot_object(PoolSlot *slot)
+{
+    return (char *)slot + SLOT_HEADER;
+}
+
+static PoolSlot *object_slot(void *obj)
+{
+    return (PoolSlot *)((char *)obj - SLOT_HEADER);
+}
+
+/* Move a cache's counters into its pool (pool->mtx held) */
+static void cache_fold(ObjPool *pool, PoolCache *c)
+{
+    pool->allocs += c->allocs;
+    pool->frees += c->frees;
+    c->allocs = 0;
+    c->frees = 0;
+}
+
+/* Give n cached objects back to the shared list */
+static void cache_flush(ObjPool *pool, PoolCache *c, int n)
+{
+    pthread_mutex_lock(&pool->mtx);
+    while (n-- > 0 && c->head)
+    {
+        PoolSlot *slot = c->head;
+        c->head = slot->next;
+        c->count--;
+        slot->next = pool->free;
+        pool->free = slot;
+        pool->nfree++;
+    }
+    cache_fold(pool, c);
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+/* Thread exit: return every cached object to pools that still exist */
+static void caches_release(void *arg)
+{
+    PoolCache *caches = arg;
+    pthread_mutex_lock(&registry_mtx);
+    for (int id = 0; id < OBJ_POOL_MAX; id++)
+    {
+        ObjPool *pool = registry[id];
+        if (pool && pool->generation == caches[id].generation)
+            cache_flush(pool, &caches[id], caches[id].count);
+    }
+    pthread_mutex_unlock(&registry_mtx);
+}
+
+static void cache_key_create(void)
+{
+    pthread_key_create(&cache_key, caches_release);
+}
+
+/* The calling thread's cache for pool (objects left over from a
+ * destroyed pool with the same id are dropped: their slabs are gone) */
+static PoolCache *cache_of(ObjPool *pool)
+{
+    if (!thread_registered)
+    {
+        pthread_once(&cache_key_once, cache_key_create);
+        pthread_setspecific(cache_key, thread_caches);
+        thread_registered = true;
+    }
+
+    PoolCache *c = &thread_caches[pool->id];
+    if (c->generation != pool->generation)
+    {
+        c->head = NULL;
+        c->count = 0;
+        c->allocs = 0;
+        c->frees = 0;
+        c->generation = pool->generation;
+    }
+    return c;
+}
+
+/* Carve a new slab onto the shared free list (pool->mtx held) */
+static int pool_grow(ObjPool *pool)
+{
+    PoolSlab *slab = malloc(SLAB_HEADER + pool->slab_objects * pool->slot_size);
+    if (!slab)
+        return -1;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+
+    char *base = (char *)slab + SLAB_HEADER;
+    for (size_t i = pool->slab_objects; i-- > 0;)
+    {
+        PoolSlot *slot = (PoolSlot *)(base + i * pool->slot_size);
+        slot->pool = pool;
+        if (pool->init)
+            pool->init(slot_object(slot));
+        slot->next = pool->free;
+        pool->free = slot;
+    }
+    pool->nfree += pool->slab_objects;
+    return 0;
+}
+
+/* Fill an empty cache with a batch from the shared list */
+static int cache_refill(ObjPool *pool, PoolCache *c)
+{
+    pthread_mutex_lock(&pool->mtx);
+    if (!pool->free && pool_grow(pool) != 0)
+    {
+        pthread_mutex_unlock(&pool->mtx);
+        LOG_ERROR("ObjPool", "Cannot grow pool %s", pool->name);
+        return -1;
+    }
+    for (int n = 0; n < pool->batch && pool->free; n++)
+    {
+        PoolSlot *slot = pool->free;
+        pool->free = slot->next;
+        pool->nfree--;
+        slot->next = c->head;
+        c->head = slot;
+        c->count++;
+    }
+    cache_fold(pool, c);
+    pthread_mutex_unlock(&pool->mtx);
+    return 0;
+}
+
+int obj_pool_init(ObjPool *pool, const char *name, size_t obj_size, size_t slab_min,
+                  void (*init)(void *obj), void (*fini)(void *obj))
+{
+    if (!pool || obj_size == 0)
+        return -1;
+
+    pool->name = name;
+    pool->obj_size = obj_size;
+    pool->slot_size = SLOT_HEADER + POOL_ROUND(obj_size);
+    pool->slab_objects = OBJ_POOL_SLAB_BYTES / pool->slot_size;
+    if (pool->slab_objects < slab_min)
+        pool->slab_objects = slab_min;
+    if (pool->slab_objects == 0)
+        pool->slab_objects = 1;
+
+    size_t cache_max = OBJ_POOL_CACHE_BYTES / pool->slot_size;
+    pool->cache_max = cache_max > OBJ_POOL_CACHE_MAX ? OBJ_POOL_CACHE_MAX
+                      : cache_max < 2               ? 2
+                                                    : (int)cache_max;
+    pool->batch = pool->cache_max / 2;
+    pool->init = init;
+    pool->fini = fini;
+
+    pool->free = NULL;
+    pool->nfree = 0;
+    pool->slabs = NULL;
+    pool->slab_count = 0;
+    pool->allocs = 0;
+    pool->frees = 0;
+
+    pthread_mutex_lock(&registry_mtx);
+    int id = 0;
+    while (id < OBJ_POOL_MAX && registry[id])
+        id++;
+    if (id == OBJ_POOL_MAX)
+    {
+        pthread_mutex_unlock(&registry_mtx);
+        LOG_ERROR("ObjPool", "Cannot create pool %s: %d pools exist", name, OBJ_POOL_MAX);
+        return -1;
+    }
+    pool->id = id;
+    pool->generation = ++registry_generation;
+    pthread_mutex_init(&pool->mtx, NULL);
+    registry[id] = pool;
+    pthread_mutex_unlock(&registry_mtx);
+    return 0;
+}
+
+void obj_pool_destroy(ObjPool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&registry_mtx);
+    registry[pool->id] = NULL;
+    pthread_mutex_unlock(&registry_mtx);
+
+    while (pool->slabs)
+    {
+        PoolSlab *slab = pool->slabs;
+        pool->slabs = slab->next;
+        if (pool->fini)
+        {
+            char *base = (char *)slab + SLAB_HEADER;
+            for (size_t i = 0; i < pool->slab_objects; i++)
+                pool->fini(slot_object((PoolSlot *)(base + i * pool->slot_size)));
+        }
+        free(slab);
+    }
+    pool->free = NULL;
+    pool->nfree = 0;
+    pthread_mutex_destroy(&pool->mtx);
+}
+
+void *obj_pool_alloc(ObjPool *pool)
+{
+    PoolCache *c = cache_of(pool);
+    if (!c->head && cache_refill(pool, c) != 0)
+        return NULL;
+
+    PoolSlot *slot = c->head;
+    c->head = slot->next;
+    c->count--;
+    c->allocs++;
+    return slot_object(slot);
+}
+
+void obj_pool_free(void *obj)
+{
+    if (!obj)
+        return;
+
+    PoolSlot *slot = object_slot(obj);
+    ObjPool *pool = slot->pool;
+    PoolCache *c = cache_of(pool);
+    slot->next = c->head;
+    c->head = slot;
+    c->count++;
+    c->frees++;
+    if (c->count > pool->cache_max)
+        cache_flush(pool, c, pool->batch);
+}
+
+void obj_pool_get_stats(ObjPool *pool, ObjPoolStats *stats)
+{
+    pthread_mutex_lock(&pool->mtx);
+    stats->allocs = pool->allocs;
+    stats->frees = pool->frees;
+    stats->slabs = pool->slab_count;
+    stats->objects = pool->slab_count * pool->slab_objects;
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+void obj_pool_write(FILE *out)
+{
+    static const char *const help[] = {
+        "# HELP stash_pool_allocs_total Objects handed out by each pool\n"
+        "# TYPE stash_pool_allocs_total counter\n",
+        "# HELP stash_pool_slabs_total Slabs each pool took from malloc\n"
+        "# TYPE stash_pool_slabs_total counter\n",
+        "# HELP stash_pool_objects Objects carved from each pool's slabs\n"
+        "# TYPE stash_pool_objects gauge\n",
+    };
+
+    pthread_mutex_lock(&registry_mtx);
+    ObjPoolStats stats[OBJ_POOL_MAX];
+    for (int id = 0; id < OBJ_POOL_MAX; id++)
+        if (registry[id])
+            obj_pool_get_stats(registry[id], &stats[id]);
+
+    for (int metric = 0; metric < 3; metric++)
+    {
+        fputs(help[metric], out);
+        for (int id = 0; id < OBJ_POOL_MAX; id++)
+        {
+            if (!registry[id])
+                continue;
+            const char *name = registry[id]->name;
+            if (metric == 0)
+                fprintf(out, "stash_pool_allocs_total{pool=\"%s\"} %lu\n", name, stats[id].allocs);
+            else if (metric == 1)
+                fprintf(out, "stash_pool_slabs_total{pool=\"%s\"} %lu\n", name, stats[id].slabs);
+            else
+                fprintf(out, "stash_pool_objects{pool=\"%s\"} %lu\n", name, stats[id].objects);
+        }
+    }
+    pthread_mutex_unlock(&registry_mtx);
+}
+
+void obj_pool_log_summary(void)
+{
+    pthread_mutex_lock(&registry_mtx);
+    for (int id = 0; id < OBJ_POOL_MAX; id++)
+    {
+        ObjPool *pool = registry[id];
+        if (!pool)
+            continue;
+        ObjPoolStats stats;
+        obj_pool_get_stats(pool, &stats);
+        if (stats.allocs > 0)
+            LOG_INFO("ObjPool", "Pool %-10s: %lu alloc(s) served by %lu object(s) in %lu slab(s)",
+                     pool->name, (unsigned long)stats.allocs, (unsigned long)stats.objects,
+                     (unsigned long)stats.slabs);
+    }
+    pthread_mutex_unlock(&registry_mtx);
+}
@@ -0,0 +1,100 @@
+#ifndef OBJ_POOL_H
+#define OBJ_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Slab object pools with per-thread caches
+ *
+ * A pool hands out fixed-size objects carved from slabs. Every thread
+ * keeps a private cache of free objects per pool, so an alloc or free is
+ * a couple of pointer moves with no lock and no shared cache line. A
+ * thread whose cache runs dry takes a batch from the pool's shared free
+ * list (under its mutex), and one whose cache overflows gives a batch
+ * back, so objects freed on another thread than the one that allocated
+ * them (worker -> connection) flow back in batches. Only growing by a
+ * slab calls malloc; slabs are kept until obj_pool_destroy.
+ *
+ * init runs once per object, when its slab is carved, so state that is
+ * costly to set up (mutexes, condition variables, scratch buffers)
+ * carries over from one user of the object to the next; fini runs on
+ * every object at destroy. Objects are handed out as their last user
+ * left them: callers reset what they use.
+ *
+ * Counters are folded in whenever a thread's cache trades with the
+ * shared list (and when the thread exits), so they trail the truth by at
+ * most a cache's worth per thread. obj_pool_write and
+ * obj_pool_log_summary report every live pool.
+ */
+
+#define OBJ_POOL_MAX 16                    /* Pools alive at once */
+#define OBJ_POOL_CACHE_MAX 64              /* Objects a thread caches per pool, */
+#define OBJ_POOL_CACHE_BYTES (1024 * 1024) /* ... at most this many bytes' worth (>= 2 objects) */
+#define OBJ_POOL_SLAB_BYTES (256 * 1024)   /* Slab size, unless that is under slab_min objects */
+
+typedef struct PoolSlot PoolSlot;
+typedef struct PoolSlab PoolSlab;
+
+typedef struct ObjPool
+{
+    const char *name;
+    int id;                      /* Registry index; selects the per-thread cache */
+    unsigned generation;         /* Tells this pool's caches from a destroyed one's */
+    size_t obj_size;
+    size_t slot_size;            /* Header + object, rounded for alignment */
+    size_t slab_objects;
+    int cache_max;               /* Per-thread cache limit */
+    int batch;                   /* Objects moved per trade with the shared list */
+    void (*init)(void *obj);
+    void (*fini)(void *obj);
+
+    pthread_mutex_t mtx;         /* Guards everything below */
+    PoolSlot *free;              /* Shared free list */
+    size_t nfree;
+    PoolSlab *slabs;
+    uint64_t slab_count;         /* malloc calls made by the pool */
+    uint64_t allocs;
+    uint64_t frees;
+} ObjPool;
+
+typedef struct ObjPoolStats
+{
+    uint64_t allocs;             /* obj_pool_alloc calls */
+    uint64_t frees;              /* obj_pool_free calls */
+    uint64_t slabs;              /* Slabs allocated (general-purpose allocator calls) */
+    uint64_t objects;            /* Objects carved from them */
+} ObjPoolStats;
+
+/**
+ * Initialize a pool and register it for reporting
+ * @param name Label in metrics and logs (must outlive the pool)
+ * @param slab_min Fewest objects per slab (large objects)
+ * @param init Run once per object when its slab is carved, or NULL
+ * @param fini Run once per object at destroy, or NULL
+ * @return 0, or -1 if OBJ_POOL_MAX pools already exist
+ */
+int obj_pool_init(ObjPool *pool, const char *name, size_t obj_size, size_t slab_min,
+                  void (*init)(void *obj), void (*fini)(void *obj));
+
+/* Free every slab (call once the pool's objects are no longer used) */
+void obj_pool_destroy(ObjPool *pool);
+
+/* An object, or NULL if a new slab is needed and malloc fails */
+void *obj_pool_alloc(ObjPool *pool);
+
+/* Give an object back to the pool it came from (any thread; NULL is a no-op) */
+void obj_pool_free(void *obj);
+
+/* Snapshot of a pool's counters */
+void obj_pool_get_stats(ObjPool *pool, ObjPoolStats *stats);
+
+/* Counters of every live pool in Prometheus text format */
+void obj_pool_write(FILE *out);
+
+/* Log each live pool's counters (at shutdown) */
+void obj_pool_log_summary(void);
+
+#endif /* OBJ_POOL_H */
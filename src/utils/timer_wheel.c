@@ -0,0 +1,106 @@
+#include "timer_wheel.h"
+#include <stddef.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void list_append(TimerNode *head, TimerNode *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/* Link a timer into the slot matching its distance from the clock
+ * (timer->expires >= w->now) */
+static void wheel_place(TimerWheel *w, TimerNode *timer)
+{
+    uint64_t at = timer->expires;
+    if (at - w->now >= TIMER_WHEEL_SPAN)
+        at = w->now + TIMER_WHEEL_SPAN - 1;  /* Parked; re-placed when cascaded */
+
+    uint64_t delta = at - w->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+
+    size_t slot = (at >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    list_append(&w->slots[level][slot], timer);
+}
+
+/* Detach a slot's whole list so callbacks can re-add while it is walked */
+static TimerNode *slot_take(TimerNode *head)
+{
+    if (head->next == head)
+        return NULL;
+    TimerNode *first = head->next;
+    head->prev->next = NULL;
+    head->next = head->prev = head;
+    return first;
+}
+
+/* Redistribute a slot of a higher level; returns that level's slot index */
+static size_t cascade(TimerWheel *w, int level)
+{
+    size_t slot = (w->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    TimerNode *timer = slot_take(&w->slots[level][slot]);
+    while (timer)
+    {
+        TimerNode *next = timer->next;
+        wheel_place(w, timer);
+        timer = next;
+    }
+    return slot;
+}
+
+void timer_wheel_init(TimerWheel *w, uint64_t now)
+{
+    w->now = now;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+            w->slots[level][slot].next = w->slots[level][slot].prev = &w->slots[level][slot];
+}
+
+void timer_wheel_add(TimerWheel *w, TimerNode *timer, uint64_t expires)
+{
+    /* The current tick's slot has already run */
+    timer->expires = expires > w->now ? expires : w->now + 1;
+    wheel_place(w, timer);
+}
+
+void timer_wheel_del(TimerNode *timer)
+{
+    if (!timer->next)
+        return;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+bool timer_pending(const TimerNode *timer)
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_advance(TimerWheel *w, uint64_t now, timer_expire_fn expire, void *ctx)
+{
+    while (w->now < now)
+    {
+        w->now++;
+
+        /* Lower wheel wrapped: pull the next span down, level by level */
+        size_t slot = w->now & TIMER_WHEEL_MASK;
+        for (int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++)
+            slot = cascade(w, level);
+
+        TimerNode *timer = slot_take(&w->slots[0][w->now & TIMER_WHEEL_MASK]);
+        while (timer)
+        {
+            TimerNode *next = timer->next;
+            timer->next = timer->prev = NULL;
+            expire(timer, ctx);
+            timer = next;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel
+ *
+ * TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots each: level 0 holds
+ * timers due within TIMER_WHEEL_SLOTS ticks, one slot per tick, and each
+ * level above covers TIMER_WHEEL_SLOTS times the span of the one below.
+ * Whenever a lower wheel wraps, the matching slot of the next level is
+ * redistributed downwards (cascade), so a timer is moved at most
+ * TIMER_WHEEL_LEVELS - 1 times before it fires.
+ *
+ * Adding and cancelling are O(1) and allocation-free (the node is embedded
+ * in its owner); advancing costs O(1) per tick plus the timers it touches.
+ * Timers further out than the wheel spans (64^4 ticks) are parked in the
+ * top level and re-placed as it turns. Ticks are whatever unit the caller
+ * uses (the session reaper uses seconds). Not thread-safe: the owner
+ * serializes every call.
+ */
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct TimerNode
+{
+    struct TimerNode *next;  /* Slot list links, NULL while not armed */
+    struct TimerNode *prev;
+    uint64_t expires;        /* Tick it fires at */
+} TimerNode;
+
+typedef struct TimerWheel
+{
+    uint64_t now;            /* Last tick processed */
+    TimerNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  /* List heads */
+} TimerWheel;
+
+/* Fired timers are already unarmed; the callback may re-add them */
+typedef void (*timer_expire_fn)(TimerNode *timer, void *ctx);
+
+/* Initialize an empty wheel whose clock reads now */
+void timer_wheel_init(TimerWheel *w, uint64_t now);
+
+/* Arm a timer (must not be armed) to fire at tick expires; times not after
+ * the wheel's clock fire on the next tick */
+void timer_wheel_add(TimerWheel *w, TimerNode *timer, uint64_t expires);
+
+/* Disarm a timer; no-op if it is not armed */
+void timer_wheel_del(TimerNode *timer);
+
+/* Whether the timer is armed */
+bool timer_pending(const TimerNode *timer);
+
+/* Move the clock forward to now, firing every timer due on the way */
+void timer_wheel_advance(TimerWheel *w, uint64_t now, timer_expire_fn expire, void *ctx);
+
+#endif /* TIMER_WHEEL_H */